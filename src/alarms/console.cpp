@@ -0,0 +1,48 @@
+#include "console.h"
+#include "../debug_console.h"
+#include "scheduler.h"
+#include "store.h"
+
+static void alarmsCommand(const String &args) {
+  if (args.startsWith("del ")) {
+    gAlarmStore.remove(args.substring(4).toInt());
+    gAlarmStore.commit();
+  }
+  int n = gAlarmStore.count();
+  Serial.println("alarms: " + String(n) + "/" +
+                 String(AlarmStore::MAX_ALARMS));
+  for (int i = 0; i < n; i++) {
+    Alarm a = gAlarmStore.get(i);
+    char rule[24];
+    if (a.kind == ALARM_ONCE)
+      snprintf(rule, sizeof(rule), "once %04d-%02d-%02d", a.year, a.month,
+               a.day);
+    else if (a.kind == ALARM_LUNAR)
+      snprintf(rule, sizeof(rule), "lunar %s%02d-%02d", a.leap ? "leap " : "",
+               a.month, a.day);
+    else
+      snprintf(rule, sizeof(rule), "days 0x%02x", a.weekdays);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "  %d: %02d:%02d %s tone %d %s", i, a.hour,
+             a.minute, rule, a.tone, a.enabled ? "on" : "off");
+    Serial.println(buf);
+  }
+}
+
+static void missedCommand(const String &args) {
+  if (args == "ring")
+    gAlarmSched.setMissedPolicy(MissedPolicy::MISSED_RING);
+  else if (args == "log")
+    gAlarmSched.setMissedPolicy(MissedPolicy::MISSED_LOG);
+  Serial.println(String("missed: ") +
+                 (gAlarmSched.missedPolicy() == MissedPolicy::MISSED_LOG
+                      ? "log"
+                      : "ring late"));
+}
+
+void alarmConsoleRegister() {
+  debugConsoleRegister("alarms", "list alarms / delete one (alarms del 3)",
+                       alarmsCommand);
+  debugConsoleRegister("missed", "missed alarm policy (missed ring|log)",
+                       missedCommand);
+}
@@ -0,0 +1,5 @@
+// Serial console commands for the alarms
+#pragma once
+
+// "alarms" (list, "alarms del 3") and "missed" (missed alarm policy)
+void alarmConsoleRegister();
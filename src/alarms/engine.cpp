@@ -1,13 +1,22 @@
 #include "../app_context.h"
 #include "../defines/pinconf.h"
 #include "../pages/alarms_page.h"
+#include "store.h"
 #include "../pages/page_manager.h"
 #include "../utils/utils.h"
+#include "wake.h"
 #include <Arduino.h>
 #include <Wire.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 volatile bool alarmRinging = false;
 static volatile int activeAlarmIdx = -1;
+static uint32_t s_lateS = 0;
+static unsigned long s_ringStartMs = 0;
+// an alarm nobody dismisses stops after this (buzzer, CPU and panel
+// would otherwise stay on until the battery is flat)
+static const unsigned long RING_TIMEOUT_MS = 5UL * 60 * 1000;
 
 // helper to manage buzzer without using Arduino tone API
 static const int BUZZER_LEDC_CHANNEL = 0;
@@ -131,126 +140,126 @@ static const Note *melodies[] = {melody1, melody2, melody3, melody4, melody5};
 static const int melody_lens[] = {melody1_len, melody2_len, melody3_len,
                                   melody4_len, melody5_len};
 
-// play melody using LEDC PWM (no Arduino tone API)
-static void playMelody(int toneIdx) {
+// The melody is played by a sequencer task: each note sets the LEDC
+// frequency and the task sleeps for its length, so nothing else waits on
+// it. A stop request wakes it immediately through its notification.
+static const unsigned long NOTE_GAP_MS = 100;
+static const unsigned long REPEAT_PAUSE_MS = 100;
+static const UBaseType_t TONE_TASK_PRIORITY = 3;
+
+static TaskHandle_t s_toneTask = NULL;
+static volatile bool s_toneStop = false;
+static int s_savedPage = 0;
+
+// sleep up to ms; false once a stop was requested
+static bool toneWait(unsigned long ms) {
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+  return !s_toneStop;
+}
+
+static void toneTaskEntry(void *arg) {
+  int toneIdx = (int)(intptr_t)arg;
   if (toneIdx < 1 || toneIdx > 5)
     toneIdx = 1;
   const Note *m = melodies[toneIdx - 1];
   int len = melody_lens[toneIdx - 1];
-  for (int r = 0; r < 3 && alarmRinging;
-       r++) { // repeat 3 times or until stopped
-    for (int i = 0; i < len && alarmRinging; i++) {
-      int f = m[i].freq;
-      int d = m[i].dur;
-#ifdef BUZZER_PIN
-      // use LEDC PWM to generate tone without Arduino tone API
-      startBuzzerFreq(f);
-      // poll button state in small slices while letting hardware play the
-      // note uninterrupted
-      const unsigned long slice = 20; // ms, shorter for better button response
-      unsigned long waited = 0;
-      while (waited < (unsigned long)d && alarmRinging) {
-        delay(slice);
-        waited += slice;
-        int bs = readButtonStateRaw();
-        if (bs != BTN_NONE) {
-          alarmRinging = false;
-          break;
-        }
-      }
-      // stop the note cleanly
+  // repeat until dismissed
+  while (!s_toneStop) {
+    for (int i = 0; i < len && !s_toneStop; i++) {
+      // frequency 0 is a rest
+      if (m[i].freq > 0)
+        startBuzzerFreq(m[i].freq);
+      bool go = toneWait(m[i].dur);
       stopBuzzer();
-      // short gap between notes, still checking buttons
-      if (alarmRinging) {
-        unsigned long gapWait = 0;
-        while (gapWait < 100 && alarmRinging) {
-          delay(20);
-          gapWait += 20;
-          int bs = readButtonStateRaw();
-          if (bs != BTN_NONE) {
-            alarmRinging = false;
-            break;
-          }
-        }
-      }
-#endif
-    }
-    // brief pause between melody repeats; allow button checking
-    unsigned long pauseMs = 100;
-    unsigned long pWait = 0;
-    while (pWait < pauseMs && alarmRinging) {
-      delay(20);
-      pWait += 20;
-      int bs = readButtonStateRaw();
-      if (bs != BTN_NONE) {
-        alarmRinging = false;
+      if (!go || !toneWait(NOTE_GAP_MS))
         break;
-      }
     }
+    toneWait(REPEAT_PAUSE_MS);
   }
-  // ensure buzzer is stopped when leaving melody playback loop
   stopBuzzer();
+  s_toneTask = NULL;
+  vTaskDelete(NULL);
 }
 
-void startAlarmNow(int idx) {
-  if (idx < 0 || idx > 4)
+static void startTone(int toneIdx) {
+  if (s_toneTask)
     return;
-  // ensure buzzer not left on
+  s_toneStop = false;
+  if (xTaskCreate(toneTaskEntry, "alarm_tone", 2048, (void *)(intptr_t)toneIdx,
+                  TONE_TASK_PRIORITY, &s_toneTask) != pdPASS) {
+    s_toneTask = NULL;
+    Serial.println("Alarm: failed to start tone task");
+  }
+}
+
+static void stopTone() {
+  s_toneStop = true;
+  TaskHandle_t t = s_toneTask;
+  if (t)
+    xTaskNotifyGive(t);
+  for (int i = 0; i < 50 && s_toneTask; ++i)
+    vTaskDelay(pdMS_TO_TICKS(2));
   stopBuzzer();
+}
+
+// Ringing is a two-state machine (idle / ringing) driven by events: the
+// scheduler in loop() starts it, a button press on the ring page (through
+// the normal PageManager input path) stops it. The ring screen is a page
+// of its own, so periodic renders of other pages cannot draw over it.
+void startAlarmNow(int idx, uint32_t lateS) {
+  if (idx < 0 || idx >= gAlarmStore.count())
+    return;
+  if (alarmRinging) {
+    Serial.println("Alarm " + String(idx) + " due while another rings, ignored");
+    return;
+  }
   Alarm a = getAlarmCfg(idx);
-  if (!a.enabled) {
-    stopBuzzer();
+  if (!a.enabled)
     return;
+  // a one-shot alarm is done once it rang
+  if (a.kind == ALARM_ONCE) {
+    Alarm done = a;
+    done.enabled = false;
+    gAlarmStore.set(idx, done);
+    gAlarmStore.commit();
   }
-  // set ringing state
   activeAlarmIdx = idx;
+  s_lateS = lateS;
+  s_ringStartMs = millis();
   alarmRinging = true;
-  // Spawn simple blocking ring routine on same thread: show UI and play
-  // Note: This blocks until user presses a key; acceptable for simple device.
-  // Save current page to restore later
-  int savedPage = currentPage;
-  // full screen show
-  refreshInProgress = true;
-  display.setFullWindow();
-  display.firstPage();
-  do {
-    display.fillScreen(GxEPD_WHITE);
-    u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
-    String hh = (a.hour < 10 ? "0" : "") + String(a.hour);
-    String mm = (a.minute < 10 ? "0" : "") + String(a.minute);
-    String title = "闹钟 " + hh + ":" + mm;
-    int tw = u8g2Fonts.getUTF8Width(title.c_str());
-    u8g2Fonts.setCursor((display.width() - tw) / 2 - 20,
-                        display.height() / 2 - 6);
-    u8g2Fonts.print(title);
-    String tip = "按任意键关闭";
-    int tw2 = u8g2Fonts.getUTF8Width(tip.c_str());
-    u8g2Fonts.setCursor((display.width() - tw2) / 2 - 20,
-                        display.height() / 2 + 12);
-    u8g2Fonts.print(tip);
-  } while (display.nextPage());
-  refreshInProgress = false;
-  // Play melody in background loop until key pressed
-  // We'll poll buttons here
-  while (alarmRinging) {
-    // play one melody iteration non-blocking-ish
-    Alarm cur = getAlarmCfg(activeAlarmIdx);
-    int toneId = cur.tone;
-    // play melody (this uses blocking tone+delay but checks alarmRinging
-    // between notes)
-    playMelody(toneId);
-    // check buttons
-    PageButton bs = (PageButton)readButtonStateRaw();
-    if (bs != BTN_NONE) {
-      // consume press and stop
-      alarmRinging = false;
-      break;
-    }
-    delay(50);
+  startTone(a.tone);
+  // remember where to go back to; the ring page is only reachable from here
+  s_savedPage = currentPage;
+  gPageMgr.setDirectSwitchAllowed(ALARM_RING_PAGE, true);
+  switchPageAndFullRefresh(ALARM_RING_PAGE);
+  gPageMgr.setDirectSwitchAllowed(ALARM_RING_PAGE, false);
+}
+
+void stopAlarm() {
+  if (!alarmRinging)
+    return;
+  alarmRinging = false;
+  stopTone();
+  Serial.println("Alarm " + String(activeAlarmIdx) + " dismissed");
+  activeAlarmIdx = -1;
+  // after a timer wake the device goes straight back to sleep
+  // (alarmWakeLoop), with the ring screen still up
+  if (alarmWakeBoot())
+    return;
+  // back to the page that was showing (music/ebook are normally not
+  // directly reachable)
+  bool allowed = gPageMgr.isDirectSwitchAllowed(s_savedPage);
+  gPageMgr.setDirectSwitchAllowed(s_savedPage, true);
+  switchPageAndFullRefresh(s_savedPage);
+  gPageMgr.setDirectSwitchAllowed(s_savedPage, allowed);
+}
+
+void alarmRingTimeoutCheck() {
+  if (alarmRinging && millis() - s_ringStartMs >= RING_TIMEOUT_MS) {
+    Serial.println("Alarm " + String(activeAlarmIdx) + " not dismissed, stopping");
+    stopAlarm();
   }
-  // ensure buzzer stopped
-  stopBuzzer();
-  // restore previous page via full refresh
-  gPageMgr.switchPage(savedPage);
-  gPageMgr.requestRender(true);
 }
+
+int ringingAlarm() { return alarmRinging ? activeAlarmIdx : -1; }
+uint32_t ringingAlarmLateS() { return alarmRinging ? s_lateS : 0; }
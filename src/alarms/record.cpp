@@ -0,0 +1,65 @@
+#include "record.h"
+
+const Alarm DEFAULT_ALARM = {7, 0, 0, 1, false};
+
+// Record layout ("ver" 1), LSB first:
+//   0-4 hour | 5-10 minute | 11-13 tone | 14 enabled | 15-16 kind |
+//   17-31 rule, by kind:
+//     weekly: 17-23 weekday mask
+//     once:   17-22 year - ONCE_BASE_YEAR | 23-26 month | 27-31 day
+//     lunar:  17-20 month | 21-25 day | 26 leap
+static const int ONCE_BASE_YEAR = 2024;
+
+uint32_t alarmEncode(const Alarm &a) {
+  uint32_t v = (uint32_t)(a.hour & 0x1F) | (uint32_t)(a.minute & 0x3F) << 5 |
+               (uint32_t)(a.tone & 0x07) << 11 |
+               (uint32_t)(a.enabled ? 1 : 0) << 14 |
+               (uint32_t)(a.kind & 0x03) << 15;
+  if (a.kind == ALARM_ONCE) {
+    uint32_t y = a.year > ONCE_BASE_YEAR ? a.year - ONCE_BASE_YEAR : 0;
+    v |= (y & 0x3F) << 17 | (uint32_t)(a.month & 0x0F) << 23 |
+         (uint32_t)(a.day & 0x1F) << 27;
+  } else if (a.kind == ALARM_LUNAR) {
+    v |= (uint32_t)(a.month & 0x0F) << 17 | (uint32_t)(a.day & 0x1F) << 21 |
+         (uint32_t)(a.leap ? 1 : 0) << 26;
+  } else {
+    v |= (uint32_t)(a.weekdays & 0x7F) << 17;
+  }
+  return v;
+}
+
+Alarm alarmDecode(uint32_t v) {
+  Alarm a = DEFAULT_ALARM;
+  a.hour = v & 0x1F;
+  a.minute = (v >> 5) & 0x3F;
+  a.tone = (v >> 11) & 0x07;
+  a.enabled = (v >> 14) & 1;
+  a.kind = (v >> 15) & 0x03;
+  if (a.kind == ALARM_ONCE) {
+    a.year = ONCE_BASE_YEAR + ((v >> 17) & 0x3F);
+    a.month = (v >> 23) & 0x0F;
+    a.day = (v >> 27) & 0x1F;
+  } else if (a.kind == ALARM_LUNAR) {
+    a.month = (v >> 17) & 0x0F;
+    a.day = (v >> 21) & 0x1F;
+    a.leap = (v >> 26) & 1;
+  } else {
+    a.kind = ALARM_WEEKLY;
+    a.weekdays = (v >> 17) & 0x7F;
+  }
+  bool ruleOk = a.kind == ALARM_ONCE    ? a.month >= 1 && a.month <= 12 &&
+                                           a.day >= 1
+                : a.kind == ALARM_LUNAR ? a.month <= 12 && a.day >= 1 &&
+                                              a.day <= 30
+                                        : true;
+  if (a.hour > 23 || a.minute > 59 || !ruleOk)
+    a = DEFAULT_ALARM;
+  if (a.tone < 1 || a.tone > 5)
+    a.tone = 1;
+  return a;
+}
+
+Alarm alarmFromLegacy(const LegacyAlarm &old) {
+  Alarm a = {old.hour, old.minute, old.weekdays, old.tone, old.enabled};
+  return alarmDecode(alarmEncode(a)); // range-checks the old fields
+}
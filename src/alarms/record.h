@@ -0,0 +1,18 @@
+// One alarm as a 32-bit NVS record
+#pragma once
+
+#include "store.h"
+
+// what get() returns for an empty table or an undecodable record
+extern const Alarm DEFAULT_ALARM;
+
+uint32_t alarmEncode(const Alarm &a);
+// out-of-range fields give DEFAULT_ALARM (a bad tone only resets the tone)
+Alarm alarmDecode(uint32_t v);
+
+// An entry of the pre-versioned "alarms" blob (raw `Alarm s_alarms[5]`)
+struct LegacyAlarm {
+  uint8_t hour, minute, weekdays, tone;
+  bool enabled;
+};
+Alarm alarmFromLegacy(const LegacyAlarm &old);
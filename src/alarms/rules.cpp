@@ -0,0 +1,121 @@
+#include "rules.h"
+#include "../utils/lunar.h"
+
+static const time_t DAY_S = 24 * 3600;
+
+// days since 1970-01-01 of a proleptic Gregorian date
+static long daysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// The local day `after` falls on; alarm times are offsets from its start
+struct Day {
+  struct tm tmv;
+  time_t start;
+  long days; // daysFromCivil
+};
+
+static Day dayOf(time_t after) {
+  Day d;
+  localtime_r(&after, &d.tmv);
+  d.start = after - (d.tmv.tm_hour * 3600 + d.tmv.tm_min * 60 + d.tmv.tm_sec);
+  d.days = daysFromCivil(d.tmv.tm_year + 1900, d.tmv.tm_mon + 1, d.tmv.tm_mday);
+  return d;
+}
+
+static time_t fireOn(const Day &today, long days, const Alarm &a) {
+  return today.start + (days - today.days) * DAY_S + a.hour * 3600 +
+         a.minute * 60;
+}
+
+// weekly: the first day that matches the mask (0 = every day)
+static time_t nextWeekly(const Alarm &a, const Day &today, time_t after) {
+  for (int d = 0; d <= 7; d++) {
+    int wday = (today.tmv.tm_wday + d) % 7;
+    if (a.weekdays != 0 && !(a.weekdays & (1 << wday)))
+      continue;
+    time_t t = fireOn(today, today.days + d, a);
+    if (t > after)
+      return t;
+  }
+  return 0;
+}
+
+// one-shot: its date, if still ahead (and valid)
+static time_t nextOnce(const Alarm &a, const Day &today, time_t after) {
+  if (a.month < 1 || a.month > 12 || a.day < 1)
+    return 0;
+  long first = daysFromCivil(a.year, a.month, 1);
+  long len = (a.month == 12 ? daysFromCivil(a.year + 1, 1, 1)
+                            : daysFromCivil(a.year, a.month + 1, 1)) -
+             first;
+  if (a.day > len)
+    return 0;
+  time_t t = fireOn(today, first + a.day - 1, a);
+  return t > after ? t : 0;
+}
+
+static bool lunarRuleMatches(const Alarm &a, int y, int m, bool leap) {
+  if (a.month == 0)
+    return true; // every lunar month, leap months included
+  if (m != a.month)
+    return false;
+  if (!a.leap)
+    return !leap;
+  // a leap-month date falls back to the regular month in years that do
+  // not double that month
+  return leap || lunarLeapMonth(y) != m;
+}
+
+// lunar: one conversion to find today's lunar month, then walk month by
+// month (leap months in place) and convert back only the months the rule
+// hits. 28 months cover two lunar years, enough for a yearly rule.
+static time_t nextLunar(const Alarm &a, const Day &today, time_t after) {
+  Solar s = {today.tmv.tm_year + 1900, today.tmv.tm_mon + 1,
+             today.tmv.tm_mday};
+  if (s.year < LUNAR_MIN_YEAR || s.year > LUNAR_MAX_YEAR)
+    return 0;
+  Lunar cur = SolarToLunar(s);
+  int y = cur.year;
+  int m = cur.month;
+  bool leap = cur.isLeap;
+  for (int step = 0; step < 28 && y <= LUNAR_MAX_YEAR; step++) {
+    if (lunarRuleMatches(a, y, m, leap)) {
+      // a 30th in a 29-day month rings on the last day
+      int len = lunarMonthDays(y, m, leap);
+      Lunar l = {y, m, a.day < len ? a.day : len, leap};
+      Solar d = LunarToSolar(l);
+      time_t t = fireOn(today, daysFromCivil(d.year, d.month, d.day), a);
+      if (t > after)
+        return t;
+    }
+    if (!leap && m == lunarLeapMonth(y)) {
+      leap = true;
+    } else {
+      leap = false;
+      if (++m > 12) {
+        m = 1;
+        y++;
+      }
+    }
+  }
+  return 0;
+}
+
+time_t alarmNextFire(const Alarm &a, time_t after) {
+  Day today = dayOf(after);
+  switch (a.kind) {
+  case ALARM_ONCE:
+    return nextOnce(a, today, after);
+  case ALARM_LUNAR:
+    return nextLunar(a, today, after);
+  default:
+    return nextWeekly(a, today, after);
+  }
+}
+
@@ -0,0 +1,11 @@
+// When an alarm rule fires next
+#pragma once
+
+#include "store.h"
+#include <time.h>
+
+// First time after `after` that alarm `a` fires by its rule (weekday mask,
+// date or lunar date; see AlarmKind), 0 if never. Times are local epoch
+// seconds as read through localtime_r(), like the scheduler's. Ignores
+// `enabled`.
+time_t alarmNextFire(const Alarm &a, time_t after);
@@ -0,0 +1,154 @@
+#include "scheduler.h"
+#include "rules.h"
+#include "store.h"
+#include <Preferences.h>
+
+AlarmScheduler gAlarmSched;
+
+static const time_t DAY_S = 24 * 3600;
+// an alarm is on time this long after its minute started
+static const time_t FIRE_GRACE_S = 60;
+// MISSED_RING still rings an alarm this late
+static const time_t RING_LATE_MAX_S = 30 * 60;
+// a gap longer than any alarm-armed deep sleep is a clock step, not
+// missed time
+static const time_t CATCHUP_MAX_S = 8 * DAY_S;
+// the deep sleep wake may ring an alarm up to this long before its fire
+// time (see alarms/wake.cpp); a clock that far behind is not a step
+static const time_t EARLY_POLL_MAX_S = 5;
+// timeClient before the first NTP sync counts from 1970
+static const time_t CLOCK_VALID = 1700000000;
+
+// last second poll() looked at; 0 = none yet
+RTC_DATA_ATTR static time_t rtc_lastEval = 0;
+
+static String hhmm(time_t t) {
+  struct tm tmv;
+  localtime_r(&t, &tmv);
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%02d:%02d", tmv.tm_hour, tmv.tm_min);
+  return String(buf);
+}
+
+// Each alarm's next fire time is cached; only the alarms that fired (or
+// all of them, after a config change or clock step) are recomputed.
+void AlarmScheduler::reschedule(time_t after) {
+  bool all = dirty || after < cachedAfter;
+  nextAt = 0;
+  nextIdx = -1;
+  int n = gAlarmStore.count();
+  for (int i = 0; i < n; i++) {
+    if (all || (fireAt[i] != 0 && fireAt[i] <= after)) {
+      Alarm a = gAlarmStore.get(i);
+      fireAt[i] = a.enabled ? alarmNextFire(a, after) : 0;
+    }
+    time_t t = fireAt[i];
+    if (t != 0 && (nextAt == 0 || t < nextAt)) {
+      nextAt = t;
+      nextIdx = i;
+    }
+  }
+  cachedAfter = after;
+  dirty = false;
+}
+
+// a config change only looks forward from the last evaluated second
+void AlarmScheduler::refresh(time_t now) {
+  if (dirty)
+    reschedule(rtc_lastEval != 0 && rtc_lastEval <= now ? rtc_lastEval : now);
+}
+
+int AlarmScheduler::poll(time_t now, uint32_t &lateS) {
+  lateS = 0;
+  if (now < CLOCK_VALID)
+    return -1;
+  if (now < rtc_lastEval && rtc_lastEval - now <= EARLY_POLL_MAX_S)
+    return -1; // already evaluated ahead, nothing new is due
+  if (rtc_lastEval == 0 || now < rtc_lastEval ||
+      now - rtc_lastEval > CATCHUP_MAX_S) {
+    if (rtc_lastEval != 0)
+      Serial.println("Alarms: clock moved by " +
+                     String((long)(now - rtc_lastEval)) + " s, rescheduled");
+    rtc_lastEval = now;
+    dirty = true;
+    reschedule(now);
+    return -1;
+  }
+  refresh(now);
+  // every fire time in (lastEval, now]
+  int idx = -1;
+  time_t at = 0;
+  while (nextAt != 0 && nextAt <= now) {
+    if (idx >= 0)
+      Serial.println("Alarm " + String(idx) + " (" + hhmm(at) +
+                     ") missed, superseded by a later one");
+    idx = nextIdx;
+    at = nextAt;
+    reschedule(at);
+  }
+  rtc_lastEval = now;
+  if (idx < 0)
+    return -1;
+  lateS = (uint32_t)(now - at);
+  if (lateS >= FIRE_GRACE_S) {
+    if (missedPolicy() == MissedPolicy::MISSED_LOG ||
+        lateS > RING_LATE_MAX_S) {
+      Serial.println("Alarm " + String(idx) + " (" + hhmm(at) + ") missed by " +
+                     String(lateS) + " s");
+      return -1;
+    }
+    Serial.println("Alarm " + String(idx) + " (" + hhmm(at) +
+                   ") ringing late by " + String(lateS) + " s");
+  }
+  return idx;
+}
+
+time_t AlarmScheduler::nextFire(time_t now) {
+  refresh(now);
+  return nextAt;
+}
+
+int AlarmScheduler::nextAlarm(time_t now) {
+  refresh(now);
+  return nextIdx;
+}
+
+uint32_t AlarmScheduler::msUntilNext(time_t now) {
+  refresh(now);
+  if (nextAt == 0)
+    return UINT32_MAX;
+  if (nextAt <= now)
+    return 0;
+  // more than ~49 days away does not fit; "far" is all the caller needs
+  time_t s = nextAt - now;
+  if (s >= (time_t)(UINT32_MAX / 1000UL))
+    return UINT32_MAX - 1;
+  return (uint32_t)s * 1000UL;
+}
+
+void AlarmScheduler::loadPolicy() {
+  Preferences p;
+  if (p.begin("alarms_cfg", true)) {
+    uint8_t v = p.getUChar("missed", (uint8_t)MissedPolicy::MISSED_RING);
+    p.end();
+    policy = v == (uint8_t)MissedPolicy::MISSED_LOG ? MissedPolicy::MISSED_LOG
+                                                    : MissedPolicy::MISSED_RING;
+  }
+  policyLoaded = true;
+}
+
+MissedPolicy AlarmScheduler::missedPolicy() {
+  if (!policyLoaded)
+    loadPolicy();
+  return policy;
+}
+
+void AlarmScheduler::setMissedPolicy(MissedPolicy p) {
+  policy = p;
+  policyLoaded = true;
+  Preferences pf;
+  if (pf.begin("alarms_cfg", false)) {
+    pf.putUChar("missed", (uint8_t)p);
+    pf.end();
+  }
+}
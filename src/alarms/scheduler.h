@@ -0,0 +1,56 @@
+// Next-fire time of the configured alarms
+#pragma once
+
+#include "store.h"
+#include <Arduino.h>
+#include <time.h>
+
+// What happens to an alarm whose minute passed while nothing looked (long
+// sleep, slow fetch, blocking refresh)
+enum class MissedPolicy : uint8_t {
+  MISSED_RING = 0, // ring late with an indicator, up to RING_LATE_MAX_S
+  MISSED_LOG,      // only log it
+};
+
+// Times are the NTP client's epoch (already shifted to local time, like the
+// rest of the UI uses it). The next fire time (weekly, one-shot and lunar
+// rules, see AlarmKind) is computed once, when the alarm config changes or
+// an alarm fires, so loop() only compares two numbers and the sleep logic
+// can wake up in time for it. The last
+// evaluated second is kept as well (in RTC memory, so it survives deep
+// sleep): every poll covers all fire times since then, however long ago.
+class AlarmScheduler {
+public:
+  // alarm config changed; recomputed on the next call
+  void invalidate() { dirty = true; }
+  // alarm due at `now`, or -1; lateS is how long ago its fire time was.
+  // Each fire time is reported once. If several passed unseen, the latest
+  // one is reported and the rest logged; a first valid time or a clock
+  // step starts over without catching up. Polling a little ahead of the
+  // clock (the wake rings early) just makes the next few seconds no-ops.
+  int poll(time_t now, uint32_t &lateS);
+  // next fire time (0 = no alarm enabled) and its alarm
+  time_t nextFire(time_t now);
+  int nextAlarm(time_t now);
+  // milliseconds from `now` until the next fire (saturating below
+  // UINT32_MAX for far-off alarms), UINT32_MAX if none
+  uint32_t msUntilNext(time_t now);
+
+  void setMissedPolicy(MissedPolicy p);
+  MissedPolicy missedPolicy();
+
+private:
+  bool dirty = true;
+  bool policyLoaded = false;
+  MissedPolicy policy = MissedPolicy::MISSED_RING;
+  time_t nextAt = 0;
+  int nextIdx = -1;
+  time_t fireAt[AlarmStore::MAX_ALARMS] = {}; // per alarm, 0 = never
+  time_t cachedAfter = 0;
+
+  void reschedule(time_t after);
+  void refresh(time_t now);
+  void loadPolicy();
+};
+
+extern AlarmScheduler gAlarmSched;
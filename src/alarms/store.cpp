@@ -0,0 +1,145 @@
+#include "store.h"
+#include "record.h"
+#include "scheduler.h"
+#include <Preferences.h>
+
+AlarmStore gAlarmStore;
+
+static const char *ALARM_NS = "alarms_cfg";
+static const uint8_t LAYOUT_VERSION = 1;
+
+static String recordKey(int idx) { return "a" + String(idx); }
+
+// The pre-versioned layout: `Alarm s_alarms[5]` stored as raw bytes
+bool AlarmStore::migrate() {
+  Preferences p;
+  if (!p.begin(ALARM_NS, false))
+    return false;
+  LegacyAlarm old[5];
+  size_t got = p.getBytes("alarms", old, sizeof(old));
+  if (got != sizeof(old)) {
+    p.end();
+    return false;
+  }
+  n = 5;
+  for (int i = 0; i < n; i++)
+    alarms[i] = alarmFromLegacy(old[i]);
+  dirty = (1UL << n) - 1;
+  storedN = 0;
+  p.end();
+  commit();
+  if (p.begin(ALARM_NS, false)) {
+    p.remove("alarms");
+    p.end();
+  }
+  Serial.println("Alarms: migrated " + String(n) + " alarms from the old blob");
+  return true;
+}
+
+void AlarmStore::load() {
+  loaded = true;
+  n = 0;
+  dirty = 0;
+  Preferences p;
+  if (!p.begin(ALARM_NS, true)) {
+    // namespace not created yet: nothing stored, nothing to migrate
+    return;
+  }
+  uint8_t ver = p.getUChar("ver", 0);
+  if (ver == 0) {
+    p.end();
+    migrate();
+    return;
+  }
+  versioned = ver == LAYOUT_VERSION;
+  if (ver > LAYOUT_VERSION) {
+    // written by newer firmware: show what decodes, never write over it
+    readOnly = true;
+    Serial.println("Alarms: unknown layout " + String(ver) + ", read-only");
+  }
+  n = p.getUChar("n", 0);
+  if (n > MAX_ALARMS)
+    n = MAX_ALARMS;
+  for (int i = 0; i < n; i++)
+    alarms[i] = alarmDecode(p.getUInt(recordKey(i).c_str(), alarmEncode(DEFAULT_ALARM)));
+  p.end();
+  storedN = n;
+}
+
+int AlarmStore::count() {
+  if (!loaded)
+    load();
+  return n;
+}
+
+Alarm AlarmStore::get(int idx) {
+  if (!loaded)
+    load();
+  if (n == 0)
+    return DEFAULT_ALARM;
+  if (idx < 0)
+    idx = 0;
+  if (idx >= n)
+    idx = n - 1;
+  return alarms[idx];
+}
+
+void AlarmStore::set(int idx, const Alarm &a) {
+  if (!loaded)
+    load();
+  if (idx < 0 || idx >= n)
+    return;
+  if (alarmEncode(alarms[idx]) == alarmEncode(a))
+    return;
+  alarms[idx] = a;
+  dirty |= 1UL << idx;
+}
+
+int AlarmStore::add(const Alarm &a) {
+  if (!loaded)
+    load();
+  if (n >= MAX_ALARMS)
+    return -1;
+  alarms[n] = a;
+  dirty |= 1UL << n;
+  return n++;
+}
+
+void AlarmStore::remove(int idx) {
+  if (!loaded)
+    load();
+  if (idx < 0 || idx >= n)
+    return;
+  // later records move down one key each
+  for (int i = idx; i + 1 < n; i++) {
+    alarms[i] = alarms[i + 1];
+    dirty |= 1UL << i;
+  }
+  n--;
+  dirty &= n > 0 ? (1UL << n) - 1 : 0;
+}
+
+void AlarmStore::commit() {
+  if (!loaded)
+    load();
+  if (readOnly || (dirty == 0 && storedN == n))
+    return;
+  Preferences p;
+  if (!p.begin(ALARM_NS, false))
+    return;
+  for (int i = 0; i < n; i++) {
+    if (dirty & (1UL << i))
+      p.putUInt(recordKey(i).c_str(), alarmEncode(alarms[i]));
+  }
+  for (int i = n; i < storedN; i++)
+    p.remove(recordKey(i).c_str());
+  if (storedN != n)
+    p.putUChar("n", (uint8_t)n);
+  if (!versioned)
+    p.putUChar("ver", LAYOUT_VERSION);
+  p.end();
+  versioned = true;
+  dirty = 0;
+  storedN = n;
+  gAlarmSched.invalidate();
+}
@@ -0,0 +1,60 @@
+// Alarm table and its NVS records
+#pragma once
+
+#include <Arduino.h>
+
+// When an alarm repeats
+enum AlarmKind : uint8_t {
+  ALARM_WEEKLY = 0, // on the weekday mask
+  ALARM_ONCE,       // on year/month/day, then it disables itself
+  ALARM_LUNAR,      // on lunar month/day every year (month 0: every month)
+};
+
+// Fields after `enabled` may be left out of an initializer (weekly rule)
+struct Alarm {
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t weekdays; // bit 0 = Sunday; 0 = every day
+  uint8_t tone;     // melody 1..5
+  bool enabled;
+  uint8_t kind;  // AlarmKind
+  uint16_t year; // ALARM_ONCE
+  uint8_t month; // ALARM_ONCE 1..12, ALARM_LUNAR 0..12
+  uint8_t day;   // 1..31 / lunar 1..30
+  bool leap;     // ALARM_LUNAR: the leap month, where the year has one
+};
+
+// Up to MAX_ALARMS alarms in namespace "alarms_cfg": the count under "n",
+// each alarm as one 32-bit record under "a<i>", and the layout version
+// under "ver". Edits mark their record dirty and commit() rewrites only
+// those, so changing one field of one alarm is a single 4-byte write. The
+// table is loaded on first use; a device still holding the old raw struct
+// blob ("alarms", 5 entries) is migrated once.
+class AlarmStore {
+public:
+  static const int MAX_ALARMS = 32;
+
+  int count();
+  // idx is clamped to the table; a default alarm if it is empty
+  Alarm get(int idx);
+  void set(int idx, const Alarm &a);
+  // index of the new alarm, -1 when full
+  int add(const Alarm &a);
+  void remove(int idx);
+  // write the dirty records (and the count, if it changed)
+  void commit();
+
+private:
+  Alarm alarms[MAX_ALARMS];
+  int n = 0;
+  int storedN = 0;
+  uint32_t dirty = 0; // one bit per record
+  bool loaded = false;
+  bool versioned = false; // "ver" already holds LAYOUT_VERSION
+  bool readOnly = false;  // stored by a newer layout
+
+  void load();
+  bool migrate();
+};
+
+extern AlarmStore gAlarmStore;
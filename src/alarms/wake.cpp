@@ -0,0 +1,141 @@
+#include "wake.h"
+#include "../app_context.h"
+#include "../defines/pinconf.h"
+#include "../power.h"
+#include "scheduler.h"
+#include <esp_sleep.h>
+#include <sys/time.h>
+
+// The system clock keeps running on the RTC timer through deep sleep, so
+// it is set from timeClient before sleeping and read back on the timer
+// wake. Both hold the local (offset) epoch.
+extern uint32_t rtc_saved_epoch;
+
+// wake this early, so boot is done before the fire time
+static const uint32_t WAKE_LEAD_S = 2;
+
+// fire time / alarm the timer was armed for, and the expected wake (us of
+// system time) for the latency log
+RTC_DATA_ATTR static time_t rtc_wakeAt = 0;
+RTC_DATA_ATTR static int8_t rtc_wakeIdx = -1;
+RTC_DATA_ATTR static int64_t rtc_wakeUs = 0;
+
+static int8_t s_boot = -1; // alarmWakeBoot() cache
+
+static int64_t nowUs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void alarmDeepSleep() {
+  time_t now = (time_t)timeClient.getEpochTime();
+  // timeClient counts whole seconds; only step the clock when it is off
+  time_t sys = time(NULL);
+  if (sys < now - 1 || sys > now + 1) {
+    struct timeval tv = {.tv_sec = now, .tv_usec = 0};
+    settimeofday(&tv, NULL);
+  }
+  rtc_saved_epoch = (uint32_t)now;
+  // settle everything up to now, so the wake only sees the armed alarm
+  uint32_t lateS = 0;
+  int due = gAlarmSched.poll(now, lateS);
+  if (due >= 0)
+    Serial.println("Alarm " + String(due) + " due while going to sleep, skipped");
+
+  uint32_t timeoutSec = 0;
+  time_t at = gAlarmSched.nextFire(now);
+  if (at > now) {
+    timeoutSec = at - now > WAKE_LEAD_S ? at - now - WAKE_LEAD_S : 1;
+    rtc_wakeAt = at;
+    rtc_wakeIdx = gAlarmSched.nextAlarm(now);
+    rtc_wakeUs = nowUs() + (int64_t)timeoutSec * 1000000LL;
+    Serial.println("Alarm " + String(rtc_wakeIdx) + " due in " +
+                   String((uint32_t)(at - now)) + " s, timer armed");
+  } else {
+    rtc_wakeAt = 0;
+    rtc_wakeIdx = -1;
+  }
+  enterDeepSleepUntilWakePin(WAKE_BUTTON_PIN, true, timeoutSec);
+}
+
+bool alarmWakeBoot() {
+  if (s_boot < 0)
+    s_boot = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER &&
+             rtc_wakeAt != 0;
+  return s_boot;
+}
+
+void alarmWakeRestoreTime() {
+  time_t now = time(NULL);
+  // NTPClient adds its offset on top, plus the millis() since its last
+  // update, which it never had; timeClientUpdate() keeps it off the network
+  timeClient.setEpochTime(
+      (unsigned long)(now - TIME_OFFSET_S - (time_t)(millis() / 1000)));
+  Serial.println("Alarm wake: time from RTC, epoch " + String((uint32_t)now) +
+                 ", " + String((int32_t)((nowUs() - rtc_wakeUs) / 1000)) +
+                 " ms after the timer");
+}
+
+void alarmWakeRing() {
+  time_t at = rtc_wakeAt;
+  rtc_wakeAt = 0;
+  time_t now = time(NULL);
+  // the slow RTC clock drifts; a wake early by more than the lead sleeps
+  // again rather than waiting here
+  if (now < at - (time_t)WAKE_LEAD_S) {
+    Serial.println("Alarm wake: " + String((int32_t)(at - now)) +
+                   " s early, sleeping again");
+    return; // alarmWakeLoop() re-arms for the right time
+  }
+  int64_t readyUs = nowUs();
+  // within the lead: ring now, as if at the fire time. The scheduler's
+  // last evaluated second is from before the sleep, so a late (drifted)
+  // wake goes through the missed-alarm policy
+  uint32_t lateS = 0;
+  int idx = gAlarmSched.poll(now < at ? at : now, lateS);
+  if (idx < 0)
+    return;
+  int64_t soundUs = nowUs();
+  startAlarmNow(idx, lateS);
+  Serial.println("Alarm wake: ready " +
+                 String((int32_t)((readyUs - rtc_wakeUs) / 1000)) +
+                 " ms after the timer (lead " + String(WAKE_LEAD_S * 1000) +
+                 " ms), sound " +
+                 String((int32_t)((soundUs - rtc_wakeUs) / 1000)) +
+                 " ms after it, " +
+                 String((int32_t)((soundUs - (int64_t)at * 1000000LL) / 1000)) +
+                 " ms after the fire time");
+}
+
+// same notice as the button sleep on the home page
+static void drawSleepNotice() {
+  const String msg = "已休眠，按中键唤醒";
+  u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+  int textW = u8g2Fonts.getUTF8Width(msg.c_str());
+  const int padX = 8;
+  const int padY = 6;
+  int pw = textW + padX * 2;
+  int ph = 12 + padY * 2;
+  int px = (display.width() - pw) / 2 - 20;
+  if (px < 0)
+    px = 0;
+  int py = (display.height() - ph) / 2;
+  display.setPartialWindow(px, py, pw, ph);
+  display.firstPage();
+  do {
+    display.fillRect(px, py, pw, ph, GxEPD_WHITE);
+    display.drawRect(px, py, pw, ph, GxEPD_BLACK);
+    u8g2Fonts.setCursor(px + (pw - textW) / 2, py + padY + 12);
+    u8g2Fonts.print(msg);
+  } while (display.nextPage());
+}
+
+void alarmWakeLoop() {
+  if (!alarmWakeBoot() || alarmRinging)
+    return;
+  drawSleepNotice();
+  display.hibernate();
+  delay(20);
+  alarmDeepSleep();
+}
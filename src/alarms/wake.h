@@ -0,0 +1,19 @@
+// Deep sleep that still rings alarms
+#pragma once
+
+#include <Arduino.h>
+
+// Deep sleep until the wake button, with the RTC timer armed a little
+// before the next alarm. Call with the panel already hibernated.
+void alarmDeepSleep();
+
+// True when this boot is the timer wake armed by alarmDeepSleep(). setup()
+// then takes a fast path: no WiFi, NTP or SD card, time comes back from
+// the RTC, the alarm rings and the device sleeps again once it is over.
+bool alarmWakeBoot();
+// fast path, before the pages: clock and timeClient from the RTC
+void alarmWakeRestoreTime();
+// fast path, after the pages: ring (up to the wake lead early)
+void alarmWakeRing();
+// from loop(): back to deep sleep once the alarm is dismissed
+void alarmWakeLoop();
@@ -1,19 +1,25 @@
 // Shared application context for modules
 #pragma once
 
+#include "epd_display.h"
 #include <Arduino.h>
-#include <GxEPD2_BW.h>
 #include <NTPClient.h>
 #include <U8g2_for_Adafruit_GFX.h>
 
-// E-paper display instance (defined in main.cpp)
-extern GxEPD2_BW<GxEPD2_213_B72, GxEPD2_213_B72::HEIGHT> display;
+// E-paper display instance (defined in main.cpp); panel access goes through
+// the SPI bus arbiter
+extern EpdDisplay display;
 
 // U8g2 fonts wrapper (defined in main.cpp)
 extern U8G2_FOR_ADAFRUIT_GFX u8g2Fonts;
 
-// NTP time client (defined in main.cpp)
+// NTP time client (defined in main.cpp); its epoch is local time, UTC plus
+// TIME_OFFSET_S
 extern NTPClient timeClient;
+static const long TIME_OFFSET_S = 8 * 3600;
+// timeClient.update(), skipped on the alarm wake boot (no WiFi there, so
+// NTPClient would block on the request); pages call this instead
+void timeClientUpdate();
 
 // Chinese week day labels (defined in main.cpp)
 extern const char *weekDaysChinese[];
@@ -29,8 +35,18 @@ extern volatile bool refreshInProgress;
 void switchPageAndFullRefresh(int page);
 void renderPlaceholderPartial(int page);
 
-// Alarm engine control: start/stop and state
-void startAlarmNow(int idx);
+// Alarm engine control: start/stop and state. startAlarmNow() returns at
+// once: the melody plays on its own task and the ring screen is page
+// ALARM_RING_PAGE, whose buttons call stopAlarm(). lateS > 0 rings a
+// missed alarm, which the ring screen points out.
+static const int ALARM_RING_PAGE = 7;
+void startAlarmNow(int idx, uint32_t lateS = 0);
+void stopAlarm();
+// from loop(): stops a ring that nobody dismissed within a few minutes
+void alarmRingTimeoutCheck();
+// index of the ringing alarm, -1 if none, and how late it started
+int ringingAlarm();
+uint32_t ringingAlarmLateS();
 extern volatile bool alarmRinging;
 
 // Forward declare PageManager and extern global instance (defined in main.cpp)
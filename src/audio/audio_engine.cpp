@@ -0,0 +1,1064 @@
+#include "audio_engine.h"
+#include "audio_harness.h"
+#include "codec_dispatch.h"
+#include "debug_console.h"
+#include "defines/pinconf.h"
+#include "mp3_seek.h"
+#include "pcm_capture.h"
+#include "pcm_format.h"
+#include "pcm_fx.h"
+#include "playback_power.h"
+#include "playlist.h"
+#include "resume_store.h"
+#include "sd_file_source.h"
+#include "AudioTools.h"
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/stream_buffer.h>
+#include <freertos/task.h>
+
+using namespace audio_tools;
+
+AudioEngine gAudio;
+
+// ~280 ms of 44.1 kHz stereo 16-bit PCM
+static const size_t RING_BYTES = 48 * 1024;
+// only decode when the ring can take a whole copy() worth of PCM: one
+// 512-byte read of a 64 kbps MP3 expands to roughly 11 KB
+static const size_t DECODE_HEADROOM = 12 * 1024;
+// I2S DMA: few, long descriptors so the output task and the driver
+// interrupt wake up rarely (4 x 1024 frames = ~93 ms at 44.1 kHz)
+static const int I2S_DMA_BUFFERS = 4;
+static const int I2S_DMA_FRAMES = 1024;
+// after a flush or an underrun, wait for this much before restarting I2S
+static const size_t PRIME_BYTES = 16 * 1024;
+static const size_t OUT_CHUNK = 1024;
+// decoded PCM held back while a command waits: one MPEG1 stereo frame,
+// the most a decoder writes at once short of a long FLAC block
+static const size_t CARRY_BYTES = 1152 * 4;
+static const int CMD_QUEUE_LEN = 8;
+// format changes waiting for the output task; more than one only when
+// several very short tracks fit in the ring at once
+static const int FMT_QUEUE_LEN = 4;
+// both tasks sit above loop() (priority 1); output preempts decode, and
+// the SD read-ahead filler (priority 5) sits between them
+static const UBaseType_t DECODE_PRIORITY = 4;
+static const UBaseType_t OUTPUT_PRIORITY = 6;
+
+// resume positions are kept for long recordings only (podcasts, books),
+// not for songs, and not right at the start or the end
+static const uint32_t RESUME_MIN_TRACK_MS = 10 * 60 * 1000;
+static const uint32_t RESUME_MIN_POS_MS = 15000;
+static const uint32_t RESUME_END_MS = 30000;
+// noted in RTC memory this often while playing, written to flash less often
+static const unsigned long RESUME_NOTE_MS = 5000;
+static const unsigned long RESUME_FLUSH_MS = 60000;
+
+enum AudioCmdType : uint8_t {
+  AUDIO_CMD_PLAY = 0,
+  AUDIO_CMD_PAUSE,
+  AUDIO_CMD_RESUME,
+  AUDIO_CMD_TOGGLE,
+  AUDIO_CMD_STOP,
+  AUDIO_CMD_NEXT,
+  AUDIO_CMD_PREV,
+  AUDIO_CMD_SEEK,
+  AUDIO_CMD_SEEK_REL,
+  AUDIO_CMD_MODE,
+  AUDIO_CMD_SHUTDOWN,
+};
+
+struct AudioCommand {
+  AudioCmdType type;
+  char *path; // heap copy for AUDIO_CMD_PLAY, freed by the decode task
+  int32_t arg; // milliseconds for the seek commands, entry for the library
+};
+
+// PCM format starting at ring offset `at` (see s_ringIn/s_ringOut)
+struct FormatChange {
+  uint32_t at;
+  AudioInfo info;
+};
+
+// track starting at ring offset `at`; only queued for a capture sink
+struct TrackMark {
+  uint32_t at;
+  char *path; // heap copy, freed by the output task
+};
+
+static QueueHandle_t s_cmdQueue = NULL;
+static QueueHandle_t s_fmtQueue = NULL;
+static QueueHandle_t s_markQueue = NULL;
+static StreamBufferHandle_t s_ring = NULL;
+static SemaphoreHandle_t s_pathMutex = NULL;
+// given by the output task once it has carried out a flushOutput() request
+static SemaphoreHandle_t s_flushDone = NULL;
+static TaskHandle_t s_decodeTask = NULL;
+static TaskHandle_t s_outputTask = NULL;
+
+// audio stack: created in begin(), then owned by the tasks
+static I2SStream *s_i2s = nullptr;
+static SDFileAudioSource *s_source = nullptr;
+static AudioPlayer *s_player = nullptr;
+static Playlist s_playlist;
+// seek table of the track being decoded (MP3 only)
+static Mp3SeekMap s_seekMap;
+// harness output replacing I2S (see setCapture)
+static PcmCapture *s_capture = nullptr;
+static uint16_t s_sdDelayMs = 0;
+
+// set by the output task once the ring ran dry after end of stream
+static volatile bool s_drained = false;
+// asks the output task to exit (shutdown)
+static volatile bool s_outputExit = false;
+
+// running byte counts into and out of the ring (wrap around); a format
+// change is tagged with s_ringIn and applied when s_ringOut gets there
+static volatile uint32_t s_ringIn = 0;
+static volatile uint32_t s_ringOut = 0;
+// what the decoder writes (decode task) and what I2S plays (output task)
+static const AudioInfo DEFAULT_INFO(44100, 2, 16);
+static AudioInfo s_srcInfo = DEFAULT_INFO;
+static AudioInfo s_outInfo = DEFAULT_INFO;
+static volatile uint32_t s_fmtSwitches = 0;
+// ring offset where the current track (or the last seek target) starts,
+// and the track time at that point
+static volatile uint32_t s_trackBase = 0;
+static volatile uint32_t s_trackBaseMs = 0;
+// decode task only
+static unsigned long s_lastResumeNote = 0;
+static unsigned long s_lastResumeFlush = 0;
+
+static volatile uint32_t s_underruns = 0;
+static volatile uint32_t s_lowWater = RING_BYTES;
+static volatile uint32_t s_decodedBytes = 0;
+static volatile uint32_t s_playedBytes = 0;
+// CPU time spent decoding (decode task) and in the PCM stage (output task),
+// for the playback power mode; one counter per writer
+static volatile uint32_t s_decodeUs = 0;
+static volatile uint32_t s_fxUs = 0;
+
+// Player output: pushes decoded PCM into the ring
+class PcmRingSink : public AudioOutput {
+public:
+  bool allocCarry() {
+    carry = (uint8_t *)malloc(CARRY_BYTES);
+    carryLen = 0;
+    return carry != nullptr;
+  }
+  void freeCarry() {
+    free(carry);
+    carry = nullptr;
+    carryLen = 0;
+  }
+  // The decoder does not offer rejected bytes again, so everything is
+  // taken: what does not fit while a command waits is carried over
+  size_t write(const uint8_t *data, size_t len) override {
+    size_t taken = len;
+    trim(data, len);
+    writeCarry();
+    size_t done = push(data, len, true);
+    if (done < len) {
+      memcpy(carry, data + done, len - done);
+      carryLen = len - done;
+    }
+    return taken;
+  }
+  // Encoder delay/padding of the track being decoded, in samples per
+  // channel (see Mp3SeekMap::trimSamples); decode task
+  void setTrim(uint32_t skip, uint32_t keep) {
+    trimSkip = skip;
+    trimKeep = keep;
+  }
+  void clearTrim() { setTrim(0, UINT32_MAX); }
+  // Put the carried-over PCM into the ring (decode task, while playing)
+  void writeCarry() {
+    if (carryLen == 0)
+      return;
+    size_t n = carryLen;
+    carryLen = 0;
+    push(carry, n, false);
+  }
+  // the ring was flushed: the carried PCM is stale too
+  void dropCarry() { carryLen = 0; }
+  // Called by the codec (decode task) when a track's format is known
+  void setAudioInfo(AudioInfo info) override {
+    if (info == s_srcInfo)
+      return;
+    // the change is tagged with s_ringIn: older PCM must be in by then
+    writeCarry();
+    if (info.bits_per_sample != 16 || info.channels < 1 || info.channels > 2) {
+      Serial.println("Audio: unsupported PCM format " +
+                     String(info.sample_rate) + "/" + String(info.channels) +
+                     "/" + String(info.bits_per_sample));
+      return;
+    }
+    FormatChange fc = {s_ringIn, info};
+    if (xQueueSend(s_fmtQueue, &fc, 0) != pdTRUE) {
+      Serial.println("Audio: format queue full, change dropped");
+      return;
+    }
+    s_srcInfo = info;
+  }
+  int availableForWrite() override {
+    return s_ring ? (int)xStreamBufferSpacesAvailable(s_ring) : 0;
+  }
+
+private:
+  uint8_t *carry = nullptr;
+  size_t carryLen = 0;
+  uint32_t trimSkip = 0;
+  uint32_t trimKeep = UINT32_MAX;
+
+  // drop the samples before trimSkip and after trimKeep
+  void trim(const uint8_t *&data, size_t &len) {
+    if (trimSkip == 0 && trimKeep == UINT32_MAX)
+      return;
+    size_t frame = s_srcInfo.channels * 2;
+    uint32_t n = len / frame;
+    uint32_t skip = n < trimSkip ? n : trimSkip;
+    trimSkip -= skip;
+    n -= skip;
+    data += skip * frame;
+    len -= skip * frame;
+    if (trimKeep == UINT32_MAX)
+      return;
+    if (n > trimKeep)
+      len = trimKeep * frame;
+    trimKeep -= n < trimKeep ? n : trimKeep;
+  }
+
+  // Copy PCM into the ring, waiting while it is full. Only whole frames go
+  // in, so the output task never sees half a sample (mono expansion works
+  // on 16-bit units). Playback is paused by the decode task alone, which
+  // is in here, so a full ring is always draining; with `mayCarry` the
+  // wait ends early once a command is queued and the rest fits the carry.
+  size_t push(const uint8_t *data, size_t len, bool mayCarry) {
+    size_t frame = s_srcInfo.channels * 2;
+    size_t done = 0;
+    while (done < len) {
+      size_t room = xStreamBufferSpacesAvailable(s_ring);
+      room -= room % frame;
+      if (room == 0) {
+        if (mayCarry && len - done <= CARRY_BYTES &&
+            uxQueueMessagesWaiting(s_cmdQueue) > 0)
+          break;
+        vTaskDelay(pdMS_TO_TICKS(5));
+        continue;
+      }
+      // single writer: the space is there, nothing to wait for
+      done += xStreamBufferSend(s_ring, data + done,
+                                len - done < room ? len - done : room, 0);
+    }
+    s_ringIn = s_ringIn + done;
+    s_decodedBytes = s_decodedBytes + done;
+    return done;
+  }
+};
+
+static PcmRingSink s_sink;
+// volume/EQ stage, run by the output task on the way to I2S
+static PcmVolume s_volume;
+static PcmEq s_eq;
+static bool s_fxLoaded = false;
+// play order settings; s_playlist follows them on the decode task
+static volatile bool s_shuffle = false;
+static volatile RepeatMode s_repeat = RepeatMode::REPEAT_OFF;
+
+// Output task: play `info` from now on. I2S always runs 16-bit stereo
+// (mono is expanded in outputLoop), so only a rate change touches the
+// driver, and it just reprograms the clock.
+static void setOutputFormat(const AudioInfo &info) {
+  if (s_i2s && info.sample_rate != s_outInfo.sample_rate)
+    s_i2s->setAudioInfo(AudioInfo(info.sample_rate, 2, 16));
+  if (s_capture)
+    s_capture->setFormat(info.sample_rate, info.channels);
+  s_eq.setSampleRate(info.sample_rate);
+  s_outInfo = info;
+  s_fmtSwitches = s_fmtSwitches + 1;
+  Serial.println("Audio: output " + String(info.sample_rate) + " Hz, " +
+                 String(info.channels) + " ch");
+}
+
+// the player's decoder; the concrete codec is picked per track
+static CodecDispatcher s_codec;
+
+static void decodeTaskEntry(void *arg) {
+  ((AudioEngine *)arg)->decodeLoop();
+  // decodeLoop only returns after a shutdown command
+  s_decodeTask = NULL;
+  vTaskDelete(NULL);
+}
+
+static void outputTaskEntry(void *arg) {
+  ((AudioEngine *)arg)->outputLoop();
+  s_outputTask = NULL;
+  vTaskDelete(NULL);
+}
+
+static void dropMarks() {
+  TrackMark m;
+  while (s_markQueue && xQueueReceive(s_markQueue, &m, 0) == pdTRUE)
+    free(m.path);
+}
+
+// queue, ring and mutex are used by UI-side calls too, so they are freed
+// by end() once both tasks are gone
+static void freeShared() {
+  if (s_cmdQueue) {
+    AudioCommand cmd;
+    while (xQueueReceive(s_cmdQueue, &cmd, 0) == pdTRUE)
+      free(cmd.path);
+    vQueueDelete(s_cmdQueue);
+    s_cmdQueue = NULL;
+  }
+  if (s_fmtQueue) {
+    vQueueDelete(s_fmtQueue);
+    s_fmtQueue = NULL;
+  }
+  if (s_markQueue) {
+    dropMarks();
+    vQueueDelete(s_markQueue);
+    s_markQueue = NULL;
+  }
+  if (s_ring) {
+    vStreamBufferDelete(s_ring);
+    s_ring = NULL;
+  }
+  if (s_pathMutex) {
+    vSemaphoreDelete(s_pathMutex);
+    s_pathMutex = NULL;
+  }
+  if (s_flushDone) {
+    vSemaphoreDelete(s_flushDone);
+    s_flushDone = NULL;
+  }
+  s_sink.freeCarry();
+}
+
+static bool postCommand(AudioCmdType type, const char *path = nullptr,
+                        int32_t arg = 0) {
+  if (!s_cmdQueue)
+    return false;
+  AudioCommand cmd = {type, path ? strdup(path) : nullptr, arg};
+  if (xQueueSend(s_cmdQueue, &cmd, pdMS_TO_TICKS(50)) != pdTRUE) {
+    free(cmd.path);
+    return false;
+  }
+  return true;
+}
+
+bool AudioEngine::running() const { return s_decodeTask != NULL; }
+
+// volume/EQ and the play order survive restarts of the engine and reboots
+static void loadFx() {
+  if (s_fxLoaded)
+    return;
+  s_fxLoaded = true;
+  Preferences prefs;
+  prefs.begin("audio", true);
+  s_volume.setLevel(prefs.getUChar("vol", 100));
+  s_eq.set(prefs.getChar("eq_b", 0), prefs.getChar("eq_m", 0),
+           prefs.getChar("eq_t", 0));
+  s_shuffle = prefs.getBool("shuffle", false);
+  uint8_t rep = prefs.getUChar("repeat", 0);
+  s_repeat = rep <= (uint8_t)RepeatMode::REPEAT_ONE ? (RepeatMode)rep
+                                                    : RepeatMode::REPEAT_OFF;
+  prefs.end();
+}
+
+void AudioEngine::setVolume(uint8_t pct) {
+  loadFx();
+  s_volume.setLevel(pct);
+  Preferences prefs;
+  prefs.begin("audio", false);
+  prefs.putUChar("vol", s_volume.level());
+  prefs.end();
+}
+
+uint8_t AudioEngine::volume() const {
+  loadFx();
+  return s_volume.level();
+}
+
+void AudioEngine::setEq(int8_t bassDb, int8_t midDb, int8_t trebleDb) {
+  loadFx();
+  s_eq.set(bassDb, midDb, trebleDb);
+  Preferences prefs;
+  prefs.begin("audio", false);
+  prefs.putChar("eq_b", s_eq.gain(0));
+  prefs.putChar("eq_m", s_eq.gain(1));
+  prefs.putChar("eq_t", s_eq.gain(2));
+  prefs.end();
+}
+
+// the decode task picks the new mode up from s_shuffle/s_repeat
+static void saveMode() {
+  Preferences prefs;
+  prefs.begin("audio", false);
+  prefs.putBool("shuffle", s_shuffle);
+  prefs.putUChar("repeat", (uint8_t)s_repeat);
+  prefs.end();
+  if (s_decodeTask)
+    postCommand(AUDIO_CMD_MODE);
+}
+
+void AudioEngine::setShuffle(bool on) {
+  loadFx();
+  s_shuffle = on;
+  saveMode();
+}
+
+bool AudioEngine::shuffle() const {
+  loadFx();
+  return s_shuffle;
+}
+
+void AudioEngine::setRepeat(RepeatMode m) {
+  loadFx();
+  s_repeat = m;
+  saveMode();
+}
+
+RepeatMode AudioEngine::repeat() const {
+  loadFx();
+  return s_repeat;
+}
+
+int8_t AudioEngine::eqGain(int band) const {
+  loadFx();
+  return band >= 0 && band < 3 ? s_eq.gain(band) : 0;
+}
+
+bool AudioEngine::begin() {
+  if (s_decodeTask)
+    return true;
+  uint32_t heap0 = ESP.getFreeHeap();
+  s_cmdQueue = xQueueCreate(CMD_QUEUE_LEN, sizeof(AudioCommand));
+  s_fmtQueue = xQueueCreate(FMT_QUEUE_LEN, sizeof(FormatChange));
+  s_ring = xStreamBufferCreate(RING_BYTES, 1);
+  s_pathMutex = xSemaphoreCreateMutex();
+  s_flushDone = xSemaphoreCreateBinary();
+  bool carryOk = s_sink.allocCarry();
+  if (s_capture)
+    s_markQueue = xQueueCreate(FMT_QUEUE_LEN, sizeof(TrackMark));
+  if (!s_cmdQueue || !s_fmtQueue || !s_ring || !s_pathMutex || !s_flushDone ||
+      !carryOk || (s_capture && !s_markQueue)) {
+    Serial.println("AudioEngine: out of memory for queue/ring");
+    freeShared();
+    return false;
+  }
+  s_outputExit = false;
+  loadFx();
+  s_eq.setSampleRate(DEFAULT_INFO.sample_rate);
+  s_playlist.setShuffle(s_shuffle);
+  s_playlist.setRepeat(s_repeat);
+  s_ringIn = s_ringOut = 0;
+  s_trackBase = 0;
+  s_trackBaseMs = 0;
+  s_srcInfo = s_outInfo = DEFAULT_INFO;
+
+  s_source = new SDFileAudioSource();
+  s_source->setPlaylist(&s_playlist);
+  s_codec.setInfoSink(&s_sink);
+  s_player = new AudioPlayer(*s_source, s_sink, s_codec);
+
+  if (s_capture) {
+    s_capture->setFormat(DEFAULT_INFO.sample_rate, DEFAULT_INFO.channels);
+  } else {
+    s_i2s = new I2SStream();
+    // configure I2S pins and params similarly to prior main.cpp code
+    auto config = s_i2s->defaultConfig(TX_MODE);
+    config.pin_bck = I2S_BCLK_PIN;
+    config.pin_ws = I2S_WS_PIN;
+    config.pin_data = I2S_DOUT_PIN;
+    // starting point only; the first track's format retunes it
+    config.sample_rate = DEFAULT_INFO.sample_rate;
+    config.channels = 2;
+    config.bits_per_sample = 16;
+    config.buffer_count = I2S_DMA_BUFFERS;
+    config.buffer_size = I2S_DMA_FRAMES;
+    s_i2s->begin(config);
+  }
+
+  s_source->readAhead().setInjectedDelay(s_sdDelayMs);
+  // set up decoder/output wiring without selecting a stream
+  s_player->begin(-1, false);
+  // unity: volume is applied by s_volume in the output task
+  s_player->setVolume(1);
+  // track changes are driven by the decode task (see decodeLoop); no fade
+  // so consecutive tracks join without a dip
+  s_player->setAutoNext(false);
+  s_player->setAutoFade(false);
+
+  if (xTaskCreate(outputTaskEntry, "audio_out", 3072, this, OUTPUT_PRIORITY,
+                  &s_outputTask) != pdPASS ||
+      xTaskCreate(decodeTaskEntry, "audio_dec", 8192, this, DECODE_PRIORITY,
+                  &s_decodeTask) != pdPASS) {
+    Serial.println("AudioEngine: failed to start audio tasks");
+    s_decodeTask = NULL;
+    teardown();
+    freeShared();
+    return false;
+  }
+  Serial.println("AudioEngine: started, heap used " +
+                 String(heap0 - ESP.getFreeHeap()) + " B");
+  return true;
+}
+
+void AudioEngine::end() {
+  if (!s_decodeTask)
+    return;
+  postCommand(AUDIO_CMD_SHUTDOWN);
+  for (int i = 0; i < 200 && s_decodeTask; ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  if (s_decodeTask) {
+    Serial.println("AudioEngine: decode task did not exit");
+    return;
+  }
+  freeShared();
+  Serial.println("AudioEngine: stopped, free heap " + String(ESP.getFreeHeap()));
+}
+
+// Release the audio stack. Runs on the decode task (or on a failed begin,
+// before it exists), so nothing else is using the player at this point.
+void AudioEngine::teardown() {
+  if (s_outputTask) {
+    s_outputExit = true;
+    for (int i = 0; i < 100 && s_outputTask; ++i)
+      vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  s_codec.release();
+  s_seekMap.close();
+  if (s_player) {
+    s_player->end();
+    delete s_player;
+    s_player = nullptr;
+  }
+  if (s_source) {
+    s_source->readAhead().end();
+    delete s_source;
+    s_source = nullptr;
+  }
+  if (s_i2s) {
+    // uninstalls the I2S driver and frees its DMA buffers
+    s_i2s->end();
+    delete s_i2s;
+    s_i2s = nullptr;
+  }
+  s_playlist.clear();
+  endOfStream = false;
+  s_drained = false;
+  trackIdx = -1;
+  trackCnt = 0;
+  setState(AudioState::AUDIO_STOPPED);
+}
+
+bool AudioEngine::play(const String &p) {
+  if (!begin())
+    return false;
+  return postCommand(AUDIO_CMD_PLAY, p.c_str());
+}
+bool AudioEngine::playLibrary(int index) {
+  if (!begin())
+    return false;
+  return postCommand(AUDIO_CMD_PLAY, LIBRARY_PLAYLIST, index);
+}
+bool AudioEngine::next() { return postCommand(AUDIO_CMD_NEXT); }
+bool AudioEngine::previous() { return postCommand(AUDIO_CMD_PREV); }
+bool AudioEngine::pause() { return postCommand(AUDIO_CMD_PAUSE); }
+bool AudioEngine::resume() { return postCommand(AUDIO_CMD_RESUME); }
+bool AudioEngine::togglePause() { return postCommand(AUDIO_CMD_TOGGLE); }
+bool AudioEngine::stop() { return postCommand(AUDIO_CMD_STOP); }
+bool AudioEngine::seek(uint32_t ms) {
+  return postCommand(AUDIO_CMD_SEEK, nullptr, (int32_t)ms);
+}
+bool AudioEngine::skip(int32_t deltaMs) {
+  return postCommand(AUDIO_CMD_SEEK_REL, nullptr, deltaMs);
+}
+
+// PCM that left the ring since the track (or seek) started, in time. Until
+// the output reaches a new track's first byte this is negative: the tail
+// of the previous track is still playing, so report 0.
+uint32_t AudioEngine::positionMs() const {
+  int32_t played = (int32_t)(s_ringOut - s_trackBase);
+  uint32_t bytesPerSec = s_srcInfo.sample_rate * s_srcInfo.channels * 2;
+  if (played <= 0 || bytesPerSec == 0)
+    return s_trackBaseMs;
+  return s_trackBaseMs + (uint32_t)((uint64_t)played * 1000 / bytesPerSec);
+}
+
+uint32_t AudioEngine::durationMs() const { return s_seekMap.durationMs(); }
+
+String AudioEngine::currentPath() {
+  if (!s_pathMutex)
+    return String();
+  xSemaphoreTake(s_pathMutex, portMAX_DELAY);
+  String p = path;
+  xSemaphoreGive(s_pathMutex);
+  return p;
+}
+
+AudioStats AudioEngine::stats() {
+  AudioStats st;
+  st.underruns = s_underruns;
+  st.ringSize = RING_BYTES;
+  st.ringFill = s_ring ? xStreamBufferBytesAvailable(s_ring) : 0;
+  st.ringLowWater = s_lowWater;
+  st.decodedBytes = s_decodedBytes;
+  st.playedBytes = s_playedBytes;
+  if (s_source) {
+    ReadAheadStream &ra = s_source->readAhead();
+    st.sdBuffered = ra.buffered();
+    st.sdStalls = ra.stalls();
+    st.sdMaxReadMs = ra.maxReadMs();
+  } else {
+    st.sdBuffered = st.sdStalls = st.sdMaxReadMs = 0;
+  }
+  st.sampleRate = s_outInfo.sample_rate;
+  st.channels = s_outInfo.channels;
+  st.formatSwitches = s_fmtSwitches;
+  st.bitrateKbps = s_seekMap.bitrateKbps();
+  st.busyUs = s_decodeUs + s_fxUs;
+  st.decodeUs = s_decodeUs;
+  return st;
+}
+
+bool AudioEngine::setCapture(PcmCapture *capture, uint16_t sdDelayMs) {
+  if (s_decodeTask)
+    return false;
+  s_capture = capture;
+  s_sdDelayMs = capture ? sdDelayMs : 0;
+  return true;
+}
+
+void AudioEngine::resetStats() {
+  s_underruns = 0;
+  s_lowWater = RING_BYTES;
+  s_decodedBytes = 0;
+  s_playedBytes = 0;
+  s_fmtSwitches = 0;
+  if (s_source)
+    s_source->readAhead().resetStats();
+}
+
+void AudioEngine::setState(AudioState s) {
+  if (curState == s)
+    return;
+  curState = s;
+  changes = changes + 1;
+}
+
+// Publish the source's current track to the UI side
+void AudioEngine::trackChanged() {
+  xSemaphoreTake(s_pathMutex, portMAX_DELAY);
+  path = String(s_source->toStr());
+  xSemaphoreGive(s_pathMutex);
+  trackIdx = s_playlist.index();
+  trackCnt = s_playlist.size();
+  s_trackBase = s_ringIn;
+  s_trackBaseMs = 0;
+  changes = changes + 1;
+  if (s_markQueue) {
+    TrackMark m = {s_ringIn, strdup(s_source->toStr())};
+    if (xQueueSend(s_markQueue, &m, 0) != pdTRUE)
+      free(m.path);
+  }
+  String p = String(s_source->toStr());
+  s_codec.beginStream(p);
+  if (codecForName(p) == AudioCodec::CODEC_MP3)
+    s_seekMap.open(p);
+  else
+    s_seekMap.close();
+  uint32_t skip, keep;
+  if (s_seekMap.trimSamples(skip, keep))
+    s_sink.setTrim(skip, keep);
+  else
+    s_sink.clearTrim();
+}
+
+// Reposition the current track. The new offset is on a frame boundary, so
+// after the flush the decoder picks up with the next read-ahead block.
+bool AudioEngine::seekTo(uint32_t ms) {
+  uint32_t pos, landed;
+  if (curState == AudioState::AUDIO_STOPPED || !s_seekMap.isOpen() ||
+      !s_seekMap.locate(ms, pos, landed))
+    return false;
+  flushOutput();
+  s_codec.restart();
+  // the Xing TOC only lands near `ms`, so the end of the track can no
+  // longer be counted in samples: it keeps its padding
+  s_sink.clearTrim();
+  if (!s_source->readAhead().seek(pos))
+    return false;
+  endOfStream = false;
+  s_drained = false;
+  s_trackBase = s_ringIn;
+  s_trackBaseMs = landed;
+  changes = changes + 1;
+  return true;
+}
+
+// Record where the current track is (decode task). Short tracks are
+// skipped, positions near either end clear the entry.
+void AudioEngine::noteResume(bool commit) {
+  s_lastResumeNote = millis();
+  uint32_t dur = s_seekMap.durationMs();
+  if (dur >= RESUME_MIN_TRACK_MS && path.length() > 0) {
+    uint32_t pos = positionMs();
+    if (pos < RESUME_MIN_POS_MS || pos + RESUME_END_MS > dur)
+      gResume.forget(path);
+    else
+      gResume.remember(path, pos);
+  }
+  if (commit) {
+    gResume.flush();
+    s_lastResumeFlush = s_lastResumeNote;
+  }
+}
+
+void AudioEngine::forgetResume() {
+  if (s_seekMap.durationMs() >= RESUME_MIN_TRACK_MS && path.length() > 0)
+    gResume.forget(path);
+}
+
+// Continue a freshly opened track where it was left
+void AudioEngine::resumeTrack() {
+  if (!s_seekMap.isOpen() || s_seekMap.durationMs() < RESUME_MIN_TRACK_MS)
+    return;
+  uint32_t at = gResume.lookup(path);
+  if (at > 0 && seekTo(at))
+    Serial.println("Audio: resumed at " + String(at / 1000) + " s");
+}
+
+// Skip within the playlist (user request): drop what is buffered so the
+// change is heard immediately
+bool AudioEngine::step(int offset) {
+  noteResume(true);
+  flushOutput();
+  endOfStream = false;
+  s_drained = false;
+  s_source->setManualStep(true);
+  bool ok = offset > 0 ? s_player->next(offset) : s_player->previous(-offset);
+  s_source->setManualStep(false);
+  if (ok) {
+    trackChanged();
+    setState(AudioState::AUDIO_PLAYING);
+    resumeTrack();
+  }
+  return ok;
+}
+
+// Discard buffered PCM. The output task is the ring's reader, so it does
+// the reset (a stream buffer must not be reset while a task blocks on it).
+// Only the decode task calls this, and the output task outlives it until
+// teardown(), so the acknowledgement always comes.
+void AudioEngine::flushOutput() {
+  s_sink.dropCarry();
+  if (!s_outputTask)
+    return;
+  flushRequested = true;
+  xSemaphoreTake(s_flushDone, portMAX_DELAY);
+}
+
+void AudioEngine::decodeLoop() {
+  for (;;) {
+    bool wantDecode = curState == AudioState::AUDIO_PLAYING && !endOfStream &&
+                      xStreamBufferSpacesAvailable(s_ring) >= DECODE_HEADROOM;
+    AudioCommand cmd;
+    if (xQueueReceive(s_cmdQueue, &cmd, wantDecode ? 0 : pdMS_TO_TICKS(20)) ==
+        pdTRUE) {
+      switch (cmd.type) {
+      case AUDIO_CMD_PLAY: {
+        if (curState != AudioState::AUDIO_STOPPED)
+          noteResume(true);
+        flushOutput();
+        endOfStream = false;
+        s_drained = false;
+        s_lowWater = RING_BYTES;
+        String p = String(cmd.path);
+        bool ok = p == LIBRARY_PLAYLIST ? s_playlist.buildFromLibrary(cmd.arg)
+                  : isPlaylistFile(p)   ? s_playlist.buildFromM3u(p)
+                                        : s_playlist.buildFromFolder(p);
+        ok = ok && s_player->setIndex(s_playlist.index());
+        if (!ok)
+          Serial.println("Audio playback failed for: " + p);
+        trackChanged();
+        setState(ok ? AudioState::AUDIO_PLAYING : AudioState::AUDIO_STOPPED);
+        if (ok)
+          resumeTrack();
+        break;
+      }
+      case AUDIO_CMD_SEEK:
+        seekTo((uint32_t)cmd.arg);
+        break;
+      case AUDIO_CMD_SEEK_REL: {
+        int32_t to = (int32_t)positionMs() + cmd.arg;
+        seekTo(to > 0 ? (uint32_t)to : 0);
+        break;
+      }
+      case AUDIO_CMD_MODE:
+        // the file queued for gapless playback is dropped on the next
+        // track change if it no longer follows in the new order
+        s_playlist.setShuffle(s_shuffle);
+        s_playlist.setRepeat(s_repeat);
+        changes = changes + 1;
+        break;
+      case AUDIO_CMD_SHUTDOWN:
+        if (curState != AudioState::AUDIO_STOPPED)
+          noteResume(true);
+        flushOutput();
+        teardown();
+        return;
+      case AUDIO_CMD_NEXT:
+      case AUDIO_CMD_PREV:
+        if (trackCnt > 0)
+          step(cmd.type == AUDIO_CMD_NEXT ? 1 : -1);
+        break;
+      case AUDIO_CMD_PAUSE:
+        if (curState == AudioState::AUDIO_PLAYING) {
+          setState(AudioState::AUDIO_PAUSED);
+          noteResume(true);
+        }
+        break;
+      case AUDIO_CMD_RESUME:
+        if (curState == AudioState::AUDIO_PAUSED)
+          setState(AudioState::AUDIO_PLAYING);
+        break;
+      case AUDIO_CMD_TOGGLE:
+        if (curState == AudioState::AUDIO_PLAYING) {
+          setState(AudioState::AUDIO_PAUSED);
+          noteResume(true);
+        } else if (curState == AudioState::AUDIO_PAUSED)
+          setState(AudioState::AUDIO_PLAYING);
+        break;
+      case AUDIO_CMD_STOP:
+        if (curState != AudioState::AUDIO_STOPPED)
+          noteResume(true);
+        flushOutput();
+        s_player->setActive(false);
+        s_codec.release();
+        endOfStream = false;
+        setState(AudioState::AUDIO_STOPPED);
+        break;
+      }
+      free(cmd.path);
+      continue;
+    }
+    // PCM held back while the command waited goes in before anything else
+    if (curState == AudioState::AUDIO_PLAYING)
+      s_sink.writeCarry();
+
+    if (endOfStream && s_drained && curState == AudioState::AUDIO_PLAYING) {
+      // played to the end: start over next time
+      forgetResume();
+      gResume.flush();
+      endOfStream = false;
+      s_drained = false;
+      s_codec.release();
+      setState(AudioState::AUDIO_STOPPED);
+      continue;
+    }
+    if (curState == AudioState::AUDIO_PLAYING &&
+        millis() - s_lastResumeNote >= RESUME_NOTE_MS)
+      noteResume(millis() - s_lastResumeFlush >= RESUME_FLUSH_MS);
+    if (!wantDecode)
+      continue;
+    // reads come from the read-ahead blocks; only the filler touches SD
+    uint32_t t0 = micros();
+    s_player->copy();
+    s_decodeUs = s_decodeUs + (micros() - t0);
+    if (s_codec.failed())
+      Serial.println("Audio: unsupported format, skipping " +
+                     String(s_source->toStr()));
+    if (s_source->readAhead().atEnd() || s_codec.failed()) {
+      // the next track is normally already queued on the read-ahead, so
+      // decoding continues straight into it while the ring still plays
+      // the tail of this one
+      if (s_player->next(1)) {
+        // the previous track was decoded to its end
+        forgetResume();
+        trackChanged();
+      } else
+        endOfStream = true;
+    } else if (!s_player->isActive()) {
+      endOfStream = true;
+    }
+  }
+}
+
+void AudioEngine::outputLoop() {
+  // room for OUT_CHUNK of stereo; mono reads half as much and expands
+  static uint8_t buf[OUT_CHUNK] __attribute__((aligned(4)));
+  bool primed = false;
+  while (!s_outputExit) {
+    if (flushRequested) {
+      // the decode task waits in flushOutput(), so s_ringIn holds still.
+      // Pending changes collapse into the latest: it describes whatever is
+      // decoded next (the decoder will not announce it again)
+      xStreamBufferReset(s_ring);
+      s_ringOut = s_ringIn;
+      FormatChange fc;
+      bool any = false;
+      while (xQueueReceive(s_fmtQueue, &fc, 0) == pdTRUE)
+        any = true;
+      if (any && fc.info != s_outInfo)
+        setOutputFormat(fc.info);
+      // marks for discarded audio; the next track is marked after this
+      dropMarks();
+      primed = false;
+      flushRequested = false;
+      xSemaphoreGive(s_flushDone);
+      continue;
+    }
+    if (curState != AudioState::AUDIO_PLAYING) {
+      // paused/stopped: keep what is buffered, I2S DMA plays silence
+      vTaskDelay(pdMS_TO_TICKS(20));
+      continue;
+    }
+    if (!primed) {
+      if (xStreamBufferBytesAvailable(s_ring) < PRIME_BYTES && !endOfStream) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+        continue;
+      }
+      primed = true;
+    }
+    size_t want = s_outInfo.channels == 1 ? sizeof(buf) / 2 : sizeof(buf);
+    FormatChange fc;
+    if (xQueuePeek(s_fmtQueue, &fc, 0) == pdTRUE) {
+      // stop exactly where the new format starts
+      want = pcmBytesBefore(fc.at, s_ringOut, want);
+      if (want == 0) {
+        xQueueReceive(s_fmtQueue, &fc, 0);
+        setOutputFormat(fc.info);
+        continue;
+      }
+    }
+    TrackMark mark;
+    if (s_markQueue && xQueuePeek(s_markQueue, &mark, 0) == pdTRUE) {
+      want = pcmBytesBefore(mark.at, s_ringOut, want);
+      if (want == 0) {
+        xQueueReceive(s_markQueue, &mark, 0);
+        s_capture->trackStart(mark.path);
+        free(mark.path);
+        continue;
+      }
+    }
+    size_t n = xStreamBufferReceive(s_ring, buf, want, pdMS_TO_TICKS(20));
+    if (n == 0) {
+      if (endOfStream)
+        s_drained = true;
+      else
+        s_underruns = s_underruns + 1;
+      primed = false;
+      continue;
+    }
+    uint32_t fill = xStreamBufferBytesAvailable(s_ring);
+    if (!endOfStream && fill < s_lowWater)
+      s_lowWater = fill;
+    s_ringOut = s_ringOut + n;
+    uint32_t t0 = micros();
+    if (s_outInfo.channels == 1) {
+      pcmMonoToStereo(buf, n);
+      n *= 2;
+    }
+    s_eq.process((int16_t *)buf, n / 4);
+    s_volume.process((int16_t *)buf, n / 4);
+    s_fxUs = s_fxUs + (micros() - t0);
+    if (s_capture)
+      s_capture->write(buf, n);
+    else
+      s_i2s->write(buf, n);
+    s_playedBytes = s_playedBytes + n;
+  }
+}
+
+static void audioCommand(const String &args) {
+  if (args == "reset") {
+    gAudio.resetStats();
+    return;
+  }
+  AudioStats st = gAudio.stats();
+  Serial.println("audio: ring " + String(st.ringFill) + "/" +
+                 String(st.ringSize) + " low " + String(st.ringLowWater) +
+                 ", underruns " + String(st.underruns) + ", decoded " +
+                 String(st.decodedBytes) + ", played " +
+                 String(st.playedBytes));
+  Serial.println("audio: sd read-ahead " + String(st.sdBuffered) +
+                 " B, stalls " + String(st.sdStalls) + ", slowest read " +
+                 String(st.sdMaxReadMs) + " ms");
+  Serial.println("audio: output " + String(st.sampleRate) + " Hz, " +
+                 String(st.channels) + " ch, format switches " +
+                 String(st.formatSwitches));
+}
+
+static void volCommand(const String &args) {
+  if (args.length() > 0)
+    gAudio.setVolume((uint8_t)constrain(args.toInt(), 0, 100));
+  Serial.println("vol: " + String(gAudio.volume()));
+}
+
+static void eqCommand(const String &args) {
+  if (args.length() > 0) {
+    int a = args.indexOf(' ');
+    int b = a < 0 ? -1 : args.indexOf(' ', a + 1);
+    if (b < 0) {
+      Serial.println("eq: need three values");
+      return;
+    }
+    gAudio.setEq(args.substring(0, a).toInt(), args.substring(a + 1, b).toInt(),
+                 args.substring(b + 1).toInt());
+  }
+  Serial.println("eq: bass " + String(gAudio.eqGain(0)) + " mid " +
+                 String(gAudio.eqGain(1)) + " treble " +
+                 String(gAudio.eqGain(2)) + " dB");
+}
+
+static void shuffleCommand(const String &args) {
+  if (args == "on" || args == "off")
+    gAudio.setShuffle(args == "on");
+  Serial.println(String("shuffle: ") + (gAudio.shuffle() ? "on" : "off"));
+}
+
+static void repeatCommand(const String &args) {
+  if (args == "off")
+    gAudio.setRepeat(RepeatMode::REPEAT_OFF);
+  else if (args == "all")
+    gAudio.setRepeat(RepeatMode::REPEAT_ALL);
+  else if (args == "one")
+    gAudio.setRepeat(RepeatMode::REPEAT_ONE);
+  RepeatMode m = gAudio.repeat();
+  Serial.println(String("repeat: ") + (m == RepeatMode::REPEAT_ALL   ? "all"
+                                       : m == RepeatMode::REPEAT_ONE ? "one"
+                                                                     : "off"));
+}
+
+static uint32_t cycleCount() { return ESP.getCycleCount(); }
+
+static void fxbenchCommand(const String &) {
+  PcmFxBench r = pcmFxBenchmark(cycleCount);
+  Serial.println("fxbench: volume " + String(r.volumeTicks, 1) + ", eq " +
+                 String(r.eqTicks, 1) + " cycles/sample");
+}
+
+void audioConsoleRegister() {
+  debugConsoleRegister("audio", "audio ring/underrun stats (audio reset)",
+                       audioCommand);
+  debugConsoleRegister("vol", "show/set volume 0-100 (vol 60)", volCommand);
+  debugConsoleRegister("eq", "show/set EQ dB bass mid treble (eq 3 0 -2)",
+                       eqCommand);
+  debugConsoleRegister("shuffle", "show/set shuffle (shuffle on|off)",
+                       shuffleCommand);
+  debugConsoleRegister("repeat", "show/set repeat (repeat off|all|one)",
+                       repeatCommand);
+  debugConsoleRegister("audiotest",
+                       "play into a capture sink: audiotest [-d sd_delay_ms] "
+                       "[-t max_s] [-w] <path>",
+                       audioHarnessCommand);
+  debugConsoleRegister("fxbench", "volume/EQ cost in cycles per sample",
+                       fxbenchCommand);
+  debugConsoleRegister("power", "playback power mode and current estimate",
+                       [](const String &) { gPlaybackPower.report(); });
+}
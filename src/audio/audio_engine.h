@@ -0,0 +1,135 @@
+// Audio playback engine running in its own tasks
+#pragma once
+
+#include "playlist.h"
+#include <Arduino.h>
+
+enum class AudioState : uint8_t { AUDIO_STOPPED = 0, AUDIO_PLAYING, AUDIO_PAUSED };
+
+struct AudioStats {
+  uint32_t underruns;    // output found the ring empty mid-track
+  uint32_t ringSize;     // PCM ring capacity in bytes
+  uint32_t ringFill;     // bytes buffered right now
+  uint32_t ringLowWater; // lowest fill seen while playing (since reset)
+  uint32_t decodedBytes; // PCM produced by the decoder
+  uint32_t playedBytes;  // PCM handed to I2S
+  uint32_t sdBuffered;   // compressed bytes read ahead from the card
+  uint32_t sdStalls;     // decoder reads that found no read-ahead data
+  uint32_t sdMaxReadMs;  // slowest single read-ahead block
+  uint32_t sampleRate;   // format the output is playing right now
+  uint8_t channels;      // of the source; mono is expanded for I2S
+  uint32_t formatSwitches; // I2S reconfigurations (since reset)
+  uint32_t bitrateKbps;  // average of the current MP3, 0 for other codecs
+  uint32_t busyUs;       // decode + PCM processing time (wraps; use deltas)
+  uint32_t decodeUs;     // decoder share of busyUs
+};
+
+class PcmCapture;
+
+// The SD -> decoder -> I2S pipeline is split over two tasks that sit above
+// the Arduino loop task, so e-paper refreshes, HTTP fetches and alarm
+// melodies in loop() no longer starve playback:
+//
+//   SD filler:   reads the file ahead into RAM blocks (ReadAheadStream)
+//   decode task: owns source/decoder/player, runs player->copy() and writes
+//                PCM into a FreeRTOS stream buffer (the ring)
+//   output task: drains the ring into I2S; the DMA write paces it
+//
+// Format changes (a 48 kHz track after a 44.1 kHz one, a mono file) are
+// queued with the ring offset they take effect at. The output task switches
+// the I2S clock when it reaches that byte, so the tail of the previous
+// track still plays at its own rate; the driver is not reinstalled.
+//
+// UI code never touches the audio objects directly; every request goes
+// through the command queue and is executed by the decode task.
+class AudioEngine {
+public:
+  // create the audio stack, the ring and the tasks. Called lazily by
+  // play(); nothing is allocated until the first track is opened.
+  bool begin();
+  // tear everything down again: tasks, ring, decoder buffers, read-ahead
+  // blocks and the I2S driver (blocks until the decode task has exited)
+  void end();
+  bool running() const;
+
+  // queued commands; return false if the queue is full.
+  // play() takes a track (its folder becomes the playlist) or an .m3u;
+  // playLibrary() plays every music file of the media index from entry
+  // `index` on
+  bool play(const String &path);
+  bool playLibrary(int index);
+  bool next();
+  bool previous();
+  bool pause();
+  bool resume();
+  bool togglePause();
+  bool stop();
+  // seek within the current track (MP3 only): to an absolute time, or
+  // relative to the current position
+  bool seek(uint32_t ms);
+  bool skip(int32_t deltaMs);
+
+  // software volume (0..100, ramped) and 3-band EQ in dB (+-12); applied
+  // right before I2S, so they take effect immediately. Saved to NVS.
+  void setVolume(uint8_t pct);
+  uint8_t volume() const;
+  void setEq(int8_t bassDb, int8_t midDb, int8_t trebleDb);
+  int8_t eqGain(int band) const;
+
+  // play order of folder/.m3u playlists (see Playlist); applied by the
+  // decode task, saved to NVS
+  void setShuffle(bool on);
+  bool shuffle() const;
+  void setRepeat(RepeatMode m);
+  RepeatMode repeat() const;
+
+  AudioState state() const { return curState; }
+  String currentPath();
+  // position in the playlist (0-based) and its length
+  int trackIndex() const { return trackIdx; }
+  int trackCount() const { return trackCnt; }
+  // bumped on every state/track change so pages know when to redraw
+  uint32_t changeCount() const { return changes; }
+  // playback position of what is being heard, and the track length (0 if
+  // unknown)
+  uint32_t positionMs() const;
+  uint32_t durationMs() const;
+
+  AudioStats stats();
+  void resetStats();
+  // test harness (audio_harness.h): send the output to `capture` instead
+  // of I2S and add `sdDelayMs` to every read-ahead block. Only while the
+  // engine is not running; nullptr restores normal output.
+  bool setCapture(PcmCapture *capture, uint16_t sdDelayMs);
+
+  // task bodies (public for the FreeRTOS entry trampolines)
+  void decodeLoop();
+  void outputLoop();
+
+private:
+  volatile AudioState curState = AudioState::AUDIO_STOPPED;
+  volatile uint32_t changes = 0;
+  // decoder reached the end of the track; output stops once the ring drains
+  volatile bool endOfStream = false;
+  // decode task asks the output task to discard buffered PCM
+  volatile bool flushRequested = false;
+  String path;
+  volatile int trackIdx = -1;
+  volatile int trackCnt = 0;
+
+  void setState(AudioState s);
+  void teardown();
+  void trackChanged();
+  bool step(int offset);
+  bool seekTo(uint32_t ms);
+  void noteResume(bool commit);
+  void forgetResume();
+  void resumeTrack();
+  void flushOutput();
+};
+
+extern AudioEngine gAudio;
+
+// serial console commands: audio, vol, eq, shuffle, repeat, audiotest,
+// fxbench and power
+void audioConsoleRegister();
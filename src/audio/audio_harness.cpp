@@ -0,0 +1,183 @@
+#include "audio_harness.h"
+#include "../spi_bus.h"
+#include "audio_engine.h"
+#include "codec_dispatch.h"
+#include "mp3_seek.h"
+#include "pcm_capture.h"
+#include <SD.h>
+
+static const uint32_t DEFAULT_LIMIT_S = 60;
+static const char *HARNESS_DIR = "/.aria";
+static const char *HARNESS_WAV_BASE = "/.aria/audiotest";
+
+// WAV files of the capture on the card: <HARNESS_WAV_BASE>_<n>.wav
+class CardWavOutput : public PcmCapture::Output {
+public:
+  bool open(int index) override {
+    String path = String(HARNESS_WAV_BASE) + "_" + String(index) + ".wav";
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    SD.mkdir(HARNESS_DIR);
+    SD.remove(path);
+    f = SD.open(path, FILE_WRITE);
+    if (!f) {
+      Serial.println("audiotest: cannot create " + path);
+      return false;
+    }
+    uint8_t h[44] = {0};
+    f.write(h, sizeof(h));
+    return true;
+  }
+  void write(const uint8_t *buf, size_t n) override {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    f.write(buf, n);
+  }
+  void close(const uint8_t *header, size_t n) override {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    f.seek(0);
+    f.write(header, n);
+    f.close();
+  }
+
+private:
+  File f;
+};
+
+static uint32_t captureNowUs() { return micros(); }
+static void captureWaitUs(uint32_t us) {
+  vTaskDelay(pdMS_TO_TICKS((us + 999) / 1000));
+}
+
+// sample rate and channels of the first MPEG frame, for the format check
+static bool probeMp3(const String &path, Mp3FrameHeader &h) {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File f = SD.open(path);
+  if (!f)
+    return false;
+  uint8_t buf[1024];
+  uint32_t pos = 0;
+  if (f.read(buf, 10) == 10 && memcmp(buf, "ID3", 3) == 0)
+    pos = 10 + ((buf[6] & 0x7F) << 21 | (buf[7] & 0x7F) << 14 |
+                (buf[8] & 0x7F) << 7 | (buf[9] & 0x7F));
+  f.seek(pos);
+  size_t n = f.read(buf, sizeof(buf));
+  f.close();
+  for (size_t i = 0; i + 4 <= n; ++i)
+    if (parseMp3Header(buf + i, h))
+      return true;
+  return false;
+}
+
+static String msText(uint64_t frames, uint32_t rate) {
+  return rate ? String((uint32_t)(frames * 1000 / rate)) + " ms" : String("?");
+}
+
+void audioHarnessCommand(const String &args) {
+  // options first, the rest is the path (it may contain spaces)
+  uint32_t delayMs = 0;
+  uint32_t limitS = DEFAULT_LIMIT_S;
+  bool saveWav = false;
+  String rest = args;
+  rest.trim();
+  while (rest.startsWith("-")) {
+    int sp = rest.indexOf(' ');
+    if (sp < 0)
+      break;
+    String opt = rest.substring(0, sp);
+    rest = rest.substring(sp + 1);
+    rest.trim();
+    if (opt == "-w") {
+      saveWav = true;
+      continue;
+    }
+    int sp2 = rest.indexOf(' ');
+    if (sp2 < 0)
+      break;
+    long v = rest.substring(0, sp2).toInt();
+    rest = rest.substring(sp2 + 1);
+    rest.trim();
+    if (opt == "-d")
+      delayMs = v;
+    else if (opt == "-t")
+      limitS = v;
+  }
+  if (rest.length() == 0) {
+    Serial.println("audiotest: usage audiotest [-d sd_delay_ms] [-t max_s] [-w] <path>");
+    return;
+  }
+  if (gAudio.running()) {
+    Serial.println("audiotest: stopping playback first");
+    gAudio.end();
+  }
+
+  static PcmCapture cap;
+  static CardWavOutput wavOut;
+  cap.begin(saveWav ? &wavOut : nullptr, captureNowUs, captureWaitUs);
+  gAudio.setCapture(&cap, delayMs);
+  gAudio.resetStats();
+  uint32_t heap0 = ESP.getFreeHeap();
+  uint32_t minFree = heap0;
+  AudioStats st0 = gAudio.stats();
+  Serial.println("audiotest: " + rest + ", sd delay " + String(delayMs) +
+                 " ms per block, limit " + String(limitS) + " s (UI is blocked)");
+  unsigned long t0 = millis();
+  bool started = gAudio.play(rest);
+  while (started && millis() - t0 < limitS * 1000UL) {
+    uint32_t f = ESP.getFreeHeap();
+    if (f < minFree)
+      minFree = f;
+    // the engine is idle again once the playlist has played out
+    if (millis() - t0 > 500 && gAudio.state() == AudioState::AUDIO_STOPPED)
+      break;
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  unsigned long wallMs = millis() - t0;
+  AudioStats st = gAudio.stats();
+  gAudio.end();
+  gAudio.setCapture(nullptr, 0);
+  cap.end();
+  if (!started) {
+    Serial.println("audiotest: could not start playback");
+    return;
+  }
+
+  for (const PcmCapture::Segment &sg : cap.segments())
+    Serial.println("audiotest: output " + String(sg.rate) + " Hz from " +
+                   String(sg.srcChannels) + " ch, " + msText(sg.frames, sg.rate));
+  int formatErrors = 0;
+  for (const PcmCapture::Boundary &b : cap.boundaries()) {
+    String line = "audiotest: track @" + msText(b.atFrame, b.rate ? b.rate : 44100) +
+                  " silence " + msText(b.silentBefore, b.rate) + " | " +
+                  msText(b.silentAfter, b.rate);
+    if (b.underrunUs > 0)
+      line += ", GAP " + String(b.underrunUs / 1000) + " ms";
+    // only MP3 has a header to check against; a byte scan of FLAC/WAV
+    // data would find false frame syncs
+    Mp3FrameHeader h;
+    if (codecForName(b.path) == AudioCodec::CODEC_MP3 && probeMp3(b.path, h)) {
+      bool ok = h.sampleRate == b.rate && h.channels == b.srcChannels;
+      if (!ok)
+        formatErrors++;
+      line += ok ? ", format ok" : ", FORMAT " + String(h.sampleRate) + "/" +
+                                       String(h.channels) + " expected";
+    }
+    Serial.println(line + "  " + b.path);
+  }
+  uint32_t audioMs = cap.audioMs();
+  uint32_t decodeUs = st.decodeUs - st0.decodeUs;
+  Serial.println("audiotest: " + String(audioMs) + " ms audio in " +
+                 String(wallMs) + " ms, decode " + String(decodeUs / 1000) +
+                 " ms = " +
+                 String(decodeUs ? (float)audioMs * 1000 / decodeUs : 0, 1) +
+                 "x realtime at " + String(getCpuFrequencyMhz()) + " MHz");
+  Serial.println("audiotest: heap peak use " + String(heap0 - minFree) +
+                 " B (min free " + String(minFree) + "), sd stalls " +
+                 String(st.sdStalls) + ", slowest read " +
+                 String(st.sdMaxReadMs) + " ms");
+  Serial.println("audiotest: simulated underruns " + String(cap.underruns()) +
+                 " (" + String(cap.underrunMs()) + " ms), ring low " +
+                 String(st.ringLowWater) + "/" + String(st.ringSize) +
+                 ", format errors " + String(formatErrors));
+  if (saveWav)
+    Serial.println("audiotest: PCM written to " + String(HARNESS_WAV_BASE) +
+                   "_<n>.wav");
+}
@@ -0,0 +1,12 @@
+// Playback test harness: the real audio chain with I2S swapped for a
+// capture sink (console "audiotest")
+#pragma once
+
+#include <Arduino.h>
+
+// "audiotest [-d sd_delay_ms] [-t max_s] [-w] <file|folder|.m3u>": play
+// through the capture sink with `sd_delay_ms` added to every read-ahead
+// block (-d), for at most `max_s` seconds (-t), optionally saving the PCM
+// as WAV (-w); then print output formats, track boundaries, decode speed,
+// peak heap and underruns. The flags come before the path.
+void audioHarnessCommand(const String &args);
@@ -0,0 +1,294 @@
+#include "codec_dispatch.h"
+#include "AudioTools/AudioCodecs/CodecAACHelix.h"
+#include "AudioTools/AudioCodecs/CodecFLAC.h"
+#include "AudioTools/AudioCodecs/CodecMP3Helix.h"
+
+using namespace audio_tools;
+
+static uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+AudioCodec codecForName(const String &path) {
+  int dot = path.lastIndexOf('.');
+  if (dot < 0)
+    return AudioCodec::CODEC_NONE;
+  String ext = path.substring(dot + 1);
+  ext.toLowerCase();
+  if (ext == "mp3")
+    return AudioCodec::CODEC_MP3;
+  if (ext == "aac")
+    return AudioCodec::CODEC_AAC;
+  if (ext == "flac")
+    return AudioCodec::CODEC_FLAC;
+  if (ext == "wav")
+    return AudioCodec::CODEC_WAV;
+  // .m4a needs an MP4 demuxer, which the build does not carry
+  return AudioCodec::CODEC_UNSUPPORTED;
+}
+
+AudioCodec CodecDispatcher::sniff(const uint8_t *p, size_t n) const {
+  if (n >= 3 && memcmp(p, "ID3", 3) == 0) {
+    // ID3v2 can front MP3, raw AAC and (from some taggers) FLAC; libFLAC
+    // skips the tag itself
+    if (hint == AudioCodec::CODEC_AAC || hint == AudioCodec::CODEC_FLAC)
+      return hint;
+    return AudioCodec::CODEC_MP3;
+  }
+  if (n >= 4 && memcmp(p, "fLaC", 4) == 0)
+    return AudioCodec::CODEC_FLAC;
+  if (n >= 12 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WAVE", 4) == 0)
+    return AudioCodec::CODEC_WAV;
+  if (n >= 8 && memcmp(p + 4, "ftyp", 4) == 0)
+    return AudioCodec::CODEC_UNSUPPORTED; // MP4/M4A container
+  if (n >= 2 && p[0] == 0xFF) {
+    if ((p[1] & 0xF6) == 0xF0)
+      return AudioCodec::CODEC_AAC; // ADTS: sync + layer 00
+    if ((p[1] & 0xE0) == 0xE0)
+      return AudioCodec::CODEC_MP3; // MPEG audio frame sync
+  }
+  // no recognisable header: trust the extension for codecs that resync
+  if (hint == AudioCodec::CODEC_MP3 || hint == AudioCodec::CODEC_AAC)
+    return hint;
+  return AudioCodec::CODEC_UNSUPPORTED;
+}
+
+void CodecDispatcher::beginStream(const String &path) {
+  hint = codecForName(path);
+  sniffing = true;
+  headLen = 0;
+  active = AudioCodec::CODEC_NONE;
+}
+
+void CodecDispatcher::release() {
+  if (decoder) {
+    decoder->end();
+    delete decoder;
+    decoder = nullptr;
+  }
+  decoderType = AudioCodec::CODEC_NONE;
+  active = AudioCodec::CODEC_NONE;
+  sniffing = false;
+}
+
+void CodecDispatcher::restart() {
+  if (decoder) {
+    decoder->end();
+    decoder->begin();
+  }
+}
+
+void CodecDispatcher::wireOutput(AudioDecoder *d) {
+  if (outOutput)
+    d->setOutput(*outOutput);
+  else if (outStream)
+    d->setOutput(*outStream);
+  else if (outPrint)
+    d->setOutput(*outPrint);
+  d->addNotifyAudioChange(*this);
+}
+
+void CodecDispatcher::setOutput(Print &out) {
+  outPrint = &out;
+  outStream = nullptr;
+  outOutput = nullptr;
+  if (decoder)
+    wireOutput(decoder);
+}
+
+void CodecDispatcher::setOutput(AudioStream &out) {
+  outPrint = &out;
+  outStream = &out;
+  outOutput = nullptr;
+  if (decoder)
+    wireOutput(decoder);
+}
+
+void CodecDispatcher::setOutput(AudioOutput &out) {
+  outPrint = &out;
+  outStream = nullptr;
+  outOutput = &out;
+  if (decoder)
+    wireOutput(decoder);
+}
+
+void CodecDispatcher::setAudioInfo(AudioInfo newInfo) {
+  info = newInfo;
+  notifyAudioChange(newInfo);
+  if (infoSink)
+    infoSink->setAudioInfo(newInfo);
+}
+
+void CodecDispatcher::select(AudioCodec c) {
+  active = c;
+  if (c == AudioCodec::CODEC_WAV || c == AudioCodec::CODEC_UNSUPPORTED) {
+    // no decoder needed: give its buffers back
+    if (decoder) {
+      decoder->end();
+      delete decoder;
+      decoder = nullptr;
+      decoderType = AudioCodec::CODEC_NONE;
+    }
+    wavState = WAV_RIFF;
+    accLen = 0;
+    return;
+  }
+  if (decoder && decoderType == c) {
+    // MP3 frames resync by themselves, which keeps album transitions
+    // gapless; the other codecs parse a stream header and need a reset
+    if (c != AudioCodec::CODEC_MP3) {
+      decoder->end();
+      decoder->begin();
+    }
+    return;
+  }
+  if (decoder) {
+    // free before allocating: two decoders do not fit next to each other
+    decoder->end();
+    delete decoder;
+    decoder = nullptr;
+  }
+  if (c == AudioCodec::CODEC_MP3)
+    decoder = new MP3DecoderHelix();
+  else if (c == AudioCodec::CODEC_AAC)
+    decoder = new AACDecoderHelix();
+  else
+    decoder = new FLACDecoder();
+  decoderType = c;
+  wireOutput(decoder);
+  if (!decoder->begin()) {
+    Serial.println("CodecDispatcher: decoder init failed (out of memory?)");
+    active = AudioCodec::CODEC_UNSUPPORTED;
+  }
+}
+
+size_t CodecDispatcher::write(const uint8_t *data, size_t len) {
+  size_t total = len;
+  if (sniffing) {
+    size_t take = sizeof(head) - headLen;
+    if (take > len)
+      take = len;
+    memcpy(head + headLen, data, take);
+    headLen += take;
+    if (headLen < sizeof(head))
+      return total; // hold until the header can be told apart
+    sniffing = false;
+    select(sniff(head, headLen));
+    feed(head, headLen);
+    data += take;
+    len -= take;
+  }
+  if (len > 0)
+    return total - len + feed(data, len);
+  return total;
+}
+
+size_t CodecDispatcher::feed(const uint8_t *data, size_t len) {
+  switch (active) {
+  case AudioCodec::CODEC_MP3:
+  case AudioCodec::CODEC_AAC:
+  case AudioCodec::CODEC_FLAC:
+    return decoder ? decoder->write(data, len) : len;
+  case AudioCodec::CODEC_WAV:
+    return writeWav(data, len);
+  default:
+    return len; // unsupported: swallow, the engine skips the track
+  }
+}
+
+// Walk the RIFF chunks as bytes arrive; once inside "data" the input
+// buffer is handed to the output as-is
+size_t CodecDispatcher::writeWav(const uint8_t *data, size_t len) {
+  size_t i = 0;
+  while (i < len && active == AudioCodec::CODEC_WAV) {
+    switch (wavState) {
+    case WAV_RIFF:
+    case WAV_CHUNK: {
+      size_t need = (wavState == WAV_RIFF ? 12 : 8) - accLen;
+      size_t n = len - i < need ? len - i : need;
+      memcpy(acc + accLen, data + i, n);
+      accLen += n;
+      i += n;
+      if (accLen < (wavState == WAV_RIFF ? 12u : 8u))
+        break;
+      accLen = 0;
+      if (wavState == WAV_RIFF) {
+        wavState = WAV_CHUNK;
+        break;
+      }
+      chunkSize = le32(acc + 4);
+      chunkLeft = chunkSize;
+      if (memcmp(acc, "fmt ", 4) == 0) {
+        info = AudioInfo();
+        wavState = WAV_FMT;
+      } else if (memcmp(acc, "data", 4) == 0) {
+        if (!info) {
+          active = AudioCodec::CODEC_UNSUPPORTED; // no usable fmt chunk
+          break;
+        }
+        setAudioInfo(info);
+        // size 0 is written by recorders that never patched the header
+        if (chunkLeft == 0)
+          chunkLeft = 0xFFFFFFFF;
+        wavState = WAV_DATA;
+      } else {
+        chunkLeft += chunkSize & 1; // chunks are word aligned
+        wavState = WAV_SKIP;
+      }
+      break;
+    }
+    case WAV_FMT: {
+      size_t n = len - i < chunkLeft ? len - i : chunkLeft;
+      for (size_t k = 0; k < n && accLen < sizeof(acc); ++k)
+        acc[accLen++] = data[i + k];
+      i += n;
+      chunkLeft -= n;
+      if (chunkLeft > 0)
+        break;
+      if (accLen >= 16) {
+        uint16_t tag = le16(acc);
+        uint16_t ch = le16(acc + 2);
+        uint32_t rate = le32(acc + 4);
+        uint16_t bits = le16(acc + 14);
+        // I2S runs at 16 bit; other depths would need conversion
+        if ((tag == 1 || tag == 0xFFFE) && bits == 16 && ch >= 1 && ch <= 2)
+          info = AudioInfo(rate, ch, 16);
+      }
+      if (!info) {
+        Serial.println("CodecDispatcher: unsupported WAV format");
+        active = AudioCodec::CODEC_UNSUPPORTED;
+        break;
+      }
+      accLen = 0;
+      chunkLeft = chunkSize & 1;
+      wavState = chunkLeft ? WAV_SKIP : WAV_CHUNK;
+      break;
+    }
+    case WAV_SKIP: {
+      size_t n = len - i < chunkLeft ? len - i : chunkLeft;
+      i += n;
+      chunkLeft -= n;
+      if (chunkLeft == 0) {
+        accLen = 0;
+        wavState = WAV_CHUNK;
+      }
+      break;
+    }
+    case WAV_DATA: {
+      size_t n = len - i < chunkLeft ? len - i : chunkLeft;
+      if (n == 0)
+        return len; // trailing chunks after the samples
+      // the player offers whatever the output did not take again
+      size_t w = outPrint ? outPrint->write(data + i, n) : n;
+      i += w;
+      if (chunkLeft != 0xFFFFFFFF)
+        chunkLeft -= w;
+      if (w < n)
+        return i;
+      break;
+    }
+    }
+  }
+  return len;
+}
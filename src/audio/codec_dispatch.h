@@ -0,0 +1,78 @@
+// Decoder front-end that picks the codec per track
+#pragma once
+
+#include "AudioTools.h"
+
+enum class AudioCodec : uint8_t {
+  CODEC_NONE = 0,
+  CODEC_MP3,
+  CODEC_AAC, // ADTS stream (.aac)
+  CODEC_FLAC,
+  CODEC_WAV, // 16-bit PCM, passed straight through
+  CODEC_UNSUPPORTED,
+};
+
+// Guess from the extension only (used when the magic bytes are ambiguous)
+AudioCodec codecForName(const String &path);
+
+// The player is given this object as its one decoder. At the start of each
+// track the first bytes are sniffed (ID3/frame sync, "fLaC", "RIFF..WAVE",
+// ADTS sync; extension as tie-breaker) and the matching decoder is created
+// on demand. Only one decoder exists at a time: switching codec frees the
+// previous one first, and release() frees it when playback stops. WAV data
+// skips decoding entirely and is written through to the output.
+class CodecDispatcher : public audio_tools::AudioDecoder {
+public:
+  // a new track starts; `path` supplies the extension hint
+  void beginStream(const String &path);
+  // free the active decoder (playback stopped)
+  void release();
+  // drop partially buffered input after the stream was repositioned; the
+  // decoder resyncs on the next frame
+  void restart();
+  AudioCodec codec() const { return active; }
+  // the current track cannot be played (unknown/unsupported format)
+  bool failed() const { return active == AudioCodec::CODEC_UNSUPPORTED; }
+  // explicit receiver for format changes (the PCM sink)
+  void setInfoSink(audio_tools::AudioInfoSupport *s) { infoSink = s; }
+
+  // AudioDecoder
+  void setOutput(Print &out) override;
+  void setOutput(audio_tools::AudioStream &out) override;
+  void setOutput(audio_tools::AudioOutput &out) override;
+  bool begin() override { return true; }
+  void end() override { release(); }
+  size_t write(const uint8_t *data, size_t len) override;
+  void setAudioInfo(audio_tools::AudioInfo info) override;
+  audio_tools::AudioInfo audioInfo() override { return info; }
+  operator bool() override { return true; }
+
+private:
+  enum WavState : uint8_t { WAV_RIFF, WAV_CHUNK, WAV_FMT, WAV_SKIP, WAV_DATA };
+
+  audio_tools::AudioDecoder *decoder = nullptr;
+  AudioCodec decoderType = AudioCodec::CODEC_NONE;
+  AudioCodec active = AudioCodec::CODEC_NONE;
+  AudioCodec hint = AudioCodec::CODEC_NONE;
+  bool sniffing = false;
+  uint8_t head[12];
+  size_t headLen = 0;
+
+  Print *outPrint = nullptr;
+  audio_tools::AudioStream *outStream = nullptr;
+  audio_tools::AudioOutput *outOutput = nullptr;
+  audio_tools::AudioInfoSupport *infoSink = nullptr;
+
+  // WAV header walker
+  WavState wavState = WAV_RIFF;
+  uint8_t acc[16];
+  size_t accLen = 0;
+  uint32_t chunkLeft = 0;
+  uint32_t chunkSize = 0;
+
+  AudioCodec sniff(const uint8_t *p, size_t n) const;
+  void select(AudioCodec c);
+  size_t feed(const uint8_t *data, size_t len);
+  size_t writeWav(const uint8_t *data, size_t len);
+  void wireOutput(audio_tools::AudioDecoder *d);
+};
@@ -0,0 +1,139 @@
+#include "mp3_frame.h"
+#include <string.h>
+
+static const uint16_t BITRATES_V1[16] = {0,   32,  40,  48,  56,  64,
+                                         80,  96,  112, 128, 160, 192,
+                                         224, 256, 320, 0};
+static const uint16_t BITRATES_V2[16] = {0,  8,  16, 24,  32,  40,  48,  56,
+                                         64, 80, 96, 112, 128, 144, 160, 0};
+static const uint32_t SAMPLE_RATES_V1[3] = {44100, 48000, 32000};
+
+static uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+}
+static uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+bool parseMp3Header(const uint8_t *p, Mp3FrameHeader &h) {
+  if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+    return false;
+  uint8_t ver = (p[1] >> 3) & 3; // 0 = 2.5, 1 = reserved, 2 = 2, 3 = 1
+  uint8_t layer = (p[1] >> 1) & 3;
+  uint8_t brIdx = p[2] >> 4;
+  uint8_t srIdx = (p[2] >> 2) & 3;
+  if (ver == 1 || layer != 1 || brIdx == 0 || brIdx == 15 || srIdx == 3)
+    return false;
+  bool v1 = ver == 3;
+  h.version = v1 ? 1 : (ver == 2 ? 2 : 25);
+  h.bitrate = v1 ? BITRATES_V1[brIdx] : BITRATES_V2[brIdx];
+  h.sampleRate = SAMPLE_RATES_V1[srIdx] >> (v1 ? 0 : (ver == 2 ? 1 : 2));
+  h.samples = v1 ? 1152 : 576;
+  h.channels = (p[3] >> 6) == 3 ? 1 : 2;
+  h.frameLen =
+      (v1 ? 144 : 72) * h.bitrate * 1000 / h.sampleRate + ((p[2] >> 1) & 1);
+  return true;
+}
+
+// the Xing tag sits right after the side info
+static size_t xingOffset(const Mp3FrameHeader &h) {
+  size_t side = h.version == 1 ? (h.channels == 1 ? 17 : 32)
+                               : (h.channels == 1 ? 9 : 17);
+  return 4 + side;
+}
+// VBRI always sits 32 bytes after the header
+static const size_t VBRI_OFFSET = 4 + 32;
+
+uint32_t mp3EstimateDurationMs(const uint8_t *p, size_t len,
+                               uint32_t audioBytes) {
+  Mp3FrameHeader h;
+  if (len < 4 || !parseMp3Header(p, h))
+    return 0;
+  uint32_t frames = 0;
+  size_t x = xingOffset(h);
+  if (x + 12 <= len &&
+      (memcmp(p + x, "Xing", 4) == 0 || memcmp(p + x, "Info", 4) == 0)) {
+    if (be32(p + x + 4) & 1)
+      frames = be32(p + x + 8);
+  } else if (VBRI_OFFSET + 18 <= len && memcmp(p + VBRI_OFFSET, "VBRI", 4) == 0) {
+    frames = be32(p + VBRI_OFFSET + 14);
+  }
+  if (frames > 0)
+    return (uint64_t)frames * h.samples * 1000 / h.sampleRate;
+  return (uint64_t)audioBytes * 8 / h.bitrate;
+}
+
+void Mp3VbrTable::clear() {
+  type = TABLE_NONE;
+  frames = bytes = 0;
+  std::vector<uint32_t>().swap(vbriOffsets);
+  vbriFramesPerEntry = 0;
+  lame = false;
+  encDelay = encPadding = 0;
+}
+
+bool parseMp3VbrTable(const uint8_t *p, size_t len, const Mp3FrameHeader &h,
+                      uint32_t dataStart, uint32_t audioBytes,
+                      Mp3VbrTable &out) {
+  out.clear();
+  size_t x = xingOffset(h);
+  if (x + 8 <= len &&
+      (memcmp(p + x, "Xing", 4) == 0 || memcmp(p + x, "Info", 4) == 0)) {
+    bool info = memcmp(p + x, "Info", 4) == 0;
+    uint32_t flags = be32(p + x + 4);
+    size_t o = x + 8;
+    if ((flags & 1) && o + 4 <= len) {
+      out.frames = be32(p + o);
+      o += 4;
+    }
+    out.bytes = audioBytes;
+    if ((flags & 2) && o + 4 <= len) {
+      out.bytes = be32(p + o);
+      o += 4;
+    }
+    if ((flags & 4) && o + 100 <= len) {
+      if (out.frames > 0) {
+        memcpy(out.toc, p + o, 100);
+        out.type = Mp3VbrTable::TABLE_XING;
+      }
+      o += 100;
+    }
+    if (flags & 8)
+      o += 4; // quality
+    // LAME tag (ffmpeg writes the same layout): 9 bytes of encoder name,
+    // then at +21 the delay and padding, 12 bits each
+    if (o + 24 <= len && (memcmp(p + o, "LAME", 4) == 0 ||
+                          memcmp(p + o, "Lavc", 4) == 0 ||
+                          memcmp(p + o, "Lavf", 4) == 0)) {
+      const uint8_t *d = p + o + 21;
+      out.lame = true;
+      out.encDelay = (d[0] << 4) | (d[1] >> 4);
+      out.encPadding = ((d[1] & 0x0F) << 8) | d[2];
+    }
+    return info;
+  }
+  const size_t v = VBRI_OFFSET;
+  if (v + 26 <= len && memcmp(p + v, "VBRI", 4) == 0) {
+    out.bytes = be32(p + v + 10);
+    out.frames = be32(p + v + 14);
+    uint16_t entries = be16(p + v + 18);
+    uint16_t scale = be16(p + v + 20);
+    uint16_t entrySize = be16(p + v + 22);
+    out.vbriFramesPerEntry = be16(p + v + 24);
+    const uint8_t *t = p + v + 26;
+    if (entrySize < 1 || entrySize > 4 || out.vbriFramesPerEntry == 0 ||
+        t + (size_t)entries * entrySize > p + len)
+      return false; // keep the frame count for the duration only
+    uint32_t off = dataStart;
+    out.vbriOffsets.reserve(entries + 1);
+    out.vbriOffsets.push_back(off);
+    for (uint16_t e = 0; e < entries; ++e) {
+      uint32_t sz = 0;
+      for (uint16_t b = 0; b < entrySize; ++b)
+        sz = (sz << 8) | *t++;
+      off += sz * scale;
+      out.vbriOffsets.push_back(off);
+    }
+    out.type = Mp3VbrTable::TABLE_VBRI;
+  }
+  return false;
+}
+
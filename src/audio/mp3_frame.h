@@ -0,0 +1,52 @@
+// MPEG audio (Layer III) frame headers and the VBR tables of the first frame
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// One decoded MPEG audio (Layer III) frame header
+struct Mp3FrameHeader {
+  uint8_t version;     // 1 = MPEG1, 2 = MPEG2, 25 = MPEG2.5
+  uint8_t channels;
+  uint16_t samples;    // per frame: 1152 (MPEG1) or 576
+  uint32_t bitrate;    // kbit/s
+  uint32_t sampleRate;
+  uint32_t frameLen;   // bytes including the header
+};
+
+// Parse 4 header bytes; false if they are not a valid Layer III header
+bool parseMp3Header(const uint8_t *p, Mp3FrameHeader &h);
+
+// Duration from the first frame: the Xing/VBRI frame count if present,
+// otherwise `audioBytes` at that frame's bitrate. 0 if p is not a frame.
+uint32_t mp3EstimateDurationMs(const uint8_t *p, size_t len,
+                               uint32_t audioBytes);
+
+// Xing/Info or VBRI header of a first frame. Either may carry only the
+// frame count (type stays TABLE_NONE); the seek table is kept when it is
+// complete.
+struct Mp3VbrTable {
+  enum Type : uint8_t { TABLE_NONE = 0, TABLE_XING, TABLE_VBRI };
+  Type type;
+  uint32_t frames; // total frames, 0 if unknown
+  uint32_t bytes;  // audio bytes the table spans
+  uint8_t toc[100]; // Xing: byte position in 1/256 of `bytes` per percent
+  std::vector<uint32_t> vbriOffsets; // file offsets, one per VBRI entry
+  uint32_t vbriFramesPerEntry;
+  // LAME tag after the Xing/Info table: silence the encoder added before
+  // and after the audio, in samples per channel
+  bool lame;
+  uint16_t encDelay;
+  uint16_t encPadding;
+
+  Mp3VbrTable() { clear(); }
+  void clear();
+};
+
+// Read the table from the first frame `p` (len bytes, audio starting at
+// file offset dataStart, audioBytes long). Returns true if the encoder
+// marked the file as CBR ("Info").
+bool parseMp3VbrTable(const uint8_t *p, size_t len, const Mp3FrameHeader &h,
+                      uint32_t dataStart, uint32_t audioBytes,
+                      Mp3VbrTable &out);
@@ -0,0 +1,419 @@
+#include "mp3_seek.h"
+#include "../spi_bus.h"
+#include "../utils/hash.h"
+#include <SD.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+static const char *CACHE_DIR = "/.aria";
+static const char *SEEK_DIR = "/.aria/seek";
+static const uint32_t CACHE_MAGIC = 0x4B534D41; // "AMSK"
+static const uint16_t CACHE_VERSION = 1;
+// header: magic u32, version u16, reserved u16, fileSize u32, dataStart u32,
+// framesPerEntry u32, totalFrames u32, entryCount u32
+static const size_t CACHE_HEADER_SIZE = 28;
+
+// room for the first frame plus a Xing/VBRI table
+static const size_t HEAD_BYTES = 1536;
+// resync window; the longest Layer III frame is 1441 bytes
+static const size_t SYNC_BYTES = 2048;
+static const size_t SCAN_CHUNK = 2048;
+// index granularity starts at 8 frames (~0.2 s) and doubles whenever the
+// table would grow past this many entries
+static const uint32_t FIRST_FRAMES_PER_ENTRY = 8;
+static const size_t MAX_ENTRIES = 1024;
+// the decoder's output lags its input by this many samples (synthesis
+// filterbank), on top of the encoder delay
+static const uint32_t DECODER_DELAY = 529;
+
+// s_seekMutex guards `opened` and the published frame index, which the UI
+// reads through durationMs() while the index task fills it in. The bus is
+// never taken while holding it. s_scanDone is given by the index task as
+// its last act, so close() can wait for it to be gone.
+static SemaphoreHandle_t s_seekMutex = NULL;
+static SemaphoreHandle_t s_scanDone = NULL;
+
+static void scanTaskEntry(void *arg) {
+  ((Mp3SeekMap *)arg)->scanLoop();
+  xSemaphoreGive(s_scanDone);
+  vTaskDelete(NULL);
+}
+
+bool Mp3SeekMap::open(const String &path) {
+  close();
+  if (!s_seekMutex)
+    s_seekMutex = xSemaphoreCreateMutex();
+  if (!s_scanDone)
+    s_scanDone = xSemaphoreCreateBinary();
+  if (!s_seekMutex || !s_scanDone)
+    return false;
+  uint8_t *buf = (uint8_t *)malloc(HEAD_BYTES);
+  if (!buf)
+    return false;
+  size_t n = 0;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File f = SD.open(path);
+    if (f) {
+      fileSize = f.size();
+      // skip an ID3v2 tag (syncsafe size, optional footer)
+      uint8_t id3[10];
+      dataStart = 0;
+      if (f.read(id3, 10) == 10 && memcmp(id3, "ID3", 3) == 0) {
+        dataStart = 10 + ((id3[6] & 0x7F) << 21 | (id3[7] & 0x7F) << 14 |
+                          (id3[8] & 0x7F) << 7 | (id3[9] & 0x7F));
+        if (id3[5] & 0x10)
+          dataStart += 10;
+      }
+      f.seek(dataStart);
+      n = f.read(buf, HEAD_BYTES);
+      f.close();
+    }
+  }
+  // some taggers leave padding or junk before the first frame
+  size_t i = 0;
+  Mp3FrameHeader h;
+  for (; i + 4 <= n; ++i) {
+    if (!parseMp3Header(buf + i, h))
+      continue;
+    Mp3FrameHeader h2;
+    if (i + h.frameLen + 4 > n ||
+        (parseMp3Header(buf + i + h.frameLen, h2) &&
+         h2.sampleRate == h.sampleRate))
+      break;
+  }
+  if (i + 4 > n) {
+    free(buf);
+    return false;
+  }
+  first = h;
+  dataStart += i;
+  filePath = path;
+  bool cbr = parseMp3VbrTable(buf + i, n - i, first, dataStart,
+                              fileSize - dataStart, vbr);
+  free(buf);
+  bool cached = vbr.type != Mp3VbrTable::TABLE_NONE || cbr || loadCache();
+  xSemaphoreTake(s_seekMutex, portMAX_DELAY);
+  opened = true;
+  xSemaphoreGive(s_seekMutex);
+
+  // a VBR file without a table gets a frame index (cached on the card)
+  if (!cached) {
+    stopScan = false;
+    scanning = xTaskCreate(scanTaskEntry, "mp3_index", 4096, this,
+                           tskIDLE_PRIORITY + 1, NULL) == pdPASS;
+    if (!scanning)
+      Serial.println("Mp3SeekMap: failed to start index task");
+  }
+  return true;
+}
+
+void Mp3SeekMap::close() {
+  if (scanning) {
+    // the task checks stopScan between chunks; it still reads filePath and
+    // the header fields, so nothing is cleared before it has exited
+    stopScan = true;
+    xSemaphoreTake(s_scanDone, portMAX_DELAY);
+    scanning = false;
+  }
+  if (s_seekMutex) {
+    xSemaphoreTake(s_seekMutex, portMAX_DELAY);
+    opened = false;
+    indexReady = false;
+    std::vector<uint32_t>().swap(offsets);
+    framesPerEntry = indexFrames = 0;
+    xSemaphoreGive(s_seekMutex);
+  }
+  vbr.clear();
+  filePath = String();
+}
+
+uint32_t Mp3SeekMap::durationMs() const {
+  if (!s_seekMutex)
+    return 0;
+  // open() fills the header fields before it sets `opened` and close()
+  // clears it first, so they hold still while the mutex is held
+  xSemaphoreTake(s_seekMutex, portMAX_DELAY);
+  uint32_t ms = 0;
+  uint32_t frames = indexReady ? indexFrames : vbr.frames;
+  if (!opened)
+    ms = 0;
+  else if (frames > 0)
+    ms = (uint64_t)frames * first.samples * 1000 / first.sampleRate;
+  else // no frame count: assume the first frame's bitrate holds throughout
+    ms = (uint64_t)(fileSize - dataStart) * 8 / first.bitrate;
+  xSemaphoreGive(s_seekMutex);
+  return ms;
+}
+
+uint32_t Mp3SeekMap::bitrateKbps() const {
+  uint32_t dur = durationMs();
+  if (dur == 0)
+    return 0;
+  // bytes * 8 / ms is kbit/s
+  return (uint64_t)(fileSize - dataStart) * 8 / dur;
+}
+
+uint32_t Mp3SeekMap::msForByte(uint32_t pos) const {
+  if (!opened || pos <= dataStart)
+    return 0;
+  uint32_t span = fileSize - dataStart;
+  if (span == 0)
+    return 0;
+  return (uint64_t)(pos - dataStart) * durationMs() / span;
+}
+
+// The Info frame itself decodes to a frame of silence, then the encoder
+// delay follows. The Xing frame count leaves the Info frame out.
+bool Mp3SeekMap::trimSamples(uint32_t &skip, uint32_t &keep) const {
+  if (!opened || !vbr.lame || vbr.frames == 0)
+    return false;
+  uint64_t total = (uint64_t)vbr.frames * first.samples;
+  if (total <= (uint32_t)vbr.encDelay + vbr.encPadding || total > UINT32_MAX)
+    return false;
+  skip = first.samples + vbr.encDelay + DECODER_DELAY;
+  keep = (uint32_t)total - vbr.encDelay - vbr.encPadding;
+  return true;
+}
+
+bool Mp3SeekMap::locate(uint32_t ms, uint32_t &pos, uint32_t &landedMs) {
+  if (!opened)
+    return false;
+  uint32_t dur = durationMs();
+  if (ms >= dur)
+    ms = dur > 1000 ? dur - 1000 : 0;
+  uint64_t frame = (uint64_t)ms * first.sampleRate / (1000 * first.samples);
+
+  xSemaphoreTake(s_seekMutex, portMAX_DELAY);
+  bool indexed = indexReady && !offsets.empty();
+  if (indexed) {
+    // the index holds real frame starts: no resync needed
+    size_t e = frame / framesPerEntry;
+    if (e >= offsets.size())
+      e = offsets.size() - 1;
+    pos = offsets[e];
+    landedMs = (uint64_t)e * framesPerEntry * first.samples * 1000 /
+               first.sampleRate;
+  }
+  xSemaphoreGive(s_seekMutex);
+  if (indexed)
+    return true;
+
+  if (vbr.type == Mp3VbrTable::TABLE_XING) {
+    // TOC entry i: byte position (in 1/256 of the stream) at i percent
+    float pct = dur ? ms * 100.0f / dur : 0;
+    int i = pct < 99 ? (int)pct : 99;
+    float a = vbr.toc[i];
+    float b = i < 99 ? vbr.toc[i + 1] : 256;
+    float x = a + (b - a) * (pct - i);
+    pos = dataStart + (uint32_t)(x / 256.0f * vbr.bytes);
+  } else if (vbr.type == Mp3VbrTable::TABLE_VBRI) {
+    const std::vector<uint32_t> &offs = vbr.vbriOffsets;
+    float e = (float)frame / vbr.vbriFramesPerEntry;
+    size_t i = (size_t)e;
+    if (i + 1 >= offs.size()) {
+      pos = offs.back();
+    } else {
+      pos = offs[i] + (uint32_t)((offs[i + 1] - offs[i]) * (e - i));
+    }
+  } else {
+    // kbit/s * ms / 8 = bytes
+    pos = dataStart + (uint32_t)((uint64_t)ms * first.bitrate / 8);
+  }
+  if (pos >= fileSize)
+    pos = dataStart;
+  pos = resync(pos);
+  landedMs = vbr.type == Mp3VbrTable::TABLE_NONE
+                 ? (uint32_t)((uint64_t)(pos - dataStart) * 8 / first.bitrate)
+                 : ms;
+  return true;
+}
+
+// First frame at or after `pos` whose successor is a frame too (a lone
+// 0xFFE.. pattern inside audio data is not enough)
+uint32_t Mp3SeekMap::resync(uint32_t pos) {
+  uint8_t *buf = (uint8_t *)malloc(SYNC_BYTES);
+  if (!buf)
+    return pos;
+  size_t n = 0;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File f = SD.open(filePath);
+    if (f) {
+      f.seek(pos);
+      n = f.read(buf, SYNC_BYTES);
+      f.close();
+    }
+  }
+  uint32_t found = pos;
+  for (size_t i = 0; i + 4 <= n; ++i) {
+    Mp3FrameHeader h, h2;
+    if (!parseMp3Header(buf + i, h) || h.sampleRate != first.sampleRate)
+      continue;
+    if (i + h.frameLen + 4 <= n &&
+        (!parseMp3Header(buf + i + h.frameLen, h2) ||
+         h2.sampleRate != h.sampleRate))
+      continue;
+    found = pos + i;
+    break;
+  }
+  free(buf);
+  return found;
+}
+
+String Mp3SeekMap::cachePath() const {
+  char name[24];
+  snprintf(name, sizeof(name), "/%08lx.idx", (unsigned long)fnv1a(filePath));
+  return String(SEEK_DIR) + name;
+}
+
+bool Mp3SeekMap::loadCache() {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File f = SD.open(cachePath());
+  if (!f)
+    return false;
+  uint8_t h[CACHE_HEADER_SIZE];
+  bool ok = f.read(h, sizeof(h)) == sizeof(h);
+  uint32_t magic, size, start, fpe, frames, count;
+  uint16_t ver;
+  if (ok) {
+    memcpy(&magic, h, 4);
+    memcpy(&ver, h + 4, 2);
+    memcpy(&size, h + 8, 4);
+    memcpy(&start, h + 12, 4);
+    memcpy(&fpe, h + 16, 4);
+    memcpy(&frames, h + 20, 4);
+    memcpy(&count, h + 24, 4);
+    // a re-encoded or re-tagged file changes size or where its audio starts
+    ok = magic == CACHE_MAGIC && ver == CACHE_VERSION && size == fileSize &&
+         start == dataStart && fpe > 0 && count > 0 && count <= MAX_ENTRIES;
+  }
+  std::vector<uint32_t> idx;
+  if (ok) {
+    idx.resize(count);
+    ok = f.read((uint8_t *)idx.data(), count * 4) == count * 4;
+  }
+  f.close();
+  if (!ok)
+    return false;
+  publishIndex(idx, fpe, frames);
+  return true;
+}
+
+void Mp3SeekMap::publishIndex(std::vector<uint32_t> &idx, uint32_t fpe,
+                              uint32_t frames) {
+  xSemaphoreTake(s_seekMutex, portMAX_DELAY);
+  offsets.swap(idx);
+  framesPerEntry = fpe;
+  indexFrames = frames;
+  indexReady = true;
+  xSemaphoreGive(s_seekMutex);
+}
+
+void Mp3SeekMap::saveCache() {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  SD.mkdir(CACHE_DIR);
+  SD.mkdir(SEEK_DIR);
+  File f = SD.open(cachePath(), FILE_WRITE);
+  if (!f)
+    return;
+  uint8_t h[CACHE_HEADER_SIZE] = {0};
+  uint32_t count = offsets.size();
+  memcpy(h, &CACHE_MAGIC, 4);
+  memcpy(h + 4, &CACHE_VERSION, 2);
+  memcpy(h + 8, &fileSize, 4);
+  memcpy(h + 12, &dataStart, 4);
+  memcpy(h + 16, &framesPerEntry, 4);
+  memcpy(h + 20, &indexFrames, 4);
+  memcpy(h + 24, &count, 4);
+  f.write(h, sizeof(h));
+  f.write((const uint8_t *)offsets.data(), count * 4);
+  f.close();
+}
+
+// Walk the frame headers from the first frame to the end of the file. Runs
+// at idle+1 and takes the bus one chunk at a time, so the read-ahead
+// filler (higher priority) always gets in first.
+void Mp3SeekMap::scanLoop() {
+  uint8_t *buf = (uint8_t *)malloc(SCAN_CHUNK);
+  if (!buf)
+    return;
+  unsigned long t0 = millis();
+  std::vector<uint32_t> idx;
+  uint32_t fpe = FIRST_FRAMES_PER_ENTRY;
+  uint32_t frame = 0;
+  uint32_t pos = dataStart;
+  uint32_t bufStart = 0, bufLen = 0;
+  bool lost = false;
+  File f;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    f = SD.open(filePath);
+  }
+  while (f && !stopScan && pos + 4 <= fileSize) {
+    if (pos < bufStart || pos + 4 > bufStart + bufLen) {
+      {
+        SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+        f.seek(pos);
+        bufLen = f.read(buf, SCAN_CHUNK);
+      }
+      bufStart = pos;
+      if (bufLen < 4)
+        break;
+      vTaskDelay(1);
+    }
+    Mp3FrameHeader h;
+    if (!parseMp3Header(buf + (pos - bufStart), h) ||
+        h.sampleRate != first.sampleRate) {
+      // lost sync (junk, a trailing ID3v1 tag): step bytewise
+      pos++;
+      lost = true;
+      continue;
+    }
+    if (lost) {
+      // after a sync loss only accept a header followed by another one
+      uint32_t nx = pos + h.frameLen;
+      if (nx + 4 <= fileSize) {
+        if (nx + 4 > bufStart + bufLen) {
+          if (bufStart == pos)
+            break; // short read
+          bufLen = 0; // reload starting at pos
+          continue;
+        }
+        Mp3FrameHeader h2;
+        if (!parseMp3Header(buf + (nx - bufStart), h2) ||
+            h2.sampleRate != h.sampleRate) {
+          pos++;
+          continue;
+        }
+      }
+      lost = false;
+    }
+    if (frame % fpe == 0) {
+      idx.push_back(pos);
+      if (idx.size() >= MAX_ENTRIES) {
+        // too fine for this file: keep every other entry
+        size_t half = (idx.size() + 1) / 2;
+        for (size_t i = 0; i < half; ++i)
+          idx[i] = idx[2 * i];
+        idx.resize(half);
+        fpe *= 2;
+      }
+    }
+    frame++;
+    pos += h.frameLen;
+  }
+  if (f) {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    f.close();
+  }
+  free(buf);
+  if (stopScan || idx.empty())
+    return;
+  publishIndex(idx, fpe, frame);
+  // close() waits for this task, so the index cannot be dropped meanwhile
+  saveCache();
+  Serial.println("Mp3SeekMap: indexed " + String(frame) + " frames in " +
+                 String(millis() - t0) + " ms");
+}
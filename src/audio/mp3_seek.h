@@ -0,0 +1,60 @@
+// Time -> byte mapping for MP3 files (seeking and duration)
+#pragma once
+
+#include "mp3_frame.h"
+#include <Arduino.h>
+#include <vector>
+
+// Seek support for the current MP3 track. open() reads the first frame and
+// a Xing/Info or VBRI table if the encoder wrote one. Without a table a
+// background task walks every frame header and records the byte offset of
+// every N-th frame; the result is cached in /.aria/seek so the walk runs
+// once per file. Until the index is there, seeks fall back to the bitrate
+// of the first frame (exact for CBR files).
+class Mp3SeekMap {
+public:
+  bool open(const String &path);
+  // stop a running scan and drop everything
+  void close();
+  bool isOpen() const { return opened; }
+
+  uint32_t durationMs() const;
+  // average bitrate over the whole file in kbit/s (0 if not open)
+  uint32_t bitrateKbps() const;
+  // byte offset of a frame boundary at or near `ms`; `landedMs` is the
+  // time that frame starts at. Reads the card to resync on the frame
+  // header, so call it from the task that owns playback.
+  bool locate(uint32_t ms, uint32_t &pos, uint32_t &landedMs);
+  // approximate time of a byte offset (for positions)
+  uint32_t msForByte(uint32_t pos) const;
+  // gapless playback from the LAME tag: decoded samples (per channel) to
+  // drop at the start of the track, and how many to keep after those.
+  // False when the file has no tag.
+  bool trimSamples(uint32_t &skip, uint32_t &keep) const;
+
+  // frame index task body (public for the FreeRTOS trampoline)
+  void scanLoop();
+
+private:
+  bool opened = false;
+  String filePath;
+  uint32_t fileSize = 0;
+  uint32_t dataStart = 0; // first frame, after any ID3v2 tag
+  Mp3FrameHeader first;
+
+  Mp3VbrTable vbr;
+
+  // sparse frame index: offsets[i] is where frame i*framesPerEntry starts
+  std::vector<uint32_t> offsets;
+  uint32_t framesPerEntry = 0;
+  uint32_t indexFrames = 0;
+  bool indexReady = false;
+  volatile bool stopScan = false;
+  bool scanning = false; // index task started and not yet joined by close()
+
+  String cachePath() const;
+  bool loadCache();
+  void publishIndex(std::vector<uint32_t> &idx, uint32_t fpe, uint32_t frames);
+  void saveCache();
+  uint32_t resync(uint32_t pos);
+};
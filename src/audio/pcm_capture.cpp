@@ -0,0 +1,179 @@
+#include "pcm_capture.h"
+#include <string.h>
+
+// writes to the output are batched to this size
+static const size_t WAV_CHUNK = 8192;
+// an underrun this close after a track start is charged to the boundary
+static const uint32_t BOUNDARY_WINDOW_MS = 200;
+// late by less than this is jitter of the model, not a gap
+static const uint32_t UNDERRUN_SLACK_US = 2000;
+
+static void putLe32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+void PcmCapture::begin(Output *o, ClockFn now, WaitFn wait) {
+  out = o;
+  nowUs = now;
+  waitUs = wait;
+  wavOpen = false;
+  segs.clear();
+  bounds.clear();
+  frames = 0;
+  zeroRun = 0;
+  countingAfter = false;
+  clockRunning = false;
+  underrunCount = 0;
+  underrunTotalUs = 0;
+  pending.reserve(WAV_CHUNK);
+}
+
+void PcmCapture::end() { closeWav(); }
+
+uint32_t PcmCapture::audioMs() const {
+  uint64_t ms = 0;
+  for (const Segment &s : segs)
+    ms += (uint64_t)s.frames * 1000 / s.rate;
+  return (uint32_t)ms;
+}
+
+void PcmCapture::openWav() {
+  if (!out)
+    return;
+  // header is completed by closeWav()
+  wavOpen = out->open((int)segs.size() - 1);
+  wavBytes = 0;
+}
+
+void PcmCapture::flushWav() {
+  if (pending.empty())
+    return;
+  if (wavOpen)
+    out->write(pending.data(), pending.size());
+  wavBytes += pending.size();
+  pending.clear();
+}
+
+void PcmCapture::closeWav() {
+  flushWav();
+  if (!wavOpen)
+    return;
+  wavOpen = false;
+  uint32_t rate = segs.empty() ? 44100 : segs.back().rate;
+  uint8_t h[44];
+  memcpy(h, "RIFF", 4);
+  putLe32(h + 4, 36 + wavBytes);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  putLe32(h + 16, 16);
+  h[20] = 1; // PCM
+  h[21] = 0;
+  h[22] = 2; // channels
+  h[23] = 0;
+  putLe32(h + 24, rate);
+  putLe32(h + 28, rate * 4);
+  h[32] = 4; // block align
+  h[33] = 0;
+  h[34] = 16; // bits
+  h[35] = 0;
+  memcpy(h + 36, "data", 4);
+  putLe32(h + 40, wavBytes);
+  out->close(h, sizeof(h));
+}
+
+void PcmCapture::setFormat(uint32_t rate, uint8_t srcChannels) {
+  if (!segs.empty() && segs.back().rate == rate &&
+      segs.back().srcChannels == srcChannels)
+    return;
+  bool newFile = segs.empty() || segs.back().rate != rate;
+  if (newFile)
+    closeWav(); // the header takes the rate of the last segment
+  if (!segs.empty() && segs.back().frames == 0) {
+    // switched again before any audio: replace the empty segment
+    segs.back() = {rate, srcChannels, 0};
+  } else {
+    segs.push_back({rate, srcChannels, 0});
+  }
+  if (newFile)
+    openWav();
+  // the modelled DMA queue drains at the old rate; restart the clock
+  clockRunning = false;
+}
+
+void PcmCapture::trackStart(const char *path) {
+  if ((int)bounds.size() >= MAX_BOUNDARIES)
+    return;
+  Boundary b;
+  b.path = path;
+  b.atFrame = frames;
+  b.rate = segs.empty() ? 0 : segs.back().rate;
+  b.srcChannels = segs.empty() ? 0 : segs.back().srcChannels;
+  b.silentBefore = zeroRun;
+  b.silentAfter = 0;
+  b.underrunUs = 0;
+  bounds.push_back(b);
+  countingAfter = true;
+}
+
+void PcmCapture::write(const uint8_t *buf, size_t n) {
+  if (segs.empty())
+    return;
+  uint32_t rate = segs.back().rate;
+  uint32_t count = n / 4;
+  uint32_t durUs = (uint64_t)count * 1000000 / rate;
+  uint32_t depthUs = (uint64_t)DMA_FRAMES * 1000000 / rate;
+
+  uint32_t now = nowUs();
+  if (!clockRunning) {
+    clockRunning = true;
+    drainEnd = now;
+  } else if ((int32_t)(now - drainEnd) > (int32_t)UNDERRUN_SLACK_US) {
+    // the DMA queue ran dry before this data came: silence on the DAC
+    uint32_t gap = now - drainEnd;
+    underrunCount++;
+    underrunTotalUs += gap;
+    if (!bounds.empty() &&
+        (uint64_t)(frames - bounds.back().atFrame) * 1000 / rate <
+            BOUNDARY_WINDOW_MS)
+      bounds.back().underrunUs += gap;
+    drainEnd = now;
+  } else if ((int32_t)(now - drainEnd) > 0) {
+    drainEnd = now;
+  }
+  // queue full: wait like i2s_write does until this chunk fits
+  int32_t over = (int32_t)(drainEnd + durUs - now) - (int32_t)depthUs;
+  if (over > 0)
+    waitUs(over);
+  drainEnd += durUs;
+
+  // silence around boundaries (exact zeros: volume 100 and flat EQ keep
+  // the decoder output bit for bit)
+  const int16_t *s = (const int16_t *)buf;
+  for (uint32_t i = 0; i < count; ++i) {
+    bool zero = s[2 * i] == 0 && s[2 * i + 1] == 0;
+    zeroRun = zero ? zeroRun + 1 : 0;
+    if (countingAfter) {
+      if (zero)
+        bounds.back().silentAfter++;
+      else
+        countingAfter = false;
+    }
+  }
+  frames += count;
+  segs.back().frames += count;
+
+  if (wavOpen) {
+    size_t done = 0;
+    while (done < n) {
+      size_t take = n - done;
+      if (take > WAV_CHUNK - pending.size())
+        take = WAV_CHUNK - pending.size();
+      pending.insert(pending.end(), buf + done, buf + done + take);
+      done += take;
+      if (pending.size() >= WAV_CHUNK)
+        flushWav();
+    }
+  }
+}
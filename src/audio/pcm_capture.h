@@ -0,0 +1,90 @@
+// Capture sink of the playback harness: the output side of the audio chain
+// with the I2S DMA queue modelled on a clock
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+// Stands in for I2S on the output task. A virtual clock models the DMA
+// queue: written frames drain at the sample rate, write() blocks while the
+// queue is full (as i2s_write does), and data that arrives after the queue
+// ran dry counts as an underrun the DAC would have played as silence. The
+// PCM (after volume/EQ, always 16-bit stereo) can be saved as WAV files,
+// one per output rate.
+class PcmCapture {
+public:
+  // modelled DMA depth: the I2S config of the engine (4 x 1024 frames)
+  static const uint32_t DMA_FRAMES = 4 * 1024;
+  static const int MAX_BOUNDARIES = 32;
+
+  // time source of the model: micros() and a task delay on the device, a
+  // fake clock in the host tests
+  typedef uint32_t (*ClockFn)();
+  typedef void (*WaitFn)(uint32_t us);
+
+  // Where the WAV files go. PcmCapture batches the PCM and builds the
+  // header; the output only stores bytes.
+  class Output {
+  public:
+    virtual ~Output() {}
+    // start file `index` with 44 bytes of room for the header
+    virtual bool open(int index) = 0;
+    virtual void write(const uint8_t *buf, size_t n) = 0;
+    // put the header at the start of the file and close it
+    virtual void close(const uint8_t *header, size_t n) = 0;
+  };
+
+  struct Segment {
+    uint32_t rate;
+    uint8_t srcChannels;
+    uint32_t frames;
+  };
+  struct Boundary {
+    String path;
+    uint32_t atFrame;     // output frame the track starts at
+    uint32_t rate;        // output format when it started
+    uint8_t srcChannels;
+    uint32_t silentBefore; // all-zero frames right before the boundary
+    uint32_t silentAfter;  // and right after it
+    uint32_t underrunUs;   // simulated DAC starvation around it
+  };
+
+  // out nullptr captures statistics only
+  void begin(Output *out, ClockFn now, WaitFn wait);
+  void end();
+
+  // output task
+  void setFormat(uint32_t rate, uint8_t srcChannels);
+  void trackStart(const char *path);
+  void write(const uint8_t *buf, size_t n);
+
+  const std::vector<Segment> &segments() const { return segs; }
+  const std::vector<Boundary> &boundaries() const { return bounds; }
+  uint32_t underruns() const { return underrunCount; }
+  uint32_t underrunMs() const { return underrunTotalUs / 1000; }
+  uint32_t totalFrames() const { return frames; }
+  // output audio time in ms, over all segments
+  uint32_t audioMs() const;
+
+private:
+  Output *out = nullptr;
+  ClockFn nowUs = nullptr;
+  WaitFn waitUs = nullptr;
+  bool wavOpen = false;
+  uint32_t wavBytes = 0;
+  std::vector<uint8_t> pending; // batched writes
+  std::vector<Segment> segs;
+  std::vector<Boundary> bounds;
+  uint32_t frames = 0;
+  uint32_t zeroRun = 0;
+  bool countingAfter = false;
+  // virtual clock: when the modelled DMA queue runs empty (us)
+  bool clockRunning = false;
+  uint32_t drainEnd = 0;
+  uint32_t underrunCount = 0;
+  uint64_t underrunTotalUs = 0;
+
+  void openWav();
+  void closeWav();
+  void flushWav();
+};
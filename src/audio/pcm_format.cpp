@@ -0,0 +1,27 @@
+#include "pcm_format.h"
+
+// The C3 has no SIMD, so this goes a 32-bit word at a time: two samples
+// in, two frames out, walking backwards so nothing is overwritten before
+// it is read.
+void pcmMonoToStereo(uint8_t *buf, size_t n) {
+  uint32_t *w = (uint32_t *)buf;
+  size_t i = n / 2; // samples
+  if (i & 1) {
+    --i;
+    uint32_t s = w[i / 2] & 0xFFFF;
+    w[i] = s | (s << 16);
+  }
+  while (i > 0) {
+    i -= 2;
+    uint32_t pair = w[i / 2];
+    uint32_t a = pair & 0xFFFF;
+    uint32_t b = pair >> 16;
+    w[i + 1] = b | (b << 16);
+    w[i] = a | (a << 16);
+  }
+}
+
+size_t pcmBytesBefore(uint32_t at, uint32_t pos, size_t want) {
+  uint32_t left = at - pos;
+  return left < want ? left : want;
+}
@@ -0,0 +1,15 @@
+// PCM layout helpers for the audio output task
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Duplicate n bytes of 16-bit mono in buf into stereo frames, in place
+// (buf must hold 2n bytes and be word aligned).
+void pcmMonoToStereo(uint8_t *buf, size_t n);
+
+// How much of a `want`-byte read may be taken from the ring at running
+// offset `pos` without crossing `at`, where a format change (or track
+// mark) applies. Offsets are running byte counts that wrap around; 0 means
+// `at` is reached and the change is due now.
+size_t pcmBytesBefore(uint32_t at, uint32_t pos, size_t want);
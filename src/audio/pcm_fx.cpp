@@ -0,0 +1,220 @@
+#include "pcm_fx.h"
+#include <math.h>
+#include <string.h>
+
+// the EQ settings and coefficient hand-over are shared between the
+// setters' task and the output task; host tests are single threaded
+#ifdef ARDUINO_ARCH_ESP32
+#include <freertos/FreeRTOS.h>
+static portMUX_TYPE s_coefMux = portMUX_INITIALIZER_UNLOCKED;
+#define COEF_LOCK() portENTER_CRITICAL(&s_coefMux)
+#define COEF_UNLOCK() portEXIT_CRITICAL(&s_coefMux)
+#else
+#define COEF_LOCK()
+#define COEF_UNLOCK()
+#endif
+
+// ~23 ms at 44.1 kHz for a full 0 -> unity swing
+static const int32_t RAMP_FRAMES = 1024;
+static const int32_t RAMP_STEP = 32768 / RAMP_FRAMES;
+static const int Q = 28;
+static const int8_t MAX_DB = 12;
+static const float BAND_HZ[3] = {200.0f, 1000.0f, 4000.0f};
+
+static inline int16_t clip16(int32_t v) {
+  return v > 32767 ? 32767 : (v < -32768 ? -32768 : (int16_t)v);
+}
+
+void PcmVolume::setLevel(uint8_t p) {
+  if (p > 100)
+    p = 100;
+  pct = p;
+  target = (int32_t)p * p * UNITY / 10000;
+}
+
+void PcmVolume::process(int16_t *s, size_t frames) {
+  int32_t g = gain;
+  const int32_t t = target;
+  if (g == t) {
+    if (g == UNITY)
+      return;
+    // |s * g| < 2^30, no saturation needed
+    for (size_t i = 0; i < frames * 2; ++i)
+      s[i] = (int16_t)((s[i] * g) >> 15);
+    return;
+  }
+  for (size_t i = 0; i < frames; ++i) {
+    if (g < t)
+      g = g + RAMP_STEP < t ? g + RAMP_STEP : t;
+    else if (g > t)
+      g = g - RAMP_STEP > t ? g - RAMP_STEP : t;
+    s[2 * i] = (int16_t)((s[2 * i] * g) >> 15);
+    s[2 * i + 1] = (int16_t)((s[2 * i + 1] * g) >> 15);
+  }
+  gain = g;
+}
+
+void PcmEq::set(int8_t bassDb, int8_t midDb, int8_t trebleDb) {
+  int8_t g[BANDS] = {bassDb, midDb, trebleDb};
+  COEF_LOCK();
+  for (int i = 0; i < BANDS; ++i)
+    gains[i] = g[i] > MAX_DB ? MAX_DB : (g[i] < -MAX_DB ? -MAX_DB : g[i]);
+  COEF_UNLOCK();
+  redesign();
+}
+
+void PcmEq::setSampleRate(uint32_t r) {
+  if (r == 0)
+    return;
+  COEF_LOCK();
+  bool same = r == rate;
+  rate = r;
+  COEF_UNLOCK();
+  if (!same)
+    redesign();
+}
+
+static PcmEq::Coeffs quantize(float b0, float b1, float b2, float a0, float a1,
+                              float a2, float pre) {
+  const float scale = (float)(1L << Q);
+  PcmEq::Coeffs c;
+  c.b0 = (int32_t)lroundf(b0 * pre / a0 * scale);
+  c.b1 = (int32_t)lroundf(b1 * pre / a0 * scale);
+  c.b2 = (int32_t)lroundf(b2 * pre / a0 * scale);
+  c.a1 = (int32_t)lroundf(a1 / a0 * scale);
+  c.a2 = (int32_t)lroundf(a2 / a0 * scale);
+  return c;
+}
+
+// RBJ audio EQ cookbook; shelves with slope 1, peak with Q 1
+static void design(const int8_t *g, uint32_t rate, PcmEq::Bank &out) {
+  int8_t boost = 0;
+  for (int i = 0; i < PcmEq::BANDS; ++i)
+    if (g[i] > boost)
+      boost = g[i];
+  // headroom for the largest boost, folded into the first active filter
+  float pre = powf(10.0f, -boost / 20.0f);
+  out.active = 0;
+  for (int band = 0; band < PcmEq::BANDS; ++band) {
+    if (g[band] == 0)
+      continue;
+    float A = powf(10.0f, g[band] / 40.0f);
+    float w0 = 2.0f * (float)M_PI * BAND_HZ[band] / rate;
+    float cw = cosf(w0), sw = sinf(w0);
+    PcmEq::Coeffs c;
+    if (band == 1) {
+      float alpha = sw / 2.0f; // Q = 1
+      c = quantize(1 + alpha * A, -2 * cw, 1 - alpha * A, 1 + alpha / A,
+                   -2 * cw, 1 - alpha / A, pre);
+    } else {
+      float k = 2.0f * sqrtf(A) * sw / 2.0f * sqrtf(2.0f); // 2*sqrt(A)*alpha
+      if (band == 0)
+        c = quantize(A * ((A + 1) - (A - 1) * cw + k),
+                     2 * A * ((A - 1) - (A + 1) * cw),
+                     A * ((A + 1) - (A - 1) * cw - k), (A + 1) + (A - 1) * cw + k,
+                     -2 * ((A - 1) + (A + 1) * cw), (A + 1) + (A - 1) * cw - k,
+                     pre);
+      else
+        c = quantize(A * ((A + 1) + (A - 1) * cw + k),
+                     -2 * A * ((A - 1) + (A + 1) * cw),
+                     A * ((A + 1) + (A - 1) * cw - k), (A + 1) - (A - 1) * cw + k,
+                     2 * ((A - 1) - (A + 1) * cw), (A + 1) - (A - 1) * cw - k,
+                     pre);
+    }
+    pre = 1.0f;
+    out.band[out.active] = band;
+    out.coef[out.active++] = c;
+  }
+}
+
+// Design from a snapshot of the settings and hand the result over. Two
+// tasks may race here (a setting and a rate change): only the design of
+// the latest snapshot is handed over.
+void PcmEq::redesign() {
+  int8_t g[BANDS];
+  COEF_LOCK();
+  memcpy(g, gains, sizeof(g));
+  uint32_t r = rate;
+  uint32_t seq = ++designSeq;
+  COEF_UNLOCK();
+  Bank b;
+  design(g, r, b);
+  COEF_LOCK();
+  if (seq == designSeq) {
+    pending = b;
+    fresh = true;
+  }
+  COEF_UNLOCK();
+}
+
+static inline int32_t biquad(const PcmEq::Coeffs &c, PcmEq::State &s,
+                             int32_t x) {
+  int64_t acc = (int64_t)c.b0 * x + (int64_t)c.b1 * s.x1 +
+                (int64_t)c.b2 * s.x2 - (int64_t)c.a1 * s.y1 -
+                (int64_t)c.a2 * s.y2 + s.err;
+  int32_t y = (int32_t)(acc >> Q);
+  s.err = (int32_t)(acc - ((int64_t)y << Q));
+  s.x2 = s.x1;
+  s.x1 = x;
+  s.y2 = s.y1;
+  s.y1 = y;
+  return y;
+}
+
+void PcmEq::process(int16_t *s, size_t frames) {
+  if (fresh) {
+    bool was[BANDS] = {false, false, false};
+    for (int b = 0; b < live.active; ++b)
+      was[live.band[b]] = true;
+    COEF_LOCK();
+    live = pending;
+    fresh = false;
+    COEF_UNLOCK();
+    // a band that was bypassed starts from silence; the others keep
+    // their history, so the response changes without a step
+    for (int b = 0; b < live.active; ++b)
+      if (!was[live.band[b]])
+        memset(st[live.band[b]], 0, sizeof(st[0]));
+  }
+  if (live.active == 0)
+    return;
+  for (size_t i = 0; i < frames; ++i) {
+    for (int ch = 0; ch < 2; ++ch) {
+      int32_t v = s[2 * i + ch];
+      // stages stay in 32 bit; only the result is clipped
+      for (int b = 0; b < live.active; ++b)
+        v = biquad(live.coef[b], st[live.band[b]][ch], v);
+      s[2 * i + ch] = clip16(v);
+    }
+  }
+}
+
+PcmFxBench pcmFxBenchmark(uint32_t (*counter)()) {
+  const size_t FRAMES = 512;
+  const int ROUNDS = 20;
+  static int16_t buf[FRAMES * 2];
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < FRAMES * 2; ++i) {
+    seed = seed * 1664525 + 1013904223;
+    buf[i] = (int16_t)(seed >> 16) / 4;
+  }
+  PcmVolume vol;
+  vol.setLevel(60);
+  PcmEq eq;
+  eq.set(6, -3, 4);
+  eq.process(buf, 1); // pick the filters up outside the timed loop
+
+  PcmFxBench r;
+  uint32_t t0 = counter();
+  for (int i = 0; i < ROUNDS; ++i) {
+    // alternate targets so every round ramps
+    vol.setLevel(i & 1 ? 60 : 40);
+    vol.process(buf, FRAMES);
+  }
+  r.volumeTicks = (float)(counter() - t0) / (ROUNDS * FRAMES * 2);
+  t0 = counter();
+  for (int i = 0; i < ROUNDS; ++i)
+    eq.process(buf, FRAMES);
+  r.eqTicks = (float)(counter() - t0) / (ROUNDS * FRAMES * 2);
+  return r;
+}
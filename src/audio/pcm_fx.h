@@ -0,0 +1,78 @@
+// Fixed-point PCM stage between the ring and I2S: volume and tone control
+#pragma once
+
+#include <Arduino.h>
+
+// Both stages work in place on interleaved 16-bit stereo and use integer
+// math only (the C3 has no FPU; float is used just to design the filters
+// when a setting or the sample rate changes, in the setter). Setters may be
+// called from any task, process() runs on the audio output task.
+
+// Software volume. Gains are Q15 (32768 = unity); a new level is reached
+// by a linear ramp of RAMP_FRAMES frames so changes never click.
+class PcmVolume {
+public:
+  // 0..100 on a squared curve (closer to perceived loudness)
+  void setLevel(uint8_t pct);
+  uint8_t level() const { return pct; }
+  void process(int16_t *s, size_t frames);
+
+private:
+  static const int32_t UNITY = 32768;
+  volatile int32_t target = UNITY;
+  int32_t gain = UNITY;
+  uint8_t pct = 100;
+};
+
+// Three-band EQ: low shelf (200 Hz), peaking mid (1 kHz), high shelf
+// (4 kHz) from the RBJ cookbook, cascaded direct form I biquads with Q28
+// coefficients, 64-bit accumulation (mul/mulh on RV32) and the truncated
+// fraction carried into the next sample. Positive gains lower the input
+// by the largest boost first, so a boosted band does not clip.
+// The filters are designed by the setters, on the calling task; process()
+// only picks the new coefficients up, and keeps the filter state so a
+// change does not click.
+class PcmEq {
+public:
+  // gains in dB, clamped to +-12; 0/0/0 bypasses the stage
+  void set(int8_t bassDb, int8_t midDb, int8_t trebleDb);
+  int8_t gain(int band) const { return gains[band]; }
+  void setSampleRate(uint32_t rate);
+  void process(int16_t *s, size_t frames);
+
+  static const int BANDS = 3;
+  struct Coeffs {
+    int32_t b0, b1, b2, a1, a2;
+  };
+  struct State {
+    int32_t x1, x2, y1, y2;
+    int32_t err; // fraction below the Q28 cut
+  };
+  // the bands in use, in processing order
+  struct Bank {
+    int active;
+    uint8_t band[BANDS];
+    Coeffs coef[BANDS];
+  };
+
+private:
+  // settings and the hand-over, guarded by the coefficient lock
+  int8_t gains[BANDS] = {0, 0, 0};
+  uint32_t rate = 44100;
+  uint32_t designSeq = 0; // last settings snapshot taken for a design
+  Bank pending = {0, {0}, {}};
+  volatile bool fresh = false;
+  // output task
+  Bank live = {0, {0}, {}};
+  State st[BANDS][2] = {};
+
+  void redesign();
+};
+
+// cost of the PCM stage per sample (one channel), in ticks of `counter`:
+// CPU cycles for the "fxbench" command, nanoseconds in the host benchmark
+struct PcmFxBench {
+  float volumeTicks;
+  float eqTicks;
+};
+PcmFxBench pcmFxBenchmark(uint32_t (*counter)());
@@ -0,0 +1,130 @@
+#include "playback_power.h"
+#include "../app_context.h"
+#include "audio_engine.h"
+#include "codec_dispatch.h"
+
+PlaybackPower gPlaybackPower;
+
+// load measured over this long before deciding
+static const unsigned long WINDOW_MS = 2000;
+// step down only if the work would fill less than this at LOW_MHZ, for
+// CALM_WINDOWS windows in a row; step up above LOAD_UP
+static const float LOAD_DOWN = 0.5f;
+static const float LOAD_UP = 0.7f;
+static const uint8_t CALM_WINDOWS = 2;
+// MP3s up to this bitrate (at <= 48 kHz) go to LOW_MHZ without waiting
+// for a measurement; everything else is measured first
+static const uint32_t LOW_MHZ_MAX_KBPS = 192;
+
+// Rough current budget (mA, 3.3 V) for the console estimate: C3 datasheet
+// typicals with the radio off, core busy vs parked in WFI, plus the SD
+// card streaming at ~1 read per 100 ms and the panel with its booster on.
+// Speaker amplifier not included.
+static const float CPU_BUSY_MA_160 = 23.0f;
+static const float CPU_BUSY_MA_80 = 17.0f;
+static const float CPU_IDLE_MA_160 = 11.0f;
+static const float CPU_IDLE_MA_80 = 8.0f;
+static const float SD_AVG_MA = 3.0f;
+static const float PANEL_ON_MA = 1.5f;
+
+void PlaybackPower::setClock(uint32_t m) {
+  if (m == mhz)
+    return;
+  // 160 <-> 80 keeps the APB at 80 MHz: SPI, I2S and UART are unaffected
+  if (!setCpuFrequencyMhz(m)) {
+    Serial.println("Power: cannot set CPU to " + String(m) + " MHz");
+    return;
+  }
+  mhz = m;
+  if (lowPower())
+    panelIdle();
+  Serial.println("Power: CPU " + String(mhz) + " MHz" +
+                 (lowPower() ? " (low-power playback)" : ""));
+  report();
+}
+
+void PlaybackPower::startWindow() {
+  AudioStats st = gAudio.stats();
+  windowStart = millis();
+  busyAtStart = st.busyUs;
+  underrunsAtStart = st.underruns;
+}
+
+void PlaybackPower::update() {
+  bool nowPlaying = gAudio.running() && gAudio.state() == AudioState::AUDIO_PLAYING;
+  if (!nowPlaying) {
+    if (playing) {
+      playing = false;
+      setClock(FULL_MHZ);
+    }
+    return;
+  }
+  if (!playing) {
+    playing = true;
+    calmWindows = 0;
+    startWindow();
+  }
+  AudioStats st = gAudio.stats();
+  bool pinned = pinnedTrack == gAudio.trackIndex() &&
+                pinnedChanges == gAudio.changeCount();
+  if (!pinned && !lowPower() && st.bitrateKbps > 0 &&
+      st.bitrateKbps <= LOW_MHZ_MAX_KBPS && st.sampleRate <= 48000) {
+    // plain MP3: known to fit, the window below still checks it
+    setClock(LOW_MHZ);
+    startWindow();
+    return;
+  }
+  unsigned long now = millis();
+  if (now - windowStart < WINDOW_MS)
+    return;
+  load = (float)(st.busyUs - busyAtStart) / ((now - windowStart) * 1000.0f);
+  bool underrun = st.underruns != underrunsAtStart;
+  if (lowPower()) {
+    if (underrun || load > LOAD_UP) {
+      // could not keep up: full speed until the track or state changes
+      pinnedTrack = gAudio.trackIndex();
+      pinnedChanges = gAudio.changeCount();
+      setClock(FULL_MHZ);
+    }
+  } else if (!pinned) {
+    float atLow = load * FULL_MHZ / LOW_MHZ;
+    calmWindows = (!underrun && atLow < LOAD_DOWN) ? calmWindows + 1 : 0;
+    if (calmWindows >= CALM_WINDOWS) {
+      calmWindows = 0;
+      setClock(LOW_MHZ);
+    }
+  }
+  startWindow();
+}
+
+void PlaybackPower::panelIdle() {
+  if (!gAudio.running() || gAudio.state() != AudioState::AUDIO_PLAYING) {
+    panelAsleep = false;
+    return;
+  }
+  display.hibernate();
+  panelAsleep = true;
+}
+
+float PlaybackPower::estimateMa(uint32_t atMhz, float loadAtFull) const {
+  float busy = atMhz == FULL_MHZ ? loadAtFull : loadAtFull * FULL_MHZ / atMhz;
+  if (busy > 1)
+    busy = 1;
+  float busyMa = atMhz == FULL_MHZ ? CPU_BUSY_MA_160 : CPU_BUSY_MA_80;
+  float idleMa = atMhz == FULL_MHZ ? CPU_IDLE_MA_160 : CPU_IDLE_MA_80;
+  return idleMa + (busyMa - idleMa) * busy + SD_AVG_MA;
+}
+
+void PlaybackPower::report() {
+  float loadAtFull = mhz == FULL_MHZ ? load : load * LOW_MHZ / FULL_MHZ;
+  float panel = panelAsleep ? 0 : PANEL_ON_MA;
+  Serial.println("power: " + String(lowPower() ? "low-power playback" : "normal") +
+                 ", CPU " + String(mhz) + " MHz, load " +
+                 String(load * 100, 0) + "%, panel " +
+                 (panelAsleep ? "asleep" : "awake"));
+  Serial.println("power: est. " + String(estimateMa(FULL_MHZ, loadAtFull) + PANEL_ON_MA, 1) +
+                 " mA at 160 MHz/panel awake, " +
+                 String(estimateMa(LOW_MHZ, loadAtFull), 1) +
+                 " mA at 80 MHz/panel asleep, now ~" +
+                 String(estimateMa(mhz, loadAtFull) + panel, 1) + " mA");
+}
@@ -0,0 +1,52 @@
+// Playback power mode: CPU clock scaling and panel sleep while music plays
+#pragma once
+
+#include <Arduino.h>
+
+// Runs from the main loop. While a track plays, the CPU clock is lowered
+// to the slowest step that keeps up with the decoder, judged from the
+// bitrate and from the decode time the engine measures; pausing or
+// stopping restores full speed for the UI and Wi-Fi. The panel is put in
+// deep sleep between music page refreshes.
+//
+// Only 160 and 80 MHz are used: below 80 MHz the C3 runs from the crystal,
+// which stops the PLL that clocks I2S (and lowers the APB clock the SD
+// bus is derived from). Light sleep is not used for the same reason; the
+// idle task parks the core (WFI) whenever the audio tasks block on the
+// ring or the I2S DMA queue.
+class PlaybackPower {
+public:
+  void update();
+  // true while playing at reduced clock
+  bool lowPower() const { return mhz < FULL_MHZ; }
+  // after a page draw during playback: let the panel sleep until the next
+  // one (GxEPD2 resets it on the next refresh)
+  void panelIdle();
+  // how long loop() may sleep between polls
+  uint32_t loopDelayMs() const { return lowPower() ? 30 : 10; }
+  // mode, clock, measured load and current estimates for both clocks
+  void report();
+
+private:
+  static const uint32_t FULL_MHZ = 160;
+  static const uint32_t LOW_MHZ = 80;
+
+  uint32_t mhz = FULL_MHZ;
+  bool playing = false;
+  bool panelAsleep = false; // as left by the last panelIdle()
+  // measurement window
+  unsigned long windowStart = 0;
+  uint32_t busyAtStart = 0;
+  uint32_t underrunsAtStart = 0;
+  float load = 0; // busy fraction at the current clock, last window
+  uint8_t calmWindows = 0;
+  // track that could not keep up at LOW_MHZ; stays at full speed
+  int pinnedTrack = -1;
+  uint32_t pinnedChanges = 0;
+
+  void setClock(uint32_t m);
+  void startWindow();
+  float estimateMa(uint32_t atMhz, float loadAtFull) const;
+};
+
+extern PlaybackPower gPlaybackPower;
@@ -0,0 +1,317 @@
+#include "playlist.h"
+#include "../media/media_index.h"
+#include "../spi_bus.h"
+#include "../utils/hash.h"
+#include "shuffle.h"
+#include <SD.h>
+#include <algorithm>
+
+const char *const LIBRARY_PLAYLIST = "/:music";
+
+// shuffle state of the last list, kept across deep sleep
+static const uint32_t SHUFFLE_MAGIC = 0x53484631; // "SHF1"
+
+struct ShuffleState {
+  uint32_t magic;
+  uint32_t listId;
+  uint32_t seed;
+  uint32_t start;
+  uint32_t counter;
+};
+RTC_DATA_ATTR static ShuffleState rtc_shuffle;
+
+static uint32_t listHash(const String &source, size_t count) {
+  return shuffleMix(fnv1a(source) ^ (uint32_t)count);
+}
+
+bool isPlaylistFile(const String &path) {
+  String lower = path;
+  lower.toLowerCase();
+  return lower.endsWith(".m3u") || lower.endsWith(".m3u8");
+}
+
+static String parentDir(const String &path) {
+  int slash = path.lastIndexOf('/');
+  if (slash <= 0)
+    return "/";
+  return path.substring(0, slash);
+}
+
+static String joinPath(const String &dir, const String &name) {
+  if (dir.endsWith("/"))
+    return dir + name;
+  return dir + "/" + name;
+}
+
+void Playlist::clear() {
+  // give the capacity back too: an .m3u can be long
+  std::vector<uint16_t>().swap(order);
+  std::vector<uint32_t>().swap(lineOffs);
+  kind = SOURCE_NONE;
+  source = String();
+  count = 0;
+  first = 0;
+  cur = -1;
+}
+
+// Entry numbers of the folder `source` in the current media index, sorted
+// by name. The names are only needed for the sort; `cur` becomes the
+// position of `name` if it is listed.
+bool Playlist::loadFolder(const String &name) {
+  std::vector<uint16_t>().swap(order);
+  int n = 0;
+  indexGen = gMediaIndex.generation();
+  if (!gMediaIndex.folderRange(MediaType::MEDIA_MUSIC, source, first, n) ||
+      n > 0xFFFF)
+    return false;
+  std::vector<String> names;
+  if (!gMediaIndex.namesAt(MediaType::MEDIA_MUSIC, first, n, names))
+    return false;
+  order.resize(n);
+  for (int i = 0; i < n; ++i)
+    order[i] = (uint16_t)i;
+  std::sort(order.begin(), order.end(), [&names](uint16_t a, uint16_t b) {
+    String la = names[a], lb = names[b];
+    la.toLowerCase();
+    lb.toLowerCase();
+    return la < lb;
+  });
+  count = n;
+  for (int i = 0; i < n && name.length() > 0; ++i)
+    if (names[order[i]] == name) {
+      cur = i;
+      break;
+    }
+  return true;
+}
+
+bool Playlist::buildFromFolder(const String &trackPath) {
+  clear();
+  kind = SOURCE_FOLDER;
+  source = parentDir(trackPath);
+  int slash = trackPath.lastIndexOf('/');
+  loadFolder(trackPath.substring(slash + 1));
+  if (cur < 0) {
+    // not in the index (hidden, or not scanned yet): play it alone
+    std::vector<uint16_t>().swap(order);
+    kind = SOURCE_SINGLE;
+    source = trackPath;
+    count = 1;
+    cur = 0;
+  }
+  restoreShuffle();
+  return true;
+}
+
+bool Playlist::buildFromLibrary(int index) {
+  clear();
+  int n = gMediaIndex.count(MediaType::MEDIA_MUSIC);
+  if (index < 0 || index >= n)
+    return false;
+  kind = SOURCE_LIBRARY;
+  source = LIBRARY_PLAYLIST;
+  indexGen = gMediaIndex.generation();
+  count = n;
+  cur = index;
+  restoreShuffle();
+  return true;
+}
+
+bool Playlist::buildFromM3u(const String &m3uPath) {
+  clear();
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File f = SD.open(m3uPath);
+  if (!f)
+    return false;
+  while (f.available()) {
+    uint32_t off = f.position();
+    String line = f.readStringUntil('\n');
+    // UTF-8 BOM written by some editors
+    if (off == 0 && line.length() >= 3 && (uint8_t)line[0] == 0xEF &&
+        (uint8_t)line[1] == 0xBB && (uint8_t)line[2] == 0xBF) {
+      line = line.substring(3);
+      off = 3;
+    }
+    line.trim();
+    if (line.length() == 0 || line.startsWith("#") || line.indexOf("://") >= 0)
+      continue;
+    lineOffs.push_back(off);
+  }
+  f.close();
+  if (lineOffs.empty())
+    return false;
+  kind = SOURCE_M3U;
+  source = m3uPath;
+  count = (int)lineOffs.size();
+  cur = 0;
+  restoreShuffle();
+  return true;
+}
+
+// A rescan publishes a new media index whose entry numbers may differ.
+// Unchanged folders keep their records (and so their order), so only the
+// range moves; otherwise the list is rebuilt and a new shuffle cycle starts.
+void Playlist::revalidate() {
+  if ((kind != SOURCE_FOLDER && kind != SOURCE_LIBRARY) ||
+      indexGen == gMediaIndex.generation())
+    return;
+  int before = count;
+  if (kind == SOURCE_LIBRARY) {
+    indexGen = gMediaIndex.generation();
+    count = gMediaIndex.count(MediaType::MEDIA_MUSIC);
+  } else if (!loadFolder()) {
+    count = 0;
+  }
+  if (count == before)
+    return;
+  Serial.println("Playlist: media index changed, " + String(before) + " -> " +
+                 String(count) + " tracks");
+  if (cur >= count)
+    cur = count - 1;
+  listId = listHash(source, count);
+  if (shuffled && cur >= 0)
+    newCycleAt(cur);
+}
+
+void Playlist::setIndex(int i) {
+  if (i < 0 || i >= count)
+    return;
+  if (shuffled && i != cur)
+    newCycleAt(i);
+  cur = i;
+}
+
+String Playlist::pathAt(int i) {
+  revalidate();
+  if (i < 0 || i >= count)
+    return String();
+  switch (kind) {
+  case SOURCE_SINGLE:
+    return source;
+  case SOURCE_FOLDER:
+    return gMediaIndex.pathAt(MediaType::MEDIA_MUSIC, first + order[i]);
+  case SOURCE_LIBRARY:
+    return gMediaIndex.pathAt(MediaType::MEDIA_MUSIC, i);
+  case SOURCE_M3U: {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File f = SD.open(source);
+    if (!f)
+      return String();
+    String line;
+    if (f.seek(lineOffs[i]))
+      line = f.readStringUntil('\n');
+    f.close();
+    line.trim();
+    if (line.length() == 0)
+      return String();
+    line.replace("\\", "/");
+    // relative paths resolve against the playlist's folder
+    return line.startsWith("/") ? line : joinPath(parentDir(source), line);
+  }
+  default:
+    return String();
+  }
+}
+
+uint32_t Playlist::permute(uint32_t cycle, uint32_t x, bool inverse) const {
+  // each cycle gets its own order
+  uint32_t key = shuffleMix(seed ^ (cycle * 0x9E3779B9UL));
+  return shufflePermute(count, key, x, inverse);
+}
+
+int Playlist::trackAt(uint32_t step) const {
+  uint32_t n = count;
+  return (int)permute(step / n, (start + step % n) % n, false);
+}
+
+// shuffle counter `offset` steps away, -1 outside the current cycle
+// unless repeating all
+int64_t Playlist::stepAt(int offset) const {
+  int64_t n = count;
+  int64_t k = (int64_t)counter + offset;
+  if (repeatMode != RepeatMode::REPEAT_ALL) {
+    int64_t base = counter / n * n;
+    if (k < base || k >= base + n)
+      return -1;
+  }
+  return k < 0 ? -1 : k;
+}
+
+int Playlist::indexAt(int offset) const {
+  int n = count;
+  if (cur < 0 || n == 0)
+    return -1;
+  if (shuffled) {
+    int64_t k = stepAt(offset);
+    return k < 0 ? -1 : trackAt((uint32_t)k);
+  }
+  int i = cur + offset;
+  if (repeatMode == RepeatMode::REPEAT_ALL)
+    i = ((i % n) + n) % n;
+  if (i < 0 || i >= n)
+    return -1;
+  return i;
+}
+
+int Playlist::nextIndex() const {
+  if (cur >= 0 && repeatMode == RepeatMode::REPEAT_ONE)
+    return cur;
+  return indexAt(1);
+}
+
+void Playlist::move(int offset) {
+  int i = indexAt(offset);
+  if (i < 0)
+    return;
+  if (shuffled) {
+    counter = (uint32_t)stepAt(offset);
+    saveShuffle();
+  }
+  cur = i;
+}
+
+void Playlist::advance() {
+  if (repeatMode != RepeatMode::REPEAT_ONE)
+    move(1);
+}
+
+void Playlist::setShuffle(bool on) {
+  if (on == shuffled)
+    return;
+  shuffled = on;
+  // the current track stays; the order from here on changes
+  if (on && cur >= 0)
+    newCycleAt(cur);
+}
+
+// fresh order whose first step is entry i
+void Playlist::newCycleAt(int i) {
+  seed = esp_random();
+  counter = 0;
+  start = permute(0, (uint32_t)i, true);
+  saveShuffle();
+}
+
+// After a rebuild: continue the saved order if it is for this list and
+// still at the same track (e.g. resumed after deep sleep)
+void Playlist::restoreShuffle() {
+  listId = listHash(source, count);
+  if (!shuffled)
+    return;
+  if (rtc_shuffle.magic == SHUFFLE_MAGIC && rtc_shuffle.listId == listId) {
+    seed = rtc_shuffle.seed;
+    start = rtc_shuffle.start;
+    counter = rtc_shuffle.counter;
+    if (start < (uint32_t)count && trackAt(counter) == cur)
+      return;
+  }
+  newCycleAt(cur);
+}
+
+void Playlist::saveShuffle() const {
+  rtc_shuffle.magic = SHUFFLE_MAGIC;
+  rtc_shuffle.listId = listId;
+  rtc_shuffle.seed = seed;
+  rtc_shuffle.start = start;
+  rtc_shuffle.counter = counter;
+}
@@ -0,0 +1,95 @@
+// Track list for the music player: a folder, the whole library or an .m3u
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+// true for .m3u/.m3u8
+bool isPlaylistFile(const String &path);
+
+// source name of the library playlist (every music file in the index)
+extern const char *const LIBRARY_PLAYLIST;
+
+enum class RepeatMode : uint8_t { REPEAT_OFF = 0, REPEAT_ALL, REPEAT_ONE };
+
+// No paths are held in RAM. Folder and library lists are media index
+// entries (2 bytes per track for a folder, nothing for the library), .m3u
+// lists are byte offsets of their lines (4 bytes per track); pathAt()
+// reads the path back from the card when a track is opened.
+class Playlist {
+public:
+  // every music file in the folder of trackPath, sorted by name; the
+  // current entry is trackPath itself. Until the media index knows the
+  // folder, trackPath plays alone.
+  bool buildFromFolder(const String &trackPath);
+  // every music file in the media index, in index order, starting at
+  // entry `index`
+  bool buildFromLibrary(int index);
+  // entries of an .m3u/.m3u8; relative paths resolve against its folder
+  bool buildFromM3u(const String &m3uPath);
+  void clear();
+
+  int size() const { return count; }
+  int index() const { return cur; }
+  // jump to an entry; in shuffle mode a new cycle starts there unless it
+  // is the current one
+  void setIndex(int i);
+  String pathAt(int i);
+
+  // Play order. Shuffle keeps no permutation array: the n-th track of a
+  // cycle is a seeded bijection of n (see permute()), so every entry plays
+  // once per cycle and the whole state is a seed, a start offset and a
+  // counter. That state is kept in RTC memory and picked up again when
+  // the same list is rebuilt after deep sleep. Repeat all starts a new
+  // cycle (with a new order) at the end; repeat one only affects what
+  // follows a track that played to its end.
+  void setShuffle(bool on);
+  bool shuffle() const { return shuffled; }
+  void setRepeat(RepeatMode m) { repeatMode = m; }
+  RepeatMode repeat() const { return repeatMode; }
+
+  // index `offset` entries away from the current one in play order (a
+  // user step), -1 past either end unless repeating
+  int indexAt(int offset) const;
+  // what plays when the current track ends, -1 for none
+  int nextIndex() const;
+  // make indexAt(offset) the current entry
+  void move(int offset);
+  // the current track ended and nextIndex() follows
+  void advance();
+
+private:
+  enum Source : uint8_t {
+    SOURCE_NONE = 0,
+    SOURCE_SINGLE, // `source` is the track itself
+    SOURCE_FOLDER, // media index entries first + order[i]; `source` is the dir
+    SOURCE_LIBRARY, // media index entry i
+    SOURCE_M3U,    // line at lineOffs[i] of the .m3u `source`
+  };
+  Source kind = SOURCE_NONE;
+  String source;
+  int count = 0;
+  int first = 0;
+  std::vector<uint16_t> order;
+  std::vector<uint32_t> lineOffs;
+  // media index generation the entry numbers belong to
+  uint32_t indexGen = 0;
+  int cur = -1;
+  bool shuffled = false;
+  RepeatMode repeatMode = RepeatMode::REPEAT_OFF;
+  // shuffle state: track of step k is permute(seed of cycle k / n,
+  // (start + k % n) % n)
+  uint32_t listId = 0; // which list the state belongs to
+  uint32_t seed = 0;
+  uint32_t start = 0;
+  uint32_t counter = 0;
+
+  bool loadFolder(const String &name = String());
+  void revalidate();
+  uint32_t permute(uint32_t cycle, uint32_t x, bool inverse) const;
+  int trackAt(uint32_t step) const;
+  int64_t stepAt(int offset) const;
+  void newCycleAt(int i);
+  void restoreShuffle();
+  void saveShuffle() const;
+};
@@ -0,0 +1,356 @@
+#include "read_ahead_stream.h"
+#include "../spi_bus.h"
+#include <SD.h>
+
+// above the decode task so a consumed block is refilled right away
+static const UBaseType_t FILL_PRIORITY = 5;
+// longest a decoder read waits for the filler before returning short
+static const TickType_t READ_WAIT = pdMS_TO_TICKS(20);
+
+static void fillTaskEntry(void *arg) {
+  ((ReadAheadStream *)arg)->fillLoop();
+}
+
+ReadAheadStream::ReadAheadStream(const char *name) : taskName(name) {
+  for (int i = 0; i < BLOCK_COUNT; ++i)
+    blocks[i] = {nullptr, 0, 0, 0};
+}
+
+bool ReadAheadStream::begin() {
+  if (fillTask)
+    return true;
+  for (int i = 0; i < BLOCK_COUNT; ++i) {
+    if (!blocks[i].data)
+      blocks[i].data = (uint8_t *)malloc(BLOCK_SIZE);
+    if (!blocks[i].data) {
+      Serial.println("ReadAheadStream: out of memory for blocks");
+      end();
+      return false;
+    }
+  }
+  if (!ioMutex)
+    ioMutex = xSemaphoreCreateMutex();
+  if (!dataReady)
+    dataReady = xSemaphoreCreateBinary();
+  stopping = false;
+  if (!ioMutex || !dataReady ||
+      xTaskCreate(fillTaskEntry, taskName, 3072, this, FILL_PRIORITY,
+                  &fillTask) != pdPASS) {
+    Serial.println("ReadAheadStream: failed to start filler task");
+    fillTask = NULL;
+    end();
+    return false;
+  }
+  return true;
+}
+
+void ReadAheadStream::end() {
+  if (fillTask) {
+    stopping = true;
+    xTaskNotifyGive(fillTask);
+    for (int i = 0; i < 100 && fillTask; ++i)
+      vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  if (ioMutex)
+    close();
+  for (int i = 0; i < BLOCK_COUNT; ++i) {
+    free(blocks[i].data);
+    blocks[i] = {nullptr, 0, 0, 0};
+  }
+  if (ioMutex) {
+    vSemaphoreDelete(ioMutex);
+    ioMutex = NULL;
+  }
+  if (dataReady) {
+    vSemaphoreDelete(dataReady);
+    dataReady = NULL;
+  }
+}
+
+// Reader side; caller holds ioMutex
+void ReadAheadStream::resetBlocks(uint32_t pos) {
+  uint32_t aligned = pos - pos % BLOCK_SIZE;
+  portENTER_CRITICAL(&mux);
+  gen++;
+  head = 0;
+  tail = 0;
+  ready = 0;
+  fillOff = aligned;
+  fillSize = fileSize;
+  fillSeg = readSeg;
+  readOff = pos;
+  readPos = pos - aligned;
+  startOff = pos;
+  portEXIT_CRITICAL(&mux);
+  // drop a stale "data ready" from before the reset
+  xSemaphoreTake(dataReady, 0);
+  if (fillTask)
+    xTaskNotifyGive(fillTask);
+}
+
+bool ReadAheadStream::open(const char *path) {
+  if (!ioMutex || !path)
+    return false;
+  xSemaphoreTake(ioMutex, portMAX_DELAY);
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    if (file)
+      file.close();
+    if (nextFile)
+      nextFile.close();
+    file = SD.open(path);
+  }
+  nextQueued = false;
+  opened = (bool)file;
+  fileSize = opened ? file.size() : 0;
+  curPath = path;
+  resetBlocks(0);
+  xSemaphoreGive(ioMutex);
+  return opened;
+}
+
+void ReadAheadStream::close() {
+  if (!ioMutex)
+    return;
+  xSemaphoreTake(ioMutex, portMAX_DELAY);
+  if (file || nextFile) {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    if (file)
+      file.close();
+    if (nextFile)
+      nextFile.close();
+  }
+  nextQueued = false;
+  opened = false;
+  fileSize = 0;
+  resetBlocks(0);
+  xSemaphoreGive(ioMutex);
+}
+
+bool ReadAheadStream::seek(uint32_t pos) {
+  if (!opened || pos > fileSize)
+    return false;
+  xSemaphoreTake(ioMutex, portMAX_DELAY);
+  bool ok = true;
+  if (fillSeg != readSeg) {
+    // the filler already moved on to the queued file: reopen ours and put
+    // the follow-up back in the queue
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    file.close();
+    file = SD.open(curPath);
+    ok = (bool)file;
+    if (ok && !nextQueued) {
+      nextFile = SD.open(nextPath);
+      nextQueued = (bool)nextFile;
+    }
+  }
+  if (ok)
+    resetBlocks(pos);
+  else
+    opened = false;
+  xSemaphoreGive(ioMutex);
+  return ok;
+}
+
+bool ReadAheadStream::queueNext(const char *path) {
+  if (!opened || !path)
+    return false;
+  xSemaphoreTake(ioMutex, portMAX_DELAY);
+  bool ok = false;
+  if (!nextQueued && fillSeg == readSeg) {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    nextFile = SD.open(path);
+    if (nextFile) {
+      nextSize = nextFile.size();
+      nextPath = path;
+      nextQueued = true;
+      ok = true;
+    }
+  }
+  xSemaphoreGive(ioMutex);
+  if (ok && fillTask)
+    xTaskNotifyGive(fillTask);
+  return ok;
+}
+
+bool ReadAheadStream::advance() {
+  if (!opened)
+    return false;
+  xSemaphoreTake(ioMutex, portMAX_DELAY);
+  bool ok = false;
+  portENTER_CRITICAL(&mux);
+  if (readOff >= fileSize && fillSeg == (uint8_t)(readSeg + 1)) {
+    readSeg = fillSeg;
+    fileSize = fillSize;
+    readOff = 0;
+    readPos = 0;
+    startOff = 0;
+    ok = true;
+  }
+  portEXIT_CRITICAL(&mux);
+  if (ok)
+    curPath = nextPath;
+  xSemaphoreGive(ioMutex);
+  return ok;
+}
+
+uint32_t ReadAheadStream::buffered() {
+  uint32_t total = 0;
+  portENTER_CRITICAL(&mux);
+  for (int i = 0; i < ready; ++i)
+    total += blocks[(head + i) % BLOCK_COUNT].len;
+  total = total > readPos ? total - readPos : 0;
+  portEXIT_CRITICAL(&mux);
+  return total;
+}
+
+void ReadAheadStream::resetStats() {
+  stallCount = 0;
+  slowestReadMs = 0;
+}
+
+int ReadAheadStream::available() {
+  if (!opened || readOff >= fileSize)
+    return 0;
+  return (int)(fileSize - readOff);
+}
+
+size_t ReadAheadStream::readBytes(uint8_t *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    portENTER_CRITICAL(&mux);
+    int avail = ready;
+    portEXIT_CRITICAL(&mux);
+    // blocks of a chained file wait for advance()
+    if (avail > 0 && blocks[head].seg != readSeg)
+      break;
+    if (avail == 0) {
+      if (!opened || readOff >= fileSize || done > 0)
+        break;
+      // only a miss after data started flowing is a stall; the first block
+      // after open/seek is always on its way
+      if (readOff != startOff)
+        stallCount = stallCount + 1;
+      if (xSemaphoreTake(dataReady, READ_WAIT) != pdTRUE)
+        break;
+      continue;
+    }
+    Block &b = blocks[head];
+    size_t n = b.len > readPos ? b.len - readPos : 0;
+    if (n > len - done)
+      n = len - done;
+    memcpy(buf + done, b.data + readPos, n);
+    done += n;
+    readPos += n;
+    readOff += n;
+    if (readPos >= b.len) {
+      portENTER_CRITICAL(&mux);
+      head = (head + 1) % BLOCK_COUNT;
+      ready--;
+      portEXIT_CRITICAL(&mux);
+      readPos = 0;
+      if (fillTask)
+        xTaskNotifyGive(fillTask);
+    }
+  }
+  return done;
+}
+
+int ReadAheadStream::read() {
+  uint8_t c;
+  return readBytes(&c, 1) == 1 ? c : -1;
+}
+
+int ReadAheadStream::peek() {
+  portENTER_CRITICAL(&mux);
+  int avail = ready;
+  portEXIT_CRITICAL(&mux);
+  if (avail == 0 || blocks[head].seg != readSeg ||
+      readPos >= blocks[head].len)
+    return -1;
+  return blocks[head].data[readPos];
+}
+
+void ReadAheadStream::fillLoop() {
+  while (!stopping) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    while (!stopping) {
+      portENTER_CRITICAL(&mux);
+      bool room = opened && ready < BLOCK_COUNT;
+      int idx = tail;
+      uint32_t off = fillOff;
+      uint32_t size = fillSize;
+      uint8_t seg = fillSeg;
+      uint32_t g = gen;
+      portEXIT_CRITICAL(&mux);
+      if (!room)
+        break;
+      if (off >= size) {
+        // current file fully buffered: chain into the queued one
+        if (!nextQueued)
+          break;
+        xSemaphoreTake(ioMutex, portMAX_DELAY);
+        if (opened && nextQueued && g == gen && seg == readSeg) {
+          SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+          file.close();
+          file = nextFile;
+          nextFile = File();
+          nextQueued = false;
+          portENTER_CRITICAL(&mux);
+          fillSize = nextSize;
+          fillOff = 0;
+          fillSeg = seg + 1;
+          portEXIT_CRITICAL(&mux);
+        }
+        xSemaphoreGive(ioMutex);
+        continue;
+      }
+      uint32_t want = size - off;
+      if (want > BLOCK_SIZE)
+        want = BLOCK_SIZE;
+
+      bool stale = false;
+      uint32_t n = 0;
+      unsigned long t0 = millis();
+      if (injectedDelayMs)
+        vTaskDelay(pdMS_TO_TICKS(injectedDelayMs));
+      xSemaphoreTake(ioMutex, portMAX_DELAY);
+      if (!opened || g != gen || seg != fillSeg) {
+        stale = true; // reopened/seeked while we waited for the file
+      } else {
+        SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+        if (file.position() != off)
+          file.seek(off);
+        n = file.read(blocks[idx].data, want);
+      }
+      xSemaphoreGive(ioMutex);
+      if (stale)
+        continue;
+      uint32_t dt = millis() - t0;
+      if (dt > slowestReadMs)
+        slowestReadMs = dt;
+      if (n == 0) {
+        // read error: back off instead of spinning on the bus
+        vTaskDelay(pdMS_TO_TICKS(20));
+        break;
+      }
+
+      bool published = false;
+      portENTER_CRITICAL(&mux);
+      if (g == gen && seg == fillSeg) {
+        blocks[idx].off = off;
+        blocks[idx].len = n;
+        blocks[idx].seg = seg;
+        tail = (tail + 1) % BLOCK_COUNT;
+        fillOff = off + n;
+        ready++;
+        published = true;
+      }
+      portEXIT_CRITICAL(&mux);
+      if (published)
+        xSemaphoreGive(dataReady);
+    }
+  }
+  fillTask = NULL;
+  vTaskDelete(NULL);
+}
@@ -0,0 +1,109 @@
+// Read-ahead wrapper around an SD file for the audio decoder
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// A filler task reads the file in large, block-aligned chunks into a small
+// set of RAM blocks (triple buffered); the decoder only ever reads from RAM.
+// Aligned multi-sector reads bypass the FAT sector cache and take the bus
+// once per block instead of once per decoder read, so the decoder rides out
+// SD latency spikes (other page traffic, slow cards) of several hundred ms
+// at typical MP3 bitrates.
+class ReadAheadStream : public Stream {
+public:
+  static const size_t BLOCK_SIZE = 8192;
+  static const int BLOCK_COUNT = 3;
+
+  explicit ReadAheadStream(const char *taskName = "audio_sd");
+  // allocate the blocks and start the filler task
+  bool begin();
+  // stop the filler and free the blocks (closes the file)
+  void end();
+
+  bool open(const char *path);
+  void close();
+  bool isOpen() const { return opened; }
+  // drop buffered data and continue reading at pos
+  bool seek(uint32_t pos);
+
+  // Gapless chaining: once the current file is fully buffered the filler
+  // carries on with the queued file, so its head is already in RAM when the
+  // reader reaches the end. advance() then switches the reader over without
+  // touching the card. Only one file can be queued at a time.
+  bool queueNext(const char *path);
+  bool hasQueued() const { return nextQueued; }
+  bool advance();
+  // reader consumed the whole current file
+  bool atEnd() const { return opened && readOff >= fileSize; }
+  uint32_t size() const { return fileSize; }
+  uint32_t position() const { return readOff; }
+  // bytes prefetched and not yet consumed
+  uint32_t buffered();
+
+  // reads that found no data ready, and the slowest single block read
+  uint32_t stalls() const { return stallCount; }
+  uint32_t maxReadMs() const { return slowestReadMs; }
+  void resetStats();
+  // test harness: stall every block read this long (simulated slow card)
+  void setInjectedDelay(uint16_t ms) { injectedDelayMs = ms; }
+
+  // Stream
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t readBytes(uint8_t *buf, size_t len) override;
+  size_t write(uint8_t) override { return 0; }
+
+  // filler task body
+  void fillLoop();
+
+private:
+  struct Block {
+    uint8_t *data;
+    uint32_t off; // file offset of data[0]
+    uint32_t len;
+    uint8_t seg;  // which chained file the data belongs to
+  };
+  const char *taskName;
+  Block blocks[BLOCK_COUNT];
+  File file;             // file being filled (owned by ioMutex)
+  bool opened = false;
+  uint32_t fileSize = 0; // size of the file being read
+  String curPath;        // reopened if a seek has to undo a chain switch
+  // queued follow-up file (owned by ioMutex)
+  File nextFile;
+  String nextPath;
+  uint32_t nextSize = 0;
+  volatile bool nextQueued = false;
+
+  // reader side (decode task)
+  int head = 0;          // next block to consume
+  uint32_t readPos = 0;  // offset inside the head block
+  uint32_t readOff = 0;  // logical file position
+  uint32_t startOff = 0; // position of the last open/seek
+  uint8_t readSeg = 0;
+  // filler side
+  int tail = 0;          // next block to fill
+  uint32_t fillOff = 0;  // next file offset to read
+  uint32_t fillSize = 0; // size of the file being filled
+  uint8_t fillSeg = 0;   // readSeg, or readSeg + 1 once chained
+  // shared, guarded by mux
+  int ready = 0;         // blocks filled and not consumed
+  uint32_t gen = 0;      // bumped on open/seek/close to drop in-flight reads
+
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  SemaphoreHandle_t ioMutex = NULL;   // owns `file`
+  SemaphoreHandle_t dataReady = NULL; // given when a block is published
+  TaskHandle_t fillTask = NULL;
+  volatile bool stopping = false;
+
+  volatile uint32_t stallCount = 0;
+  volatile uint32_t slowestReadMs = 0;
+  uint16_t injectedDelayMs = 0;
+
+  void resetBlocks(uint32_t pos);
+};
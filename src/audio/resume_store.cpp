@@ -0,0 +1,191 @@
+#include "resume_store.h"
+#include "../utils/hash.h"
+#include <Preferences.h>
+
+ResumeStore gResume;
+
+static const char *PREF_NS = "resume";
+// RTC working set; the least recently touched slot is reused
+static const int SLOT_COUNT = 8;
+static const uint32_t RTC_MAGIC = 0x52534D31; // "RSM1"
+// NVS keeps at most this many positions, one blob per record ("s0".."s31");
+// flush() overwrites the least recently written one when they are all taken
+static const int NVS_RECORDS = 32;
+
+struct ResumeSlot {
+  uint32_t hash; // 0 = unused
+  uint32_t ms;   // 0 = forget
+  uint32_t used; // LRU stamp
+  uint8_t dirty;
+};
+
+RTC_DATA_ATTR static uint32_t rtc_resume_magic = 0;
+RTC_DATA_ATTR static uint32_t rtc_resume_clock = 0;
+RTC_DATA_ATTR static ResumeSlot rtc_resume_slots[SLOT_COUNT];
+
+struct ResumeRecord {
+  uint32_t hash; // 0 = unused
+  uint32_t ms;
+  uint32_t used; // LRU stamp, bumped on every write
+};
+
+// RAM mirror of the NVS records, read once per boot
+static ResumeRecord s_records[NVS_RECORDS];
+static uint32_t s_recordClock = 0;
+static bool s_recordsLoaded = false;
+
+static uint32_t pathHash(const String &path) {
+  uint32_t h = fnv1a(path);
+  return h ? h : 1;
+}
+
+static String recordKey(int i) {
+  char k[8];
+  snprintf(k, sizeof(k), "s%d", i);
+  return String(k);
+}
+
+static void loadRecords(Preferences &prefs) {
+  if (s_recordsLoaded)
+    return;
+  memset(s_records, 0, sizeof(s_records));
+  s_recordClock = 0;
+  for (int i = 0; i < NVS_RECORDS; ++i) {
+    String k = recordKey(i);
+    if (!prefs.isKey(k.c_str()) ||
+        prefs.getBytes(k.c_str(), &s_records[i], sizeof(ResumeRecord)) !=
+            sizeof(ResumeRecord))
+      memset(&s_records[i], 0, sizeof(ResumeRecord));
+    if (s_records[i].used > s_recordClock)
+      s_recordClock = s_records[i].used;
+  }
+  s_recordsLoaded = true;
+}
+
+static int findRecord(uint32_t h) {
+  for (int i = 0; i < NVS_RECORDS; ++i)
+    if (s_records[i].hash == h)
+      return i;
+  return -1;
+}
+
+// a free record, else the least recently written one
+static int victimRecord() {
+  int v = 0;
+  for (int i = 0; i < NVS_RECORDS; ++i) {
+    if (s_records[i].hash == 0)
+      return i;
+    if (s_records[i].used < s_records[v].used)
+      v = i;
+  }
+  return v;
+}
+
+// RTC memory is garbage after a cold boot
+static void ensureSlots() {
+  if (rtc_resume_magic == RTC_MAGIC)
+    return;
+  memset(rtc_resume_slots, 0, sizeof(rtc_resume_slots));
+  rtc_resume_clock = 0;
+  rtc_resume_magic = RTC_MAGIC;
+}
+
+static ResumeSlot *findSlot(uint32_t h) {
+  for (int i = 0; i < SLOT_COUNT; ++i)
+    if (rtc_resume_slots[i].hash == h)
+      return &rtc_resume_slots[i];
+  return nullptr;
+}
+
+static ResumeSlot *takeSlot(uint32_t h) {
+  ResumeSlot *s = findSlot(h);
+  if (!s) {
+    // evict the oldest; write it out first if it still holds a change
+    s = &rtc_resume_slots[0];
+    for (int i = 1; i < SLOT_COUNT; ++i)
+      if (rtc_resume_slots[i].used < s->used)
+        s = &rtc_resume_slots[i];
+    if (s->hash && s->dirty)
+      gResume.flush();
+    s->hash = h;
+    s->dirty = 0;
+  }
+  s->used = ++rtc_resume_clock;
+  return s;
+}
+
+uint32_t ResumeStore::lookup(const String &path) {
+  ensureSlots();
+  uint32_t h = pathHash(path);
+  ResumeSlot *s = findSlot(h);
+  if (s)
+    return s->ms;
+  if (!s_recordsLoaded) {
+    Preferences prefs;
+    prefs.begin(PREF_NS, true);
+    loadRecords(prefs);
+    prefs.end();
+  }
+  int r = findRecord(h);
+  uint32_t ms = r >= 0 ? s_records[r].ms : 0;
+  if (ms) {
+    s = takeSlot(h);
+    s->ms = ms;
+  }
+  return ms;
+}
+
+void ResumeStore::remember(const String &path, uint32_t ms) {
+  ensureSlots();
+  ResumeSlot *s = takeSlot(pathHash(path));
+  if (s->ms != ms) {
+    s->ms = ms;
+    s->dirty = 1;
+  }
+}
+
+void ResumeStore::forget(const String &path) {
+  ensureSlots();
+  uint32_t h = pathHash(path);
+  ResumeSlot *s = findSlot(h);
+  // not in RTC: it may still be in flash from an earlier boot
+  bool known = s != nullptr;
+  s = takeSlot(h);
+  if (!known || s->ms != 0) {
+    s->ms = 0;
+    s->dirty = 1;
+  }
+}
+
+void ResumeStore::flush() {
+  ensureSlots();
+  bool any = false;
+  for (int i = 0; i < SLOT_COUNT; ++i)
+    any = any || rtc_resume_slots[i].dirty;
+  if (!any)
+    return;
+  Preferences prefs;
+  prefs.begin(PREF_NS, false);
+  loadRecords(prefs);
+  for (int i = 0; i < SLOT_COUNT; ++i) {
+    ResumeSlot &s = rtc_resume_slots[i];
+    if (!s.dirty)
+      continue;
+    s.dirty = 0;
+    int r = findRecord(s.hash);
+    if (s.ms == 0) {
+      if (r >= 0) {
+        prefs.remove(recordKey(r).c_str());
+        memset(&s_records[r], 0, sizeof(ResumeRecord));
+      }
+      continue;
+    }
+    if (r < 0)
+      r = victimRecord();
+    s_records[r].hash = s.hash;
+    s_records[r].ms = s.ms;
+    s_records[r].used = ++s_recordClock;
+    prefs.putBytes(recordKey(r).c_str(), &s_records[r], sizeof(ResumeRecord));
+  }
+  prefs.end();
+}
@@ -0,0 +1,23 @@
+// Per-track resume positions for long recordings
+#pragma once
+
+#include <Arduino.h>
+
+// Positions are noted in RTC memory (survives deep sleep, costs nothing to
+// update) and written to NVS namespace "resume" only on flush(), which the
+// audio engine calls on pause/stop/track change and at most once a minute
+// while playing. Entries are keyed by a hash of the path, so renaming a file
+// forgets its position. NVS holds a fixed number of records; the least
+// recently written one is overwritten once they are all in use.
+class ResumeStore {
+public:
+  // position in ms, 0 if none is stored
+  uint32_t lookup(const String &path);
+  void remember(const String &path, uint32_t ms);
+  // finished (or rewound to the start): drop the entry
+  void forget(const String &path);
+  // write changed entries to flash
+  void flush();
+};
+
+extern ResumeStore gResume;
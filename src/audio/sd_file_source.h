@@ -0,0 +1,81 @@
+// AudioSource backed by files on the SD card
+#pragma once
+
+#include "AudioTools.h"
+#include "playlist.h"
+#include "read_ahead_stream.h"
+
+// Minimal AudioSource implementation that uses Arduino SD to open files by path.
+// This keeps memory small and avoids depending on std::filesystem.
+// The decoder reads through a ReadAheadStream, never from the File itself.
+// Index based selection walks the attached playlist; the following track is
+// always queued on the read-ahead so a forward step is gapless.
+namespace audio_tools {
+class SDFileAudioSource : public AudioSource {
+ public:
+  SDFileAudioSource() {}
+  bool begin() override { return stream.begin(); }
+  void setPlaylist(Playlist* p) { playlist = p; }
+  Stream* nextStream(int offset) override {
+    if (playlist == nullptr) return nullptr;
+    // a track that ended is followed by nextIndex() (repeat one: itself),
+    // a user step goes by the play order. The queued file is taken when
+    // it is that target, i.e. unless the order changed since queueing.
+    bool follow = offset == 1 && !manualStep;
+    int target = follow ? playlist->nextIndex() : playlist->indexAt(offset);
+    if (target < 0) return nullptr;
+    if (target == queuedIndex && stream.advance()) {
+      commitStep(follow, offset);
+      last_path = playlist->pathAt(target);
+      queueFollowing();
+      return &stream;
+    }
+    String p = playlist->pathAt(target);
+    if (!stream.open(p.c_str())) return nullptr;
+    commitStep(follow, offset);
+    last_path = p;
+    queueFollowing();
+    return &stream;
+  }
+  Stream* selectStream(int index) override { return openIndex(index); }
+  Stream* selectStream(const char* path) override {
+    if (path == nullptr) return nullptr;
+    // closes any previously opened file
+    if (!stream.open(path)) return nullptr;
+    last_path = String(path);
+    queuedIndex = -1;
+    return &stream;
+  }
+  int index() override { return playlist ? playlist->index() : -1; }
+  const char* toStr() override { return last_path.c_str(); }
+  ReadAheadStream& readAhead() { return stream; }
+  // set around player next()/previous() calls made for the user
+  void setManualStep(bool manual) { manualStep = manual; }
+ protected:
+  ReadAheadStream stream;
+  String last_path;
+  Playlist* playlist = nullptr;
+  int queuedIndex = -1;
+  bool manualStep = false;
+
+  void commitStep(bool follow, int offset) {
+    if (follow) playlist->advance();
+    else playlist->move(offset);
+  }
+
+  Stream* openIndex(int i) {
+    if (playlist == nullptr || i < 0 || i >= playlist->size()) return nullptr;
+    String p = playlist->pathAt(i);
+    if (!stream.open(p.c_str())) return nullptr;
+    playlist->setIndex(i);
+    last_path = p;
+    queueFollowing();
+    return &stream;
+  }
+  void queueFollowing() {
+    int n = playlist->nextIndex();
+    queuedIndex = -1;
+    if (n >= 0 && stream.queueNext(playlist->pathAt(n).c_str())) queuedIndex = n;
+  }
+};
+}
@@ -0,0 +1,38 @@
+#include "shuffle.h"
+
+static const int FEISTEL_ROUNDS = 4;
+
+uint32_t shuffleMix(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7FEB352DUL;
+  x ^= x >> 15;
+  x *= 0x846CA68BUL;
+  x ^= x >> 16;
+  return x;
+}
+
+uint32_t shufflePermute(uint32_t n, uint32_t key, uint32_t x, bool inverse) {
+  if (n <= 1)
+    return 0;
+  int h = 1;
+  while ((1UL << (2 * h)) < n)
+    h++;
+  uint32_t mask = (1UL << h) - 1;
+  do {
+    uint32_t l = x >> h, r = x & mask;
+    for (int k = 0; k < FEISTEL_ROUNDS; ++k) {
+      if (!inverse) {
+        uint32_t t = l ^ (shuffleMix(r ^ (key + k)) & mask);
+        l = r;
+        r = t;
+      } else {
+        uint32_t t =
+            r ^ (shuffleMix(l ^ (key + FEISTEL_ROUNDS - 1 - k)) & mask);
+        r = l;
+        l = t;
+      }
+    }
+    x = (l << h) | r;
+  } while (x >= n);
+  return x;
+}
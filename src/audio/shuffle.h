@@ -0,0 +1,13 @@
+// Seeded permutations for the playlist's shuffle order
+#pragma once
+
+#include <stdint.h>
+
+// 32-bit integer hash (murmur3-style finalizer)
+uint32_t shuffleMix(uint32_t x);
+
+// Bijection on 0..n-1 selected by `key`: a balanced Feistel network over
+// the smallest 2h-bit domain that holds n, with cycle walking (re-applying
+// until the result is below n). The domain is under 4n, so a lookup takes
+// a few rounds on average and no memory. `inverse` undoes it.
+uint32_t shufflePermute(uint32_t n, uint32_t key, uint32_t x, bool inverse);
@@ -0,0 +1,62 @@
+#include "debug_console.h"
+
+struct DebugCommand {
+  const char *name;
+  const char *help;
+  DebugCommandFn fn;
+};
+
+static const int MAX_COMMANDS = 16;
+static DebugCommand s_commands[MAX_COMMANDS];
+static int s_commandCount = 0;
+// partial input line; commands are short, cap to avoid unbounded growth
+static String s_line;
+static const unsigned MAX_LINE = 96;
+
+void debugConsoleRegister(const char *name, const char *help,
+                          DebugCommandFn fn) {
+  if (s_commandCount >= MAX_COMMANDS || !name || !fn)
+    return;
+  s_commands[s_commandCount++] = {name, help, fn};
+}
+
+static void dispatch(String line) {
+  line.trim();
+  if (line.length() == 0)
+    return;
+  int sp = line.indexOf(' ');
+  String cmd = (sp < 0) ? line : line.substring(0, sp);
+  String args = (sp < 0) ? String() : line.substring(sp + 1);
+  args.trim();
+  if (cmd == "help") {
+    for (int i = 0; i < s_commandCount; ++i)
+      Serial.println(String(s_commands[i].name) + " - " +
+                     String(s_commands[i].help ? s_commands[i].help : ""));
+    return;
+  }
+  for (int i = 0; i < s_commandCount; ++i) {
+    if (cmd == s_commands[i].name) {
+      s_commands[i].fn(args);
+      return;
+    }
+  }
+  Serial.println("Unknown command: " + cmd + " (try help)");
+}
+
+void debugConsolePoll() {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c < 0)
+      break;
+    if (c == '\r' || c == '\n') {
+      if (s_line.length() > 0) {
+        String line = s_line;
+        s_line = "";
+        dispatch(line);
+      }
+      continue;
+    }
+    if (s_line.length() < MAX_LINE)
+      s_line += (char)c;
+  }
+}
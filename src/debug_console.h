@@ -0,0 +1,14 @@
+// Line-based serial debug commands
+#pragma once
+
+#include <Arduino.h>
+
+// handler receives everything after the command word (trimmed)
+typedef void (*DebugCommandFn)(const String &args);
+
+// Register a command; `help` is printed by the built-in "help" command.
+void debugConsoleRegister(const char *name, const char *help,
+                          DebugCommandFn fn);
+
+// Poll Serial for a complete line and dispatch it (call from loop()).
+void debugConsolePoll();
@@ -0,0 +1,46 @@
+// E-paper display type with SPI bus arbitration
+#pragma once
+
+#include "spi_bus.h"
+#include <GxEPD2_BW.h>
+
+using EpdBase = GxEPD2_BW<GxEPD2_213_B72, GxEPD2_213_B72::HEIGHT>;
+
+// Drop-in replacement for the GxEPD2 display object: every call that talks
+// to the panel takes the shared SPI bus. Drawing between firstPage() and
+// nextPage() only touches the RAM buffer and needs no lock. While the panel
+// is busy refreshing (up to ~2 s for a full refresh) the bus is lent to
+// waiting SD clients through the driver's busy callback.
+class EpdDisplay : public EpdBase {
+public:
+  explicit EpdDisplay(GxEPD2_213_B72 epd) : EpdBase(epd) {}
+
+  void init(uint32_t serial_diag_bitrate = 0, bool initial = true,
+            uint16_t reset_duration = 10, bool pulldown_rst_mode = false) {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_DISPLAY);
+    EpdBase::init(serial_diag_bitrate, initial, reset_duration,
+                  pulldown_rst_mode);
+    epd2.setBusyCallback(busyCallback);
+  }
+  bool nextPage() {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_DISPLAY);
+    return EpdBase::nextPage();
+  }
+  void clearScreen(uint8_t value = 0xFF) {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_DISPLAY);
+    EpdBase::clearScreen(value);
+  }
+  void hibernate() {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_DISPLAY);
+    EpdBase::hibernate();
+  }
+  void powerOff() {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_DISPLAY);
+    EpdBase::powerOff();
+  }
+
+private:
+  static void busyCallback(const void *) {
+    spiBusYield(SpiClient::SPI_CLIENT_DISPLAY);
+  }
+};
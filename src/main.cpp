@@ -17,12 +17,18 @@
 #include <time.h>
 #include <sys/time.h>
 #include <Preferences.h>
-GxEPD2_BW<GxEPD2_213_B72, GxEPD2_213_B72::HEIGHT>
+#include "epd_display.h"
+#include "spi_bus.h"
+EpdDisplay
     display(GxEPD2_213_B72(EPD_CS_PIN, EPD_DC_PIN, EPD_RST_PIN, EPD_BUSY_PIN));
 
 // Audio objects are managed by MusicPage to avoid global init in main
 U8G2_FOR_ADAFRUIT_GFX u8g2Fonts;
+#include "alarms/console.h"
+#include "alarms/scheduler.h"
+#include "alarms/wake.h"
 #include "app_context.h"
+#include "pages/alarm_ring_page.h"
 #include "pages/alarms_page.h"
 #include "pages/calendar_page.h"
 #include "pages/files_page.h"
@@ -34,16 +40,27 @@ U8G2_FOR_ADAFRUIT_GFX u8g2Fonts;
 #include "utils/lunar.h"
 #include "utils/utils.h"
 #include "battery.h"
+#include "media/media_index.h"
+#include "sd_card.h"
+#include "debug_console.h"
+#include "audio/audio_engine.h"
+#include "audio/playback_power.h"
 
 // NTP 相关
 WiFiUDP ntpUDP;
 NTPClient
-    timeClient(ntpUDP, "ntp.aliyun.com", 8 * 3600,
+    timeClient(ntpUDP, "ntp.aliyun.com", TIME_OFFSET_S,
                60000); // 使用阿里云NTP服务器，中国时区(+8)，每分钟更新一次
 
 // RTC 保持的最后一次同步时间（备份），在深度睡眠/重启间保留（取决于芯片）
 RTC_DATA_ATTR uint32_t rtc_saved_epoch = 0;
 
+void timeClientUpdate() {
+  // the alarm wake boot keeps WiFi off; its time comes from the RTC
+  if (!alarmWakeBoot())
+    timeClient.update();
+}
+
 // home/time related globals moved to pages/time_page.cpp
 
 // 中文星期数组（放在时间正下方）
@@ -67,12 +84,12 @@ void renderPlaceholderPartial(int page);
 
 // ---------- 页面翻页逻辑（由 PageManager 接管） ----------
 int currentPage = 0;               // 暂时保留供模块访问
-const int totalPages = 7;          // 页面总数（增加 ebook 页面）
+const int totalPages = 8;          // 页面总数（增加 ebook 与闹钟响铃页面）
 unsigned long lastInteraction = 0; // 供少量模块使用
 int pageSwitchCount = 0;           // 保留计数逻辑
 const int partialBeforeFull = 5;
 PageManager gPageMgr;
-static Page *gPages[7] = {nullptr};
+static Page *gPages[8] = {nullptr};
 static PageButton lastButtonState = BTN_NONE;
 // single global definition for lastPageSwitchMs
 unsigned long lastPageSwitchMs = 0;
@@ -84,26 +101,8 @@ unsigned long lastPageSwitchMs = 0;
 
 // 日历页面的按钮处理函数已在 calendar.cpp 中实现
 
-void setup() {
-  Serial.begin(9600);
-  // If resumed from deep sleep, print wakeup cause for debugging
-  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
-  Serial.println("Wakeup cause: " + String((int)cause));
-  // ensure buzzer pin is in defined state to avoid idle noise
-  pinMode(BUZZER_PIN, OUTPUT);
-  digitalWrite(BUZZER_PIN, LOW);
-  SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN, EPD_CS_PIN);
-  display.init();
-  display.setRotation(1);
-  u8g2Fonts.begin(display);
-  u8g2Fonts.setFontMode(1);
-  u8g2Fonts.setFontDirection(0);
-  u8g2Fonts.setForegroundColor(GxEPD_BLACK);
-  u8g2Fonts.setBackgroundColor(GxEPD_WHITE);
-  u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
-
-  display.clearScreen();
-
+// WiFi (config portal on first use) and NTP; false if WiFi never came up
+static bool networkSetup() {
   WiFiManager wm;
 
   // Customizing the portal
@@ -134,7 +133,7 @@ void setup() {
     } while (display.nextPage());
     // ESP.restart();
     // Or go into deep sleep
-    return;
+    return false;
   }
 
   Serial.println("Connected to WiFi");
@@ -184,13 +183,49 @@ void setup() {
       Serial.println("未找到有效备份时间，继续使用设备启动时默认时间");
     }
   }
+  return true;
+}
+
+void setup() {
+  unsigned long setupStart = millis();
+  Serial.begin(9600);
+  // If resumed from deep sleep, print wakeup cause for debugging
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+  Serial.println("Wakeup cause: " + String((int)cause));
+  // ensure buzzer pin is in defined state to avoid idle noise
+  pinMode(BUZZER_PIN, OUTPUT);
+  digitalWrite(BUZZER_PIN, LOW);
+  // shared by the panel and the SD card; all access goes through the arbiter
+  spiBusBegin();
+  display.init();
+  display.setRotation(1);
+  u8g2Fonts.begin(display);
+  u8g2Fonts.setFontMode(1);
+  u8g2Fonts.setFontDirection(0);
+  u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+  u8g2Fonts.setBackgroundColor(GxEPD_WHITE);
+  u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+
+  // an alarm timer wake skips the network (time comes from the RTC) and
+  // the panel clear, which would delay the sound
+  bool fastBoot = alarmWakeBoot();
+  if (!fastBoot)
+    display.clearScreen();
+
+  if (fastBoot) {
+    alarmWakeRestoreTime();
+  } else if (!networkSetup()) {
+    return;
+  }
 
   // 初始化全刷新时间戳
   lastFullRefresh = millis();
 
   // 获取第一条一言
-  currentHitokoto = getHitokoto();
-  lastHitokotoUpdate = millis();
+  if (!fastBoot) {
+    currentHitokoto = getHitokoto();
+    lastHitokotoUpdate = millis();
+  }
 
   // 日历页初始化由 CalendarPage 自行完成
 
@@ -222,32 +257,64 @@ void setup() {
   gPages[5] = new MusicPage();
   // EBook page at index 6 (entered only via Files open)
   gPages[6] = new EBookPage();
-  gPageMgr.setPages(gPages, 7);
-  gPageMgr.begin();
+  // Alarm ring screen at index 7 (entered only by a ringing alarm)
+  gPages[ALARM_RING_PAGE] = new AlarmRingPage();
+  gPageMgr.setPages(gPages, totalPages);
+  if (fastBoot)
+    alarmWakeRing(); // goes straight to the ring page
+  else
+    gPageMgr.begin();
   lastInteraction = millis();
   lastButtonState = (PageButton)readButtonStateRaw();
 
-  delay(2000);
+  if (!fastBoot) {
+    delay(2000);
 
-  Serial.println("Initializing SD card...");
-  if (!SD.begin(SD_CS_PIN)) {
-    Serial.println("SD initialization failed, continuing without SD");
-    // keep running but FilesPage will show empty entries until SD is mounted
-  } else {
-    Serial.println("SD initialization done.");
-    // If FilesPage exists, refresh entries now that filesystem is mounted
-    Page *p3 = gPages[3];
-    if (p3) {
-      // safe cast because we know page 3 is FilesPage
-      ((FilesPage *)p3)->refreshEntries();
+    Serial.println("Initializing SD card...");
+    // negotiates the fastest clock the card passes the read self-test at
+    bool sdOk = sdMount();
+    if (!sdOk) {
+      Serial.println("SD initialization failed, continuing without SD");
+      // keep running but FilesPage will show empty entries until SD is mounted
+    } else {
+      Serial.println("SD initialization done.");
+      // If FilesPage exists, refresh entries now that filesystem is mounted
+      Page *p3 = gPages[3];
+      if (p3) {
+        // safe cast because we know page 3 is FilesPage
+        ((FilesPage *)p3)->refreshEntries();
+      }
+      // build/refresh the card-wide media library in the background
+      gMediaIndex.beginBackgroundScan();
     }
   }
-  
-  // Audio initialization is performed by MusicPage when needed
+
+  // Audio stack is created on the first play and released again after
+  // playback stops (see AudioEngine::begin/end)
+
+  // serial debug commands (type "help")
+  sdConsoleRegister();
+  audioConsoleRegister();
+  alarmConsoleRegister();
+  debugConsoleRegister("heap", "free heap / low-water / largest block",
+                       [](const String &) {
+                         Serial.println("heap: free " + String(ESP.getFreeHeap()) +
+                                        ", min " + String(ESP.getMinFreeHeap()) +
+                                        ", largest " +
+                                        String(ESP.getMaxAllocHeap()) +
+                                        (gAudio.running() ? ", audio on"
+                                                          : ", audio off"));
+                       });
 
   // 初始化电池监测（ADC 引脚与分压系数可在需要时调整）
   // 这里假设电压分压为 (Rtop=100k, Rbottom=200k) -> dividerFactor = (Rtop+Rbottom)/Rbottom = 1.5
   gBattery.begin(BAT_ADC_PIN, 3.3f, 4095, 1.5f);
+
+  // boot footprint, to compare against the audio stack's cost
+  Serial.println("Boot: setup took " + String(millis() - setupStart) +
+                 " ms (since reset " + String(millis()) + " ms), free heap " +
+                 String(ESP.getFreeHeap()) + ", largest block " +
+                 String(ESP.getMaxAllocHeap()));
 }
 
 bool openEbookFromPath(const String &path) {
@@ -290,10 +357,10 @@ bool openEbookFromPath(const String &path) {
   return false;
 }
 
-bool openMusicFromPath(const String &path) {
+// show the "加载中..." prompt; the music page, or null if there is none
+static MusicPage *musicPageLoading() {
   Page *p5 = gPages[5];
-  if (!p5) return false;
-  MusicPage *mp = (MusicPage *)p5;
+  if (!p5) return nullptr;
   // show a small loading prompt
   int px = 20;
   int py = 30;
@@ -309,19 +376,39 @@ bool openMusicFromPath(const String &path) {
     u8g2Fonts.setCursor(px + 10, py + 18);
     u8g2Fonts.print("加载中...");
   } while (display.nextPage());
+  return (MusicPage *)p5;
+}
 
-  mp->openFromFile(path);
+static void showMusicPage() {
   gPageMgr.setDirectSwitchAllowed(5, true);
   switchPageAndFullRefresh(5);
   gPageMgr.setDirectSwitchAllowed(5, false);
+}
+
+bool openMusicFromPath(const String &path) {
+  MusicPage *mp = musicPageLoading();
+  if (!mp) return false;
+  mp->openFromFile(path);
+  showMusicPage();
+  return true;
+}
+
+// a track picked in "All music": the whole library is the playlist
+bool openMusicFromLibrary(int index) {
+  MusicPage *mp = musicPageLoading();
+  if (!mp) return false;
+  mp->openFromLibrary(index);
+  showMusicPage();
   return true;
 }
 
 void loop() {
   unsigned long now = millis();
 
-  // keep per-alarm last triggered minute to avoid retriggering within same minute
-  static int lastAlarmTriggerMinute[5] = {-1, -1, -1, -1, -1};
+  // after an alarm timer wake: back to sleep once it is dismissed (or
+  // timed out)
+  alarmRingTimeoutCheck();
+  alarmWakeLoop();
 
   // 长按检测相关状态
   static unsigned long centerPressStartTime = 0; // CENTER 按钮按下开始时间
@@ -401,7 +488,7 @@ void loop() {
           Serial.println("Hibernating e-paper before deep sleep (release 5s)");
           display.hibernate();
           delay(20);
-          enterDeepSleepUntilWakePin(WAKE_BUTTON_PIN);
+          alarmDeepSleep();
         } else if (currentPage == 0 && held >= LONG_PRESS_DURATION) {
           // treat as manual refresh when released after >=1s
           Serial.println("Release after >=1s on homepage -> manual refresh");
@@ -507,38 +594,24 @@ void loop() {
                      String(gPageMgr.currentIndex()));
       gPageMgr.requestRender(false);
     }
-    // Alarm check: run every second but only trigger once per minute per alarm
-    // Use NTP time for correctness
+    // Alarms: the scheduler keeps the next fire time, so this is a compare
     time_t raw = timeClient.getEpochTime();
-    struct tm *tm = localtime(&raw);
-    int curHour = tm->tm_hour;
-    int curMin = tm->tm_min;
-    int curWday = tm->tm_wday; // 0 = Sunday .. 6 = Saturday
-    for (int i = 0; i < 5; i++) {
-      Alarm a = getAlarmCfg(i);
-      if (!a.enabled) continue;
-      // check weekday mask: if weekdays == 0 treat as everyday
-      bool weekdayMatch = (a.weekdays == 0) || ((a.weekdays & (1 << curWday)) != 0);
-      if (!weekdayMatch) continue;
-      if (a.hour == curHour && a.minute == curMin) {
-        if (lastAlarmTriggerMinute[i] != curMin) {
-          lastAlarmTriggerMinute[i] = curMin;
-          Serial.println("Triggering alarm " + String(i) + " at " + String(curHour) + ":" + String(curMin));
-          startAlarmNow(i);
-        }
-      } else {
-        // reset per-minute lock when time moved away
-        if (lastAlarmTriggerMinute[i] == curMin)
-          lastAlarmTriggerMinute[i] = -1;
-      }
+    uint32_t lateS = 0;
+    int due = gAlarmSched.poll(raw, lateS);
+    if (due >= 0) {
+      Serial.println("Triggering alarm " + String(due));
+      startAlarmNow(due, lateS);
     }
   }
 
-  // Audio processing: forward to MusicPage if present
+  // Playback runs in the audio tasks; the page only redraws on state changes
+  // (and tears the audio stack down once it is no longer needed)
   Page *p5 = gPages[5];
   if (p5) {
     MusicPage *mp = (MusicPage *)p5;
     mp->tick();
   }
-  vTaskDelay(10);
+  gPlaybackPower.update();
+  debugConsolePoll();
+  vTaskDelay(gPlaybackPower.loopDelayMs());
 }
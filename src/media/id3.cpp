@@ -0,0 +1,192 @@
+#include "id3.h"
+#include "../audio/mp3_frame.h"
+#include <string.h>
+
+// longest text frame we decode; longer titles are cut
+static const size_t MAX_TEXT = 96;
+// window searched for the first MPEG frame after the tag
+static const size_t FRAME_PROBE = 256;
+
+static uint32_t syncsafe(const uint8_t *p) {
+  return (p[0] & 0x7F) << 21 | (p[1] & 0x7F) << 14 | (p[2] & 0x7F) << 7 |
+         (p[3] & 0x7F);
+}
+static uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void appendUtf8(String &s, uint32_t cp) {
+  if (cp < 0x80) {
+    s += (char)cp;
+  } else if (cp < 0x800) {
+    s += (char)(0xC0 | (cp >> 6));
+    s += (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    s += (char)(0xE0 | (cp >> 12));
+    s += (char)(0x80 | ((cp >> 6) & 0x3F));
+    s += (char)(0x80 | (cp & 0x3F));
+  } else {
+    s += (char)(0xF0 | (cp >> 18));
+    s += (char)(0x80 | ((cp >> 12) & 0x3F));
+    s += (char)(0x80 | ((cp >> 6) & 0x3F));
+    s += (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+// ISO-8859-1 bytes up to the first NUL
+static String latin1(const uint8_t *p, size_t n) {
+  String out;
+  for (size_t i = 0; i < n && p[i]; ++i)
+    appendUtf8(out, p[i]);
+  out.trim();
+  return out;
+}
+
+// ID3v2 text frame body: encoding byte, then the string
+static String decodeText(const uint8_t *p, size_t n) {
+  if (n < 2)
+    return String();
+  uint8_t enc = p[0];
+  p++;
+  n--;
+  if (enc == 0)
+    return latin1(p, n);
+  String out;
+  if (enc == 3) {
+    for (size_t i = 0; i < n && p[i]; ++i)
+      out += (char)p[i];
+  } else if (enc == 1 || enc == 2) {
+    // UTF-16 with BOM (1) or big endian without (2)
+    bool be = enc == 2;
+    size_t i = 0;
+    if (enc == 1 && n >= 2) {
+      if (p[0] == 0xFF && p[1] == 0xFE) {
+        i = 2;
+      } else if (p[0] == 0xFE && p[1] == 0xFF) {
+        be = true;
+        i = 2;
+      }
+    }
+    for (; i + 1 < n; i += 2) {
+      uint32_t u = be ? (p[i] << 8 | p[i + 1]) : (p[i + 1] << 8 | p[i]);
+      if (u == 0)
+        break;
+      if (u >= 0xD800 && u < 0xDC00 && i + 3 < n) {
+        uint32_t lo = be ? (p[i + 2] << 8 | p[i + 3]) : (p[i + 3] << 8 | p[i + 2]);
+        if (lo >= 0xDC00 && lo < 0xE000) {
+          u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+          i += 2;
+        }
+      }
+      appendUtf8(out, u);
+    }
+  }
+  out.trim();
+  return out;
+}
+
+// Walk the frames of an ID3v2 tag; returns where the audio starts
+static uint32_t readId3v2(Id3Source &f, TrackMeta &out, bool &found) {
+  uint8_t h[10];
+  if (f.read(h, 10) != 10 || memcmp(h, "ID3", 3) != 0 || h[3] < 2 || h[3] > 4)
+    return 0;
+  found = true;
+  uint8_t ver = h[3];
+  uint32_t tagEnd = 10 + syncsafe(h + 6);
+  uint32_t audioStart = tagEnd + ((h[5] & 0x10) ? 10 : 0);
+  uint32_t pos = 10;
+  if ((h[5] & 0x40) && ver >= 3) {
+    // extended header: v2.4 size includes itself, v2.3 does not
+    uint8_t e[4];
+    if (f.read(e, 4) != 4)
+      return audioStart;
+    pos += ver == 4 ? syncsafe(e) : be32(e) + 4;
+  }
+  const size_t hdrLen = ver == 2 ? 6 : 10;
+  while (pos + hdrLen <= tagEnd) {
+    uint8_t fh[10];
+    f.seek(pos);
+    if (f.read(fh, hdrLen) != hdrLen || fh[0] == 0)
+      break; // padding
+    uint32_t size = ver == 2   ? (fh[3] << 16 | fh[4] << 8 | fh[5])
+                    : ver == 4 ? syncsafe(fh + 4)
+                               : be32(fh + 4);
+    pos += hdrLen;
+    if (size == 0 || pos + size > tagEnd)
+      break;
+    String *dst = nullptr;
+    bool tlen = false;
+    if (ver == 2) {
+      if (memcmp(fh, "TT2", 3) == 0)
+        dst = &out.title;
+      else if (memcmp(fh, "TP1", 3) == 0)
+        dst = &out.artist;
+      else if (memcmp(fh, "TAL", 3) == 0)
+        dst = &out.album;
+      else if (memcmp(fh, "TLE", 3) == 0)
+        tlen = true;
+    } else {
+      if (memcmp(fh, "TIT2", 4) == 0)
+        dst = &out.title;
+      else if (memcmp(fh, "TPE1", 4) == 0)
+        dst = &out.artist;
+      else if (memcmp(fh, "TALB", 4) == 0)
+        dst = &out.album;
+      else if (memcmp(fh, "TLEN", 4) == 0)
+        tlen = true;
+    }
+    // compressed/encrypted frames are skipped like any other
+    bool packed = ver == 3 ? (fh[9] & 0xC0) : ver == 4 ? (fh[9] & 0x0C) : false;
+    if ((dst || tlen) && !packed) {
+      uint8_t buf[MAX_TEXT];
+      size_t n = size < MAX_TEXT ? size : MAX_TEXT;
+      if (f.read(buf, n) == n) {
+        String s = decodeText(buf, n);
+        if (tlen)
+          out.durationMs = s.toInt();
+        else if (dst->length() == 0)
+          *dst = s;
+      }
+    }
+    pos += size;
+  }
+  return audioStart;
+}
+
+bool readId3(Id3Source &f, TrackMeta &out) {
+  uint32_t fileSize = f.size();
+  bool found = false;
+  uint32_t audioStart = readId3v2(f, out, found);
+  uint32_t audioEnd = fileSize;
+
+  // ID3v1: fixed 128 bytes at the very end
+  if (fileSize >= 128 + audioStart) {
+    uint8_t t[128];
+    f.seek(fileSize - 128);
+    if (f.read(t, 128) == 128 && memcmp(t, "TAG", 3) == 0) {
+      found = true;
+      audioEnd -= 128;
+      if (out.title.length() == 0)
+        out.title = latin1(t + 3, 30);
+      if (out.artist.length() == 0)
+        out.artist = latin1(t + 33, 30);
+      if (out.album.length() == 0)
+        out.album = latin1(t + 63, 30);
+    }
+  }
+
+  if (out.durationMs == 0 && audioEnd > audioStart) {
+    uint8_t buf[FRAME_PROBE];
+    f.seek(audioStart);
+    size_t n = f.read(buf, sizeof(buf));
+    Mp3FrameHeader h;
+    for (size_t i = 0; i + 4 <= n; ++i) {
+      if (!parseMp3Header(buf + i, h))
+        continue;
+      out.durationMs =
+          mp3EstimateDurationMs(buf + i, n - i, audioEnd - audioStart - i);
+      break;
+    }
+  }
+  return found;
+}
@@ -0,0 +1,32 @@
+// ID3 tag reader for the music library
+#pragma once
+
+#include <Arduino.h>
+
+struct TrackMeta {
+  String title;
+  String artist;
+  String album;
+  uint32_t durationMs = 0; // estimate, 0 if unknown
+};
+
+// Read title/artist/album from an ID3v2 (2.2-2.4) tag, filling gaps from an
+// ID3v1 tag at the end of the file, and estimate the duration from TLEN or
+// the first MPEG frame. Only frame headers and the wanted text frames are
+// read; everything else (artwork above all) is skipped by its size field.
+// Text is returned as UTF-8. False if the file has neither tag.
+bool readId3(const String &path, TrackMeta &out);
+
+// Random access bytes of a file, for the tag reader
+class Id3Source {
+public:
+  virtual uint32_t size() = 0;
+  virtual bool seek(uint32_t pos) = 0;
+  virtual size_t read(uint8_t *buf, size_t n) = 0;
+
+protected:
+  ~Id3Source() {}
+};
+
+// the same from any source (readId3(path) wraps a card file)
+bool readId3(Id3Source &in, TrackMeta &out);
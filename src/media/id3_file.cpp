@@ -0,0 +1,25 @@
+#include "id3.h"
+#include "../spi_bus.h"
+#include <SD.h>
+
+class Id3File : public Id3Source {
+public:
+  explicit Id3File(File &f) : f(f) {}
+  uint32_t size() override { return f.size(); }
+  bool seek(uint32_t pos) override { return f.seek(pos); }
+  size_t read(uint8_t *buf, size_t n) override { return f.read(buf, n); }
+
+private:
+  File &f;
+};
+
+bool readId3(const String &path, TrackMeta &out) {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File f = SD.open(path);
+  if (!f)
+    return false;
+  Id3File src(f);
+  bool found = readId3(src, out);
+  f.close();
+  return found;
+}
@@ -0,0 +1,113 @@
+#include "lrc.h"
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// "mm:ss", "mm:ss.xx" or "mm:ss.xxx"; false for ID tags like "ar:"
+static bool parseStamp(const char *p, size_t n, uint32_t &ms) {
+  size_t i = 0;
+  uint32_t mm = 0, ss = 0, frac = 0, fracDigits = 0;
+  if (i >= n || !isdigit((uint8_t)p[i]))
+    return false;
+  while (i < n && isdigit((uint8_t)p[i]))
+    mm = mm * 10 + (p[i++] - '0');
+  if (i >= n || p[i++] != ':')
+    return false;
+  if (i >= n || !isdigit((uint8_t)p[i]))
+    return false;
+  while (i < n && isdigit((uint8_t)p[i]))
+    ss = ss * 10 + (p[i++] - '0');
+  if (i < n && (p[i] == '.' || p[i] == ':')) {
+    i++;
+    while (i < n && isdigit((uint8_t)p[i]) && fracDigits < 3) {
+      frac = frac * 10 + (p[i++] - '0');
+      fracDigits++;
+    }
+  }
+  if (i != n)
+    return false;
+  while (fracDigits < 3) {
+    frac *= 10;
+    fracDigits++;
+  }
+  ms = (mm * 60 + ss) * 1000 + frac;
+  return true;
+}
+
+bool LrcTrack::parse(const char *s, size_t len) {
+  clear();
+  size_t pos = 0;
+  if (len >= 3 && (uint8_t)s[0] == 0xEF && (uint8_t)s[1] == 0xBB &&
+      (uint8_t)s[2] == 0xBF)
+    pos = 3;
+  int32_t offsetMs = 0;
+  texts.reserve(len / 2);
+  while (pos < len) {
+    size_t end = pos;
+    while (end < len && s[end] != '\n')
+      end++;
+    size_t lineEnd = end;
+    if (lineEnd > pos && s[lineEnd - 1] == '\r')
+      lineEnd--;
+    // leading [..] tags, then the text
+    size_t p = pos;
+    size_t firstNew = lines.size();
+    while (p < lineEnd && s[p] == '[') {
+      size_t close = p + 1;
+      while (close < lineEnd && s[close] != ']')
+        close++;
+      if (close >= lineEnd)
+        break;
+      uint32_t ms;
+      if (parseStamp(s + p + 1, close - p - 1, ms)) {
+        lines.push_back({ms, 0});
+      } else if (close - p - 1 > 7 && strncmp(s + p + 1, "offset:", 7) == 0) {
+        // positive offsets make the lyrics appear sooner
+        offsetMs = strtol(s + p + 8, nullptr, 10);
+      }
+      p = close + 1;
+    }
+    if (lines.size() > firstNew) {
+      while (p < lineEnd && s[p] == ' ')
+        p++;
+      uint32_t off = texts.size();
+      texts.insert(texts.end(), s + p, s + lineEnd);
+      texts.push_back('\0');
+      for (size_t i = firstNew; i < lines.size(); ++i)
+        lines[i].off = off;
+    }
+    pos = end + 1;
+  }
+  if (offsetMs != 0) {
+    for (auto &l : lines) {
+      int32_t t = (int32_t)l.ms - offsetMs;
+      l.ms = t > 0 ? (uint32_t)t : 0;
+    }
+  }
+  std::stable_sort(lines.begin(), lines.end(),
+                   [](const Line &a, const Line &b) { return a.ms < b.ms; });
+  lines.shrink_to_fit();
+  texts.shrink_to_fit();
+  return !lines.empty();
+}
+
+
+void LrcTrack::clear() {
+  std::vector<Line>().swap(lines);
+  std::vector<char>().swap(texts);
+}
+
+int LrcTrack::lineAt(uint32_t ms) const {
+  // last line whose time is <= ms
+  auto it = std::upper_bound(
+      lines.begin(), lines.end(), ms,
+      [](uint32_t t, const Line &l) { return t < l.ms; });
+  return (int)(it - lines.begin()) - 1;
+}
+
+String LrcTrack::text(int line) const {
+  if (line < 0 || line >= (int)lines.size())
+    return String();
+  return String(&texts[lines[line].off]);
+}
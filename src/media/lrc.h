@@ -0,0 +1,30 @@
+// Timed lyrics (.lrc) for the music page
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+// An .lrc file parsed into one text buffer plus a table of
+// (time, text offset) sorted by time. Lines with several time tags get one
+// entry per tag; [offset:] is applied, other ID tags are ignored. Text is
+// expected in UTF-8 (a BOM is stripped).
+class LrcTrack {
+public:
+  // load the .lrc next to `audioPath` (same name); false if there is none
+  bool loadFor(const String &audioPath);
+  // parse .lrc text already in memory; false if it has no timed line
+  bool parse(const char *s, size_t len);
+  void clear();
+  bool empty() const { return lines.empty(); }
+  // index of the line showing at `ms` (-1 before the first one)
+  int lineAt(uint32_t ms) const;
+  String text(int line) const;
+
+private:
+  struct Line {
+    uint32_t ms;
+    uint32_t off; // into texts, NUL terminated
+  };
+  std::vector<Line> lines;
+  std::vector<char> texts;
+};
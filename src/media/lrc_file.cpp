@@ -0,0 +1,31 @@
+#include "lrc.h"
+#include "../spi_bus.h"
+#include <SD.h>
+
+// lyrics files are a few KB; anything bigger is not an .lrc worth showing
+static const size_t MAX_LRC_BYTES = 32 * 1024;
+
+bool LrcTrack::loadFor(const String &audioPath) {
+  clear();
+  int dot = audioPath.lastIndexOf('.');
+  if (dot < 0)
+    return false;
+  String lrcPath = audioPath.substring(0, dot) + ".lrc";
+  std::vector<char> raw;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File f = SD.open(lrcPath);
+    if (!f)
+      return false;
+    size_t size = f.size();
+    if (size == 0 || size > MAX_LRC_BYTES) {
+      f.close();
+      return false;
+    }
+    raw.resize(size);
+    size = f.read((uint8_t *)raw.data(), size);
+    raw.resize(size);
+    f.close();
+  }
+  return parse(raw.data(), raw.size());
+}
@@ -0,0 +1,577 @@
+#include "media_index.h"
+#include "../spi_bus.h"
+#include "../utils/hash.h"
+#include "track_meta.h"
+#include <FS.h>
+#include <SD.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+MediaIndex gMediaIndex;
+
+static const char *DB_DIR = "/.aria";
+static const char *DB_PATH = "/.aria/media.db";
+static const char *DB_TMP_PATH = "/.aria/media.tmp";
+static const uint32_t DB_MAGIC = 0x42444D41; // "AMDB"
+static const uint16_t DB_VERSION = 1;
+// header: magic u32, version u16, reserved u16, dirCount u32, fileCount u32
+static const size_t DB_HEADER_SIZE = 16;
+// directories an index can hold (width of Entry::dir)
+static const uint32_t MAX_DIRS = 1UL << 24;
+
+// protects dirs/music/books between the scanner task and the UI
+static SemaphoreHandle_t s_indexMutex = NULL;
+// Set (under s_indexMutex) once media.db has been replaced or removed and the
+// in-memory entries no longer match its name offsets; cleared by load().
+static bool s_dbStale = false;
+static TaskHandle_t s_scanTaskHandle = NULL;
+
+MediaType mediaTypeForName(const String &name) {
+  int dot = name.lastIndexOf('.');
+  if (dot < 0)
+    return MediaType::MEDIA_NONE;
+  String ext = name.substring(dot + 1);
+  ext.toLowerCase();
+  if (ext == "mp3" || ext == "flac" || ext == "aac" || ext == "wav" ||
+      ext == "m4a")
+    return MediaType::MEDIA_MUSIC;
+  if (ext == "txt")
+    return MediaType::MEDIA_BOOK;
+  return MediaType::MEDIA_NONE;
+}
+
+// ---- small binary helpers (little endian, matches the chip) ----
+static bool readU32(File &f, uint32_t &v) {
+  return f.read((uint8_t *)&v, 4) == 4;
+}
+static bool readU16(File &f, uint16_t &v) {
+  return f.read((uint8_t *)&v, 2) == 2;
+}
+static void writeU32(File &f, uint32_t v) { f.write((const uint8_t *)&v, 4); }
+static void writeU16(File &f, uint16_t v) { f.write((const uint8_t *)&v, 2); }
+
+static String joinPath(const String &dir, const String &name) {
+  if (dir == "/")
+    return String("/") + name;
+  return dir + String("/") + name;
+}
+
+// the in-memory entries are about to stop matching media.db
+static void markStale() {
+  if (!s_indexMutex)
+    return;
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  s_dbStale = true;
+  xSemaphoreGive(s_indexMutex);
+}
+
+// directories that never contain user media
+static bool skipDirName(const String &name) {
+  return name.startsWith(".") || name == "System Volume Information";
+}
+
+// a directory block of the previous database, to tell whether it changed
+struct OldDirBlock {
+  uint32_t pathHash;
+  uint32_t stamp;
+  uint32_t off; // where the block starts
+  uint16_t files;
+};
+
+static bool readHeader(File &f, uint32_t &dirCount, uint32_t &fileCount) {
+  uint32_t magic = 0;
+  uint16_t ver = 0, reserved = 0;
+  if (!readU32(f, magic) || !readU16(f, ver) || !readU16(f, reserved))
+    return false;
+  if (magic != DB_MAGIC || ver != DB_VERSION)
+    return false;
+  return readU32(f, dirCount) && readU32(f, fileCount);
+}
+
+// skip `files` file records starting at the current position
+static bool skipFileRecords(File &f, uint16_t files) {
+  for (uint16_t i = 0; i < files; ++i) {
+    uint8_t hdr[6];
+    if (f.read(hdr, 6) != 6)
+      return false;
+    if (!f.seek(f.position() + hdr[5]))
+      return false;
+  }
+  return true;
+}
+
+static void writeBlockHeader(File &out, const String &dirPath, uint32_t stamp,
+                             uint16_t files) {
+  writeU32(out, stamp);
+  writeU16(out, files);
+  writeU16(out, (uint16_t)dirPath.length());
+  out.write((const uint8_t *)dirPath.c_str(), dirPath.length());
+}
+
+static void writeFileRecord(File &out, MediaType t, uint32_t size,
+                            const String &name) {
+  writeU32(out, size);
+  uint8_t hdr[2] = {(uint8_t)t, (uint8_t)name.length()};
+  out.write(hdr, 2);
+  out.write((const uint8_t *)name.c_str(), name.length());
+}
+
+// Start the new database: a placeholder header, then the leading blocks
+// of the old one up to `copyEnd` (the directories found unchanged so far)
+static bool startDb(File &out, File &oldDb, uint32_t copyEnd) {
+  SD.mkdir(DB_DIR);
+  out = SD.open(DB_TMP_PATH, FILE_WRITE);
+  if (!out) {
+    Serial.println("MediaIndex: cannot create " + String(DB_TMP_PATH));
+    return false;
+  }
+  uint8_t buf[512] = {0};
+  out.write(buf, DB_HEADER_SIZE);
+  if (copyEnd > DB_HEADER_SIZE && !oldDb.seek(DB_HEADER_SIZE))
+    return false;
+  for (uint32_t at = DB_HEADER_SIZE; at < copyEnd;) {
+    size_t n = copyEnd - at < sizeof(buf) ? copyEnd - at : sizeof(buf);
+    if (oldDb.read(buf, n) != n)
+      return false;
+    out.write(buf, n);
+    at += n;
+  }
+  return true;
+}
+
+static void scanTaskEntry(void *arg) {
+  MediaIndex *idx = (MediaIndex *)arg;
+  if (idx)
+    idx->scanNow();
+  // tags of new tracks, so list views can show titles from the cache
+  gTrackMeta.fillFromLibrary();
+  s_scanTaskHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+MediaIndex::MediaIndex() {}
+
+void MediaIndex::beginBackgroundScan() {
+  if (!s_indexMutex)
+    s_indexMutex = xSemaphoreCreateMutex();
+  if (s_scanTaskHandle != NULL)
+    return;
+  // publish whatever the card already holds so the virtual folders are
+  // usable right away; the rescan replaces it when done
+  if (!isReady)
+    load();
+  isScanning = true;
+  BaseType_t r = xTaskCreate(scanTaskEntry, "media_index", 6144, this,
+                             tskIDLE_PRIORITY + 1, &s_scanTaskHandle);
+  if (r != pdPASS) {
+    Serial.println("MediaIndex: failed to start scanner task");
+    s_scanTaskHandle = NULL;
+    isScanning = false;
+  }
+}
+
+// The walk lists every directory once and stamps it. While the stamps
+// match the old database block for block, nothing is written; at the
+// first difference the matching blocks are copied over and from then on
+// records are written during the walk (the changed directory itself is
+// listed a second time, being the only one whose records were not kept).
+void MediaIndex::scanNow() {
+  isScanning = true;
+  unsigned long t0 = millis();
+
+  // the bus is taken per step (not for the whole walk) so page code can
+  // use the card between directories
+  spiBusAcquire(SpiClient::SPI_CLIENT_SD);
+  // directory stamps of the previous database, in walk order
+  std::vector<OldDirBlock> old;
+  uint32_t oldEnd = DB_HEADER_SIZE;
+  File oldDb = SD.open(DB_PATH);
+  if (oldDb) {
+    uint32_t dirCount = 0, fileCount = 0;
+    if (readHeader(oldDb, dirCount, fileCount)) {
+      for (uint32_t d = 0; d < dirCount; ++d) {
+        OldDirBlock b;
+        uint16_t pathLen = 0;
+        b.off = oldDb.position();
+        if (!readU32(oldDb, b.stamp) || !readU16(oldDb, b.files) ||
+            !readU16(oldDb, pathLen))
+          break;
+        char path[256];
+        if (pathLen >= sizeof(path) ||
+            oldDb.read((uint8_t *)path, pathLen) != pathLen)
+          break;
+        b.pathHash = fnv1a(path, pathLen);
+        if (!skipFileRecords(oldDb, b.files))
+          break;
+        old.push_back(b);
+        oldEnd = oldDb.position();
+      }
+    }
+  }
+  spiBusRelease(SpiClient::SPI_CLIENT_SD);
+
+  File out; // opened at the first difference
+  size_t same = 0;
+  uint32_t dirCount = 0, fileCount = 0;
+  bool failed = false;
+  std::vector<String> pending;
+  pending.push_back("/");
+  while (!pending.empty() && !failed) {
+    String dirPath = pending.back();
+    pending.pop_back();
+    // let the UI task use the card between directories
+    vTaskDelay(1);
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File dir = SD.open(dirPath.c_str());
+    if (!dir || !dir.isDirectory()) {
+      if (dir)
+        dir.close();
+      continue;
+    }
+    // queue subdirectories, stamp the listing and, once writing, put out a
+    // record per media file; the block header is patched afterwards
+    bool indexed = dirPath.length() <= 255 && dirCount < MAX_DIRS;
+    bool writing = indexed && out;
+    uint32_t blockOff = writing ? out.position() : 0;
+    if (writing)
+      writeBlockHeader(out, dirPath, 0, 0);
+    uint32_t stamp = FNV1A_SEED;
+    uint16_t mediaFiles = 0;
+    File e = dir.openNextFile();
+    while (e) {
+      String nm = String(e.name());
+      int slash = nm.lastIndexOf('/');
+      if (slash >= 0)
+        nm = nm.substring(slash + 1);
+      bool isDir = e.isDirectory();
+      uint32_t sz = isDir ? 0 : (uint32_t)e.size();
+      stamp = fnv1a(nm, stamp);
+      stamp = fnv1a(&sz, sizeof(sz), stamp);
+      MediaType t = isDir ? MediaType::MEDIA_NONE : mediaTypeForName(nm);
+      if (isDir) {
+        if (!skipDirName(nm))
+          pending.push_back(joinPath(dirPath, nm));
+      } else if (t != MediaType::MEDIA_NONE && nm.length() <= 255 &&
+                 mediaFiles < 0xFFFF) {
+        if (writing)
+          writeFileRecord(out, t, sz, nm);
+        mediaFiles++;
+      }
+      e.close();
+      spiBusYield(SpiClient::SPI_CLIENT_SD);
+      e = dir.openNextFile();
+    }
+    if (!indexed || mediaFiles == 0) {
+      // nothing to list here: the next block overwrites the header (bytes
+      // past the last block are ignored, the header counts the blocks)
+      if (writing)
+        out.seek(blockOff);
+      dir.close();
+      continue;
+    }
+    dirCount++;
+    fileCount += mediaFiles;
+    if (writing) {
+      uint32_t blockEnd = out.position();
+      out.seek(blockOff);
+      writeBlockHeader(out, dirPath, stamp, mediaFiles);
+      out.seek(blockEnd);
+      dir.close();
+      continue;
+    }
+    uint32_t pathHash = fnv1a(dirPath);
+    if (same < old.size() && old[same].pathHash == pathHash &&
+        old[same].stamp == stamp && old[same].files == mediaFiles) {
+      same++;
+      dir.close();
+      continue;
+    }
+    // first difference: keep the blocks before it, list this one again
+    if (!startDb(out, oldDb, same < old.size() ? old[same].off : oldEnd)) {
+      dir.close();
+      failed = true;
+      break;
+    }
+    writeBlockHeader(out, dirPath, stamp, mediaFiles);
+    dir.rewindDirectory();
+    uint16_t written = 0;
+    e = dir.openNextFile();
+    while (e && written < mediaFiles) {
+      String nm = String(e.name());
+      int slash = nm.lastIndexOf('/');
+      if (slash >= 0)
+        nm = nm.substring(slash + 1);
+      MediaType t = e.isDirectory() ? MediaType::MEDIA_NONE
+                                    : mediaTypeForName(nm);
+      if (t != MediaType::MEDIA_NONE && nm.length() <= 255) {
+        writeFileRecord(out, t, (uint32_t)e.size(), nm);
+        written++;
+      }
+      e.close();
+      e = dir.openNextFile();
+    }
+    if (e)
+      e.close();
+    // the listing shrank in between: pad with empty records so the block
+    // stays well-formed (they are ignored on load)
+    for (; written < mediaFiles; ++written)
+      writeFileRecord(out, MediaType::MEDIA_NONE, 0, String());
+    dir.close();
+  }
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  // directories dropped off the end of the walk are a difference as well
+  if (!failed && !out && same < old.size())
+    failed = !startDb(out, oldDb, old[same].off);
+  if (oldDb)
+    oldDb.close();
+  if (failed) {
+    Serial.println("MediaIndex: cannot write the index, scan aborted");
+    if (out)
+      out.close();
+    SD.remove(DB_TMP_PATH);
+    markStale();
+    SD.remove(DB_PATH); // next boot rebuilds from scratch
+    isScanning = false;
+    return;
+  }
+
+  bool changed = (bool)out;
+  if (changed) {
+    // patch header with final counts
+    out.seek(0);
+    writeU32(out, DB_MAGIC);
+    writeU16(out, DB_VERSION);
+    writeU16(out, 0);
+    writeU32(out, dirCount);
+    writeU32(out, fileCount);
+    out.close();
+    markStale();
+    SD.remove(DB_PATH);
+    SD.rename(DB_TMP_PATH, DB_PATH);
+  }
+  Serial.println("MediaIndex: scan done in " + String(millis() - t0) +
+                 " ms, dirs=" + String(dirCount) + " files=" +
+                 String(fileCount) + " unchanged=" + String(same) +
+                 (changed ? " (rewritten)" : ""));
+  if (changed || !isReady)
+    load();
+  isScanning = false;
+}
+
+bool MediaIndex::load() {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File db = SD.open(DB_PATH);
+  if (!db)
+    return false;
+  uint32_t dirCount = 0, fileCount = 0;
+  if (!readHeader(db, dirCount, fileCount) || dirCount > MAX_DIRS) {
+    db.close();
+    return false;
+  }
+  std::vector<String> newDirs;
+  std::vector<Entry> newMusic;
+  std::vector<Entry> newBooks;
+  newDirs.reserve(dirCount);
+  bool ok = true;
+  for (uint32_t d = 0; d < dirCount && ok; ++d) {
+    uint32_t stamp = 0;
+    uint16_t files = 0, pathLen = 0;
+    char path[256];
+    if (!readU32(db, stamp) || !readU16(db, files) || !readU16(db, pathLen) ||
+        pathLen >= sizeof(path) ||
+        db.read((uint8_t *)path, pathLen) != pathLen) {
+      ok = false;
+      break;
+    }
+    path[pathLen] = '\0';
+    newDirs.push_back(String(path));
+    for (uint16_t i = 0; i < files; ++i) {
+      uint8_t hdr[6];
+      if (db.read(hdr, 6) != 6) {
+        ok = false;
+        break;
+      }
+      Entry en;
+      en.nameOff = db.position();
+      en.dir = d;
+      en.nameLen = hdr[5];
+      if (!db.seek(en.nameOff + en.nameLen)) {
+        ok = false;
+        break;
+      }
+      if ((MediaType)hdr[4] == MediaType::MEDIA_MUSIC)
+        newMusic.push_back(en);
+      else if ((MediaType)hdr[4] == MediaType::MEDIA_BOOK)
+        newBooks.push_back(en);
+    }
+  }
+  db.close();
+  if (!ok) {
+    Serial.println("MediaIndex: database corrupt, ignoring");
+    return false;
+  }
+  if (!s_indexMutex)
+    s_indexMutex = xSemaphoreCreateMutex();
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  dirs.swap(newDirs);
+  music.swap(newMusic);
+  books.swap(newBooks);
+  gen = gen + 1;
+  isReady = true;
+  s_dbStale = false;
+  xSemaphoreGive(s_indexMutex);
+  Serial.println("MediaIndex: loaded music=" + String(music.size()) +
+                 " books=" + String(books.size()));
+  return true;
+}
+
+int MediaIndex::count(MediaType t) const {
+  if (!s_indexMutex)
+    return 0;
+  int n = 0;
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  if (t == MediaType::MEDIA_MUSIC)
+    n = (int)music.size();
+  else if (t == MediaType::MEDIA_BOOK)
+    n = (int)books.size();
+  xSemaphoreGive(s_indexMutex);
+  return n;
+}
+
+const MediaIndex::Entry *MediaIndex::entryAt(MediaType t, int i) const {
+  const std::vector<Entry> *v = nullptr;
+  if (t == MediaType::MEDIA_MUSIC)
+    v = &music;
+  else if (t == MediaType::MEDIA_BOOK)
+    v = &books;
+  if (!v || i < 0 || i >= (int)v->size())
+    return nullptr;
+  return &(*v)[i];
+}
+
+String MediaIndex::readName(const Entry &e) {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File db = SD.open(DB_PATH);
+  if (!db)
+    return String();
+  char buf[256];
+  String out;
+  if (db.seek(e.nameOff) && db.read((uint8_t *)buf, e.nameLen) == e.nameLen) {
+    buf[e.nameLen] = '\0';
+    out = String(buf);
+  }
+  db.close();
+  return out;
+}
+
+// Name offsets are only meaningful against the media.db they were loaded
+// from, so the lookup and the read happen under one hold of the index mutex.
+// The bus is taken first, matching the order in scanNow()/load().
+String MediaIndex::nameAt(MediaType t, int i) {
+  if (!s_indexMutex)
+    return String();
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  const Entry *p = s_dbStale ? nullptr : entryAt(t, i);
+  String name = p ? readName(*p) : String();
+  xSemaphoreGive(s_indexMutex);
+  return name;
+}
+
+String MediaIndex::pathAt(MediaType t, int i) {
+  if (!s_indexMutex)
+    return String();
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  const Entry *p = s_dbStale ? nullptr : entryAt(t, i);
+  String dir = (p && p->dir < dirs.size()) ? dirs[p->dir] : String();
+  String name = dir.length() ? readName(*p) : String();
+  xSemaphoreGive(s_indexMutex);
+  if (name.length() == 0)
+    return String();
+  return joinPath(dir, name);
+}
+
+bool MediaIndex::folderRange(MediaType t, const String &dir, int &first,
+                             int &count) {
+  if (!s_indexMutex)
+    return false;
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  const std::vector<Entry> *v = t == MediaType::MEDIA_MUSIC  ? &music
+                                : t == MediaType::MEDIA_BOOK ? &books
+                                                             : nullptr;
+  int d = -1;
+  for (size_t i = 0; v && i < dirs.size(); ++i)
+    if (dirs[i] == dir) {
+      d = (int)i;
+      break;
+    }
+  first = -1;
+  count = 0;
+  for (size_t i = 0; d >= 0 && i < v->size(); ++i) {
+    if ((*v)[i].dir != d) {
+      if (first >= 0)
+        break;
+      continue;
+    }
+    if (first < 0)
+      first = (int)i;
+    count++;
+  }
+  xSemaphoreGive(s_indexMutex);
+  return count > 0;
+}
+
+bool MediaIndex::namesAt(MediaType t, int first, int count,
+                         std::vector<String> &out) {
+  out.clear();
+  std::vector<char> names;
+  std::vector<uint32_t> offs;
+  if (!namesAt(t, first, count, names, offs))
+    return false;
+  out.reserve(offs.size());
+  for (uint32_t o : offs)
+    out.push_back(String(&names[o]));
+  return true;
+}
+
+bool MediaIndex::namesAt(MediaType t, int first, int count,
+                         std::vector<char> &names,
+                         std::vector<uint32_t> &offs) {
+  if (!s_indexMutex)
+    return false;
+  size_t names0 = names.size(), offs0 = offs.size();
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  xSemaphoreTake(s_indexMutex, portMAX_DELAY);
+  File db = s_dbStale ? File() : SD.open(DB_PATH);
+  bool ok = (bool)db;
+  // sized up front from the lengths in RAM, so the buffer is allocated once
+  size_t bytes = 0;
+  for (int i = 0; ok && i < count; ++i) {
+    const Entry *e = entryAt(t, first + i);
+    bytes += e ? e->nameLen + 1 : 0;
+  }
+  names.reserve(names0 + bytes);
+  offs.reserve(offs0 + count);
+  for (int i = 0; ok && i < count; ++i) {
+    const Entry *e = entryAt(t, first + i);
+    if (!e || !db.seek(e->nameOff)) {
+      ok = false;
+      break;
+    }
+    size_t at = names.size();
+    names.resize(at + e->nameLen + 1);
+    ok = db.read((uint8_t *)&names[at], e->nameLen) == e->nameLen;
+    names[at + e->nameLen] = '\0';
+    offs.push_back(at);
+  }
+  if (db)
+    db.close();
+  xSemaphoreGive(s_indexMutex);
+  if (!ok) {
+    names.resize(names0);
+    offs.resize(offs0);
+  }
+  return ok;
+}
@@ -0,0 +1,68 @@
+// Card-wide media library index built by a background task
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+enum class MediaType : uint8_t { MEDIA_NONE = 0, MEDIA_MUSIC, MEDIA_BOOK };
+
+// Classify a file name by extension (case-insensitive)
+MediaType mediaTypeForName(const String &name);
+
+// The index lives in /.aria/media.db on the card. The database is a flat
+// sequence of directory blocks; each block carries a stamp (hash of the
+// directory listing). A rescan lists every directory once, writing the
+// new records as it goes; when every stamp matches the previous database
+// the old file and the loaded index are kept, so nothing is reloaded.
+//
+// Only compact per-entry handles (name offset into the db file, directory
+// id) are kept in RAM; paths are read back from the card on demand.
+class MediaIndex {
+public:
+  MediaIndex();
+  // spawn the background scanner (no-op if one is already running)
+  void beginBackgroundScan();
+  bool ready() const { return isReady; }
+  bool scanning() const { return isScanning; }
+  // bumped every time a new index is published; pages compare it to know
+  // when to refresh virtual listings
+  uint32_t generation() const { return gen; }
+
+  int count(MediaType t) const;
+  // absolute path of the i-th entry of the given type ("" if out of range)
+  String pathAt(MediaType t, int i);
+  // basename only (cheaper: no directory lookup)
+  String nameAt(MediaType t, int i);
+  // entries of one directory are contiguous: the first one's index and
+  // how many there are (false if the directory holds none of type t)
+  bool folderRange(MediaType t, const String &dir, int &first, int &count);
+  // basenames of entries first..first+count-1, read in one pass
+  bool namesAt(MediaType t, int first, int count, std::vector<String> &out);
+  // the same packed into one buffer: each name NUL terminated, offs[i]
+  // where the i-th starts (appended to what the vectors already hold)
+  bool namesAt(MediaType t, int first, int count, std::vector<char> &names,
+               std::vector<uint32_t> &offs);
+
+  // run the scan synchronously (used by the background task)
+  void scanNow();
+
+  struct Entry {
+    uint32_t nameOff;     // byte offset of the name inside media.db
+    uint32_t dir : 24;    // index into dirs
+    uint32_t nameLen : 8;
+  };
+
+private:
+  std::vector<String> dirs;
+  std::vector<Entry> music;
+  std::vector<Entry> books;
+  volatile bool isReady = false;
+  volatile bool isScanning = false;
+  volatile uint32_t gen = 0;
+
+  bool load();
+  const Entry *entryAt(MediaType t, int i) const;
+  String readName(const Entry &e);
+};
+
+extern MediaIndex gMediaIndex;
@@ -0,0 +1,315 @@
+#include "track_meta.h"
+#include "../spi_bus.h"
+#include "../utils/hash.h"
+#include "media_index.h"
+#include <SD.h>
+#include <algorithm>
+
+TrackMetaCache gTrackMeta;
+
+static const char *META_DIR = "/.aria";
+static const char *META_PATH = "/.aria/meta.db";
+static const char *META_TMP_PATH = "/.aria/meta.tmp";
+static const uint32_t META_MAGIC = 0x41544D41; // "AMTA"
+static const uint16_t META_VERSION = 1;
+// header: magic u32, version u16, reserved u16
+static const size_t META_HEADER_SIZE = 8;
+// record: hash u32, file size u32, duration u32, title/artist/album
+// lengths u8 x3, reserved u8, then the three UTF-8 strings
+static const size_t RECORD_HEADER_SIZE = 16;
+static const size_t MAX_FIELD = 96;
+// meta.db is rewritten once this many records, and at least a quarter of
+// them, are superseded or belong to tracks no longer on the card
+static const size_t COMPACT_MIN_DEAD = 64;
+// decoded records kept in RAM (current track, visible rows)
+static const int RECENT_COUNT = 6;
+
+struct RecentMeta {
+  uint32_t hash = 0;
+  uint32_t size = 0;
+  uint32_t used = 0;
+  TrackMeta meta;
+};
+static RecentMeta s_recent[RECENT_COUNT];
+static uint32_t s_recentClock = 0;
+
+// cut to MAX_FIELD bytes without splitting a UTF-8 sequence
+static String clipField(const String &s) {
+  if (s.length() <= MAX_FIELD)
+    return s;
+  size_t n = MAX_FIELD;
+  while (n > 0 && ((uint8_t)s[n] & 0xC0) == 0x80)
+    n--;
+  return s.substring(0, n);
+}
+
+static RecentMeta *findRecent(uint32_t hash) {
+  for (int i = 0; i < RECENT_COUNT; ++i)
+    if (s_recent[i].used && s_recent[i].hash == hash) {
+      s_recent[i].used = ++s_recentClock;
+      return &s_recent[i];
+    }
+  return nullptr;
+}
+
+static void putRecent(uint32_t hash, uint32_t size, const TrackMeta &m) {
+  RecentMeta *r = &s_recent[0];
+  for (int i = 0; i < RECENT_COUNT; ++i) {
+    if (s_recent[i].used && s_recent[i].hash == hash) {
+      r = &s_recent[i];
+      break;
+    }
+    if (s_recent[i].used < r->used)
+      r = &s_recent[i];
+  }
+  r->hash = hash;
+  r->size = size;
+  r->meta = m;
+  r->used = ++s_recentClock;
+}
+
+// Build the hash -> offset table from meta.db (caller holds the bus)
+void TrackMetaCache::load() {
+  loaded = true;
+  slots.clear();
+  File db = SD.open(META_PATH);
+  if (!db)
+    return;
+  uint8_t h[RECORD_HEADER_SIZE];
+  uint32_t magic = 0;
+  uint16_t ver = 0;
+  if (db.read(h, META_HEADER_SIZE) == META_HEADER_SIZE) {
+    memcpy(&magic, h, 4);
+    memcpy(&ver, h + 4, 2);
+  }
+  if (magic != META_MAGIC || ver != META_VERSION) {
+    db.close();
+    SD.remove(META_PATH); // unknown layout: start over
+    return;
+  }
+  uint32_t off = META_HEADER_SIZE;
+  uint32_t end = db.size();
+  while (off + RECORD_HEADER_SIZE <= end) {
+    if (db.read(h, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE)
+      break;
+    uint32_t len = RECORD_HEADER_SIZE + h[12] + h[13] + h[14];
+    if (off + len > end)
+      break; // torn append at the end
+    Slot s;
+    memcpy(&s.hash, h, 4);
+    s.off = off;
+    slots.push_back(s);
+    off += len;
+    if (!db.seek(off))
+      break;
+  }
+  db.close();
+  Serial.println("TrackMeta: " + String(slots.size()) + " cached tracks");
+}
+
+const TrackMetaCache::Slot *TrackMetaCache::find(uint32_t hash) const {
+  // newest record wins: a changed file is appended again
+  for (size_t i = slots.size(); i-- > 0;)
+    if (slots[i].hash == hash)
+      return &slots[i];
+  return nullptr;
+}
+
+bool TrackMetaCache::readRecord(uint32_t off, uint32_t &size, TrackMeta &out) {
+  File db = SD.open(META_PATH);
+  if (!db)
+    return false;
+  uint8_t h[RECORD_HEADER_SIZE];
+  bool ok = db.seek(off) && db.read(h, sizeof(h)) == sizeof(h);
+  char buf[MAX_FIELD + 1];
+  String *fields[3] = {&out.title, &out.artist, &out.album};
+  for (int i = 0; ok && i < 3; ++i) {
+    uint8_t n = h[12 + i];
+    ok = n <= MAX_FIELD && db.read((uint8_t *)buf, n) == n;
+    buf[ok ? n : 0] = '\0';
+    *fields[i] = String(buf);
+  }
+  db.close();
+  if (ok) {
+    memcpy(&size, h + 4, 4);
+    memcpy(&out.durationMs, h + 8, 4);
+  }
+  return ok;
+}
+
+void TrackMetaCache::append(uint32_t hash, uint32_t size, const TrackMeta &m) {
+  String f[3] = {clipField(m.title), clipField(m.artist), clipField(m.album)};
+  SD.mkdir(META_DIR);
+  bool fresh = !SD.exists(META_PATH);
+  File db = SD.open(META_PATH, fresh ? FILE_WRITE : FILE_APPEND);
+  if (!db)
+    return;
+  if (fresh) {
+    uint8_t h[META_HEADER_SIZE] = {0};
+    memcpy(h, &META_MAGIC, 4);
+    memcpy(h + 4, &META_VERSION, 2);
+    db.write(h, sizeof(h));
+  }
+  uint32_t off = db.size();
+  uint8_t h[RECORD_HEADER_SIZE] = {0};
+  memcpy(h, &hash, 4);
+  memcpy(h + 4, &size, 4);
+  memcpy(h + 8, &m.durationMs, 4);
+  for (int i = 0; i < 3; ++i)
+    h[12 + i] = (uint8_t)f[i].length();
+  db.write(h, sizeof(h));
+  for (int i = 0; i < 3; ++i)
+    db.write((const uint8_t *)f[i].c_str(), f[i].length());
+  db.close();
+  slots.push_back({hash, off});
+}
+
+bool TrackMetaCache::lookup(const String &path, TrackMeta &out) {
+  uint32_t hash = fnv1a(path);
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  RecentMeta *r = findRecent(hash);
+  if (r) {
+    out = r->meta;
+    return true;
+  }
+  if (!loaded)
+    load();
+  const Slot *s = find(hash);
+  uint32_t size = 0;
+  if (!s || !readRecord(s->off, size, out))
+    return false;
+  putRecent(hash, size, out);
+  return true;
+}
+
+bool TrackMetaCache::get(const String &path, TrackMeta &out) {
+  uint32_t hash = fnv1a(path);
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  File f = SD.open(path);
+  if (!f)
+    return false;
+  uint32_t size = f.size();
+  f.close();
+  RecentMeta *r = findRecent(hash);
+  if (r && r->size == size) {
+    out = r->meta;
+    return true;
+  }
+  if (!loaded)
+    load();
+  const Slot *s = find(hash);
+  uint32_t cachedSize = 0;
+  if (s && readRecord(s->off, cachedSize, out) && cachedSize == size) {
+    putRecent(hash, size, out);
+    return true;
+  }
+  // only MP3 and raw AAC carry ID3; other formats are cached empty so
+  // they are not probed again
+  out = TrackMeta();
+  String lower = path;
+  lower.toLowerCase();
+  if (lower.endsWith(".mp3") || lower.endsWith(".aac"))
+    readId3(path, out);
+  append(hash, size, out);
+  putRecent(hash, size, out);
+  return true;
+}
+
+void TrackMetaCache::fillFromLibrary() {
+  unsigned long t0 = millis();
+  size_t before;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    before = slots.size();
+  }
+  int n = gMediaIndex.count(MediaType::MEDIA_MUSIC);
+  std::vector<uint32_t> live;
+  live.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    String p = gMediaIndex.pathAt(MediaType::MEDIA_MUSIC, i);
+    TrackMeta m;
+    if (p.length() > 0) {
+      get(p, m);
+      live.push_back(fnv1a(p));
+    }
+    // the bus is free between tracks; let the panel and playback in
+    vTaskDelay(1);
+  }
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  if (slots.size() != before)
+    Serial.println("TrackMeta: tagged " + String(slots.size() - before) +
+                   " tracks in " + String(millis() - t0) + " ms");
+  // an empty or failed scan says nothing about which tracks are gone
+  if (!live.empty())
+    compact(live);
+}
+
+// Rewrite meta.db with only the newest record of each track in the
+// library `live` (path hashes), if enough of it is dead. Caller holds the
+// bus.
+void TrackMetaCache::compact(std::vector<uint32_t> &live) {
+  if (!loaded)
+    load();
+  std::sort(live.begin(), live.end());
+  // slots by hash, oldest first within a hash: the last of a run wins
+  std::vector<uint32_t> order(slots.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return slots[a].hash != slots[b].hash ? slots[a].hash < slots[b].hash
+                                          : a < b;
+  });
+  std::vector<bool> keep(slots.size(), false);
+  size_t kept = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    uint32_t h = slots[order[i]].hash;
+    bool newest = i + 1 == order.size() || slots[order[i + 1]].hash != h;
+    if (newest && std::binary_search(live.begin(), live.end(), h)) {
+      keep[order[i]] = true;
+      kept++;
+    }
+  }
+  size_t dead = slots.size() - kept;
+  if (dead < COMPACT_MIN_DEAD || dead * 4 < slots.size())
+    return;
+
+  File db = SD.open(META_PATH);
+  File out = SD.open(META_TMP_PATH, FILE_WRITE);
+  bool ok = db && out;
+  uint8_t buf[RECORD_HEADER_SIZE + 3 * MAX_FIELD];
+  if (ok) {
+    memcpy(buf, &META_MAGIC, 4);
+    memcpy(buf + 4, &META_VERSION, 2);
+    memset(buf + 6, 0, 2);
+    ok = out.write(buf, META_HEADER_SIZE) == META_HEADER_SIZE;
+  }
+  std::vector<Slot> next;
+  next.reserve(kept);
+  uint32_t at = META_HEADER_SIZE;
+  for (size_t i = 0; ok && i < slots.size(); ++i) {
+    if (!keep[i])
+      continue;
+    ok = db.seek(slots[i].off) &&
+         db.read(buf, RECORD_HEADER_SIZE) == RECORD_HEADER_SIZE;
+    size_t len = RECORD_HEADER_SIZE + buf[12] + buf[13] + buf[14];
+    ok = ok && len <= sizeof(buf) &&
+         db.read(buf + RECORD_HEADER_SIZE, len - RECORD_HEADER_SIZE) ==
+             len - RECORD_HEADER_SIZE &&
+         out.write(buf, len) == len;
+    next.push_back({slots[i].hash, at});
+    at += len;
+  }
+  if (db)
+    db.close();
+  if (out)
+    out.close();
+  if (!ok) {
+    SD.remove(META_TMP_PATH);
+    return;
+  }
+  SD.remove(META_PATH);
+  SD.rename(META_TMP_PATH, META_PATH);
+  slots.swap(next);
+  Serial.println("TrackMeta: compacted, dropped " + String(dead) +
+                 " records, kept " + String(kept));
+}
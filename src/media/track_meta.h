@@ -0,0 +1,42 @@
+// Cache of parsed track tags (title/artist/album/duration)
+#pragma once
+
+#include "id3.h"
+#include <Arduino.h>
+#include <vector>
+
+// Records are appended to /.aria/meta.db, keyed by a hash of the path and
+// the file size (a replaced file gets a new record; after a library fill
+// the file is rewritten without the dead records once there are enough of
+// them). RAM holds only a
+// hash -> offset table (8 bytes per track) and the last few decoded
+// records, so list views can show titles without touching the tags.
+// Every call runs under the SD bus lock, which also keeps the UI and the
+// media scan task from appending at the same time.
+class TrackMetaCache {
+public:
+  // cached entry only; never opens the track itself
+  bool lookup(const String &path, TrackMeta &out);
+  // cached entry, or parse the tags and add them. Checks the file size,
+  // so a changed file is parsed again.
+  bool get(const String &path, TrackMeta &out);
+  // parse every library track that has no entry yet (media scan task)
+  void fillFromLibrary();
+
+  struct Slot {
+    uint32_t hash;
+    uint32_t off; // record offset in meta.db
+  };
+
+private:
+  std::vector<Slot> slots;
+  bool loaded = false;
+
+  void load();
+  const Slot *find(uint32_t hash) const;
+  bool readRecord(uint32_t off, uint32_t &size, TrackMeta &out);
+  void append(uint32_t hash, uint32_t size, const TrackMeta &m);
+  void compact(std::vector<uint32_t> &live);
+};
+
+extern TrackMetaCache gTrackMeta;
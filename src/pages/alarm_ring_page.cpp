@@ -0,0 +1,58 @@
+#include "alarm_ring_page.h"
+#include "../app_context.h"
+#include "alarms_page.h"
+
+void AlarmRingPage::render(bool full) {
+  int idx = ringingAlarm();
+  if (idx < 0)
+    return;
+  Alarm a = getAlarmCfg(idx);
+  if (full) {
+    refreshInProgress = true;
+    display.setFullWindow();
+  } else {
+    display.setPartialWindow(0, 0, display.width(), display.height());
+  }
+  display.firstPage();
+  do {
+    display.fillScreen(GxEPD_WHITE);
+    u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+    u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+    String hh = (a.hour < 10 ? "0" : "") + String(a.hour);
+    String mm = (a.minute < 10 ? "0" : "") + String(a.minute);
+    String title = "闹钟 " + hh + ":" + mm;
+    int tw = u8g2Fonts.getUTF8Width(title.c_str());
+    u8g2Fonts.setCursor((display.width() - tw) / 2 - 20,
+                        display.height() / 2 - 6);
+    u8g2Fonts.print(title);
+    String tip = "按任意键关闭";
+    int tw2 = u8g2Fonts.getUTF8Width(tip.c_str());
+    u8g2Fonts.setCursor((display.width() - tw2) / 2 - 20,
+                        display.height() / 2 + 12);
+    u8g2Fonts.print(tip);
+    // missed alarm rung late (after a long sleep or blocking work)
+    uint32_t late = ringingAlarmLateS();
+    if (late >= 60) {
+      String note = "已错过 " + String(late / 60) + " 分钟";
+      int tw3 = u8g2Fonts.getUTF8Width(note.c_str());
+      u8g2Fonts.setCursor((display.width() - tw3) / 2 - 20,
+                          display.height() / 2 + 30);
+      u8g2Fonts.print(note);
+    }
+  } while (display.nextPage());
+  if (full)
+    refreshInProgress = false;
+}
+
+bool AlarmRingPage::onLeft() {
+  stopAlarm();
+  return true;
+}
+bool AlarmRingPage::onRight() {
+  stopAlarm();
+  return true;
+}
+bool AlarmRingPage::onCenter() {
+  stopAlarm();
+  return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "page.h"
+
+// Screen shown while an alarm rings (see startAlarmNow); any button
+// dismisses it and returns to the previous page
+class AlarmRingPage : public Page {
+public:
+  void render(bool full) override;
+  bool onLeft() override;
+  bool onRight() override;
+  bool onCenter() override;
+  const char *name() const override { return "alarm_ring"; }
+};
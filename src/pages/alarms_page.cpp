@@ -1,10 +1,7 @@
 #include "alarms_page.h"
 #include "../app_context.h"
 #include "../defines/pinconf.h"
-
-// Internal state same as legacy
-static Alarm s_alarms[5];
-static const char *ALARM_NS = "alarms_cfg";
+#include "../utils/lunar.h"
 
 // field indices
 static const int ALARM_FIELD_HOUR = 0;
@@ -12,46 +9,70 @@ static const int ALARM_FIELD_MIN = 1;
 static const int ALARM_FIELD_WEEK_START = 2;
 static const int ALARM_FIELD_TONE = 9;
 static const int ALARM_FIELD_ENABLED = 10;
+static const int ALARM_FIELD_KIND = 11;
+// shown in the kind slot as "删": CENTER removes the alarm
+static const int ALARM_FIELD_DELETE = 12;
+// the weekday columns hold the date fields of one-shot/lunar alarms
+static const int RULE_DATE_FIELDS = 3;
+// one-shot years offered, from this year on
+static const int ONCE_YEARS = 5;
 
-AlarmsPage::AlarmsPage() {
-  // defaults
-  for (int i = 0; i < 5; i++)
-    s_alarms[i] = {7, 0, 0, 1, false};
-  load();
+static bool fieldExists(const Alarm &a, int f) {
+  if (f >= ALARM_FIELD_WEEK_START && f < ALARM_FIELD_WEEK_START + 7)
+    return a.kind == ALARM_WEEKLY ||
+           f < ALARM_FIELD_WEEK_START + RULE_DATE_FIELDS;
+  return f >= ALARM_FIELD_HOUR && f <= ALARM_FIELD_DELETE;
 }
 
-void AlarmsPage::load() {
-  Preferences p;
-  if (p.begin(ALARM_NS, true)) {
-    size_t need = sizeof(s_alarms);
-    size_t got = p.getBytes("alarms", &s_alarms, need);
-    p.end();
-    if (got != need) { /* keep defaults */
-    }
-  }
+static int solarMonthDays(int y, int m) {
+  static const int mdays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  if (m < 1 || m > 12)
+    return 31;
+  bool leap = (y % 4 == 0 && y % 100 != 0) || (y % 400 == 0);
+  return mdays[m - 1] + (m == 2 && leap ? 1 : 0);
 }
 
-void AlarmsPage::save() {
-  Preferences p;
-  if (p.begin(ALARM_NS, false)) {
-    p.putBytes("alarms", &s_alarms, sizeof(s_alarms));
-    p.end();
-  }
+static Solar today() {
+  time_t raw = timeClient.getEpochTime();
+  struct tm *tm = localtime(&raw);
+  return Solar{tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday};
 }
 
-static Alarm getAlarm(int idx) {
-  if (idx < 0)
-    idx = 0;
-  if (idx > 4)
-    idx = 4;
-  return s_alarms[idx];
+// a new rule starts on today's (solar or lunar) date
+static void startRule(Alarm &a) {
+  Solar s = today();
+  if (a.kind == ALARM_ONCE) {
+    a.year = s.year;
+    a.month = s.month;
+    a.day = s.day;
+  } else if (a.kind == ALARM_LUNAR) {
+    Lunar l = SolarToLunar(s);
+    a.month = l.month;
+    a.day = l.day;
+    a.leap = false;
+  }
 }
+
+// rows that fit between the top margin and the divider
+static const int VISIBLE_ROWS = 5;
+
+AlarmsPage::AlarmsPage() {}
+
 // Public wrapper
-Alarm getAlarmCfg(int idx) { return getAlarm(idx); }
-static void setAlarm(int idx, const Alarm &a) {
-  if (idx < 0 || idx > 4)
-    return;
-  s_alarms[idx] = a;
+Alarm getAlarmCfg(int idx) { return gAlarmStore.get(idx); }
+
+int AlarmsPage::rowCount() {
+  int n = gAlarmStore.count();
+  return n < AlarmStore::MAX_ALARMS ? n + 1 : n;
+}
+
+void AlarmsPage::scrollTo(int row) {
+  if (row < 0)
+    topRow = 0;
+  else if (row < topRow)
+    topRow = row;
+  else if (row >= topRow + VISIBLE_ROWS)
+    topRow = row - VISIBLE_ROWS + 1;
 }
 
 void AlarmsPage::render(bool full) {
@@ -73,8 +94,10 @@ void AlarmsPage::render(bool full) {
   do {
     display.fillScreen(GxEPD_WHITE);
     u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
-    for (int r = 0; r < 5; r++) {
-      int y = startY + r * rowH + rowH;
+    int rows = rowCount();
+    for (int i = 0; i < VISIBLE_ROWS && topRow + i < rows; i++) {
+      int r = topRow + i;
+      int y = startY + i * rowH + rowH;
       bool h = (highlightedRow == r);
       int fieldLocal = (h && fieldCursor >= 0) ? fieldCursor : -1;
       drawRow(r, 0, y, rowW, rowH, fieldLocal, h);
@@ -100,13 +123,23 @@ bool AlarmsPage::onRight() {
     return true;
   }
   if (fieldCursor < 0) {
+    // on the "add" row: append an alarm and start editing it
+    if (highlightedRow >= gAlarmStore.count()) {
+      Alarm a = {7, 0, 0, 1, false};
+      if (gAlarmStore.add(a) < 0)
+        return true;
+      gAlarmStore.commit();
+    }
     fieldCursor = ALARM_FIELD_HOUR;
     render(false);
     lastInteraction = millis();
     return true;
   }
-  fieldCursor++;
-  if (fieldCursor > ALARM_FIELD_ENABLED)
+  Alarm a = gAlarmStore.get(highlightedRow);
+  do
+    fieldCursor++;
+  while (fieldCursor <= ALARM_FIELD_DELETE && !fieldExists(a, fieldCursor));
+  if (fieldCursor > ALARM_FIELD_DELETE)
     fieldCursor = -1;
   render(false);
   lastInteraction = millis();
@@ -119,12 +152,17 @@ bool AlarmsPage::onLeft() {
     return true;
   }
   if (fieldCursor < 0) {
-    fieldCursor = ALARM_FIELD_ENABLED;
+    if (highlightedRow >= gAlarmStore.count())
+      return true; // "add" row has no fields
+    fieldCursor = ALARM_FIELD_KIND;
     render(false);
     lastInteraction = millis();
     return true;
   }
-  fieldCursor--;
+  Alarm a = gAlarmStore.get(highlightedRow);
+  do
+    fieldCursor--;
+  while (fieldCursor >= ALARM_FIELD_HOUR && !fieldExists(a, fieldCursor));
   if (fieldCursor < ALARM_FIELD_HOUR)
     fieldCursor = -1;
   render(false);
@@ -137,6 +175,7 @@ bool AlarmsPage::onCenter() {
     int old = highlightedRow;
     highlightedRow = 0;
     fieldCursor = -1;
+    scrollTo(highlightedRow);
     if (old != highlightedRow &&
         highlightedRow >=
             0) { /* in-page selection, do not count as page switch */
@@ -148,13 +187,14 @@ bool AlarmsPage::onCenter() {
   if (fieldCursor < 0) {
     int oldRow = highlightedRow;
     int nextRow = highlightedRow + 1;
-    if (nextRow >= 5) {
+    if (nextRow >= rowCount()) {
       highlightedRow = -1;
       fieldCursor = -1;
     } else {
       highlightedRow = nextRow;
       fieldCursor = -1;
     }
+    scrollTo(highlightedRow);
     if (oldRow != highlightedRow &&
         highlightedRow >= 0) { /* row navigation inside page; do not count */
     }
@@ -162,21 +202,57 @@ bool AlarmsPage::onCenter() {
     lastInteraction = millis();
     return true;
   }
-  Alarm &a = s_alarms[highlightedRow];
+  if (fieldCursor == ALARM_FIELD_DELETE) {
+    // the row now shows the next alarm (or the "add" row)
+    gAlarmStore.remove(highlightedRow);
+    gAlarmStore.commit();
+    fieldCursor = -1;
+    scrollTo(highlightedRow);
+    render(false);
+    lastInteraction = millis();
+    return true;
+  }
+  Alarm a = gAlarmStore.get(highlightedRow);
   if (fieldCursor == ALARM_FIELD_HOUR)
     a.hour = (a.hour + 1) % 24;
   else if (fieldCursor == ALARM_FIELD_MIN)
     a.minute = (a.minute + 1) % 60;
   else if (fieldCursor >= ALARM_FIELD_WEEK_START &&
            fieldCursor < ALARM_FIELD_WEEK_START + 7) {
-    int wd = fieldCursor - ALARM_FIELD_WEEK_START;
-    a.weekdays ^= (1 << wd);
+    int rf = fieldCursor - ALARM_FIELD_WEEK_START;
+    if (a.kind == ALARM_ONCE) {
+      int y0 = today().year;
+      if (rf == 0)
+        a.year = (a.year < y0 || a.year >= y0 + ONCE_YEARS - 1) ? y0
+                                                                : a.year + 1;
+      else if (rf == 1)
+        a.month = (a.month % 12) + 1;
+      else
+        a.day = (a.day % solarMonthDays(a.year, a.month)) + 1;
+      // never leave a date that does not exist (02-30 would never ring)
+      if (a.day > solarMonthDays(a.year, a.month))
+        a.day = solarMonthDays(a.year, a.month);
+    } else if (a.kind == ALARM_LUNAR) {
+      if (rf == 0)
+        a.month = (a.month + 1) % 13; // 0 = every lunar month
+      else if (rf == 1)
+        a.day = (a.day % 30) + 1;
+      else
+        a.leap = !a.leap;
+    } else {
+      a.weekdays ^= (1 << rf);
+    }
   } else if (fieldCursor == ALARM_FIELD_TONE)
     a.tone = (a.tone % 5) + 1;
   else if (fieldCursor == ALARM_FIELD_ENABLED)
     a.enabled = !a.enabled;
-  setAlarm(highlightedRow, a);
-  save();
+  else if (fieldCursor == ALARM_FIELD_KIND) {
+    a.kind = (a.kind + 1) % 3;
+    startRule(a);
+  }
+  // rewrites only this alarm's record
+  gAlarmStore.set(highlightedRow, a);
+  gAlarmStore.commit();
   render(false);
   lastInteraction = millis();
   return true;
@@ -184,9 +260,22 @@ bool AlarmsPage::onCenter() {
 
 void AlarmsPage::drawRow(int rowIndex, int x, int y, int rowW, int rowH,
                          int fieldCursorLocal, bool highlightRow) {
-  Alarm a = s_alarms[rowIndex];
   int colX = x;
   u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+  if (rowIndex >= gAlarmStore.count()) {
+    // trailing row: RIGHT adds an alarm
+    if (highlightRow) {
+      display.fillRect(x, y - rowH - 1, rowW, rowH, GxEPD_BLACK);
+      u8g2Fonts.setForegroundColor(GxEPD_WHITE);
+    } else {
+      u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+    }
+    u8g2Fonts.setCursor(colX, y - 4);
+    u8g2Fonts.print("+ 新闹钟");
+    u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+    return;
+  }
+  Alarm a = gAlarmStore.get(rowIndex);
   String th = (a.hour < 10 ? "0" : "") + String(a.hour);
   String tm = (a.minute < 10 ? "0" : "") + String(a.minute);
   if (highlightRow) {
@@ -218,33 +307,63 @@ void AlarmsPage::drawRow(int rowIndex, int x, int y, int rowW, int rowH,
   rev = (fieldCursorLocal == ALARM_FIELD_MIN);
   drawField(fx, tm, rev);
   fx += 28;
-  const char *wdnames[] = {"日", "一", "二", "三", "四", "五", "六"};
-  for (int i = 0; i < 7; i++) {
-    bool on = (a.weekdays & (1 << i));
-    String txt = String(wdnames[i]);
-    if (on) {
-      int w = u8g2Fonts.getUTF8Width(txt.c_str());
-      int tx = fx;
-      int ty = y - 4;
-      int rectX = tx - 2;
-      int rectY = ty - 12;
-      int rectW = w + 4;
-      int rectH = 16;
-      int rectColor = highlightRow ? GxEPD_WHITE : GxEPD_BLACK;
-      display.drawRect(rectX, rectY, rectW, rectH, rectColor);
-      u8g2Fonts.setForegroundColor(highlightRow ? GxEPD_WHITE : GxEPD_BLACK);
-      u8g2Fonts.setCursor(tx, ty);
-      u8g2Fonts.print(txt);
-      u8g2Fonts.setForegroundColor(highlightRow ? GxEPD_WHITE : GxEPD_BLACK);
-    } else {
-      bool revwd = (fieldCursorLocal == (ALARM_FIELD_WEEK_START + i));
-      drawField(fx, txt, revwd);
+  auto two = [](int v) -> String { return (v < 10 ? "0" : "") + String(v); };
+  auto revRule = [&](int rf) {
+    return fieldCursorLocal == ALARM_FIELD_WEEK_START + rf;
+  };
+  if (a.kind == ALARM_ONCE) {
+    // yyyy-mm-dd in the weekday columns
+    drawField(fx, String(a.year), revRule(0));
+    drawField(fx + 26, "-", false);
+    drawField(fx + 32, two(a.month), revRule(1));
+    drawField(fx + 46, "-", false);
+    drawField(fx + 52, two(a.day), revRule(2));
+    fx += 7 * 18;
+  } else if (a.kind == ALARM_LUNAR) {
+    // 农 mm-dd 闰/平; month 每 = every lunar month
+    drawField(fx, "农", false);
+    drawField(fx + 16, a.month == 0 ? String("每") : two(a.month), revRule(0));
+    drawField(fx + 30, "-", false);
+    drawField(fx + 36, two(a.day), revRule(1));
+    drawField(fx + 54, a.leap ? "闰" : "平", revRule(2));
+    fx += 7 * 18;
+  } else {
+    const char *wdnames[] = {"日", "一", "二", "三", "四", "五", "六"};
+    for (int i = 0; i < 7; i++) {
+      bool on = (a.weekdays & (1 << i));
+      String txt = String(wdnames[i]);
+      if (on) {
+        int w = u8g2Fonts.getUTF8Width(txt.c_str());
+        int tx = fx;
+        int ty = y - 4;
+        int rectX = tx - 2;
+        int rectY = ty - 12;
+        int rectW = w + 4;
+        int rectH = 16;
+        int rectColor = highlightRow ? GxEPD_WHITE : GxEPD_BLACK;
+        display.drawRect(rectX, rectY, rectW, rectH, rectColor);
+        u8g2Fonts.setForegroundColor(highlightRow ? GxEPD_WHITE : GxEPD_BLACK);
+        u8g2Fonts.setCursor(tx, ty);
+        u8g2Fonts.print(txt);
+        u8g2Fonts.setForegroundColor(highlightRow ? GxEPD_WHITE : GxEPD_BLACK);
+      } else {
+        bool revwd = (fieldCursorLocal == (ALARM_FIELD_WEEK_START + i));
+        drawField(fx, txt, revwd);
+      }
+      fx += 18;
     }
-    fx += 18;
   }
   bool revTone = (fieldCursorLocal == ALARM_FIELD_TONE);
   drawField(fx, String(a.tone), revTone);
   fx += 24;
   bool revEn = (fieldCursorLocal == ALARM_FIELD_ENABLED);
   drawField(fx, String(a.enabled ? "开" : "关"), revEn);
+  fx += 18;
+  static const char *kindNames[] = {"周", "单", "农"};
+  if (fieldCursorLocal == ALARM_FIELD_DELETE) {
+    drawField(fx, "删", true);
+  } else {
+    bool revKind = (fieldCursorLocal == ALARM_FIELD_KIND);
+    drawField(fx, String(kindNames[a.kind % 3]), revKind);
+  }
 }
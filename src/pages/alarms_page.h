@@ -1,14 +1,6 @@
 #pragma once
+#include "../alarms/store.h"
 #include "page.h"
-#include <Preferences.h>
-
-struct Alarm {
-  uint8_t hour;
-  uint8_t minute;
-  uint8_t weekdays;
-  uint8_t tone;
-  bool enabled;
-};
 
 class AlarmsPage : public Page {
 public:
@@ -22,12 +14,14 @@ public:
 private:
   int highlightedRow = -1;
   int fieldCursor = -1;
+  int topRow = 0; // first alarm on screen
 
   void drawRow(int rowIndex, int x, int y, int rowW, int rowH,
                int fieldCursorLocal, bool highlightRow);
-  void load();
-  void save();
+  // alarms plus the trailing "add" row while the table has room
+  int rowCount();
+  void scrollTo(int row);
 };
   
-// Public accessor for other modules
+// Public accessor for other modules (see gAlarmStore)
 Alarm getAlarmCfg(int idx);
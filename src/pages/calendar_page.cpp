@@ -4,7 +4,7 @@
 
 CalendarPage::CalendarPage() {
   // default to today
-  timeClient.update();
+  timeClientUpdate();
   time_t rawtime = timeClient.getEpochTime();
   struct tm *timeinfo = localtime(&rawtime);
   selectedYear = timeinfo->tm_year + 1900;
@@ -190,7 +190,7 @@ void CalendarPage::render(bool full) {
 
     int dividerY = display.height() - 18;
     display.drawFastHLine(0, dividerY, display.width(), GxEPD_BLACK);
-    timeClient.update();
+    timeClientUpdate();
     time_t rawtime = timeClient.getEpochTime();
     struct tm *timeinfo = localtime(&rawtime);
     int year = timeinfo->tm_year + 1900;
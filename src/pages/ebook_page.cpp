@@ -4,6 +4,7 @@
 #include <SD.h>
 
 #include <Preferences.h>
+#include "../spi_bus.h"
 #include "../utils/utils.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -47,10 +48,13 @@ bool EBookPage::buildPageIndex(const String &absPath) {
   // Lazy indexing: only set up initial state (first page). Heavy scanning is deferred.
   pageOffsets.clear();
   openedPath = absPath;
-  File f = SD.open(absPath.c_str());
-  if (!f) return false;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File f = SD.open(absPath.c_str());
+    if (!f) return false;
+    f.close();
+  }
   pageOffsets.push_back(0); // first page starts at byte 0
-  f.close();
   // compute first couple pages synchronously to ensure pagination is available
   // immediately after opening (avoid showing only one page for large files)
   ensurePageIndexUpTo(2);
@@ -59,6 +63,7 @@ bool EBookPage::buildPageIndex(const String &absPath) {
 
 // compute the byte offset where the next page starts given a start offset in the file
 unsigned long EBookPage::computeNextPageOffset(unsigned long startOffset) {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
   File f = SD.open(openedPath.c_str());
   if (!f) return startOffset;
   unsigned long offset = startOffset;
@@ -78,7 +83,15 @@ unsigned long EBookPage::computeNextPageOffset(unsigned long startOffset) {
     return u8g2Fonts.getUTF8Width(tmp);
   };
 
+  // the precompute task runs this concurrently with display refreshes:
+  // step aside for a waiting panel transfer every 1 KB read (multi-byte
+  // characters step over exact multiples, so count since the last yield)
+  unsigned long lastYield = startOffset;
   while (f.available()) {
+    if (offset - lastYield >= 1024) {
+      spiBusYield(SpiClient::SPI_CLIENT_SD);
+      lastYield = offset;
+    }
     uint8_t first = f.read();
     offset++;
     int cb = 1;
@@ -165,6 +178,7 @@ bool EBookPage::ensurePageIndexUpTo(int idx) {
   // fetch file size once to avoid repeated open/close
   unsigned long fsz = 0xFFFFFFFF;
   {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
     File ff = SD.open(openedPath.c_str());
     if (ff) { fsz = (unsigned long)ff.size(); ff.close(); }
   }
@@ -205,10 +219,14 @@ void EBookPage::startPrecomputeAsync(int centerIndex) {
 
 int EBookPage::estimateTotalPagesApprox() {
   if (openedPath.length() == 0) return 0;
-  File f = SD.open(openedPath.c_str());
-  if (!f) return 0;
-  unsigned long fsz = (unsigned long)f.size();
-  f.close();
+  unsigned long fsz = 0;
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File f = SD.open(openedPath.c_str());
+    if (!f) return 0;
+    fsz = (unsigned long)f.size();
+    f.close();
+  }
   // compute first page length in bytes (ensure it's available)
   if (!ensurePageIndexUpTo(0)) return 1;
   unsigned long firstStart = pageOffsets.size() > 0 ? pageOffsets[0] : 0;
@@ -224,6 +242,7 @@ int EBookPage::estimateTotalPagesApprox() {
 String EBookPage::loadPageContent(int idx) {
   String out;
   if (idx < 0 || idx >= (int)pageOffsets.size()) return out;
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
   File f = SD.open(openedPath.c_str());
   if (!f) return out;
   // ensure we have the end offset for this page to avoid reading to EOF
@@ -2,11 +2,95 @@
 #include "../app_context.h"
 #include "../utils/utils.h"
 #include "defines/pinconf.h"
+#include "../media/media_index.h"
+#include "../media/track_meta.h"
+#include "../sd_card.h"
+#include "../spi_bus.h"
 #include "ebook_page.h"
 #include "page_manager.h"
 #include <FS.h>
 #include <SD.h>
 
+// Virtual folders served from the media index. ':' is not a valid FAT name
+// character, so these paths can never collide with a real directory; the
+// labels are bracketed with '<' '>', which FAT names cannot hold either, so
+// a real folder can never be listed (or opened) as one of them.
+static const char *VDIR_MUSIC = "/:music";
+static const char *VDIR_BOOKS = "/:books";
+static const char *VLABEL_MUSIC = "<全部音乐>/";
+static const char *VLABEL_BOOKS = "<全部电子书>/";
+
+// control entries offered next to the candidate characters while filtering
+static const char *FILTER_DONE = "[确定]";
+static const char *FILTER_BACK = "[退格]";
+
+static int utf8CharLen(uint8_t c) {
+  if ((c & 0x80) == 0)
+    return 1;
+  if ((c & 0xE0) == 0xC0)
+    return 2;
+  if ((c & 0xF0) == 0xE0)
+    return 3;
+  if ((c & 0xF8) == 0xF0)
+    return 4;
+  return 1;
+}
+
+// ASCII case folding; multi-byte characters are compared as-is
+static String foldCase(const String &s) {
+  String out = s;
+  for (unsigned i = 0; i < out.length(); ++i) {
+    char c = out[i];
+    if (c >= 'A' && c <= 'Z')
+      out[i] = c - 'A' + 'a';
+  }
+  return out;
+}
+
+static bool foldedStartsWith(const char *name, const String &foldedPrefix) {
+  for (unsigned i = 0; i < foldedPrefix.length(); ++i) {
+    char c = name[i];
+    if (c == '\0')
+      return false;
+    if (c >= 'A' && c <= 'Z')
+      c = c - 'A' + 'a';
+    if (c != foldedPrefix[i])
+      return false;
+  }
+  return true;
+}
+
+static MediaType virtualDirType(const String &dir) {
+  if (dir == VDIR_MUSIC)
+    return MediaType::MEDIA_MUSIC;
+  if (dir == VDIR_BOOKS)
+    return MediaType::MEDIA_BOOK;
+  return MediaType::MEDIA_NONE;
+}
+
+bool FilesPage::inVirtualDir() const {
+  return virtualDirType(currentDir) != MediaType::MEDIA_NONE;
+}
+
+// number of virtual folders listed at the top of the root directory
+int FilesPage::virtualRootCount() {
+  if (currentDir != "/" || !gMediaIndex.ready())
+    return 0;
+  int n = 0;
+  if (gMediaIndex.count(MediaType::MEDIA_MUSIC) > 0)
+    n++;
+  if (gMediaIndex.count(MediaType::MEDIA_BOOK) > 0)
+    n++;
+  return n;
+}
+
+String FilesPage::virtualRootLabel(int i) {
+  // music first, empty folders are not listed
+  if (i == 0 && gMediaIndex.count(MediaType::MEDIA_MUSIC) > 0)
+    return String(VLABEL_MUSIC);
+  return String(VLABEL_BOOKS);
+}
+
 // detect SD insertion/removal and update internal state. Rate-limited.
 void FilesPage::detectSdChange() {
   static unsigned long lastSdPollMs = 0;
@@ -15,7 +99,7 @@ void FilesPage::detectSdChange() {
     return; // poll at most twice per second
   lastSdPollMs = now;
 
-  bool current = SD.begin(SD_CS_PIN);
+  bool current = sdEnsureMounted();
   if (current != sdAvailable) {
     sdAvailable = current;
     if (sdAvailable) {
@@ -26,7 +110,8 @@ void FilesPage::detectSdChange() {
       refreshEntries();
     } else {
       // removed -> clear listing
-      allEntries.clear();
+      clearFilter();
+      clearListing();
       totalEntries = 0;
       topIndex = 0;
       highlightedRow = -1;
@@ -47,12 +132,26 @@ FilesPage::FilesPage() {
 String FilesPage::getEntryNameAt(int absIndex) {
   if (absIndex < 0)
     return String();
+  if (filterActive) {
+    // filtered view: served from the cached listing, no parent entry
+    if (absIndex >= (int)filterMatches.size())
+      return String();
+    return String(listedName(filterMatches[absIndex]));
+  }
   bool hasParent = (currentDir != "/");
   if (hasParent) {
     if (absIndex == 0)
       return String("../");
     absIndex -= 1; // skip parent when scanning dir
   }
+  MediaType vt = virtualDirType(currentDir);
+  if (vt != MediaType::MEDIA_NONE)
+    return gMediaIndex.nameAt(vt, absIndex);
+  int vcount = virtualRootCount();
+  if (absIndex < vcount)
+    return virtualRootLabel(absIndex);
+  absIndex -= vcount;
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
   File root = SD.open(currentDir.c_str());
   if (!root)
     return String();
@@ -78,16 +177,27 @@ void FilesPage::pollSd() { detectSdChange(); }
 void FilesPage::refreshEntries() {
   // Lazy counting of entries to avoid loading large directories into RAM
   totalEntries = 0;
-  sdAvailable = SD.begin(SD_CS_PIN);
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  // the listing may have changed: drop filter state and the cached names
+  clearFilter();
+  clearListing();
+  sdAvailable = sdEnsureMounted();
   if (!sdAvailable) {
     totalEntries = 0;
     topIndex = 0;
     highlightedRow = -1;
     return;
   }
+  indexGen = gMediaIndex.generation();
+  MediaType vt = virtualDirType(currentDir);
   // count entries
-  File dir = SD.open(currentDir.c_str());
-  if (!dir) {
+  File dir;
+  if (vt == MediaType::MEDIA_NONE)
+    dir = SD.open(currentDir.c_str());
+  if (vt != MediaType::MEDIA_NONE) {
+    // virtual folder: served from the in-RAM index, plus parent entry
+    totalEntries = gMediaIndex.count(vt) + 1;
+  } else if (!dir) {
     totalEntries = 0;
   } else {
     int cnt = 0;
@@ -97,8 +207,9 @@ void FilesPage::refreshEntries() {
       f = dir.openNextFile();
     }
     dir.close();
-    // include parent entry if not root
-    totalEntries = cnt + ((currentDir == "/") ? 0 : 1);
+    // include parent entry if not root, virtual folders at root
+    totalEntries =
+        cnt + ((currentDir == "/") ? virtualRootCount() : 1);
   }
 
   // clamp indices
@@ -130,6 +241,15 @@ void FilesPage::fillVisibleCache() {
     if (idx >= totalEntries)
       break;
     String nm = getEntryNameAt(idx);
+    // library rows show the tag title when the metadata cache has one
+    if (!filterActive && idx > 0 &&
+        virtualDirType(currentDir) == MediaType::MEDIA_MUSIC) {
+      TrackMeta m;
+      if (gTrackMeta.lookup(gMediaIndex.pathAt(MediaType::MEDIA_MUSIC, idx - 1),
+                            m) &&
+          m.title.length() > 0)
+        nm = m.artist.length() > 0 ? m.artist + " - " + m.title : m.title;
+    }
     visibleCache.push_back(nm);
   }
 }
@@ -137,6 +257,15 @@ void FilesPage::fillVisibleCache() {
 void FilesPage::render(bool full) {
   // detect SD insertion/removal before rendering
   pollSd();
+  // the background indexer published a new library: rebuild listings that
+  // depend on it
+  if (sdAvailable && (currentDir == "/" || inVirtualDir()) &&
+      indexGen != gMediaIndex.generation()) {
+    if (filterActive)
+      reapplyFilter();
+    else
+      refreshEntries();
+  }
   const int startY = 20;
   const int rowH = 18;
   const int rowW = display.width() - 20;
@@ -195,18 +324,7 @@ void FilesPage::render(bool full) {
         }
       }
       // footer
-      int dividerY = display.height() - footerHeight;
-      display.drawFastHLine(0, dividerY, display.width(), GxEPD_BLACK);
-      // ensure footer text uses black foreground
-      u8g2Fonts.setForegroundColor(GxEPD_BLACK);
-      u8g2Fonts.setCursor(5, dividerY + 15);
-      u8g2Fonts.print("< 闹钟");
-      u8g2Fonts.setCursor(172, dividerY + 15);
-      u8g2Fonts.print("设置 >");
-      String title = "文件浏览";
-      int tw = u8g2Fonts.getUTF8Width(title.c_str());
-      u8g2Fonts.setCursor((display.width() - tw) / 2 - 20, dividerY + 15);
-      u8g2Fonts.print(title);
+      drawFooter(display.height() - footerHeight);
     } while (display.nextPage());
     refreshInProgress = false;
     return;
@@ -271,6 +389,43 @@ void FilesPage::render(bool full) {
 
   // Draw footer area with a separate partial update to ensure it's correct for
   // this page
+  renderFooterPartial();
+}
+
+// footer: page navigation hints, or the filter prompt while filtering
+void FilesPage::drawFooter(int dividerY) {
+  display.drawFastHLine(0, dividerY, display.width(), GxEPD_BLACK);
+  // explicitly set font and foreground for footer
+  u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+  u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+  if (filterActive) {
+    String txt = String("筛选:") + filterPrefix;
+    int n = (int)filterMatches.size();
+    if (filterEditing && filterChoice < (int)filterChoices.size()) {
+      const String &c = filterChoices[filterChoice];
+      txt += String("[") + (c == " " ? String("_") : c) + String("]");
+      n = filterChoiceCounts[filterChoice];
+    }
+    String cnt = String(n) + String("项");
+    int cw = u8g2Fonts.getUTF8Width(cnt.c_str());
+    u8g2Fonts.setCursor(5, dividerY + 15);
+    u8g2Fonts.print(fitToWidthSingleLine(txt, 172 - 5 - 8));
+    u8g2Fonts.setCursor(display.width() - 40 - cw, dividerY + 15);
+    u8g2Fonts.print(cnt);
+    return;
+  }
+  u8g2Fonts.setCursor(5, dividerY + 15);
+  u8g2Fonts.print("< 闹钟");
+  u8g2Fonts.setCursor(172, dividerY + 15);
+  u8g2Fonts.print("设置 >");
+  String title = "文件浏览";
+  int tw = u8g2Fonts.getUTF8Width(title.c_str());
+  u8g2Fonts.setCursor((display.width() - tw) / 2 - 20, dividerY + 15);
+  u8g2Fonts.print(title);
+}
+
+void FilesPage::renderFooterPartial() {
+  const int footerHeight = 18;
   int dividerY = display.height() - footerHeight;
   int footerPartialY = dividerY - 4;
   int footerPartialH = footerHeight + 8;
@@ -278,24 +433,29 @@ void FilesPage::render(bool full) {
   display.firstPage();
   do {
     display.fillScreen(GxEPD_WHITE);
-    display.drawFastHLine(0, dividerY, display.width(), GxEPD_BLACK);
-    // explicitly set font and foreground for footer
-    u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
-    u8g2Fonts.setForegroundColor(GxEPD_BLACK);
-    u8g2Fonts.setCursor(5, dividerY + 15);
-    u8g2Fonts.print("< 闹钟");
-    u8g2Fonts.setCursor(172, dividerY + 15);
-    u8g2Fonts.print("设置 >");
-    String title = "文件浏览";
-    int tw = u8g2Fonts.getUTF8Width(title.c_str());
-    u8g2Fonts.setCursor((display.width() - tw) / 2 - 20, dividerY + 15);
-    u8g2Fonts.print(title);
+    drawFooter(dividerY);
   } while (display.nextPage());
 }
 
 bool FilesPage::onLeft() {
   // poll SD state first
   pollSd();
+  if (filterEditing) {
+    // previous candidate character; only the footer changes
+    if (!filterChoices.empty())
+      filterChoice = (filterChoice + (int)filterChoices.size() - 1) %
+                     (int)filterChoices.size();
+    renderFooterPartial();
+    lastInteraction = millis();
+    return true;
+  }
+  if (filterActive) {
+    // left drops an applied filter before navigating anywhere
+    clearFilter();
+    render(false);
+    lastInteraction = millis();
+    return true;
+  }
   // New behavior: left should navigate up (to parent directory) when an
   // entry is highlighted or selection is active. Only when nothing is
   // highlighted should left switch pages.
@@ -356,6 +516,13 @@ bool FilesPage::onLeft() {
 bool FilesPage::onRight() {
   // poll SD state first
   pollSd();
+  if (filterEditing) {
+    if (!filterChoices.empty())
+      filterChoice = (filterChoice + 1) % (int)filterChoices.size();
+    renderFooterPartial();
+    lastInteraction = millis();
+    return true;
+  }
   // If selection active, right opens (confirm). If not active, right switches
   // page.
   if (selectionActive) {
@@ -376,6 +543,11 @@ bool FilesPage::onRight() {
 bool FilesPage::onCenter() {
   // poll SD state first
   pollSd();
+  if (filterEditing) {
+    confirmFilterChoice();
+    lastInteraction = millis();
+    return true;
+  }
   // If no SD or no entries, center toggles nothing
   if (!sdAvailable || totalEntries == 0) {
     // do a small flash
@@ -384,9 +556,9 @@ bool FilesPage::onCenter() {
     return true;
   }
   unsigned long now = millis();
-  // If already in selection mode, center is a no-op (could be changed later)
+  // In selection mode, center starts (or resumes) the type-ahead filter
   if (selectionActive) {
-    render(false);
+    startFilter();
     lastInteraction = now;
     lastCenterTapMs = now;
     return true;
@@ -471,6 +643,9 @@ void FilesPage::openSelected() {
           tmp = "/";
         currentDir = tmp;
       }
+    } else if (currentDir == "/" &&
+               (fname == VLABEL_MUSIC || fname == VLABEL_BOOKS)) {
+      currentDir = (fname == VLABEL_MUSIC) ? VDIR_MUSIC : VDIR_BOOKS;
     } else {
       // enter subdir: construct candidate path and test it before committing
       String candidate;
@@ -480,12 +655,15 @@ void FilesPage::openSelected() {
         candidate = currentDir + String("/") + nameNoSlash;
       bool found = false;
       String path = candidate;
-      File testDir = SD.open(path.c_str());
-      if (testDir) {
-        testDir.close();
-        found = true;
+      {
+        SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+        File testDir = SD.open(path.c_str());
+        if (testDir) {
+          testDir.close();
+          found = true;
+        }
       }
-  if (!found) {
+      if (!found) {
         // cannot open directory -> show error and abort
         display.setFullWindow();
         display.firstPage();
@@ -560,15 +738,12 @@ void FilesPage::openSelected() {
   // for files: only accept open action for supported types, otherwise show name
   if (lower.endsWith(".mp3") || lower.endsWith(".flac") ||
       lower.endsWith(".aac") || lower.endsWith(".wav") ||
-      lower.endsWith(".m4a") || lower.endsWith(".txt")) {
+      lower.endsWith(".m4a") || lower.endsWith(".m3u") ||
+      lower.endsWith(".m3u8") || lower.endsWith(".txt")) {
     // If it's a text file, open in ebook viewer
     if (lower.endsWith(".txt")) {
       // construct absolute path for file (currentDir + name)
-      String apath;
-      if (currentDir == "/")
-        apath = String("/") + fname;
-      else
-        apath = currentDir + String("/") + fname;
+      String apath = absPathForEntry(idx, fname);
       // attempt to open via main-provided helper
       extern bool openEbookFromPath(const String &path);
       if (openEbookFromPath(apath)) {
@@ -590,14 +765,15 @@ void FilesPage::openSelected() {
       render(true);
       return;
     }
-    // For audio files, open in music player page
-    String apath;
-    if (currentDir == "/")
-      apath = String("/") + fname;
-    else
-      apath = currentDir + String("/") + fname;
+    // For audio files and playlists, open in music player page; from "All
+    // music" the whole library becomes the playlist
+    String apath = absPathForEntry(idx, fname);
     extern bool openMusicFromPath(const String &path);
-    if (openMusicFromPath(apath)) {
+    extern bool openMusicFromLibrary(int index);
+    int libIdx = virtualDirType(currentDir) == MediaType::MEDIA_MUSIC
+                     ? virtualIndexForEntry(idx)
+                     : -1;
+    if (libIdx >= 0 ? openMusicFromLibrary(libIdx) : openMusicFromPath(apath)) {
       lastInteraction = millis();
       return;
     }
@@ -622,3 +798,214 @@ void FilesPage::openSelected() {
   lastInteraction = millis();
   return;
 }
+
+// media index entry behind a row of a virtual folder, -1 elsewhere
+int FilesPage::virtualIndexForEntry(int absIndex) {
+  if (virtualDirType(currentDir) == MediaType::MEDIA_NONE)
+    return -1;
+  if (filterActive) {
+    // map back to the unfiltered listing index (which counts "../")
+    if (absIndex < 0 || absIndex >= (int)filterMatches.size())
+      return -1;
+    absIndex = filterMatches[absIndex] + 1;
+  }
+  return absIndex - 1; // skip "../"
+}
+
+String FilesPage::absPathForEntry(int absIndex, const String &fname) {
+  MediaType vt = virtualDirType(currentDir);
+  if (vt != MediaType::MEDIA_NONE)
+    return gMediaIndex.pathAt(vt, virtualIndexForEntry(absIndex));
+  if (filterActive) {
+    // map back to the unfiltered listing index (which counts "../")
+    if (absIndex < 0 || absIndex >= (int)filterMatches.size())
+      return String();
+    absIndex = filterMatches[absIndex] + ((currentDir == "/") ? 0 : 1);
+  }
+  if (currentDir == "/")
+    return String("/") + fname;
+  return currentDir + String("/") + fname;
+}
+
+void FilesPage::addListed(const String &name) {
+  listOffs.push_back(listNames.size());
+  listNames.insert(listNames.end(), name.c_str(), name.c_str() + name.length());
+  listNames.push_back('\0');
+}
+
+void FilesPage::clearListing() {
+  std::vector<char>().swap(listNames);
+  std::vector<uint32_t>().swap(listOffs);
+  listingCached = false;
+}
+
+// Read the current directory's names into the listing (once per listing).
+// Library folders come from the index in one pass over media.db.
+void FilesPage::cacheListing() {
+  if (listingCached)
+    return;
+  clearListing();
+  MediaType vt = virtualDirType(currentDir);
+  if (vt != MediaType::MEDIA_NONE) {
+    gMediaIndex.namesAt(vt, 0, gMediaIndex.count(vt), listNames, listOffs);
+  } else {
+    int vcount = virtualRootCount();
+    for (int i = 0; i < vcount; ++i)
+      addListed(virtualRootLabel(i));
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    File dir = SD.open(currentDir.c_str());
+    if (dir) {
+      File f = dir.openNextFile();
+      while (f) {
+        String name = String(f.name());
+        if (f.isDirectory())
+          name += '/';
+        addListed(name);
+        f = dir.openNextFile();
+      }
+      dir.close();
+    }
+  }
+  listingCached = true;
+}
+
+// every listed entry that starts with filterPrefix
+void FilesPage::matchPrefix() {
+  filterMatches.clear();
+  for (size_t k = 0; k < listOffs.size(); ++k) {
+    if (foldedStartsWith(listedName(k), filterPrefix))
+      filterMatches.push_back(k);
+  }
+}
+
+void FilesPage::startFilter() {
+  selectionActive = false;
+  if (!filterActive) {
+    cacheListing();
+    filterActive = true;
+    filterPrefix = "";
+    matchPrefix();
+    showFilterMatches();
+  }
+  filterEditing = true;
+  rebuildFilterChoices();
+  render(false);
+}
+
+// The listing changed under an active filter (new media index): read it
+// again and run the same prefix against it
+void FilesPage::reapplyFilter() {
+  String prefix = filterPrefix;
+  bool editing = filterEditing;
+  refreshEntries();
+  cacheListing();
+  filterActive = true;
+  filterEditing = editing;
+  filterPrefix = prefix;
+  matchPrefix();
+  rebuildFilterChoices();
+  showFilterMatches();
+}
+
+void FilesPage::clearFilter() {
+  bool wasActive = filterActive;
+  filterActive = false;
+  filterEditing = false;
+  filterPrefix = "";
+  filterMatches.clear();
+  filterChoices.clear();
+  filterChoiceCounts.clear();
+  filterChoice = 0;
+  if (wasActive && listingCached) {
+    // restore the unfiltered view from the cache, no SD access needed
+    bool hasParent = (currentDir != "/");
+    totalEntries = (int)listOffs.size() + (hasParent ? 1 : 0);
+    topIndex = 0;
+    highlightedRow = hasParent ? 0 : -1;
+    visibleCache.clear();
+    visibleCacheStart = -1;
+  }
+}
+
+// Offer every character that follows the prefix in at least one match,
+// sorted, each with the number of entries it would leave.
+void FilesPage::rebuildFilterChoices() {
+  filterChoices.clear();
+  filterChoiceCounts.clear();
+  unsigned pos = filterPrefix.length();
+  for (uint32_t m : filterMatches) {
+    const char *nm = listedName(m);
+    unsigned len = strlen(nm);
+    if (len <= pos)
+      continue;
+    unsigned cb = utf8CharLen((uint8_t)nm[pos]);
+    if (pos + cb > len)
+      cb = len - pos;
+    String ch;
+    for (unsigned i = 0; i < cb; ++i)
+      ch += nm[pos + i];
+    ch = foldCase(ch);
+    size_t k = 0;
+    while (k < filterChoices.size() && filterChoices[k] < ch)
+      k++;
+    if (k < filterChoices.size() && filterChoices[k] == ch) {
+      filterChoiceCounts[k]++;
+    } else {
+      filterChoices.insert(filterChoices.begin() + k, ch);
+      filterChoiceCounts.insert(filterChoiceCounts.begin() + k, 1);
+    }
+  }
+  filterChoices.push_back(FILTER_DONE);
+  filterChoiceCounts.push_back(filterMatches.size());
+  filterChoices.push_back(FILTER_BACK);
+  filterChoiceCounts.push_back(filterMatches.size());
+  filterChoice = 0;
+}
+
+void FilesPage::confirmFilterChoice() {
+  if (filterChoice >= (int)filterChoices.size())
+    return;
+  String c = filterChoices[filterChoice];
+  if (c == FILTER_DONE) {
+    // keep the filtered listing and return to normal row navigation
+    filterEditing = false;
+    render(false);
+    return;
+  }
+  if (c == FILTER_BACK) {
+    if (filterPrefix.length() == 0) {
+      clearFilter();
+      render(false);
+      return;
+    }
+    int i = (int)filterPrefix.length() - 1;
+    while (i > 0 && ((uint8_t)filterPrefix[i] & 0xC0) == 0x80)
+      i--;
+    filterPrefix.remove(i);
+    // widening: recompute from the cached listing
+    matchPrefix();
+  } else {
+    // narrowing: only the new character of the surviving candidates is tested
+    unsigned pos = filterPrefix.length();
+    std::vector<uint32_t> next;
+    next.reserve(filterMatches.size());
+    for (uint32_t m : filterMatches) {
+      const char *nm = listedName(m);
+      if (strlen(nm) >= pos && foldedStartsWith(nm + pos, c))
+        next.push_back(m);
+    }
+    filterMatches.swap(next);
+    filterPrefix += c;
+  }
+  rebuildFilterChoices();
+  showFilterMatches();
+  render(false);
+}
+
+void FilesPage::showFilterMatches() {
+  totalEntries = (int)filterMatches.size();
+  topIndex = 0;
+  highlightedRow = filterMatches.empty() ? -1 : 0;
+  visibleCache.clear();
+  visibleCacheStart = -1;
+}
@@ -20,8 +20,14 @@ public:
 private:
   // current directory
   String currentDir = "/";
-  // all entries in current dir (directories end with '/')
-  std::vector<String> allEntries;
+  // all entries in current dir (directories end with '/', parent entry
+  // excluded); only populated on demand by cacheListing(). Names are packed
+  // NUL terminated into one buffer, listOffs[i] is where the i-th starts.
+  std::vector<char> listNames;
+  std::vector<uint32_t> listOffs;
+  const char *listedName(size_t i) const { return &listNames[listOffs[i]]; }
+  void addListed(const String &name);
+  void clearListing();
   int totalEntries = 0;
   // visible window cache to avoid repeated full-directory scans
   std::vector<String> visibleCache;
@@ -37,9 +43,42 @@ private:
   bool sdAvailable = false;
   // last center tap time for double-tap detection
   unsigned long lastCenterTapMs = 0;
+  // media index generation the current listing was built against
+  uint32_t indexGen = 0;
+  // "All music"/"All books" folders served from the media index
+  bool inVirtualDir() const;
+  int virtualRootCount();
+  String virtualRootLabel(int i);
   // internal helper: detect SD state change and update entries accordingly
   void detectSdChange();
   void fillVisibleCache();
   // open the currently highlighted/selected entry (file or directory)
   void openSelected();
+  // absolute card path for the file entry at absIndex (named fname)
+  String absPathForEntry(int absIndex, const String &fname);
+  int virtualIndexForEntry(int absIndex);
+
+  // ---- type-ahead filter ----
+  // Entered with center while selection is active. left/right cycle the
+  // next character (only characters that still occur are offered), center
+  // confirms it. Matching runs against the cached listing, which is read
+  // from the card once; narrowing never touches the SD card.
+  bool listingCached = false;
+  bool filterEditing = false;
+  bool filterActive = false;
+  String filterPrefix; // confirmed prefix, ASCII-folded
+  std::vector<uint32_t> filterMatches; // indices into the listing
+  std::vector<String> filterChoices;   // next characters + controls
+  std::vector<uint32_t> filterChoiceCounts;
+  int filterChoice = 0;
+  void cacheListing();
+  void startFilter();
+  void clearFilter();
+  void matchPrefix();
+  void reapplyFilter();
+  void rebuildFilterChoices();
+  void confirmFilterChoice();
+  void showFilterMatches();
+  void drawFooter(int dividerY);
+  void renderFooterPartial();
 };
@@ -1,88 +1,88 @@
 #include "music_page.h"
 #include "../app_context.h"
-#include <Preferences.h>
-#include "defines/pinconf.h"
-#include "AudioTools.h"
-// include the concrete MP3 decoder wrapper so the type is visible here
-#include "AudioTools/AudioCodecs/CodecMP3Helix.h"
-#include "FS.h"
-#include <SD.h>
-#include "FS.h"
-#include <SD.h>
-
-// Minimal AudioSource implementation that uses Arduino SD to open files by path.
-// This keeps memory small and avoids depending on std::filesystem.
-namespace audio_tools {
-class SDFileAudioSource : public AudioSource {
- public:
-  SDFileAudioSource() {}
-  bool begin() override { return true; }
-  Stream* nextStream(int offset) override { return nullptr; }
-  Stream* selectStream(int index) override { return nullptr; }
-  Stream* selectStream(const char* path) override {
-    if (path == nullptr) return nullptr;
-    // close any previously opened file
-    if (file) file.close();
-    ::File f = SD.open(path);
-    if (!f) return nullptr;
-    file = f; // move
-    last_path = String(path);
-    return &file;
-  }
-  const char* toStr() override { return last_path.c_str(); }
- protected:
-  ::File file;
-  String last_path;
-};
-}
+#include "../audio/audio_engine.h"
+#include "../audio/playback_power.h"
+#include "../battery.h"
+#include "../media/media_index.h"
+#include "../media/track_meta.h"
+#include "../utils/utils.h"
+#include "page_manager.h"
+
+// Lyric line between the tags and the status line. Only this strip is
+// refreshed when the line changes, and at most every LYRIC_MIN_REFRESH_MS:
+// lines that come faster are skipped, the panel shows the latest one.
+// Both strips sit on 8-px boundaries of the panel's own (unrotated) x axis,
+// which GxEPD2 rounds partial windows to, so neither refresh spills into
+// the other.
+static const int LYRIC_BASELINE = 92;
+static const int LYRIC_AREA_Y = 80;
+static const int LYRIC_AREA_H = 16;
+static const unsigned long LYRIC_MIN_REFRESH_MS = 1000;
 
-// audio-tools classes
-using namespace audio_tools;
+// Status row at the bottom: state, playlist position, elapsed/total and a
+// progress bar. It is its own partial window; pause/resume and the
+// progress ticks refresh only this strip, a new track redraws the page.
+static const int STATUS_AREA_Y = 96;
+static const int STATUS_AREA_H = 32; // to the panel edge, 122 visible
+static const int STATUS_BASELINE = 108;
+static const int BAR_Y = 113;
+static const int BAR_H = 6;
+// Progress refresh period: about PROGRESS_STEPS updates per track, never
+// more often than PROGRESS_MIN_MS nor less than PROGRESS_MAX_MS, stretched
+// when the battery runs low.
+static const uint32_t PROGRESS_STEPS = 60;
+static const unsigned long PROGRESS_MIN_MS = 5000;
+static const unsigned long PROGRESS_MAX_MS = 60000;
+
+static String mmss(uint32_t ms) {
+  char buf[12];
+  snprintf(buf, sizeof(buf), "%lu:%02lu", (unsigned long)(ms / 60000),
+           (unsigned long)(ms / 1000 % 60));
+  return String(buf);
+}
 
 MusicPage::MusicPage() {
   currentTrack = String();
-  playing = false;
-  // allocate audio stack
-  i2s = new audio_tools::I2SStream();
-  // use audio-tools codec wrapper which implements AudioDecoder
-  decoder = new audio_tools::MP3DecoderHelix();
-  // create a small SD-backed AudioSource and construct player with it
-  source = new SDFileAudioSource();
-  player = new audio_tools::AudioPlayer(*source, *i2s, *decoder);
-
-  // configure I2S pins and params similarly to prior main.cpp code
-  auto config = i2s->defaultConfig(TX_MODE);
-  config.pin_bck = I2S_BCLK_PIN;
-  config.pin_ws = I2S_WS_PIN;
-  config.pin_data = I2S_DOUT_PIN;
-  config.sample_rate = 44100;
-  config.channels = 2;
-  config.bits_per_sample = 16;
-  i2s->begin(config);
-
-  // wire up player
-  // already wired by constructor; do not force-set audioInfo here (decoder may not have valid info yet)
-  // Reduce default volume to avoid damaging speakers/mic (safe default)
-  if (player) {
-    // 0.0 - 1.0, use a conservative value
-    player->setVolume(1);
-    Serial.println("MusicPage: default volume set to 20% (safe)");
-  }
+  // decode/output tasks, ring buffer and I2S are owned by the audio engine
+  // and only created by the first play(), so they cost nothing at boot
 }
 
 void MusicPage::openFromFile(const String &path) {
   currentTrack = path;
+  libraryIndex = -1;
   Serial.println("MusicPage: openFromFile " + path);
-  // use blocking convenience if available
-  if (player) {
-    bool ok = player->playPath(path.c_str());
-    playing = ok;
-    if (!ok) Serial.println("Audio playback failed for: " + path);
-  }
+  if (!gAudio.play(path))
+    Serial.println("Audio command queue full, dropped: " + path);
+}
+
+void MusicPage::openFromLibrary(int index) {
+  currentTrack = gMediaIndex.pathAt(MediaType::MEDIA_MUSIC, index);
+  libraryIndex = index;
+  Serial.println("MusicPage: openFromLibrary " + String(index));
+  if (!gAudio.playLibrary(index))
+    Serial.println("Audio command queue full, dropped library entry " +
+                   String(index));
 }
 
 void MusicPage::render(bool full) {
   // simple UI: show filename and play/pause status
+  visible = true;
+  String path = gAudio.currentPath();
+  if (path.length() == 0)
+    path = currentTrack;
+  if (path != metaPath) {
+    // parsed once per file, then served from the cache
+    metaPath = path;
+    meta = TrackMeta();
+    if (path.length() > 0)
+      gTrackMeta.get(path, meta);
+    if (path.length() == 0 || !lyrics.loadFor(path))
+      lyrics.clear();
+  }
+  lyricLine = lyrics.empty() ? -1 : lyrics.lineAt(gAudio.positionMs());
+  lastLyricDraw = millis();
+  lastStatusDraw = millis();
+  statusInterval = progressInterval();
   const int footerH = 18;
   if (full) {
     display.setFullWindow();
@@ -97,45 +97,231 @@ void MusicPage::render(bool full) {
     u8g2Fonts.setForegroundColor(GxEPD_BLACK);
     String title = "音乐播放器";
     int tw = u8g2Fonts.getUTF8Width(title.c_str());
-    u8g2Fonts.setCursor((display.width() - tw) / 2, 30);
+    u8g2Fonts.setCursor((display.width() - tw) / 2, 20);
     u8g2Fonts.print(title);
-    String fname = currentTrack;
-    int p = fname.lastIndexOf('/');
-    if (p >= 0) fname = fname.substring(p + 1);
-    u8g2Fonts.setCursor(10, 60);
+    // tag title if there is one, else the file name
+    String fname = meta.title;
+    if (fname.length() == 0) {
+      fname = path;
+      int p = fname.lastIndexOf('/');
+      if (p >= 0) fname = fname.substring(p + 1);
+    }
+    int y = 44;
+    u8g2Fonts.setCursor(10, y);
     u8g2Fonts.print("曲目: ");
     u8g2Fonts.print(fname);
-  // reflect actual audio state if available
-  bool running = false;
-  if (player) running = player->isActive();
-  u8g2Fonts.setCursor(10, 90);
-  u8g2Fonts.print(running ? "状态: 播放中" : "状态: 暂停");
+    if (meta.artist.length() > 0) {
+      y += 16;
+      u8g2Fonts.setCursor(10, y);
+      u8g2Fonts.print("艺人: ");
+      u8g2Fonts.print(meta.artist);
+    }
+    if (meta.album.length() > 0) {
+      y += 16;
+      u8g2Fonts.setCursor(10, y);
+      u8g2Fonts.print("专辑: ");
+      u8g2Fonts.print(meta.album);
+    }
+    drawLyric();
+    drawStatus();
   } while (display.nextPage());
+  gPlaybackPower.panelIdle();
+}
+
+// Short press steps through the playlist; holding the button seeks,
+// SEEK_STEP_MS per SEEK_REPEAT_MS held. The audio task applies either
+// without waiting for the panel, tick() redraws afterwards.
+static const unsigned long SEEK_HOLD_MS = 600;
+static const unsigned long SEEK_REPEAT_MS = 500;
+static const int32_t SEEK_STEP_MS = 10000;
+
+static void stepOrSeek(PageButton btn, int dir) {
+  unsigned long t0 = millis();
+  unsigned long lastSeek = 0;
+  bool seeking = false;
+  while (readButtonStateRaw() == btn) {
+    unsigned long now = millis();
+    if (now - t0 >= SEEK_HOLD_MS && (!seeking || now - lastSeek >= SEEK_REPEAT_MS)) {
+      gAudio.skip(dir * SEEK_STEP_MS);
+      seeking = true;
+      lastSeek = now;
+    }
+    vTaskDelay(20);
+  }
+  if (!seeking) {
+    if (dir < 0)
+      gAudio.previous();
+    else
+      gAudio.next();
+  }
 }
 
 bool MusicPage::onLeft() {
-  // left: previous track (not implemented)
-  return false;
+  // left: previous track / hold to rewind
+  if (currentTrack.length() == 0)
+    return false;
+  stepOrSeek(BTN_LEFT, -1);
+  return true;
 }
 bool MusicPage::onRight() {
-  // right: next track (not implemented)
-  return false;
+  // right: next track / hold to fast-forward
+  if (currentTrack.length() == 0)
+    return false;
+  stepOrSeek(BTN_RIGHT, 1);
+  return true;
 }
 bool MusicPage::onCenter() {
-  if (player) {
-    if (player->isActive()) player->setActive(false);
-    else player->setActive(true);
-    playing = player->isActive();
-  } else {
-    playing = !playing;
+  // hold center to go back to the file list (playback continues)
+  unsigned long t0 = millis();
+  const unsigned long requiredHold = 1500; // ms
+  while (millis() - t0 < requiredHold) {
+    if (readButtonStateRaw() != BTN_CENTER) {
+      // short press: play/pause; tick() redraws once the audio task has
+      // applied it
+      if (gAudio.state() == AudioState::AUDIO_STOPPED) {
+        if (libraryIndex >= 0)
+          gAudio.playLibrary(libraryIndex);
+        else if (currentTrack.length() > 0)
+          gAudio.play(currentTrack);
+      } else {
+        gAudio.togglePause();
+      }
+      return true;
+    }
+    vTaskDelay(20);
   }
-  render(false);
+  switchPageAndFullRefresh(3);
   return true;
 }
 
+void MusicPage::drawLyric() {
+  if (lyricLine < 0)
+    return;
+  String text = fitToWidthSingleLine(lyrics.text(lyricLine), display.width() - 20);
+  int w = u8g2Fonts.getUTF8Width(text.c_str());
+  u8g2Fonts.setCursor((display.width() - w) / 2, LYRIC_BASELINE);
+  u8g2Fonts.print(text);
+}
+
+void MusicPage::renderLyricPartial() {
+  display.setPartialWindow(0, LYRIC_AREA_Y, display.width(), LYRIC_AREA_H);
+  display.firstPage();
+  do {
+    display.fillScreen(GxEPD_WHITE);
+    u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+    u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+    drawLyric();
+  } while (display.nextPage());
+  gPlaybackPower.panelIdle();
+  lastLyricDraw = millis();
+}
+
+uint32_t MusicPage::trackDurationMs() const {
+  return gAudio.durationMs() ? gAudio.durationMs() : meta.durationMs;
+}
+
+unsigned long MusicPage::progressInterval() {
+  uint32_t dur = trackDurationMs();
+  unsigned long ms = dur / PROGRESS_STEPS;
+  if (ms < PROGRESS_MIN_MS)
+    ms = PROGRESS_MIN_MS;
+  gBattery.update();
+  int pct = gBattery.percent();
+  if (pct < 20)
+    ms *= 4;
+  else if (pct < 50)
+    ms *= 2;
+  return ms > PROGRESS_MAX_MS ? PROGRESS_MAX_MS : ms;
+}
+
+void MusicPage::drawStatus() {
+  // reflect actual audio state
+  AudioState st = gAudio.state();
+  String line = st == AudioState::AUDIO_PLAYING  ? "状态: 播放中"
+                : st == AudioState::AUDIO_PAUSED ? "状态: 暂停"
+                                                 : "状态: 已停止";
+  if (gAudio.trackCount() > 1)
+    line += "  " + String(gAudio.trackIndex() + 1) + "/" +
+            String(gAudio.trackCount());
+  // play order: 随 = shuffle, 循 = repeat all, 单 = repeat one
+  if (gAudio.shuffle())
+    line += " 随";
+  if (gAudio.repeat() == RepeatMode::REPEAT_ALL)
+    line += " 循";
+  else if (gAudio.repeat() == RepeatMode::REPEAT_ONE)
+    line += " 单";
+  u8g2Fonts.setCursor(10, STATUS_BASELINE);
+  u8g2Fonts.print(line);
+
+  uint32_t dur = trackDurationMs();
+  uint32_t pos = st == AudioState::AUDIO_STOPPED ? 0 : gAudio.positionMs();
+  if (dur > 0 && pos > dur)
+    pos = dur;
+  String time = dur > 0 ? mmss(pos) + "/" + mmss(dur) : mmss(pos);
+  int tw = u8g2Fonts.getUTF8Width(time.c_str());
+  u8g2Fonts.setCursor(display.width() - 10 - tw, STATUS_BASELINE);
+  u8g2Fonts.print(time);
+
+  int barW = display.width() - 20;
+  display.drawRect(10, BAR_Y, barW, BAR_H, GxEPD_BLACK);
+  if (dur > 0) {
+    int fill = (int)((uint64_t)(barW - 2) * pos / dur);
+    if (fill > 0)
+      display.fillRect(11, BAR_Y + 1, fill, BAR_H - 2, GxEPD_BLACK);
+  }
+}
+
+void MusicPage::renderStatusPartial() {
+  display.setPartialWindow(0, STATUS_AREA_Y, display.width(), STATUS_AREA_H);
+  display.firstPage();
+  do {
+    display.fillScreen(GxEPD_WHITE);
+    u8g2Fonts.setFont(u8g2_font_wqy12_t_gb2312);
+    u8g2Fonts.setForegroundColor(GxEPD_BLACK);
+    drawStatus();
+  } while (display.nextPage());
+  gPlaybackPower.panelIdle();
+  lastStatusDraw = millis();
+  statusInterval = progressInterval();
+}
+
+void MusicPage::onLeave() {
+  visible = false;
+}
+
 void MusicPage::tick() {
-  // advance player processing if non-blocking mode
-  if (player) {
-    player->copy();
+  if (!visible) {
+    // left while playing: keep going in the background, free I2S, decoder
+    // and buffers once the playlist has ended (or was stopped)
+    if (gAudio.running() && gAudio.state() == AudioState::AUDIO_STOPPED)
+      gAudio.end();
+    return;
+  }
+  uint32_t c = gAudio.changeCount();
+  if (c != seenChanges) {
+    seenChanges = c;
+    String path = gAudio.currentPath();
+    if (path.length() > 0 && path != metaPath) {
+      // new track: clean full refresh (clears partial-update ghosting)
+      render(true);
+    } else {
+      // pause/resume/seek: only the status row changes
+      renderStatusPartial();
+    }
+    return;
+  }
+  if (gAudio.state() == AudioState::AUDIO_PLAYING &&
+      millis() - lastStatusDraw >= statusInterval)
+    renderStatusPartial();
+  // follow the playback clock; the lookup is a binary search, the panel is
+  // only touched when the line differs and the rate cap allows it
+  if (lyrics.empty() || gAudio.state() != AudioState::AUDIO_PLAYING)
+    return;
+  if (millis() - lastLyricDraw < LYRIC_MIN_REFRESH_MS)
+    return;
+  int line = lyrics.lineAt(gAudio.positionMs());
+  if (line != lyricLine) {
+    lyricLine = line;
+    renderLyricPartial();
   }
 }
@@ -1,15 +1,9 @@
 #pragma once
 
+#include "../media/id3.h"
+#include "../media/lrc.h"
 #include "page.h"
 
-// Forward declarations from audio-tools headers
-  namespace audio_tools {
-  class I2SStream;
-  class AudioPlayer;
-  class AudioDecoder;
-  class AudioSource;
-}
-
 class MusicPage : public Page {
 public:
   MusicPage();
@@ -18,16 +12,37 @@ public:
   bool onRight() override;
   bool onCenter() override;
   const char *name() const override { return "music"; }
+  void onLeave() override;
   void openFromFile(const String &path);
-  // called periodically from the main loop to advance playback
+  // entry `index` of the media index, with the whole library as playlist
+  void openFromLibrary(int index);
+  // called periodically from the main loop; while shown it refreshes the
+  // status row on engine state changes and as the track progresses, the
+  // whole page on a track change (playback itself runs in the audio
+  // tasks), and releases the audio stack once playback has stopped and the
+  // page was left
   void tick();
 private:
   String currentTrack;
-  bool playing = false;
-  // audio stack owned by this page
-  audio_tools::I2SStream *i2s = nullptr;
-  audio_tools::AudioPlayer *player = nullptr;
-  audio_tools::AudioDecoder *decoder = nullptr;
-  // audio source for filesystem/SD playback (use base class so we can implement a small SD-backed source)
-  audio_tools::AudioSource *source = nullptr;
+  // library entry the library playlist was started from, -1 for a folder
+  // or .m3u playlist
+  int libraryIndex = -1;
+  uint32_t seenChanges = 0;
+  bool visible = false;
+  // tags of the track on screen (from the metadata cache)
+  String metaPath;
+  TrackMeta meta;
+  // timed lyrics of that track, if it has an .lrc next to it
+  LrcTrack lyrics;
+  int lyricLine = -1;
+  unsigned long lastLyricDraw = 0;
+  // status row / progress widget
+  unsigned long lastStatusDraw = 0;
+  unsigned long statusInterval = 0;
+  uint32_t trackDurationMs() const;
+  unsigned long progressInterval();
+  void drawStatus();
+  void renderStatusPartial();
+  void drawLyric();
+  void renderLyricPartial();
 };
@@ -14,5 +14,7 @@ public:
   virtual bool onLeft() { return false; }
   virtual bool onRight() { return false; }
   virtual bool onCenter() { return false; }
+  // called by PageManager right before switching away from this page
+  virtual void onLeave() {}
   virtual const char *name() const { return ""; }
 };
@@ -34,11 +34,12 @@ PageManager::PageManager() {}
 void PageManager::setPages(Page **pagesIn, int count) {
   pages = pagesIn;
   totalPages = count;
-  // initialize directSwitchAllowed defaults: allow all pages except 5 and 6
+  // initialize directSwitchAllowed defaults: allow all pages except 5-7
   for (int i = 0; i < MAX_PAGES; ++i) directSwitchAllowed[i] = true;
   // if configured pages fewer than indexes 5/6, ignore
   if (totalPages > 5) directSwitchAllowed[5] = false; // music page
   if (totalPages > 6) directSwitchAllowed[6] = false; // ebook page
+  if (totalPages > 7) directSwitchAllowed[7] = false; // alarm ring page
 }
 
 void PageManager::begin() {
@@ -69,6 +70,8 @@ void PageManager::switchPage(int page) {
     return;
   }
 
+  if (page != currentPage)
+    pages[currentPage]->onLeave();
   currentPage = page;
   lastInteraction = millis();
   ::lastInteraction = lastInteraction;
@@ -180,7 +183,9 @@ void PageManager::loop() {
     }
   }
   // inactivity auto-home: respect global lastInteraction updated by pages
-  if ((now - ::lastInteraction) > inactivityTimeout && currentPage != 0) {
+  // (a ringing alarm keeps its screen until dismissed)
+  if ((now - ::lastInteraction) > inactivityTimeout && currentPage != 0 &&
+      !::alarmRinging) {
   switchPage(0);
   // ensure the global currentPage (used by main and other modules) is
   // synchronized when auto-navigating home
@@ -194,7 +199,7 @@ void PageManager::loop() {
     if (pname && strcmp(pname, "ebook") == 0) {
       if (now - lastEbookFooterMs >= 60UL * 1000UL) {
         // refresh NTP and request a light partial render for footer
-        ::timeClient.update();
+        ::timeClientUpdate();
         pages[currentPage]->render(false);
         lastEbookFooterMs = now;
       }
@@ -1,5 +1,7 @@
 #include "time_page.h"
 #include "app_context.h"
+#include "alarms/scheduler.h"
+#include "alarms/wake.h"
 #include "battery.h"
 #include "power.h"
 #include <esp_sleep.h>
@@ -79,6 +81,7 @@ static void enterLightSleepUntilWakePinLocal(int wakePin, bool activeLow = true,
 // - next full refresh interval
 // - next hitokoto update
 // - next weather update
+// - next alarm (the sleep must not run past it)
 static uint32_t computeNextScheduledWakeMs() {
   uint32_t now = millis();
   uint32_t nextMs = UINT32_MAX;
@@ -120,6 +123,10 @@ static uint32_t computeNextScheduledWakeMs() {
     }
   }
 
+  // alarm
+  uint32_t toAlarm = gAlarmSched.msUntilNext(epoch);
+  if (toAlarm < nextMs) nextMs = toAlarm;
+
   // enforce sensible bounds
   if (nextMs == UINT32_MAX) nextMs = 1000;
   if (nextMs < 500) nextMs = 500; // at least 0.5s
@@ -159,7 +166,7 @@ bool HomeTimePage::onCenter() {
 }
 
 void HomeTimePage::renderFull() {
-  timeClient.update();
+  timeClientUpdate();
   int hours = timeClient.getHours();
   int minutes = timeClient.getMinutes();
   String currentTime = String(hours < 10 ? "0" : "") + String(hours) + ":" +
@@ -252,7 +259,7 @@ void HomeTimePage::renderFull() {
     Serial.println("Hibernating e-paper before deep sleep (partial overlay)");
     display.hibernate();
     delay(20);
-    enterDeepSleepUntilWakePin(WAKE_BUTTON_PIN);
+    alarmDeepSleep();
   }
   String pct = String(battPct) + "%";
 
@@ -356,7 +363,7 @@ void HomeTimePage::renderFull() {
 }
 
 void HomeTimePage::renderPartial() {
-  timeClient.update();
+  timeClientUpdate();
   int hours = timeClient.getHours();
   int minutes = timeClient.getMinutes();
   String currentTime = String(hours < 10 ? "0" : "") + String(hours) + ":" +
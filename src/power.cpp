@@ -38,6 +38,12 @@ void enterDeepSleepUntilWakePin(int wakePin, bool activeLow /*= true*/,
 
   int level = activeLow ? 0 : 1;
 
+  // Defensive: drop any wakeup sources left over from light sleep or earlier
+  // code paths before arming ours, so only the pin (and the timer, if asked
+  // for below) can wake the device.
+  Serial.println("Disabling previous wakeup sources before deep sleep");
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+
   Serial.println("Using esp_deep_sleep_enable_gpio_wakeup bitmask fallback");
   // create a bitmask for the given wakePin (1 << gpio)
   uint64_t wake_mask = (1ULL << (uint64_t)wakePin);
@@ -64,14 +70,6 @@ void enterDeepSleepUntilWakePin(int wakePin, bool activeLow /*= true*/,
     esp_sleep_enable_timer_wakeup((uint64_t)timeoutSec * 1000000ULL);
   }
 
-  // Defensive: disable any previously enabled wakeup sources that might have
-  // been configured for light-sleep or earlier code paths. This prevents those
-  // sources from accidentally waking the device when we intend deep-sleep
-  // behavior.
-  Serial.println(
-      "Disabling common wakeup sources before deep sleep: TIMER, GPIO, EXT0");
-  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
-
   Serial.println("About to enter deep sleep now...");
   esp_deep_sleep_start();
 }
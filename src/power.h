@@ -9,7 +9,7 @@
 // Enter deep sleep until the given wake pin is asserted.
 // - wakePin: GPIO number connected to wake button
 // - activeLow: whether the button pulls the line LOW when pressed (default true)
-// - timeoutSec: optional backup timeout in seconds (0 = disabled)
+// - timeoutSec: also wake on the RTC timer after this many seconds (0 = disabled)
 void enterDeepSleepUntilWakePin(int wakePin, bool activeLow = true, uint32_t timeoutSec = 0);
 
 #endif
@@ -0,0 +1,192 @@
+#include "sd_card.h"
+#include "debug_console.h"
+#include "defines/pinconf.h"
+#include "spi_bus.h"
+#include <Preferences.h>
+#include <SD.h>
+#include <SPI.h>
+#include <rom/crc.h>
+
+// Clock rungs, fastest first. All are exact divisors of the 80 MHz APB
+// clock so the SPI peripheral runs at the requested rate.
+static const uint32_t CLOCK_LADDER[] = {40000000, 26666666, 20000000,
+                                        16000000, 10000000, 8000000};
+static const int CLOCK_RUNGS = sizeof(CLOCK_LADDER) / sizeof(CLOCK_LADDER[0]);
+static const uint32_t SAFE_CLOCK = 4000000;
+
+// self-test: boot area (MBR/partition table, FAT start) plus a spread of
+// sectors across the card
+static const uint32_t SELFTEST_HEAD = 16;
+static const uint32_t SELFTEST_SPREAD = 8;
+
+static uint32_t s_clockHz = 0;
+
+static bool mountAt(uint32_t hz) {
+  SD.end();
+  if (!SD.begin(SD_CS_PIN, SPI, hz)) {
+    s_clockHz = 0;
+    return false;
+  }
+  s_clockHz = hz;
+  return true;
+}
+
+// CRC32 over the self-test sectors; false on any read error
+static bool selfTestCrc(uint32_t &crcOut) {
+  static uint8_t buf[512];
+  uint32_t total = SD.numSectors();
+  if (total == 0 || SD.sectorSize() != 512)
+    return false;
+  uint32_t crc = 0;
+  uint32_t head = total < SELFTEST_HEAD ? total : SELFTEST_HEAD;
+  for (uint32_t s = 0; s < head; ++s) {
+    if (!SD.readRAW(buf, s))
+      return false;
+    crc = crc32_le(crc, buf, sizeof(buf));
+  }
+  for (uint32_t i = 1; i <= SELFTEST_SPREAD && total > SELFTEST_HEAD; ++i) {
+    uint32_t s = (uint32_t)(((uint64_t)total * i) / (SELFTEST_SPREAD + 1));
+    if (!SD.readRAW(buf, s))
+      return false;
+    crc = crc32_le(crc, buf, sizeof(buf));
+  }
+  crcOut = crc;
+  return true;
+}
+
+// first rung worth trying for this card (remembered from the last mount)
+static int startRung(uint32_t sectors) {
+  Preferences prefs;
+  int rung = 0;
+  if (prefs.begin("sdcard", true)) {
+    if (prefs.getUInt("sectors", 0) == sectors)
+      rung = prefs.getUChar("rung", 0);
+    prefs.end();
+  }
+  if (rung < 0 || rung >= CLOCK_RUNGS)
+    rung = 0;
+  return rung;
+}
+
+static void saveRung(uint32_t sectors, int rung) {
+  Preferences prefs;
+  if (!prefs.begin("sdcard", false))
+    return;
+  if (prefs.getUInt("sectors", 0) != sectors ||
+      prefs.getUChar("rung", 0xFF) != rung) {
+    prefs.putUInt("sectors", sectors);
+    prefs.putUChar("rung", (uint8_t)rung);
+  }
+  prefs.end();
+}
+
+bool sdMount() {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  // reference read at the safe clock; failing here means no usable card
+  uint32_t refCrc = 0;
+  if (!mountAt(SAFE_CLOCK) || !selfTestCrc(refCrc)) {
+    SD.end();
+    s_clockHz = 0;
+    return false;
+  }
+  uint32_t sectors = SD.numSectors();
+  for (int rung = startRung(sectors); rung < CLOCK_RUNGS; ++rung) {
+    uint32_t hz = CLOCK_LADDER[rung];
+    uint32_t crc1 = 0, crc2 = 0;
+    // read twice: marginal clocks often fail intermittently
+    bool ok = mountAt(hz) && selfTestCrc(crc1) && crc1 == refCrc &&
+              selfTestCrc(crc2) && crc2 == refCrc;
+    if (ok) {
+      Serial.println("SD: mounted at " + String(hz / 1000) + " kHz");
+      saveRung(sectors, rung);
+      return true;
+    }
+    Serial.println("SD: self-test failed at " + String(hz / 1000) +
+                   " kHz, stepping down");
+    spiBusYield(SpiClient::SPI_CLIENT_SD);
+  }
+  // nothing faster verified: stay at the safe clock
+  if (!mountAt(SAFE_CLOCK)) {
+    Serial.println("SD: remount at safe clock failed");
+    return false;
+  }
+  Serial.println("SD: mounted at safe clock " + String(SAFE_CLOCK / 1000) +
+                 " kHz");
+  return true;
+}
+
+bool sdEnsureMounted() {
+  {
+    SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+    if (s_clockHz != 0 && SD.cardType() != CARD_NONE)
+      return true;
+  }
+  return sdMount();
+}
+
+uint32_t sdClockHz() { return s_clockHz; }
+
+SdBenchResult sdBenchmark() {
+  SdBenchResult r = {false, s_clockHz, 0.0f, 0.0f};
+  if (!sdEnsureMounted())
+    return r;
+  static uint8_t buf[512];
+  const uint32_t SEQ_SECTORS = 2048; // 1 MiB
+  const uint32_t RAND_READS = 256;
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
+  uint32_t total = SD.numSectors();
+  if (total < SEQ_SECTORS)
+    return r;
+  r.clockHz = s_clockHz;
+
+  // the timers exclude time the bus was lent to the display
+  uint32_t seqUs = 0;
+  uint32_t t0 = micros();
+  for (uint32_t s = 0; s < SEQ_SECTORS; ++s) {
+    if (!SD.readRAW(buf, s))
+      return r;
+    if ((s & 63) == 63) {
+      seqUs += micros() - t0;
+      spiBusYield(SpiClient::SPI_CLIENT_SD);
+      t0 = micros();
+    }
+  }
+  seqUs += micros() - t0;
+
+  uint32_t randUs = 0;
+  t0 = micros();
+  for (uint32_t i = 0; i < RAND_READS; ++i) {
+    uint32_t s = (uint32_t)random((long)total);
+    if (!SD.readRAW(buf, s))
+      return r;
+    if ((i & 15) == 15) {
+      randUs += micros() - t0;
+      spiBusYield(SpiClient::SPI_CLIENT_SD);
+      t0 = micros();
+    }
+  }
+  randUs += micros() - t0;
+
+  if (seqUs > 0)
+    r.seqMBps = (SEQ_SECTORS * 512.0f) / (float)seqUs; // bytes/us == MB/s
+  if (randUs > 0)
+    r.randReadsPerSec = RAND_READS * 1000000.0f / (float)randUs;
+  r.ok = true;
+  return r;
+}
+
+static void sdbenchCommand(const String &) {
+  SdBenchResult r = sdBenchmark();
+  if (!r.ok) {
+    Serial.println("sdbench: failed (no card?)");
+    return;
+  }
+  Serial.println("sdbench: clock " + String(r.clockHz / 1000) + " kHz, seq " +
+                 String(r.seqMBps, 2) + " MB/s, random " +
+                 String(r.randReadsPerSec, 0) + " reads/s");
+}
+
+void sdConsoleRegister() {
+  debugConsoleRegister("sdbench", "SD read throughput benchmark",
+                       sdbenchCommand);
+}
@@ -0,0 +1,33 @@
+// SD card mount with clock negotiation
+#pragma once
+
+#include <Arduino.h>
+
+// Mount the card at the fastest SPI clock that passes a read/CRC self-test.
+// A reference CRC over a fixed set of sectors is taken at the safe 4 MHz
+// clock, then each faster rung is tried from the top down until one reads
+// the same data back. The chosen rung is remembered in NVS (per card size)
+// so later mounts skip clocks the card is known to fail at.
+// Takes the SD side of the SPI bus itself.
+bool sdMount();
+
+// Cheap check used by the periodic card-detect poll: returns immediately if
+// the card is mounted, otherwise tries a (negotiated) mount.
+bool sdEnsureMounted();
+
+// SPI clock the card is currently mounted at (0 if not mounted)
+uint32_t sdClockHz();
+
+struct SdBenchResult {
+  bool ok;
+  uint32_t clockHz;
+  float seqMBps;         // sequential single-sector reads
+  float randReadsPerSec; // random 512 B sector reads
+};
+
+// Read-only throughput benchmark on raw sectors (~1 MiB sequential plus a
+// few hundred random sectors). Lends the bus to the display while running.
+SdBenchResult sdBenchmark();
+
+// serial console command "sdbench"
+void sdConsoleRegister();
@@ -0,0 +1,105 @@
+#include "spi_bus.h"
+#include "defines/pinconf.h"
+#include <SPI.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+static SemaphoreHandle_t s_busMutex = NULL;
+// number of tasks blocked waiting for the bus, per client
+static volatile int s_displayWaiting = 0;
+static volatile int s_sdWaiting = 0;
+// acquisition stack of the current holder (recursive mutex)
+static const int MAX_DEPTH = 8;
+static SpiClient s_stack[MAX_DEPTH];
+static int s_depth = 0;
+// client whose pin routing is currently applied
+static int s_routed = -1;
+
+// Route the shared GPIO for the given client. Only needed when the panel's
+// DC line doubles as SD MISO.
+static void routePins(SpiClient client) {
+  if (s_routed == (int)client)
+    return;
+#if SPI_MISO_PIN == EPD_DC_PIN
+  if (client == SpiClient::SPI_CLIENT_SD) {
+    // hand the pad back to the SPI peripheral as MISO input
+    spiAttachMISO(SPI.bus(), SPI_MISO_PIN);
+  } else {
+    // panel drives DC as a plain GPIO output
+    pinMode(EPD_DC_PIN, OUTPUT);
+  }
+#endif
+  s_routed = (int)client;
+}
+
+void spiBusBegin() {
+  SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN, EPD_CS_PIN);
+  if (!s_busMutex)
+    s_busMutex = xSemaphoreCreateRecursiveMutex();
+  s_routed = -1;
+}
+
+bool spiBusAcquire(SpiClient client, TickType_t wait) {
+  if (!s_busMutex)
+    return true; // before spiBusBegin: single-threaded boot code
+  bool display = (client == SpiClient::SPI_CLIENT_DISPLAY);
+  bool holder =
+      xSemaphoreGetMutexHolder(s_busMutex) == xTaskGetCurrentTaskHandle();
+  if (!holder && !display) {
+    // display transfers go first: new SD users wait for them to drain
+    TickType_t waited = 0;
+    while (s_displayWaiting > 0 && waited < wait) {
+      vTaskDelay(1);
+      waited++;
+    }
+  }
+  if (display)
+    s_displayWaiting = s_displayWaiting + 1;
+  else
+    s_sdWaiting = s_sdWaiting + 1;
+  BaseType_t ok = xSemaphoreTakeRecursive(s_busMutex, wait);
+  if (display)
+    s_displayWaiting = s_displayWaiting - 1;
+  else
+    s_sdWaiting = s_sdWaiting - 1;
+  if (ok != pdTRUE)
+    return false;
+  if (s_depth < MAX_DEPTH)
+    s_stack[s_depth] = client;
+  s_depth++;
+  routePins(client);
+  return true;
+}
+
+void spiBusRelease(SpiClient client) {
+  if (!s_busMutex)
+    return;
+  if (s_depth > 0)
+    s_depth--;
+  // restore routing for an enclosing acquisition by a different client
+  if (s_depth > 0 && s_depth <= MAX_DEPTH)
+    routePins(s_stack[s_depth - 1]);
+  xSemaphoreGiveRecursive(s_busMutex);
+  (void)client;
+}
+
+void spiBusYield(SpiClient client) {
+  if (!s_busMutex || s_depth != 1 ||
+      xSemaphoreGetMutexHolder(s_busMutex) != xTaskGetCurrentTaskHandle()) {
+    // nested ownership cannot be handed over safely
+    if (client == SpiClient::SPI_CLIENT_DISPLAY)
+      vTaskDelay(1);
+    return;
+  }
+  bool contended = (client == SpiClient::SPI_CLIENT_DISPLAY)
+                       ? (s_sdWaiting > 0)
+                       : (s_displayWaiting > 0);
+  if (!contended) {
+    if (client == SpiClient::SPI_CLIENT_DISPLAY)
+      vTaskDelay(1); // called from the panel busy-wait: don't spin
+    return;
+  }
+  spiBusRelease(client);
+  vTaskDelay(1);
+  spiBusAcquire(client);
+}
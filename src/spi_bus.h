@@ -0,0 +1,39 @@
+// Arbiter for the SPI bus shared by the e-paper panel and the SD card
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+// Bus clients. Each library still runs its own SPI transactions (GxEPD2 and
+// the SD driver both call beginTransaction with their own clock/mode), so the
+// arbiter only has to make sure those transactions never interleave and that
+// the shared GPIO (SPI_MISO_PIN == EPD_DC_PIN on this board) is routed for
+// whoever owns the bus. That also lets the SD card run at a higher clock
+// than the panel.
+enum class SpiClient : uint8_t { SPI_CLIENT_DISPLAY = 0, SPI_CLIENT_SD };
+
+// Start the SPI peripheral and create the bus mutex (call once in setup).
+void spiBusBegin();
+
+// Acquire/release the bus. Recursive for the calling task; nested
+// acquisitions by another client switch the pin routing and restore it on
+// release. SD acquisitions step aside while a display transfer is waiting.
+bool spiBusAcquire(SpiClient client, TickType_t wait = portMAX_DELAY);
+void spiBusRelease(SpiClient client);
+
+// Long-running holders call this between chunks of work: if a higher
+// priority client (display) or, during panel busy-waits, an SD client is
+// waiting, the bus is handed over and re-acquired.
+void spiBusYield(SpiClient client);
+
+// Scoped bus ownership
+class SpiBusLock {
+public:
+  explicit SpiBusLock(SpiClient c) : client(c) { spiBusAcquire(client); }
+  ~SpiBusLock() { spiBusRelease(client); }
+  SpiBusLock(const SpiBusLock &) = delete;
+  SpiBusLock &operator=(const SpiBusLock &) = delete;
+
+private:
+  SpiClient client;
+};
@@ -1,4 +1,5 @@
 #include "encoding.h"
+#include "../spi_bus.h"
 #include <SD.h>
 #include <Preferences.h>
 
@@ -57,6 +58,7 @@ ETextEncoding detectEncodingFromBuffer(const uint8_t *buf, size_t len) {
 }
 
 ETextEncoding detectEncodingFromFile(const String &absPath, size_t maxRead) {
+  SpiBusLock lock(SpiClient::SPI_CLIENT_SD);
   File f = SD.open(absPath.c_str());
   if (!f) return ETextEncoding::ENC_UNKNOWN;
   size_t toRead = (size_t)f.size();
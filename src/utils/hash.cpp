@@ -0,0 +1,14 @@
+#include "hash.h"
+
+uint32_t fnv1a(const void *data, size_t len, uint32_t h) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+uint32_t fnv1a(const String &s, uint32_t h) {
+  return fnv1a(s.c_str(), s.length(), h);
+}
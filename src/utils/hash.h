@@ -0,0 +1,9 @@
+// hash.h - FNV-1a hashing shared by the on-card caches and NVS keys
+#pragma once
+#include <Arduino.h>
+
+static const uint32_t FNV1A_SEED = 2166136261UL;
+
+// 32-bit FNV-1a over a byte range; pass a previous result as `h` to chain.
+uint32_t fnv1a(const void *data, size_t len, uint32_t h = FNV1A_SEED);
+uint32_t fnv1a(const String &s, uint32_t h = FNV1A_SEED);
@@ -39,6 +39,9 @@ static int monthDays(int y, int m) {
   return (info & (0x10000 >> m)) ? 30 : 29;
 }
 static int leapMonth(int y) { return lunarInfo[y - 1900] & 0xf; }
+static int leapDays(int y) {
+  return leapMonth(y) ? ((lunarInfo[y - 1900] & 0x10000) ? 30 : 29) : 0;
+}
 static long daysBetween1900(int y, int m, int d) {
   long days = 0;
   for (int i = 1900; i < y; i++)
@@ -67,28 +70,25 @@ Lunar SolarToLunar(const Solar &s) {
     daysInYear = yearDays(y);
   }
   out.year = y;
+  // the leap month (if any) follows month `leap` and carries its number
   int leap = leapMonth(y);
   bool isLeap = false;
   int m = 1;
   while (true) {
-    int mdays = 0;
-    if (m == leap + 1 && leap > 0 && !isLeap) {
-      mdays = (lunarInfo[y - 1900] & 0x10000) ? 30 : 29;
-      isLeap = true;
-    } else {
-      mdays = monthDays(y, m);
-      if (isLeap)
-        isLeap = false;
-    }
+    int mdays = isLeap ? leapDays(y) : monthDays(y, m);
     if (offset < mdays)
       break;
     offset -= mdays;
-    if (!isLeap)
+    if (!isLeap && m == leap) {
+      isLeap = true;
+    } else {
+      isLeap = false;
       m++;
+    }
   }
   out.month = m;
   out.day = offset + 1;
-  out.isLeap = (leap > 0 && isLeap);
+  out.isLeap = isLeap;
   return out;
 }
 
@@ -98,20 +98,13 @@ Solar LunarToSolar(const Lunar &l) {
   for (int i = 1900; i < l.year; i++)
     offset += yearDays(i);
   int leap = leapMonth(l.year);
-  bool usedLeap = false;
-  int m = 1;
-  while (m < l.month) {
-    if (leap > 0 && m == leap + 1 && !usedLeap) {
-      offset += ((lunarInfo[l.year - 1900] & 0x10000) ? 30 : 29);
-      usedLeap = true;
-    } else {
-      offset += monthDays(l.year, m);
-      if (usedLeap)
-        usedLeap = false;
-      else
-        m++;
-    }
+  for (int m = 1; m < l.month; m++) {
+    offset += monthDays(l.year, m);
+    if (m == leap)
+      offset += leapDays(l.year);
   }
+  if (l.isLeap && l.month == leap)
+    offset += monthDays(l.year, l.month);
   offset += (l.day - 1);
   long total = offset + 30;
   int y = 1900;
@@ -139,3 +132,18 @@ Solar LunarToSolar(const Lunar &l) {
   s.day = total + 1;
   return s;
 }
+
+int lunarLeapMonth(int year) {
+  if (year < LUNAR_MIN_YEAR || year > LUNAR_MAX_YEAR)
+    return 0;
+  return leapMonth(year);
+}
+
+int lunarMonthDays(int year, int month, bool isLeap) {
+  if (year < LUNAR_MIN_YEAR || year > LUNAR_MAX_YEAR || month < 1 ||
+      month > 12)
+    return 0;
+  if (isLeap)
+    return month == leapMonth(year) ? leapDays(year) : 0;
+  return monthDays(year, month);
+}
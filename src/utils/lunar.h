@@ -14,9 +14,16 @@ struct Lunar {
   bool isLeap;
 };
 
+// A leap month follows the regular month of the same number and is
+// returned/accepted as {month, isLeap = true}.
 Lunar SolarToLunar(const Solar &s);
 Solar LunarToSolar(const Lunar &l);
 
 // Supported lunar data table in this file covers years 1900..2049.
 constexpr int LUNAR_MIN_YEAR = 1900;
 constexpr int LUNAR_MAX_YEAR = 2049;
+
+// month number that is doubled in lunar `year` (0 = none)
+int lunarLeapMonth(int year);
+// 29 or 30; 0 if that (leap) month does not exist
+int lunarMonthDays(int year, int month, bool isLeap);
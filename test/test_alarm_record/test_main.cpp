@@ -0,0 +1,109 @@
+// alarms/record: the 32-bit NVS record and the legacy blob
+#include "alarms/record.h"
+#include <string.h>
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+static void assertSame(const Alarm &e, const Alarm &a) {
+  TEST_ASSERT_EQUAL(e.hour, a.hour);
+  TEST_ASSERT_EQUAL(e.minute, a.minute);
+  TEST_ASSERT_EQUAL(e.tone, a.tone);
+  TEST_ASSERT_EQUAL(e.enabled, a.enabled);
+  TEST_ASSERT_EQUAL(e.kind, a.kind);
+  if (e.kind == ALARM_WEEKLY)
+    TEST_ASSERT_EQUAL(e.weekdays, a.weekdays);
+  if (e.kind == ALARM_ONCE)
+    TEST_ASSERT_EQUAL(e.year, a.year);
+  if (e.kind != ALARM_WEEKLY) {
+    TEST_ASSERT_EQUAL(e.month, a.month);
+    TEST_ASSERT_EQUAL(e.day, a.day);
+  }
+  if (e.kind == ALARM_LUNAR)
+    TEST_ASSERT_EQUAL(e.leap, a.leap);
+}
+
+static void test_weekly_round_trip() {
+  const Alarm a = {6, 30, 0x3E, 3, true};
+  assertSame(a, alarmDecode(alarmEncode(a)));
+  const Alarm every = {23, 59, 0, 5, false};
+  assertSame(every, alarmDecode(alarmEncode(every)));
+}
+
+static void test_once_round_trip() {
+  const Alarm a = {7, 15, 0, 2, true, ALARM_ONCE, 2026, 10, 19};
+  assertSame(a, alarmDecode(alarmEncode(a)));
+  const Alarm last = {0, 0, 0, 1, true, ALARM_ONCE, 2024 + 63, 12, 31};
+  assertSame(last, alarmDecode(alarmEncode(last)));
+  // years before the base clamp to it
+  Alarm old = {7, 0, 0, 1, true, ALARM_ONCE, 2020, 1, 1};
+  TEST_ASSERT_EQUAL(2024, alarmDecode(alarmEncode(old)).year);
+}
+
+static void test_lunar_round_trip() {
+  const Alarm a = {6, 0, 0, 1, true, ALARM_LUNAR, 0, 8, 15, false};
+  assertSame(a, alarmDecode(alarmEncode(a)));
+  const Alarm leap = {9, 5, 0, 4, false, ALARM_LUNAR, 0, 6, 30, true};
+  assertSame(leap, alarmDecode(alarmEncode(leap)));
+  const Alarm monthly = {8, 0, 0, 1, true, ALARM_LUNAR, 0, 0, 1, false};
+  assertSame(monthly, alarmDecode(alarmEncode(monthly)));
+}
+
+static void test_bad_records_give_default() {
+  const Alarm badHour = {24, 0, 0, 1, true};
+  assertSame(DEFAULT_ALARM, alarmDecode(alarmEncode(badHour)));
+  const Alarm badMinute = {6, 60, 0, 1, true};
+  assertSame(DEFAULT_ALARM, alarmDecode(alarmEncode(badMinute)));
+  const Alarm badMonth = {6, 0, 0, 1, true, ALARM_ONCE, 2026, 13, 1};
+  assertSame(DEFAULT_ALARM, alarmDecode(alarmEncode(badMonth)));
+  const Alarm noDay = {6, 0, 0, 1, true, ALARM_ONCE, 2026, 5, 0};
+  assertSame(DEFAULT_ALARM, alarmDecode(alarmEncode(noDay)));
+  const Alarm lunarDay31 = {6, 0, 0, 1, true, ALARM_LUNAR, 0, 1, 31};
+  assertSame(DEFAULT_ALARM, alarmDecode(alarmEncode(lunarDay31)));
+  // kind 3 is unused and reads as weekly
+  TEST_ASSERT_EQUAL(ALARM_WEEKLY, alarmDecode(3u << 15 | 7).kind);
+}
+
+static void test_bad_tone_resets_tone_only() {
+  const Alarm a = {6, 30, 0x02, 0, true};
+  Alarm d = alarmDecode(alarmEncode(a));
+  TEST_ASSERT_EQUAL(1, d.tone);
+  TEST_ASSERT_EQUAL(6, d.hour);
+  TEST_ASSERT_EQUAL(0x02, d.weekdays);
+  const Alarm high = {6, 30, 0x02, 7, true};
+  TEST_ASSERT_EQUAL(1, alarmDecode(alarmEncode(high)).tone);
+}
+
+static void test_legacy_blob() {
+  // the old blob was the raw array of the 5-byte struct
+  TEST_ASSERT_EQUAL(5, sizeof(LegacyAlarm));
+  const uint8_t blob[5 * 5] = {
+      6,  45, 0x41, 2, 1, // weekend alarm
+      30, 0,  0,    1, 1, // corrupt hour
+      7,  0,  0,    9, 0, // tone out of range
+      0,  0,  0,    0, 0, 0, 0, 0, 0, 0,
+  };
+  LegacyAlarm old[5];
+  memcpy(old, blob, sizeof(old));
+
+  Alarm a = alarmFromLegacy(old[0]);
+  const Alarm want = {6, 45, 0x41, 2, true};
+  assertSame(want, a);
+  assertSame(DEFAULT_ALARM, alarmFromLegacy(old[1]));
+  Alarm c = alarmFromLegacy(old[2]);
+  TEST_ASSERT_EQUAL(7, c.hour);
+  TEST_ASSERT_FALSE(c.enabled);
+  TEST_ASSERT_EQUAL(1, c.tone);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_weekly_round_trip);
+  RUN_TEST(test_once_round_trip);
+  RUN_TEST(test_lunar_round_trip);
+  RUN_TEST(test_bad_records_give_default);
+  RUN_TEST(test_bad_tone_resets_tone_only);
+  RUN_TEST(test_legacy_blob);
+  return UNITY_END();
+}
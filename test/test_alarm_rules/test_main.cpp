@@ -0,0 +1,111 @@
+// alarms/rules: next firing time of weekly, one-shot and lunar alarms
+#include "alarms/rules.h"
+#include <stdlib.h>
+#include <unity.h>
+
+void setUp() {
+  setenv("TZ", "UTC0", 1);
+  tzset();
+}
+void tearDown() {}
+
+// UTC epoch seconds of a civil date and time
+static time_t at(int y, int m, int d, int hh = 0, int mm = 0) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097 + doe - 719468;
+  return (time_t)days * 86400 + hh * 3600 + mm * 60;
+}
+
+static const int MON = 1 << 1, WED = 1 << 3, SUN = 1 << 0;
+
+static void test_weekly_mask() {
+  // 2026-10-19 is a Monday
+  const Alarm a = {7, 0, MON | WED, 1, true};
+  TEST_ASSERT_EQUAL(at(2026, 10, 19, 7), alarmNextFire(a, at(2026, 10, 19, 6)));
+  // strictly after: ringing at 07:00 moves on to Wednesday
+  TEST_ASSERT_EQUAL(at(2026, 10, 21, 7), alarmNextFire(a, at(2026, 10, 19, 7)));
+  TEST_ASSERT_EQUAL(at(2026, 10, 26, 7),
+                    alarmNextFire(a, at(2026, 10, 21, 7, 30)));
+  const Alarm sunday = {22, 15, SUN, 1, true};
+  TEST_ASSERT_EQUAL(at(2026, 10, 25, 22, 15),
+                    alarmNextFire(sunday, at(2026, 10, 19, 12)));
+  // only Monday, already past: a week later
+  const Alarm monday = {7, 0, MON, 1, true};
+  TEST_ASSERT_EQUAL(at(2026, 10, 26, 7),
+                    alarmNextFire(monday, at(2026, 10, 19, 8)));
+}
+
+static void test_weekly_every_day() {
+  const Alarm a = {7, 0, 0, 1, true};
+  TEST_ASSERT_EQUAL(at(2026, 10, 20, 7), alarmNextFire(a, at(2026, 10, 19, 8)));
+  TEST_ASSERT_EQUAL(at(2027, 1, 1, 7), alarmNextFire(a, at(2026, 12, 31, 23)));
+}
+
+static void test_once() {
+  const Alarm a = {23, 59, 0, 1, true, ALARM_ONCE, 2026, 12, 31};
+  TEST_ASSERT_EQUAL(at(2026, 12, 31, 23, 59),
+                    alarmNextFire(a, at(2026, 10, 19)));
+  TEST_ASSERT_EQUAL(0, alarmNextFire(a, at(2026, 12, 31, 23, 59)));
+  const Alarm leapDay = {6, 0, 0, 1, true, ALARM_ONCE, 2028, 2, 29};
+  TEST_ASSERT_EQUAL(at(2028, 2, 29, 6), alarmNextFire(leapDay, at(2026, 10, 19)));
+  const Alarm feb30 = {6, 0, 0, 1, true, ALARM_ONCE, 2027, 2, 30};
+  TEST_ASSERT_EQUAL(0, alarmNextFire(feb30, at(2026, 10, 19)));
+  const Alarm feb29 = {6, 0, 0, 1, true, ALARM_ONCE, 2027, 2, 29};
+  TEST_ASSERT_EQUAL(0, alarmNextFire(feb29, at(2026, 10, 19)));
+}
+
+static void test_lunar_yearly() {
+  // lunar new year: 2026-02-17, 2027-02-06
+  const Alarm newYear = {8, 0, 0, 1, true, ALARM_LUNAR, 0, 1, 1, false};
+  TEST_ASSERT_EQUAL(at(2026, 2, 17, 8), alarmNextFire(newYear, at(2026, 1, 1)));
+  TEST_ASSERT_EQUAL(at(2027, 2, 6, 8), alarmNextFire(newYear, at(2026, 2, 17, 8)));
+  // mid-autumn (8/15): 2026-09-25, 2027-09-15
+  const Alarm midAutumn = {20, 0, 0, 1, true, ALARM_LUNAR, 0, 8, 15, false};
+  TEST_ASSERT_EQUAL(at(2026, 9, 25, 20), alarmNextFire(midAutumn, at(2026, 9, 1)));
+  TEST_ASSERT_EQUAL(at(2027, 9, 15, 20),
+                    alarmNextFire(midAutumn, at(2026, 10, 19)));
+}
+
+static void test_lunar_leap_month() {
+  // 2023 doubles the 2nd month: 2/1 is 2023-02-20, leap 2/1 is 2023-03-22
+  const Alarm regular = {7, 0, 0, 1, true, ALARM_LUNAR, 0, 2, 1, false};
+  const Alarm leap = {7, 0, 0, 1, true, ALARM_LUNAR, 0, 2, 1, true};
+  TEST_ASSERT_EQUAL(at(2023, 2, 20, 7), alarmNextFire(regular, at(2023, 1, 1)));
+  TEST_ASSERT_EQUAL(at(2023, 3, 22, 7), alarmNextFire(leap, at(2023, 1, 1)));
+  // the regular rule skips the leap month
+  TEST_ASSERT_EQUAL(at(2024, 3, 10, 7), alarmNextFire(regular, at(2023, 3, 1)));
+  // 2024 has no leap 2nd month: the leap rule falls back to the regular one
+  TEST_ASSERT_EQUAL(at(2024, 3, 10, 7), alarmNextFire(leap, at(2023, 4, 1)));
+}
+
+static void test_lunar_every_month() {
+  // lunar 12/23 of 2025 is 2026-02-10; the next 1st is new year's day
+  const Alarm monthly = {6, 30, 0, 1, true, ALARM_LUNAR, 0, 0, 1, false};
+  TEST_ASSERT_EQUAL(at(2026, 2, 17, 6, 30),
+                    alarmNextFire(monthly, at(2026, 2, 10)));
+  // and the leap month counts as a month: 2023-03-22 follows 2023-02-20
+  TEST_ASSERT_EQUAL(at(2023, 3, 22, 6, 30),
+                    alarmNextFire(monthly, at(2023, 2, 21)));
+}
+
+static void test_lunar_day_30_in_short_month() {
+  // the 12th month of 2025 has 29 days (2026-01-19 .. 2026-02-16)
+  const Alarm a = {7, 0, 0, 1, true, ALARM_LUNAR, 0, 12, 30, false};
+  TEST_ASSERT_EQUAL(at(2026, 2, 16, 7), alarmNextFire(a, at(2026, 1, 1)));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_weekly_mask);
+  RUN_TEST(test_weekly_every_day);
+  RUN_TEST(test_once);
+  RUN_TEST(test_lunar_yearly);
+  RUN_TEST(test_lunar_leap_month);
+  RUN_TEST(test_lunar_every_month);
+  RUN_TEST(test_lunar_day_30_in_short_month);
+  return UNITY_END();
+}
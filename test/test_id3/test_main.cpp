@@ -0,0 +1,201 @@
+// id3: ID3v2/ID3v1 tags read from memory
+#include "media/id3.h"
+#include <string.h>
+#include <unity.h>
+#include <vector>
+
+void setUp() {}
+void tearDown() {}
+
+typedef std::vector<uint8_t> Bytes;
+
+class MemSource : public Id3Source {
+public:
+  explicit MemSource(const Bytes &b) : data(b) {}
+  uint32_t size() override { return data.size(); }
+  bool seek(uint32_t p) override {
+    if (p > data.size())
+      return false;
+    pos = p;
+    return true;
+  }
+  size_t read(uint8_t *buf, size_t n) override {
+    size_t left = data.size() - pos;
+    if (n > left)
+      n = left;
+    memcpy(buf, data.data() + pos, n);
+    pos += n;
+    return n;
+  }
+
+private:
+  const Bytes &data;
+  uint32_t pos = 0;
+};
+
+static void append(Bytes &b, const void *p, size_t n) {
+  b.insert(b.end(), (const uint8_t *)p, (const uint8_t *)p + n);
+}
+static void append(Bytes &b, const char *s) { append(b, s, strlen(s)); }
+
+// ID3v2.3/2.4 frame; the size is syncsafe in 2.4 (the same below 128)
+static void frame(Bytes &b, const char *id, const Bytes &body) {
+  append(b, id, 4);
+  const uint8_t hdr[6] = {0, 0, 0, (uint8_t)body.size(), 0, 0};
+  append(b, hdr, 6);
+  append(b, body.data(), body.size());
+}
+static void frame22(Bytes &b, const char *id, const Bytes &body) {
+  append(b, id, 3);
+  const uint8_t size[3] = {0, 0, (uint8_t)body.size()};
+  append(b, size, 3);
+  append(b, body.data(), body.size());
+}
+static Bytes text(uint8_t enc, const Bytes &s) {
+  Bytes b = {enc};
+  append(b, s.data(), s.size());
+  return b;
+}
+static Bytes text(uint8_t enc, const char *s) {
+  return text(enc, Bytes(s, s + strlen(s)));
+}
+
+// "ID3" header around `frames` plus `padding` zero bytes
+static Bytes tag(uint8_t ver, const Bytes &frames, size_t padding = 16) {
+  Bytes b;
+  append(b, "ID3");
+  uint32_t size = frames.size() + padding;
+  const uint8_t hdr[7] = {ver,
+                          0,
+                          0,
+                          (uint8_t)((size >> 21) & 0x7F),
+                          (uint8_t)((size >> 14) & 0x7F),
+                          (uint8_t)((size >> 7) & 0x7F),
+                          (uint8_t)(size & 0x7F)};
+  append(b, hdr, 7);
+  append(b, frames.data(), frames.size());
+  b.insert(b.end(), padding, 0);
+  return b;
+}
+
+// 16000 bytes of 128 kbit/s audio: one second
+static void audio(Bytes &b) {
+  const uint8_t hdr[4] = {0xFF, 0xFB, 0x90, 0x00};
+  append(b, hdr, 4);
+  b.insert(b.end(), 16000 - 4, 0);
+}
+
+static void v1(Bytes &b, const char *title, const char *artist,
+               const char *album) {
+  uint8_t t[128] = {'T', 'A', 'G'};
+  memcpy(t + 3, title, strlen(title));
+  memcpy(t + 33, artist, strlen(artist));
+  memcpy(t + 63, album, strlen(album));
+  append(b, t, 128);
+}
+
+static void test_v23_latin1_and_utf16() {
+  Bytes f;
+  frame(f, "TIT2", text(0, "Caf\xE9 "));
+  frame(f, "APIC", Bytes(60, 0xAB)); // skipped by size
+  frame(f, "TPE1", text(1, Bytes{0xFF, 0xFE, 'A', 0, 0x2C, 0x54, 0, 0}));
+  frame(f, "TALB", text(2, Bytes{0xD8, 0x3C, 0xDF, 0xB5}));
+  frame(f, "TLEN", text(0, "123456"));
+  Bytes file = tag(3, f);
+  audio(file);
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_TRUE(readId3(src, m));
+  TEST_ASSERT_EQUAL_STRING("Caf\xC3\xA9", m.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("A\xE5\x90\xAC", m.artist.c_str());
+  TEST_ASSERT_EQUAL_STRING("\xF0\x9F\x8E\xB5", m.album.c_str());
+  TEST_ASSERT_EQUAL(123456, m.durationMs);
+}
+
+static void test_v24_utf8_and_frame_duration() {
+  Bytes f;
+  frame(f, "TIT2", text(3, "\xE6\x99\xB4\xE5\xA4\xA9"));
+  frame(f, "TPE1", text(3, "Artist"));
+  Bytes file = tag(4, f);
+  audio(file);
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_TRUE(readId3(src, m));
+  TEST_ASSERT_EQUAL_STRING("\xE6\x99\xB4\xE5\xA4\xA9", m.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("Artist", m.artist.c_str());
+  TEST_ASSERT_EQUAL_STRING("", m.album.c_str());
+  TEST_ASSERT_EQUAL(1000, m.durationMs);
+}
+
+static void test_v22() {
+  Bytes f;
+  frame22(f, "TT2", text(0, "Old"));
+  frame22(f, "TP1", text(0, "Band"));
+  Bytes file = tag(2, f);
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_TRUE(readId3(src, m));
+  TEST_ASSERT_EQUAL_STRING("Old", m.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("Band", m.artist.c_str());
+}
+
+static void test_v1_fills_gaps() {
+  Bytes f;
+  frame(f, "TIT2", text(0, "From v2"));
+  Bytes file = tag(3, f);
+  audio(file);
+  v1(file, "From v1", "V1 Artist", "V1 Album");
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_TRUE(readId3(src, m));
+  TEST_ASSERT_EQUAL_STRING("From v2", m.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("V1 Artist", m.artist.c_str());
+  TEST_ASSERT_EQUAL_STRING("V1 Album", m.album.c_str());
+  // the v1 tag is not audio
+  TEST_ASSERT_EQUAL(1000, m.durationMs);
+}
+
+static void test_v1_only() {
+  Bytes file;
+  audio(file);
+  v1(file, "Only v1", "", "");
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_TRUE(readId3(src, m));
+  TEST_ASSERT_EQUAL_STRING("Only v1", m.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("", m.artist.c_str());
+  TEST_ASSERT_EQUAL(1000, m.durationMs);
+}
+
+static void test_no_tag() {
+  Bytes file;
+  audio(file);
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_FALSE(readId3(src, m));
+}
+
+static void test_oversized_frame_stops() {
+  Bytes f;
+  frame(f, "TIT2", text(0, "Kept"));
+  frame(f, "TPE1", text(0, "Cut"));
+  f[f.size() - 7] = 120; // TPE1 claims more than the tag holds
+  Bytes file = tag(3, f, 0);
+  MemSource src(file);
+  TrackMeta m;
+  TEST_ASSERT_TRUE(readId3(src, m));
+  TEST_ASSERT_EQUAL_STRING("Kept", m.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("", m.artist.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_v23_latin1_and_utf16);
+  RUN_TEST(test_v24_utf8_and_frame_duration);
+  RUN_TEST(test_v22);
+  RUN_TEST(test_v1_fills_gaps);
+  RUN_TEST(test_v1_only);
+  RUN_TEST(test_no_tag);
+  RUN_TEST(test_oversized_frame_stops);
+  return UNITY_END();
+}
@@ -0,0 +1,76 @@
+// lrc: timed lyric parsing
+#include "media/lrc.h"
+#include <string.h>
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+static bool parse(LrcTrack &t, const char *s) { return t.parse(s, strlen(s)); }
+
+static void test_stamps_sorted() {
+  LrcTrack t;
+  TEST_ASSERT_TRUE(parse(t, "[ar:Someone]\n"
+                            "[00:01.00]first\n"
+                            "[00:03.50][00:10.000] chorus\n"
+                            "[00:05]third\n"
+                            "plain line\n"
+                            "[xx:yy]not a stamp\n"
+                            "[01:02.5]last"));
+  TEST_ASSERT_EQUAL(-1, t.lineAt(999));
+  TEST_ASSERT_EQUAL(0, t.lineAt(1000));
+  TEST_ASSERT_EQUAL_STRING("first", t.text(0).c_str());
+  TEST_ASSERT_EQUAL(1, t.lineAt(3500));
+  TEST_ASSERT_EQUAL_STRING("chorus", t.text(1).c_str());
+  TEST_ASSERT_EQUAL(2, t.lineAt(9999));
+  TEST_ASSERT_EQUAL_STRING("third", t.text(2).c_str());
+  // a line with two tags shows up at both times
+  TEST_ASSERT_EQUAL(3, t.lineAt(10000));
+  TEST_ASSERT_EQUAL_STRING("chorus", t.text(3).c_str());
+  TEST_ASSERT_EQUAL(4, t.lineAt(62500));
+  TEST_ASSERT_EQUAL_STRING("last", t.text(4).c_str());
+  TEST_ASSERT_EQUAL(4, t.lineAt(600000));
+  TEST_ASSERT_EQUAL_STRING("", t.text(5).c_str());
+  TEST_ASSERT_EQUAL_STRING("", t.text(-1).c_str());
+}
+
+static void test_bom_and_crlf() {
+  LrcTrack t;
+  TEST_ASSERT_TRUE(parse(t, "\xEF\xBB\xBF[00:00.10]\xE4\xBD\xA0\xE5\xA5\xBD\r\n"
+                            "[00:00.20]b\r\n"));
+  TEST_ASSERT_EQUAL(0, t.lineAt(100));
+  TEST_ASSERT_EQUAL_STRING("\xE4\xBD\xA0\xE5\xA5\xBD", t.text(0).c_str());
+  TEST_ASSERT_EQUAL_STRING("b", t.text(1).c_str());
+}
+
+static void test_offset() {
+  LrcTrack t;
+  TEST_ASSERT_TRUE(parse(t, "[offset:500]\n[00:00.20]early\n[00:02.00]late\n"));
+  // positive offsets show the lines sooner, never before 0
+  TEST_ASSERT_EQUAL(0, t.lineAt(0));
+  TEST_ASSERT_EQUAL(1, t.lineAt(1500));
+  TEST_ASSERT_EQUAL(0, t.lineAt(1499));
+
+  TEST_ASSERT_TRUE(parse(t, "[00:02.00]late\n[offset:-1000]\n"));
+  TEST_ASSERT_EQUAL(-1, t.lineAt(2999));
+  TEST_ASSERT_EQUAL(0, t.lineAt(3000));
+}
+
+static void test_no_timed_lines() {
+  LrcTrack t;
+  TEST_ASSERT_TRUE(parse(t, "[00:01]x"));
+  TEST_ASSERT_FALSE(parse(t, "[ti:Title]\n[ar:Artist]\nplain text\n"));
+  TEST_ASSERT_TRUE(t.empty());
+  TEST_ASSERT_EQUAL(-1, t.lineAt(1000));
+  TEST_ASSERT_FALSE(parse(t, ""));
+  TEST_ASSERT_FALSE(parse(t, "[00:01"));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_stamps_sorted);
+  RUN_TEST(test_bom_and_crlf);
+  RUN_TEST(test_offset);
+  RUN_TEST(test_no_timed_lines);
+  return UNITY_END();
+}
@@ -0,0 +1,250 @@
+// mp3_frame: frame headers, Xing/Info and VBRI tables
+#include "audio/mp3_frame.h"
+#include <string.h>
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+// MPEG1 Layer III, 128 kbit/s, 44.1 kHz, stereo
+static const uint8_t HDR_V1_128[4] = {0xFF, 0xFB, 0x90, 0x00};
+// the Xing tag of such a frame follows 32 bytes of side info
+static const size_t XING_AT = 36;
+static const size_t VBRI_AT = 36;
+
+static uint8_t frame[417];
+
+static void putBe32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+static void putBe16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void resetFrame() {
+  memset(frame, 0, sizeof(frame));
+  memcpy(frame, HDR_V1_128, 4);
+}
+
+static void putXing(const char *tag, uint32_t flags, uint32_t frames,
+                    uint32_t bytes) {
+  uint8_t *p = frame + XING_AT;
+  memcpy(p, tag, 4);
+  putBe32(p + 4, flags);
+  p += 8;
+  if (flags & 1) {
+    putBe32(p, frames);
+    p += 4;
+  }
+  if (flags & 2) {
+    putBe32(p, bytes);
+    p += 4;
+  }
+  if (flags & 4)
+    for (int i = 0; i < 100; i++)
+      p[i] = i * 2;
+}
+
+static void test_header_mpeg1() {
+  Mp3FrameHeader h;
+  TEST_ASSERT_TRUE(parseMp3Header(HDR_V1_128, h));
+  TEST_ASSERT_EQUAL(1, h.version);
+  TEST_ASSERT_EQUAL(2, h.channels);
+  TEST_ASSERT_EQUAL(1152, h.samples);
+  TEST_ASSERT_EQUAL(128, h.bitrate);
+  TEST_ASSERT_EQUAL(44100, h.sampleRate);
+  TEST_ASSERT_EQUAL(417, h.frameLen);
+}
+
+static void test_header_padding_and_mono() {
+  const uint8_t p[4] = {0xFF, 0xFB, 0x92, 0xC0};
+  Mp3FrameHeader h;
+  TEST_ASSERT_TRUE(parseMp3Header(p, h));
+  TEST_ASSERT_EQUAL(418, h.frameLen);
+  TEST_ASSERT_EQUAL(1, h.channels);
+}
+
+static void test_header_mpeg2_and_25() {
+  const uint8_t v2[4] = {0xFF, 0xF3, 0x80, 0x00};
+  Mp3FrameHeader h;
+  TEST_ASSERT_TRUE(parseMp3Header(v2, h));
+  TEST_ASSERT_EQUAL(2, h.version);
+  TEST_ASSERT_EQUAL(576, h.samples);
+  TEST_ASSERT_EQUAL(64, h.bitrate);
+  TEST_ASSERT_EQUAL(22050, h.sampleRate);
+  TEST_ASSERT_EQUAL(208, h.frameLen);
+
+  const uint8_t v25[4] = {0xFF, 0xE3, 0x80, 0x00};
+  TEST_ASSERT_TRUE(parseMp3Header(v25, h));
+  TEST_ASSERT_EQUAL(25, h.version);
+  TEST_ASSERT_EQUAL(11025, h.sampleRate);
+}
+
+static void test_header_invalid() {
+  Mp3FrameHeader h;
+  const uint8_t noSync[4] = {0x00, 0xFB, 0x90, 0x00};
+  const uint8_t badBitrate[4] = {0xFF, 0xFB, 0xF0, 0x00};
+  const uint8_t freeBitrate[4] = {0xFF, 0xFB, 0x00, 0x00};
+  const uint8_t badRate[4] = {0xFF, 0xFB, 0x9C, 0x00};
+  const uint8_t layer1[4] = {0xFF, 0xFF, 0x90, 0x00};
+  const uint8_t reservedVersion[4] = {0xFF, 0xEB, 0x90, 0x00};
+  TEST_ASSERT_FALSE(parseMp3Header(noSync, h));
+  TEST_ASSERT_FALSE(parseMp3Header(badBitrate, h));
+  TEST_ASSERT_FALSE(parseMp3Header(freeBitrate, h));
+  TEST_ASSERT_FALSE(parseMp3Header(badRate, h));
+  TEST_ASSERT_FALSE(parseMp3Header(layer1, h));
+  TEST_ASSERT_FALSE(parseMp3Header(reservedVersion, h));
+}
+
+static void test_xing_table() {
+  resetFrame();
+  putXing("Xing", 0x0F, 1000, 500000);
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  TEST_ASSERT_FALSE(parseMp3VbrTable(frame, sizeof(frame), h, 10, 600000, t));
+  TEST_ASSERT_EQUAL(Mp3VbrTable::TABLE_XING, t.type);
+  TEST_ASSERT_EQUAL(1000, t.frames);
+  TEST_ASSERT_EQUAL(500000, t.bytes);
+  TEST_ASSERT_EQUAL(0, t.toc[0]);
+  TEST_ASSERT_EQUAL(100, t.toc[50]);
+  TEST_ASSERT_EQUAL(198, t.toc[99]);
+  // 1000 frames of 1152 samples at 44.1 kHz
+  TEST_ASSERT_EQUAL(26122, mp3EstimateDurationMs(frame, sizeof(frame), 600000));
+}
+
+static void test_info_is_cbr() {
+  resetFrame();
+  putXing("Info", 0x07, 1000, 500000);
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  TEST_ASSERT_TRUE(parseMp3VbrTable(frame, sizeof(frame), h, 10, 600000, t));
+  TEST_ASSERT_EQUAL(1000, t.frames);
+}
+
+static void test_xing_without_toc() {
+  resetFrame();
+  putXing("Xing", 0x01, 1000, 0);
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  parseMp3VbrTable(frame, sizeof(frame), h, 10, 600000, t);
+  TEST_ASSERT_EQUAL(Mp3VbrTable::TABLE_NONE, t.type);
+  TEST_ASSERT_EQUAL(1000, t.frames);
+  TEST_ASSERT_EQUAL(600000, t.bytes);
+}
+
+static void putVbri(uint16_t entries) {
+  uint8_t *v = frame + VBRI_AT;
+  memcpy(v, "VBRI", 4);
+  putBe16(v + 4, 1);       // version
+  putBe32(v + 10, 6000);   // bytes
+  putBe32(v + 14, 300);    // frames
+  putBe16(v + 18, entries);
+  putBe16(v + 20, 2);      // scale
+  putBe16(v + 22, 2);      // entry size
+  putBe16(v + 24, 100);    // frames per entry
+  for (uint16_t e = 0; e < 3; e++)
+    putBe16(v + 26 + e * 2, (e + 1) * 500);
+}
+
+static void test_vbri_table() {
+  resetFrame();
+  putVbri(3);
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  TEST_ASSERT_FALSE(parseMp3VbrTable(frame, sizeof(frame), h, 10, 6000, t));
+  TEST_ASSERT_EQUAL(Mp3VbrTable::TABLE_VBRI, t.type);
+  TEST_ASSERT_EQUAL(300, t.frames);
+  TEST_ASSERT_EQUAL(6000, t.bytes);
+  TEST_ASSERT_EQUAL(100, t.vbriFramesPerEntry);
+  const uint32_t want[4] = {10, 1010, 3010, 6010};
+  TEST_ASSERT_EQUAL(4, t.vbriOffsets.size());
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(want, t.vbriOffsets.data(), 4);
+  TEST_ASSERT_EQUAL(7836, mp3EstimateDurationMs(frame, sizeof(frame), 6000));
+}
+
+// LAME tag after a Xing table with all four fields (0x0F)
+static void putLame(const char *encoder, uint16_t delay, uint16_t padding) {
+  uint8_t *p = frame + XING_AT + 8 + 4 + 4 + 100 + 4;
+  memcpy(p, encoder, 4);
+  p[21] = delay >> 4;
+  p[22] = (delay & 0x0F) << 4 | padding >> 8;
+  p[23] = padding & 0xFF;
+}
+
+static void test_lame_delay_padding() {
+  resetFrame();
+  putXing("Info", 0x0F, 1000, 500000);
+  putLame("LAME", 576, 1260);
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  parseMp3VbrTable(frame, sizeof(frame), h, 10, 600000, t);
+  TEST_ASSERT_TRUE(t.lame);
+  TEST_ASSERT_EQUAL(576, t.encDelay);
+  TEST_ASSERT_EQUAL(1260, t.encPadding);
+
+  resetFrame();
+  putXing("Xing", 0x0F, 1000, 500000);
+  putLame("Lavc", 0xABC, 0xDEF);
+  parseMp3VbrTable(frame, sizeof(frame), h, 10, 600000, t);
+  TEST_ASSERT_EQUAL(Mp3VbrTable::TABLE_XING, t.type);
+  TEST_ASSERT_EQUAL(0xABC, t.encDelay);
+  TEST_ASSERT_EQUAL(0xDEF, t.encPadding);
+}
+
+static void test_no_lame_tag() {
+  resetFrame();
+  putXing("Xing", 0x0F, 1000, 500000);
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  parseMp3VbrTable(frame, sizeof(frame), h, 10, 600000, t);
+  TEST_ASSERT_FALSE(t.lame);
+  TEST_ASSERT_EQUAL(0, t.encDelay);
+  TEST_ASSERT_EQUAL(0, t.encPadding);
+}
+
+static void test_vbri_truncated_table() {
+  resetFrame();
+  putVbri(1000); // runs past the frame
+  Mp3FrameHeader h;
+  parseMp3Header(frame, h);
+  Mp3VbrTable t;
+  parseMp3VbrTable(frame, sizeof(frame), h, 10, 6000, t);
+  TEST_ASSERT_EQUAL(Mp3VbrTable::TABLE_NONE, t.type);
+  TEST_ASSERT_EQUAL(300, t.frames);
+  TEST_ASSERT_TRUE(t.vbriOffsets.empty());
+}
+
+static void test_cbr_estimate() {
+  resetFrame();
+  // no tag: bytes at the frame's bitrate
+  TEST_ASSERT_EQUAL(10000, mp3EstimateDurationMs(frame, sizeof(frame), 160000));
+  const uint8_t junk[4] = {0, 0, 0, 0};
+  TEST_ASSERT_EQUAL(0, mp3EstimateDurationMs(junk, 4, 160000));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_header_mpeg1);
+  RUN_TEST(test_header_padding_and_mono);
+  RUN_TEST(test_header_mpeg2_and_25);
+  RUN_TEST(test_header_invalid);
+  RUN_TEST(test_xing_table);
+  RUN_TEST(test_info_is_cbr);
+  RUN_TEST(test_lame_delay_padding);
+  RUN_TEST(test_no_lame_tag);
+  RUN_TEST(test_xing_without_toc);
+  RUN_TEST(test_vbri_table);
+  RUN_TEST(test_vbri_truncated_table);
+  RUN_TEST(test_cbr_estimate);
+  return UNITY_END();
+}
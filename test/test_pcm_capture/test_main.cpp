@@ -0,0 +1,184 @@
+// pcm_capture: underrun model, boundary silence and WAV files of the
+// playback harness, on a fake clock
+#include "audio/pcm_capture.h"
+#include <string.h>
+#include <unity.h>
+#include <vector>
+
+static uint32_t fakeUs = 0;
+static uint32_t waitedUs = 0;
+static uint32_t fakeNow() { return fakeUs; }
+// a blocked write() lets the clock run, as vTaskDelay would
+static void fakeWait(uint32_t us) {
+  waitedUs += us;
+  fakeUs += us;
+}
+
+// WAV files kept in memory
+struct FakeOutput : PcmCapture::Output {
+  struct File {
+    int index;
+    std::vector<uint8_t> bytes;
+    bool closed;
+  };
+  std::vector<File> files;
+  bool open(int index) override {
+    files.push_back({index, std::vector<uint8_t>(44, 0), false});
+    return true;
+  }
+  void write(const uint8_t *buf, size_t n) override {
+    files.back().bytes.insert(files.back().bytes.end(), buf, buf + n);
+  }
+  void close(const uint8_t *header, size_t n) override {
+    memcpy(files.back().bytes.data(), header, n);
+    files.back().closed = true;
+  }
+};
+
+static PcmCapture cap;
+static FakeOutput out;
+static int16_t pcm[2 * 4096];
+
+void setUp() {
+  fakeUs = 1000000;
+  waitedUs = 0;
+  out.files.clear();
+}
+void tearDown() {}
+
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// `frames` stereo frames, all `v`
+static void writeFrames(uint32_t frames, int16_t v) {
+  for (uint32_t i = 0; i < 2 * frames; ++i)
+    pcm[i] = v;
+  cap.write((const uint8_t *)pcm, frames * 4);
+}
+
+static void test_steady_stream_has_no_underrun() {
+  cap.begin(nullptr, fakeNow, fakeWait);
+  cap.setFormat(44100, 2);
+  // 1024 frames (~23 ms) every 20 ms: always ahead of the DAC
+  for (int i = 0; i < 100; ++i) {
+    writeFrames(1024, 100);
+    fakeUs += 20000;
+  }
+  TEST_ASSERT_EQUAL(0, cap.underruns());
+  TEST_ASSERT_EQUAL(102400, cap.totalFrames());
+  TEST_ASSERT_EQUAL(2321, cap.audioMs());
+}
+
+static void test_full_queue_blocks() {
+  cap.begin(nullptr, fakeNow, fakeWait);
+  cap.setFormat(48000, 2);
+  // the DMA queue holds 4096 frames; everything past that has to wait
+  writeFrames(4096, 1);
+  TEST_ASSERT_EQUAL(0, waitedUs);
+  writeFrames(480, 1);
+  TEST_ASSERT_EQUAL(10000, waitedUs);
+}
+
+static void test_late_data_is_underrun() {
+  cap.begin(nullptr, fakeNow, fakeWait);
+  cap.setFormat(44100, 2);
+  writeFrames(441, 1); // 10 ms
+  fakeUs += 11000;     // 1 ms late: jitter
+  writeFrames(441, 1);
+  TEST_ASSERT_EQUAL(0, cap.underruns());
+  fakeUs += 60000; // 50 ms late
+  writeFrames(441, 1);
+  TEST_ASSERT_EQUAL(1, cap.underruns());
+  TEST_ASSERT_EQUAL(50, cap.underrunMs());
+}
+
+static void test_boundary_silence_and_gap() {
+  cap.begin(nullptr, fakeNow, fakeWait);
+  cap.setFormat(44100, 2);
+  writeFrames(441, 7);
+  writeFrames(300, 0);
+  cap.trackStart("/b.mp3");
+  writeFrames(200, 0);
+  fakeUs += 100000; // the next block comes too late, within the window
+  writeFrames(441, 5);
+  writeFrames(100, 0); // silence after audio does not count
+  TEST_ASSERT_EQUAL(1, cap.boundaries().size());
+  const PcmCapture::Boundary &b = cap.boundaries()[0];
+  TEST_ASSERT_EQUAL_STRING("/b.mp3", b.path.c_str());
+  TEST_ASSERT_EQUAL(741, b.atFrame);
+  TEST_ASSERT_EQUAL(44100, b.rate);
+  TEST_ASSERT_EQUAL(2, b.srcChannels);
+  TEST_ASSERT_EQUAL(300, b.silentBefore);
+  TEST_ASSERT_EQUAL(200, b.silentAfter);
+  TEST_ASSERT_TRUE(b.underrunUs > 0);
+  TEST_ASSERT_EQUAL(1, cap.underruns());
+}
+
+static void test_gap_outside_window_not_charged() {
+  cap.begin(nullptr, fakeNow, fakeWait);
+  cap.setFormat(44100, 2);
+  cap.trackStart("/a.mp3");
+  writeFrames(4096, 1); // ~93 ms
+  writeFrames(4096, 1);
+  writeFrames(4096, 1); // past the 200 ms window
+  fakeUs += 400000;
+  writeFrames(441, 1);
+  TEST_ASSERT_EQUAL(1, cap.underruns());
+  TEST_ASSERT_EQUAL(0, cap.boundaries()[0].underrunUs);
+}
+
+static void test_wav_file_per_rate() {
+  cap.begin(&out, fakeNow, fakeWait);
+  cap.setFormat(44100, 2);
+  writeFrames(100, 1);
+  cap.setFormat(44100, 1); // mono source, same output rate: same file
+  writeFrames(50, 2);
+  cap.setFormat(48000, 2);
+  writeFrames(30, 3);
+  cap.end();
+
+  TEST_ASSERT_EQUAL(3, cap.segments().size());
+  TEST_ASSERT_EQUAL(2, out.files.size());
+  const FakeOutput::File &a = out.files[0];
+  const FakeOutput::File &b = out.files[1];
+  TEST_ASSERT_EQUAL(0, a.index);
+  TEST_ASSERT_EQUAL(2, b.index);
+  TEST_ASSERT_TRUE(a.closed && b.closed);
+  TEST_ASSERT_EQUAL(44 + 150 * 4, a.bytes.size());
+  TEST_ASSERT_EQUAL(44 + 30 * 4, b.bytes.size());
+  // each header has the rate its data was played at
+  TEST_ASSERT_EQUAL_MEMORY("RIFF", a.bytes.data(), 4);
+  TEST_ASSERT_EQUAL_MEMORY("data", a.bytes.data() + 36, 4);
+  TEST_ASSERT_EQUAL(44100, le32(a.bytes.data() + 24));
+  TEST_ASSERT_EQUAL(150 * 4, le32(a.bytes.data() + 40));
+  TEST_ASSERT_EQUAL(36 + 150 * 4, le32(a.bytes.data() + 4));
+  TEST_ASSERT_EQUAL(48000, le32(b.bytes.data() + 24));
+  TEST_ASSERT_EQUAL(48000 * 4, le32(b.bytes.data() + 28));
+  TEST_ASSERT_EQUAL(30 * 4, le32(b.bytes.data() + 40));
+  TEST_ASSERT_EQUAL_INT16(3, (int16_t)(b.bytes[44] | b.bytes[45] << 8));
+}
+
+static void test_empty_segment_replaced() {
+  cap.begin(&out, fakeNow, fakeWait);
+  cap.setFormat(44100, 2);
+  cap.setFormat(22050, 2); // before any audio
+  writeFrames(10, 1);
+  cap.end();
+  TEST_ASSERT_EQUAL(1, cap.segments().size());
+  TEST_ASSERT_EQUAL(22050, cap.segments()[0].rate);
+  TEST_ASSERT_EQUAL(22050, le32(out.files.back().bytes.data() + 24));
+  TEST_ASSERT_EQUAL(0, out.files.back().index);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_steady_stream_has_no_underrun);
+  RUN_TEST(test_full_queue_blocks);
+  RUN_TEST(test_late_data_is_underrun);
+  RUN_TEST(test_boundary_silence_and_gap);
+  RUN_TEST(test_gap_outside_window_not_charged);
+  RUN_TEST(test_wav_file_per_rate);
+  RUN_TEST(test_empty_segment_replaced);
+  return UNITY_END();
+}
@@ -0,0 +1,52 @@
+// pcm_format: mono expansion and format-change offsets
+#include "audio/pcm_format.h"
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+static void test_mono_to_stereo_even() {
+  int16_t buf[8] __attribute__((aligned(4))) = {1, -2, 0x1234, -32768};
+  pcmMonoToStereo((uint8_t *)buf, 4 * sizeof(int16_t));
+  const int16_t want[8] = {1, 1, -2, -2, 0x1234, 0x1234, -32768, -32768};
+  TEST_ASSERT_EQUAL_INT16_ARRAY(want, buf, 8);
+}
+
+static void test_mono_to_stereo_odd() {
+  int16_t buf[6] __attribute__((aligned(4))) = {7, 8, 9};
+  pcmMonoToStereo((uint8_t *)buf, 3 * sizeof(int16_t));
+  const int16_t want[6] = {7, 7, 8, 8, 9, 9};
+  TEST_ASSERT_EQUAL_INT16_ARRAY(want, buf, 6);
+}
+
+static void test_mono_to_stereo_single() {
+  int16_t buf[2] __attribute__((aligned(4))) = {-5, 99};
+  pcmMonoToStereo((uint8_t *)buf, sizeof(int16_t));
+  TEST_ASSERT_EQUAL_INT16(-5, buf[0]);
+  TEST_ASSERT_EQUAL_INT16(-5, buf[1]);
+}
+
+static void test_bytes_before_change() {
+  TEST_ASSERT_EQUAL(100, pcmBytesBefore(1000, 900, 4096));
+  TEST_ASSERT_EQUAL(4096, pcmBytesBefore(9000, 900, 4096));
+}
+
+static void test_bytes_before_change_due() {
+  TEST_ASSERT_EQUAL(0, pcmBytesBefore(900, 900, 4096));
+}
+
+static void test_bytes_before_change_wraps() {
+  // the running offsets wrapped between pos and the change
+  TEST_ASSERT_EQUAL(0x110, pcmBytesBefore(0x10, 0xFFFFFF00UL, 4096));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_mono_to_stereo_even);
+  RUN_TEST(test_mono_to_stereo_odd);
+  RUN_TEST(test_mono_to_stereo_single);
+  RUN_TEST(test_bytes_before_change);
+  RUN_TEST(test_bytes_before_change_due);
+  RUN_TEST(test_bytes_before_change_wraps);
+  return UNITY_END();
+}
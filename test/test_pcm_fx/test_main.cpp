@@ -0,0 +1,135 @@
+// pcm_fx: volume ramp, EQ coefficient hand-over, and the host side of the
+// "fxbench" benchmark
+#include "audio/pcm_fx.h"
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+static const size_t FRAMES = 256;
+
+// stereo 440 Hz tone at 44.1 kHz, continuing from `start`
+static void tone(int16_t *s, size_t frames, size_t start) {
+  for (size_t i = 0; i < frames; ++i) {
+    int16_t v = (int16_t)(8000 * sinf(2 * (float)M_PI * 440 * (start + i) / 44100));
+    s[2 * i] = v;
+    s[2 * i + 1] = v;
+  }
+}
+
+static void test_volume_unity_is_bit_exact() {
+  PcmVolume vol;
+  int16_t a[FRAMES * 2], b[FRAMES * 2];
+  tone(a, FRAMES, 0);
+  memcpy(b, a, sizeof(a));
+  vol.process(a, FRAMES);
+  TEST_ASSERT_EQUAL_INT16_ARRAY(b, a, FRAMES * 2);
+}
+
+static void test_volume_ramps_to_target() {
+  PcmVolume vol;
+  vol.setLevel(50); // 0.25 on the squared curve
+  int16_t s[2048 * 2];
+  for (size_t i = 0; i < 2048 * 2; ++i)
+    s[i] = 16384;
+  vol.process(s, 2048);
+  // first frame only one ramp step below unity, last at the target
+  TEST_ASSERT_TRUE(s[0] > 16000);
+  TEST_ASSERT_EQUAL_INT16(4096, s[2047 * 2]);
+}
+
+static void test_flat_eq_bypasses() {
+  PcmEq eq;
+  int16_t a[FRAMES * 2], b[FRAMES * 2];
+  tone(a, FRAMES, 0);
+  memcpy(b, a, sizeof(a));
+  eq.process(a, FRAMES);
+  TEST_ASSERT_EQUAL_INT16_ARRAY(b, a, FRAMES * 2);
+}
+
+// a new setting swaps the coefficients but keeps the filter history: the
+// same gains set again mid-stream must not change a single sample
+static void test_eq_change_keeps_state() {
+  PcmEq ref, eq;
+  ref.set(6, -3, 4);
+  eq.set(6, -3, 4);
+  int16_t a[FRAMES * 2], b[FRAMES * 2];
+  for (int blk = 0; blk < 4; ++blk) {
+    tone(a, FRAMES, blk * FRAMES);
+    memcpy(b, a, sizeof(a));
+    if (blk == 2)
+      eq.set(6, -3, 4);
+    ref.process(a, FRAMES);
+    eq.process(b, FRAMES);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(a, b, FRAMES * 2);
+  }
+}
+
+// enabling a band that was bypassed starts it from silence, not from the
+// history of an older setting
+static void test_eq_band_enabled_later() {
+  PcmEq eq, ref;
+  eq.set(0, 6, 3);
+  ref.set(0, 6, 0);
+  int16_t a[FRAMES * 2], b[FRAMES * 2];
+  for (int blk = 0; blk < 3; ++blk) {
+    if (blk == 1)
+      eq.set(0, 6, 0);
+    if (blk == 2) {
+      eq.set(0, 6, 3);
+      ref.set(0, 6, 3);
+    }
+    tone(a, FRAMES, blk * FRAMES);
+    memcpy(b, a, sizeof(a));
+    eq.process(a, FRAMES);
+    ref.process(b, FRAMES);
+  }
+  TEST_ASSERT_EQUAL_INT16_ARRAY(b, a, FRAMES * 2);
+}
+
+static void test_eq_sample_rate_redesigns() {
+  PcmEq a, b;
+  a.set(0, 0, 9);
+  b.set(0, 0, 9);
+  b.setSampleRate(22050);
+  int16_t x[FRAMES * 2], y[FRAMES * 2];
+  tone(x, FRAMES, 0);
+  memcpy(y, x, sizeof(x));
+  a.process(x, FRAMES);
+  b.process(y, FRAMES);
+  TEST_ASSERT_TRUE(memcmp(x, y, sizeof(x)) != 0);
+}
+
+static uint32_t hostNs() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// the device reports cycles ("fxbench"); here the same loop in ns, to
+// compare changes to the PCM stage without flashing
+static void test_benchmark() {
+  PcmFxBench r = pcmFxBenchmark(hostNs);
+  char msg[80];
+  snprintf(msg, sizeof(msg), "fxbench (host): volume %.2f, eq %.2f ns/sample",
+           r.volumeTicks, r.eqTicks);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(r.volumeTicks >= 0);
+  TEST_ASSERT_TRUE(r.eqTicks > 0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_volume_unity_is_bit_exact);
+  RUN_TEST(test_volume_ramps_to_target);
+  RUN_TEST(test_flat_eq_bypasses);
+  RUN_TEST(test_eq_change_keeps_state);
+  RUN_TEST(test_eq_band_enabled_later);
+  RUN_TEST(test_eq_sample_rate_redesigns);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,63 @@
+// shuffle: the Feistel permutation behind the playlist's shuffle order
+#include "audio/shuffle.h"
+#include <unity.h>
+#include <vector>
+
+void setUp() {}
+void tearDown() {}
+
+static const uint32_t SIZES[] = {2, 3, 5, 7, 16, 17, 100, 255, 256, 1000, 4099};
+static const uint32_t KEYS[] = {0, 1, 0xDEADBEEF, 0x9E3779B9};
+
+static void test_bijection_and_inverse() {
+  for (uint32_t n : SIZES) {
+    for (uint32_t key : KEYS) {
+      std::vector<bool> seen(n, false);
+      for (uint32_t x = 0; x < n; x++) {
+        uint32_t y = shufflePermute(n, key, x, false);
+        TEST_ASSERT_LESS_THAN(n, y);
+        TEST_ASSERT_FALSE(seen[y]);
+        seen[y] = true;
+        TEST_ASSERT_EQUAL(x, shufflePermute(n, key, y, true));
+      }
+    }
+  }
+}
+
+// Playlist walks position (start + k) % n of cycle c with key
+// shuffleMix(seed ^ c * golden); every track must come up once per cycle
+static void test_every_track_once_per_cycle() {
+  const uint32_t n = 37, seed = 12345, start = 11;
+  for (uint32_t cycle = 0; cycle < 4; cycle++) {
+    uint32_t key = shuffleMix(seed ^ (cycle * 0x9E3779B9UL));
+    std::vector<int> plays(n, 0);
+    for (uint32_t k = 0; k < n; k++)
+      plays[shufflePermute(n, key, (start + k) % n, false)]++;
+    for (uint32_t i = 0; i < n; i++)
+      TEST_ASSERT_EQUAL(1, plays[i]);
+  }
+}
+
+static void test_keys_give_different_orders() {
+  const uint32_t n = 100;
+  uint32_t same = 0;
+  for (uint32_t x = 0; x < n; x++)
+    same += shufflePermute(n, shuffleMix(1), x, false) ==
+            shufflePermute(n, shuffleMix(2), x, false);
+  TEST_ASSERT_LESS_THAN(n / 4, same);
+}
+
+static void test_tiny_lists() {
+  TEST_ASSERT_EQUAL(0, shufflePermute(0, 7, 0, false));
+  TEST_ASSERT_EQUAL(0, shufflePermute(1, 7, 0, false));
+  TEST_ASSERT_EQUAL(0, shufflePermute(1, 7, 0, true));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bijection_and_inverse);
+  RUN_TEST(test_every_track_once_per_cycle);
+  RUN_TEST(test_keys_give_different_orders);
+  RUN_TEST(test_tiny_lists);
+  return UNITY_END();
+}